@@ -6,11 +6,13 @@
 // STL includes
 #include <vector>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSFunction.h"
 
 class TH1;
 
-class TFCS1DFunction : public TFCSFunction
+class FASTCALOSIM_EXPORT TFCS1DFunction : public TFCSFunction
 {
 public:
   TFCS1DFunction() {};
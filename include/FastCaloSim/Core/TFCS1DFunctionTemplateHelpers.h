@@ -11,6 +11,7 @@
 #  include <cstring>
 #  include <vector>
 
+#  include "FastCaloSim/Core/TFCSFlatArrayStore.h"
 #  include "TBuffer.h"
 
 // For the purpose of FastCaloSim, 32bit are sufficient for bin counting
@@ -101,14 +102,23 @@ class TFCS1DFunction_Array
 public:
   typedef TFCS1DFunction_size_t size_t;
 
+  /// Marker in the streamed size for arrays stored in a TFCSFlatArrayStore
+  static constexpr size_t kFlatArray = 0x80000000;
+
   TFCS1DFunction_Array() {};
   TFCS1DFunction_Array(size_t count) { resize(count); };
   ~TFCS1DFunction_Array()
   {
-    if (m_content)
+    if (m_content && !m_external)
       delete[] m_content;
   };
 
+  /// true if the content points into a memory mapped TFCSFlatArrayStore
+  inline bool is_external() const { return m_external; };
+  /// false if the content should point into a TFCSFlatArrayStore that could
+  /// not be resolved when reading, the array is empty in this case
+  inline bool is_resolved() const { return !m_unresolved; };
+
   std::size_t MemorySizeArray() const { return size() * sizeof(T); };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
 
@@ -127,10 +137,12 @@ public:
       ncopy *= sizeof(T);
       std::memcpy(new_cont, m_content, ncopy);
     }
-    if (m_content)
+    if (m_content && !m_external)
       delete[] m_content;
     m_size = count;
     m_content = new_cont;
+    m_external = false;
+    m_unresolved = false;
   };
 
   /// Direct data pointer
@@ -153,6 +165,8 @@ public:
 private:
   T* m_content {nullptr};  //!
   size_t m_size {0};
+  bool m_external {false};  //! Fits into the padding after m_size
+  bool m_unresolved {false};  //! Fits into the padding after m_size
 
   // Use ClassDef without virtual functions. Saves 8 bytes per instance
   ClassDefNV(TFCS1DFunction_Array, 1)  // TFCS1DFunction_Array
@@ -165,11 +179,39 @@ void TFCS1DFunction_Array<T>::Streamer(TBuffer& b)
   if (b.IsReading()) {
     size_t count;
     b >> count;
+    if (count & kFlatArray) {
+      count &= ~kFlatArray;
+      ULong64_t id, offset;
+      b >> id;
+      b >> offset;
+      resize(0);
+      const void* content =
+          TFCSFlatArrayStore::Resolve(id, offset, count * sizeof(T));
+      if (content) {
+        m_content = static_cast<T*>(const_cast<void*>(content));
+        m_size = count;
+        m_external = true;
+      } else {
+        m_unresolved = true;
+      }
+      return;
+    }
     resize(count);
     if (m_size > 0)
       b.ReadFastArray(m_content, m_size);
   } else {
-    b << m_size;
+    TFCS1DFunction_Array::size_t count = m_size;
+    TFCSFlatArrayWriter* writer = TFCSFlatArrayWriter::Current();
+    if (writer && writer->accepts(MemorySizeArray())) {
+      ULong64_t id = writer->id();
+      ULong64_t offset = writer->append(m_content, MemorySizeArray());
+      count |= kFlatArray;
+      b << count;
+      b << id;
+      b << offset;
+      return;
+    }
+    b << count;
     if (m_size > 0)
       b.WriteFastArray(m_content, m_size);
   }
@@ -190,6 +232,7 @@ public:
 
   std::size_t MemorySizeArray() const { return m_array.MemorySizeArray(); };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
+  inline bool is_resolved() const { return m_array.is_resolved(); };
 
   /// Set the content of bin pos to a given value, where value is in the range
   /// [0,1]
@@ -294,6 +337,7 @@ public:
 
   std::size_t MemorySizeArray() const { return m_array.MemorySizeArray(); };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
+  inline bool is_resolved() const { return m_array.is_resolved(); };
 
   /// set number of bins
   void set_nbins(size_t nbins) { m_array.resize(nbins + 1); };
@@ -425,6 +469,7 @@ public:
 
   std::size_t MemorySizeArray() const { return m_array.MemorySizeArray(); };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
+  inline bool is_resolved() const { return m_array.is_resolved(); };
 
   /// set number of bins
   void set_nbins(size_t nbins) { m_array.resize(nbins >= 1 ? nbins - 1 : 0); };
@@ -7,12 +7,15 @@
 
 #  include <iostream>
 
+#  include <FastCaloSim/FastCaloSim_export.h>
+
 #  include "FastCaloSim/Core/TFCS1DFunction.h"
 #  include "FastCaloSim/Core/TFCS1DFunctionTemplateHelpers.h"
 #  include "TH1.h"
 
 template<typename Txvec, typename Ty, typename Trandom = float>
-class TFCS1DFunctionTemplateHistogram : public TFCS1DFunction
+class FASTCALOSIM_EXPORT TFCS1DFunctionTemplateHistogram
+    : public TFCS1DFunction
 {
 public:
   typedef TFCS1DFunction_size_t size_t;
@@ -33,6 +36,11 @@ public:
   };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
 
+  bool is_valid() const override
+  {
+    return m_HistoBorders.is_resolved() && m_HistoContents.is_resolved();
+  };
+
   /// set number of bins
   void set_nbins(size_t nbins)
   {
@@ -157,7 +165,7 @@ private:
            1)  // TFCS1DFunctionTemplateHistogram
 };
 
-class TFCS1DFunctionInt8Int8Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt8Int8Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt8BinEdges,
           uint8_t,
@@ -173,7 +181,7 @@ public:
            1)  // TFCS1DFunctionInt8Int8Histogram
 };
 
-class TFCS1DFunctionInt8Int16Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt8Int16Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt8BinEdges,
           uint16_t,
@@ -189,7 +197,7 @@ public:
            1)  // TFCS1DFunctionInt8Int16Histogram
 };
 
-class TFCS1DFunctionInt8Int32Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt8Int32Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt8BinEdges,
           uint32_t,
@@ -205,7 +213,7 @@ public:
            1)  // TFCS1DFunctionInt8Int32Histogram
 };
 
-class TFCS1DFunctionInt16Int16Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt16Int16Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt16BinEdges,
           uint16_t,
@@ -221,7 +229,7 @@ public:
            1)  // TFCS1DFunctionInt16Int16Histogram
 };
 
-class TFCS1DFunctionInt16Int32Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt16Int32Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt16BinEdges,
           uint32_t,
@@ -237,7 +245,7 @@ public:
            1)  // TFCS1DFunctionInt16Int32Histogram
 };
 
-class TFCS1DFunctionInt32Int32Histogram
+class FASTCALOSIM_EXPORT TFCS1DFunctionInt32Int32Histogram
     : public TFCS1DFunctionTemplateHistogram<
           TFCS1DFunction_HistogramInt32BinEdges,
           uint32_t,
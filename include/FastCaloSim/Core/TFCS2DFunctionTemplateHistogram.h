@@ -35,6 +35,12 @@ public:
   };
   std::size_t MemorySize() const { return sizeof(*this) + MemorySizeArray(); };
 
+  bool is_valid() const override
+  {
+    return m_HistoBordersx.is_resolved() && m_HistoBordersy.is_resolved()
+        && m_HistoContents.is_resolved();
+  };
+
   /// set number of bins
   void set_nbins(size_t nbinsx, size_t nbinsy)
   {
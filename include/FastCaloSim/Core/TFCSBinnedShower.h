@@ -3,6 +3,8 @@
 #ifndef TFCSBinnedShower_h
 #define TFCSBinnedShower_h
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -11,15 +13,25 @@
 #include <TMath.h>
 #include <hdf5.h>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSBinnedShowerBase.h"
+#include "FastCaloSim/Core/TFCSEventLibraryCache.h"
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 #include "FastCaloSim/Core/TFCSParametrizationBinnedChain.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "TFCSBinnedShowerBase.h"
 
 class CaloGeo;
+class TFCSEventLibraryIndex;
+
+namespace H5
+{
+class H5File;
+}
 
-class TFCSBinnedShower : public TFCSBinnedShowerBase
+class FASTCALOSIM_EXPORT TFCSBinnedShower : public TFCSBinnedShowerBase
 {
 public:
   typedef struct
@@ -89,9 +101,12 @@ public:
 
   // Loads all required data from the given HDF5 file
   // TODO: Define HDF5 file format somewhere
+  // The layer energies are decoded by up to n_threads threads while the
+  // next layers are read, 0 uses one thread per core
   void load_event_library(const std::string& filename,
                           std::vector<long unsigned int>& layers,
-                          bool only_load_meta_data = false);
+                          bool only_load_meta_data = false,
+                          unsigned int n_threads = 0);
 
   void load_sub_bin_distribution(const std::string& filename);
 
@@ -104,6 +119,54 @@ public:
   void delete_hdf5_path() { m_hdf5_file.clear(); }
   const std::string get_hdf5_path() const { return m_hdf5_file; }
 
+  // Converts the event library and bin boundaries of the given layers in an
+  // HDF5 file into the memory-mapped format of TFCSEventLibraryFile. Layers
+  // without data in the HDF5 file are skipped. Returns false on any error,
+  // including unreadable HDF5 files.
+  static bool convert_event_library(
+      const std::string& hdf5_file,
+      const std::string& library_file,
+      const std::vector<long unsigned int>& layers);
+
+  // Maps an event library converted with convert_event_library into memory.
+  // The events are read directly from the mapping instead of being copied
+  // into the event library vector, which stays empty. Loading or setting
+  // events by hand releases the mapping again.
+  bool load_event_library_file(const std::string& filename);
+
+  // Like the HDF5 path, a library file path set here is mapped
+  // automatically when the parametrization is read. It takes precedence
+  // over the HDF5 path.
+  void set_library_file_path(const std::string& filename)
+  {
+    m_library_file = filename;
+  }
+  void delete_library_file_path() { m_library_file.clear(); }
+  const std::string get_library_file_path() const { return m_library_file; }
+
+  // Reads the events of an HDF5 library on demand instead of loading all of
+  // them in load_event_library, also for the HDF5 path. Only the matching
+  // information is kept in memory for all events. The voxels of the used
+  // events are cached up to the given size in MB.
+  void enable_on_demand_loading(long unsigned int cache_size_mb = 256)
+  {
+    m_on_demand_cache_mb = cache_size_mb;
+  };
+  void disable_on_demand_loading() { m_on_demand_cache_mb = 0; };
+  bool is_on_demand_loading() const { return m_on_demand_cache_mb > 0; };
+
+  // Announces the events a batch of particles will use, so that they are
+  // read together. Only has an effect with on demand loading.
+  void prefetch_events(
+      const std::vector<long unsigned int>& event_indices) const;
+
+  // Same for the events that eta matching or cherry picking selects for a
+  // batch of particles
+  void prefetch_matched_events(const std::vector<float>& eta_centers,
+                               const std::vector<float>& phi_centers,
+                               const std::vector<float>& e_inits,
+                               long unsigned int reference_layer_index) const;
+
   // Allows to set the layer energy for the given layer and event manually.
   void set_layer_energy(long unsigned int event_index,
                         long unsigned int layer_index,
@@ -130,6 +193,9 @@ public:
   void set_event_library(eventvector_t eventlibrary)
   {
     m_eventlibrary = eventlibrary;
+    m_library_view.reset();
+    m_library_cache.reset();
+    reset_library_index();
   }
 
   event_bins_t get_coordinates() { return m_coordinates; }
@@ -137,6 +203,7 @@ public:
   void set_coordinates(event_bins_t coordinates)
   {
     m_coordinates = coordinates;
+    clear_projections();
   }
 
   std::vector<std::vector<std::vector<std::vector<float>>>>
@@ -158,6 +225,7 @@ public:
     m_sub_bin_distribution = sub_bin_distribution;
     m_upscaling_energies = upscaling_energies;
     m_use_upscaling = true;
+    reset_upscaling_sampler();
   }
 
 protected:
@@ -169,37 +237,68 @@ protected:
       float e_init,
       long unsigned int reference_layer_index) const override;
 
-  // Returns the number of hits that are going to be simulated in the given
-  // layer.
-  virtual long unsigned int get_n_hits(
-      TFCSSimulationState& simulstate,
-      long unsigned int layer_index) const override;
-
   // Used to precompute the number of hits for all layers in the event.
   virtual void compute_n_hits_and_elayer(TFCSSimulationState& simulstate) const;
 
-  // Returns the total deposited energy in the given layer for the current event
-  virtual float get_layer_energy(TFCSSimulationState& simulstate,
-                                 long unsigned int layer_index) const override;
+  // The sampler of the sub-bin distribution if upscaling is enabled
+  virtual std::shared_ptr<const TFCSUpscalingSampler> upscaling_sampler()
+      const override;
+
+  // Release the data of the current event that was stored in get_event()
+  virtual void delete_event(TFCSSimulationState& simulstate) const override;
 
-  // Returns the position and energy of the corresponding hit in the given
-  // event, layer and bin
-  virtual std::tuple<float, float, float> get_hit_position_and_energy(
+  // Voxels of the current event and their bins, for the direct projection
+  virtual TFCSEventLibraryFile::Voxels_t get_layer_voxels(
       TFCSSimulationState& simulstate,
-      long unsigned int layer_index,
-      long unsigned int hit_index) const override;
+      long unsigned int layer_index) const override;
 
-  // Delete all pointers that were created in get_event()
-  virtual void delete_event(TFCSSimulationState& simulstate) const override;
+  virtual long unsigned int get_n_bins(
+      long unsigned int layer_index) const override;
+
+  virtual void get_bin_boundaries(long unsigned int layer_index,
+                                  long unsigned int bin_index,
+                                  float& R_min,
+                                  float& R_max,
+                                  float& alpha_min,
+                                  float& alpha_max) const override;
 
 private:
   // Enables to load the event library from an HDF5 file on the fly.
   std::string m_hdf5_file;
 
+  // Enables to map a converted event library file on the fly.
+  std::string m_library_file;
+
   // Store the used event library
   eventvector_t m_eventlibrary;
   event_bins_t m_coordinates;
 
+  // Mapped event library file. If set, it is used instead of m_eventlibrary
+  std::shared_ptr<const TFCSEventLibraryFile>
+      m_library_view;  //! Do not persistify
+
+  // Size of the cache for on demand loading in MB, 0 to load all events
+  long unsigned int m_on_demand_cache_mb = 0;
+
+  // HDF5 library read on demand. If set, it is used instead of m_eventlibrary
+  std::shared_ptr<TFCSEventLibraryCache>
+      m_library_cache;  //! Do not persistify
+
+  // Event read on demand for the current particle, kept in a scratch slot
+  typedef std::shared_ptr<const TFCSEventLibraryCache::Event_t>
+      cached_event_t;
+
+  // Access to the events of the mapped or the in-memory library
+  long unsigned int n_library_events() const;
+  long unsigned int n_event_layers(long unsigned int event_index) const;
+  float event_center_eta(long unsigned int event_index) const;
+  float event_phi_mod(long unsigned int event_index) const;
+  float event_e_init(long unsigned int event_index) const;
+  TFCSEventLibraryFile::Voxels_t event_voxels(
+      TFCSSimulationState& simulstate,
+      long unsigned int event_index,
+      long unsigned int layer_index) const;
+
   // Event matching flag. Ensures that the chose event
   // from the event library is the same as the one taken
   // from the EVNT file. Prevents any bias due to position
@@ -224,9 +323,17 @@ private:
                                     long unsigned int reference_layer_index,
                                     bool phi_mod_matching) const;
 
-  std::tuple<float, float> get_coordinates(TFCSSimulationState& simulstate,
-                                           long unsigned int layer_index,
-                                           int bin_index) const;
+  // Spatial index over the matching coordinates of the event library,
+  // for find_best_match. Built when the library is loaded, or on first
+  // use for libraries read from file or changed by hand
+  mutable std::shared_ptr<const TFCSEventLibraryIndex>
+      m_library_index;  //! Do not persistify
+  mutable std::mutex m_library_index_mutex;  //! Do not persistify
+
+  // The index for eta and energy, and phi_mod if phi_mod_matching
+  std::shared_ptr<const TFCSEventLibraryIndex> library_index(
+      bool phi_mod_matching) const;
+  void reset_library_index();
 
   // If true, the sub-cell distribution is used to upscale the energy deposition
   bool m_use_upscaling = false;
@@ -237,31 +344,36 @@ private:
       m_sub_bin_distribution;
   std::vector<float> m_upscaling_energies;  // energies of the avg showers
 
-  void upscale(TFCSSimulationState& simulstate,
-               float& R_min,
-               float& R_max,
-               float& alpha_min,
-               float& alpha_max,
-               long unsigned int layer_index,
-               int bin_index) const;
+  // Sampling tables of the sub-bin distribution. Built when the
+  // distribution is loaded, or on first use after reading from file
+  mutable std::shared_ptr<const TFCSUpscalingSampler>
+      m_upscaling_sampler;  //! Do not persistify
+  mutable std::mutex m_upscaling_sampler_mutex;  //! Do not persistify
+
+  void reset_upscaling_sampler();
 
-  long unsigned int get_energy_index(TFCSSimulationState& simulstate,
-                                     long unsigned int layer_index,
-                                     long unsigned int hit_index) const;
+  // Does the work of convert_event_library on the open HDF5 file
+  static bool write_event_library(H5::H5File& file,
+                                  const std::string& hdf5_file,
+                                  const std::string& library_file,
+                                  const std::vector<long unsigned int>& layers);
 
-  // Helper functions to load the HDF5 dataset
-  std::tuple<std::vector<float>, std::vector<hsize_t>, bool> load_hdf5_dataset(
-      const std::string& filename, const std::string& datasetname);
+  // Helper functions to load the HDF5 dataset. All datasets are read
+  // through the same open file
+  static std::tuple<std::vector<float>, std::vector<hsize_t>, bool>
+  load_hdf5_dataset(H5::H5File& file, const std::string& datasetname);
 
-  void load_layer_energy(const std::string& filename,
-                         long unsigned int layer_index);
+  // Reads the energies of all layers into the event library. HDF5 reads
+  // are serialised on the file, the decoding of the layers runs concurrently
+  void load_layer_energies(H5::H5File& file,
+                           const std::vector<long unsigned int>& layers,
+                           unsigned int n_threads);
 
-  void load_bin_boundaries(const std::string& filename,
-                           long unsigned int layer_index);
+  void load_bin_boundaries(H5::H5File& file, long unsigned int layer_index);
 
-  void load_shower_center_information(const std::string& filename);
+  void load_shower_center_information(H5::H5File& file);
 
-  ClassDefOverride(TFCSBinnedShower, 1)  // TFCSBinnedShower
+  ClassDefOverride(TFCSBinnedShower, 3)  // TFCSBinnedShower
 };
 
 #endif
@@ -4,19 +4,30 @@
 #define TFCSBinnedShowerBase_h
 
 // local includes
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
+#include "FastCaloSim/Core/TFCSUpscalingSampler.h"
 
 // External includes
 #include <cassert>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <tuple>
+#include <vector>
 
 #include <RtypesCore.h>
 #include <TMath.h>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 class CaloGeo;
+class Cell;
 
-class TFCSBinnedShowerBase : public TFCSLateralShapeParametrizationHitBase
+class FASTCALOSIM_EXPORT TFCSBinnedShowerBase
+    : public TFCSLateralShapeParametrizationHitBase
 {
 public:
   TFCSBinnedShowerBase(const char* name = nullptr, const char* title = nullptr);
@@ -53,6 +64,68 @@ public:
 
   int get_max_hits_per_voxel() const { return m_max_hits_per_voxel; }
 
+  // Deposit the voxel energies directly into the cells instead of sampling
+  // hits. Each voxel is split between the cells it overlaps, with fractions
+  // estimated from samples x samples points per voxel. The fractions are
+  // computed once per row of cells and position of the shower center within
+  // its cell, in offset_bins x offset_bins bins, and reused for all showers
+  // in that row. The upscaling to sub-bins is not applied.
+  // In this mode the first hit of a layer deposits all its voxels itself
+  // and has the energy of the layer, any further hit has no energy and
+  // deposits nothing. All these hits are marked as deposited, which the
+  // hit-cell mapping after the shower respects. Both the fixed and the
+  // plain hit chain therefore deposit each layer once, with or without a
+  // mapping. Layers in (x, y, z) always sample hits.
+  void set_direct_projection(int samples = 4, int offset_bins = 4)
+  {
+    assert(samples > 0 && offset_bins > 0 && "projection bins must be > 0");
+    m_use_direct_projection = true;
+    m_projection_samples = samples;
+    m_projection_offset_bins = offset_bins;
+    clear_projections();
+  }
+
+  void reset_direct_projection() { m_use_direct_projection = false; }
+
+  bool use_direct_projection() const { return m_use_direct_projection; }
+
+  // A voxel of the current event with the hits that are simulated in it.
+  // The hits of a layer are numbered voxel by voxel, the voxel holds the
+  // hits [first_hit, end_hit), which all have the energy E
+  struct HitVoxel_t
+  {
+    long unsigned int layer_index = 0;
+    long unsigned int voxel_index = 0;
+    long unsigned int first_hit = 0;
+    long unsigned int end_hit = 0;
+    std::uint32_t bin_index = 0;
+    float R_min = 0;
+    float R_max = 0;
+    float alpha_min = 0;
+    float alpha_max = 0;
+    float E = 0;
+    // Voxels of the layer
+    TFCSEventLibraryFile::Voxels_t voxels;
+    // Sub-bin sampling of the hits, if upscaled
+    bool upscaled = false;
+    TFCSUpscalingSampler::Voxel_t upscaling;
+
+    long unsigned int n_hits() const { return end_hit - first_hit; };
+    bool contains(long unsigned int hit_index) const
+    {
+      return hit_index >= first_hit && hit_index < end_hit;
+    };
+  };
+
+  // Iterate over the voxels with hits of a layer of the current event.
+  // first_hit_voxel sets voxel to the first one, next_hit_voxel advances it
+  // to the next one. Both return false if there is no further voxel
+  bool first_hit_voxel(TFCSSimulationState& simulstate,
+                       long unsigned int layer_index,
+                       HitVoxel_t& voxel) const;
+  bool next_hit_voxel(TFCSSimulationState& simulstate,
+                      HitVoxel_t& voxel) const;
+
   // Fill layer energies
   virtual FCSReturnCode simulate(
       TFCSSimulationState& simulstate,
@@ -82,12 +155,27 @@ public:
     long unsigned int nhits = get_n_hits(simulstate, calosample());
     if (nhits == 0)
       return -1;
+    if (is_projected_layer(calosample()))
+      return 1;
     return static_cast<int>(nhits);
   }
 
 protected:
   CaloGeo* m_geo = nullptr;  //! do not persistify
 
+  // Position in the reference layer around which the shower is simulated
+  void get_event_center(const TFCSExtrapolationState* extrapol,
+                        float& eta_center,
+                        float& phi_center,
+                        long unsigned int& reference_layer_index) const;
+
+  // Energy the shower is scaled to
+  float get_initial_energy(const TFCSSimulationState& simulstate,
+                           const TFCSTruthState* truth) const;
+
+  // Fill the layer energies of the current event into simulstate
+  FCSReturnCode fill_layer_energies(TFCSSimulationState& simulstate) const;
+
   // Called at the beginning of the simulation to store and or generate the
   // needed shower data for the current event
   virtual void get_event(TFCSSimulationState& simulstate,
@@ -96,32 +184,176 @@ protected:
                          float e_init,
                          long unsigned int reference_layer_index) const = 0;
 
-  // Returns the number of bins that are used in the given layer
+  // Per particle data of the current event. It is kept in a scratch slot of
+  // the simulation state and reused for the next particle, so that no memory
+  // is allocated per particle once the vectors have grown large enough
+  struct EventScratch_t
+  {
+    // Index of the library event, 0 for generated events and -1 if there
+    // is no current event
+    long int event_index = -1;
+    float e_init = 0;
+    // Number of hits up to and including each voxel, the voxels of layer i
+    // are the entries [layer_begin[i], layer_begin[i+1])
+    std::vector<long unsigned int> n_hits;
+    std::vector<long unsigned int> layer_begin;
+    std::vector<float> elayer;
+    // Voxel of the last simulated hit
+    HitVoxel_t hit_voxel;
+    // Upscaling of the event and its energy weights, nullptr if the hits
+    // are not upscaled
+    std::shared_ptr<const TFCSUpscalingSampler> upscaling;
+    TFCSUpscalingSampler::Weights_t upscaling_weights;
+
+    long unsigned int n_layers() const { return elayer.size(); };
+    // Forget the event, but keep the memory
+    void clear();
+  };
+
+  EventScratch_t& event_scratch(TFCSSimulationState& simulstate) const
+  {
+    return simulstate.getScratch<EventScratch_t>("BSEventScratch"_FCShash);
+  }
+
+  // Start the hit counting of a new event. scratch.e_init must be set
+  void begin_hits(EventScratch_t& scratch) const;
+
+  // Count the hits of the voxels of the next layer from their energies
+  // relative to scratch.e_init
+  void add_layer_hits(EventScratch_t& scratch,
+                      const float* E,
+                      long unsigned int n_voxels) const;
+
+  // Find the voxel of a hit in a layer and the number of hits in that voxel.
+  // Returns false if the hit does not exist
+  bool find_hit_voxel(const EventScratch_t& scratch,
+                      long unsigned int layer_index,
+                      long unsigned int hit_index,
+                      long unsigned int& voxel_index,
+                      long unsigned int& hits_in_voxel) const;
+
+  // Returns the number of hits that are simulated in the given layer
   virtual long unsigned int get_n_hits(TFCSSimulationState& simulstate,
-                                       long unsigned int layer_index) const = 0;
+                                       long unsigned int layer_index) const;
 
   /// Returns the total deposited energy in the given layer for the current
   /// event
   virtual float get_layer_energy(TFCSSimulationState& simulstate,
-                                 long unsigned int layer_index) const = 0;
+                                 long unsigned int layer_index) const;
 
-  // Returns the position and energy of the corresponding hit in the given
-  // event, layer and bin
-  virtual std::tuple<float, float, float> get_hit_position_and_energy(
-      TFCSSimulationState& simulstate,
-      long unsigned int layer_index,
-      long unsigned int hit_index) const = 0;
+  // The voxel of a hit. Hits simulated in order only advance the voxel of
+  // the previous hit, others are searched for. Returns nullptr if the hit
+  // does not exist
+  const HitVoxel_t* hit_voxel(TFCSSimulationState& simulstate,
+                              long unsigned int layer_index,
+                              long unsigned int hit_index) const;
+
+  // Sub-bin upscaling of the hits, nullptr if it is not used
+  virtual std::shared_ptr<const TFCSUpscalingSampler> upscaling_sampler()
+      const
+  {
+    return nullptr;
+  }
+
+  // Returns the position of a hit in the given voxel, uniformly distributed
+  // in R and alpha of the voxel or of its sub-bin if upscaled
+  virtual std::tuple<float, float> get_hit_position(
+      TFCSSimulationState& simulstate, const HitVoxel_t& voxel) const;
+
+  std::tuple<float, float> sample_hit_position(TFCSSimulationState& simulstate,
+                                               float R_min,
+                                               float R_max,
+                                               float alpha_min,
+                                               float alpha_max) const;
 
-  // Delete all pointers that were created in get_event()
+  // Release the data of the current event that was stored in get_event()
   virtual void delete_event(TFCSSimulationState& simulstate) const = 0;
 
+  // Voxels of the current event in the given layer
+  virtual TFCSEventLibraryFile::Voxels_t get_layer_voxels(
+      TFCSSimulationState& simulstate, long unsigned int layer_index) const = 0;
+
+  // Number of voxel bins in the given layer and the boundaries of a bin
+  virtual long unsigned int get_n_bins(long unsigned int layer_index) const = 0;
+  virtual void get_bin_boundaries(long unsigned int layer_index,
+                                  long unsigned int bin_index,
+                                  float& R_min,
+                                  float& R_max,
+                                  float& alpha_min,
+                                  float& alpha_max) const = 0;
+
+  // Forget all projections, needed if the voxel bins change
+  void clear_projections();
+
   // What should be the average energy per hit in the library
   float m_default_hit_energy = 4.;
   // What is the maximum number of hits per voxel (for runtime reasons)
   int m_max_hits_per_voxel = 100;
 
+  // Direct projection of the voxels into the cells, see
+  // set_direct_projection()
+  bool m_use_direct_projection = false;
+  int m_projection_samples = 4;
+  int m_projection_offset_bins = 4;
+
 private:
-  ClassDefOverride(TFCSBinnedShowerBase, 1)  // TFCSBinnedShowerBase
+  // Set voxel to the first voxel with hits starting at voxel_index
+  bool load_hit_voxel(const EventScratch_t& scratch,
+                      long unsigned int voxel_index,
+                      HitVoxel_t& voxel) const;
+
+  // Fractions of the voxels of a layer in the cells around the shower
+  // center. The cells are given relative to the cell of the shower center,
+  // so that the projection holds for all cells of the same row
+  struct Projection_t
+  {
+    // Center of each cell in eta and its phi distance to the central cell
+    std::vector<float> cell_eta;
+    std::vector<float> cell_dphi;
+    // The cells and fractions of voxel bin i are the entries
+    // [offsets[i], offsets[i+1]) of cell and fraction
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> cell;
+    std::vector<float> fraction;
+  };
+
+  // Layer, eta of the row of cells, bin of the shower center within the
+  // cell in eta and phi, and the sign flips of eta and phi
+  typedef std::tuple<long unsigned int, long long, int, int, bool, bool>
+      ProjectionKey_t;
+
+  bool is_projected_layer(long unsigned int layer_index) const
+  {
+    // NOTE: this is ATLAS dependent
+    // layer 21 is FCAL0
+    return m_use_direct_projection && layer_index <= 21;
+  }
+
+  // Deposit all voxels of the layer into the cells with the first hit
+  FCSReturnCode simulate_projection(Hit& hit,
+                                    TFCSSimulationState& simulstate,
+                                    const TFCSTruthState* truth) const;
+
+  std::shared_ptr<const Projection_t> get_projection(
+      long unsigned int layer_index,
+      const Cell& center_cell,
+      float center_eta,
+      float center_phi,
+      bool flip_phi) const;
+
+  std::shared_ptr<const Projection_t> build_projection(
+      long unsigned int layer_index,
+      const Cell& center_cell,
+      float eta,
+      float phi,
+      bool flip_eta,
+      bool flip_phi) const;
+
+  mutable std::map<ProjectionKey_t, std::shared_ptr<const Projection_t>>
+      m_projections;  //! Do not persistify
+  mutable std::mutex m_projection_mutex;  //! Do not persistify
+
+  ClassDefOverride(TFCSBinnedShowerBase, 2)  // TFCSBinnedShowerBase
 };
 
 #endif
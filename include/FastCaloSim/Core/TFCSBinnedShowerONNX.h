@@ -3,6 +3,8 @@
 #ifndef TFCSBinnedShowerONNX_h
 #define TFCSBinnedShowerONNX_h
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -52,7 +54,7 @@ public:
       m_ai_simulator = nullptr;
     }
     m_ai_simulator = new TFCSMLCalorimeterSimulator();
-    if (!m_ai_simulator->loadSimulator(filename)) {
+    if (!m_ai_simulator->loadSimulator(filename, m_model_precision)) {
       delete m_ai_simulator;
       m_ai_simulator = nullptr;
       return false;
@@ -60,6 +62,104 @@ public:
     return true;
   }
 
+  // Use an already created network, e.g. from TFCSNetworkFactory, with
+  // the given voxel layout, see TFCSMLCalorimeterSimulator::setInputShapes
+  bool set_network(std::unique_ptr<VNetworkBase> network,
+                   std::vector<long unsigned int> layer_boundaries,
+                   std::vector<long unsigned int> used_layers)
+  {
+    if (m_ai_simulator) {
+      delete m_ai_simulator;
+      m_ai_simulator = nullptr;
+    }
+    m_ai_simulator = new TFCSMLCalorimeterSimulator();
+    m_ai_simulator->setInputShapes(std::move(layer_boundaries),
+                                   std::move(used_layers));
+    if (!m_ai_simulator->setNetwork(std::move(network))) {
+      delete m_ai_simulator;
+      m_ai_simulator = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  // Precision of the network weights, see TFCSONNXQuantization. Used by
+  // the next load_simulator call, which loads the variant file of this
+  // precision if there is one. An already loaded network is quantized to
+  // int8 right away, other precisions need load_simulator
+  void set_model_precision(TFCSONNXQuantization::Precision precision)
+  {
+    m_model_precision = precision;
+    if (m_ai_simulator && precision == TFCSONNXQuantization::kInt8
+        && !m_ai_simulator->quantize_int8())
+    {
+      FCS_MSG_ERROR("Could not quantize the network to int8, it stays in "
+                    "single precision");
+    }
+  }
+  TFCSONNXQuantization::Precision model_precision() const
+  {
+    return m_model_precision;
+  }
+
+  // Batching of the network evaluation, see TFCSMLCalorimeterSimulator.
+  // Only has an effect once the simulator is loaded
+  void set_max_batch_size(unsigned int max_batch_size)
+  {
+    if (m_ai_simulator)
+      m_ai_simulator->set_max_batch_size(max_batch_size);
+  }
+  void set_max_batch_latency(double microseconds)
+  {
+    if (m_ai_simulator)
+      m_ai_simulator->set_max_batch_latency(microseconds);
+  }
+  // Options of the onnxruntime session, see TFCSONNXRuntime. Only has an
+  // effect once the simulator is loaded
+  void set_session_config(const TFCSONNXRuntime::SessionConfig& config)
+  {
+    if (m_ai_simulator)
+      m_ai_simulator->set_session_config(config);
+  }
+
+  // Evaluate prefetched particles in the background with at most depth
+  // evaluations queued, 0 disables it, see TFCSInferencePipeline. Only has
+  // an effect once the simulator is loaded. Must not be changed while
+  // particles are prefetched
+  void set_pipeline_depth(unsigned int depth)
+  {
+    if (m_ai_simulator)
+      m_ai_simulator->set_pipeline_depth(depth);
+  }
+  unsigned int pipeline_depth() const
+  {
+    return m_ai_simulator ? m_ai_simulator->pipeline_depth() : 0;
+  }
+
+  // Start the network evaluation of a particle that is simulated next, so
+  // that it overlaps with the hits of the current particle. The noise is
+  // drawn from simulstate right away, so each particle in flight needs its
+  // own simulation state with its own random engine. Returns false if the
+  // particle is evaluated in simulate() instead, which is always the case
+  // with OnlyScaleEnergy(), as the energy is only known then
+  bool prefetch(TFCSSimulationState& simulstate,
+                const TFCSTruthState* truth,
+                const TFCSExtrapolationState* extrapol) const;
+
+  // Same as simulate() for many particles, followed by hit_chain if it is
+  // given, usually the hit chain that contains this shower. Without a
+  // pipeline, the network is evaluated in batches for all particles before
+  // their hits are simulated. With a pipeline depth > 0, the particles are
+  // simulated one after the other, and the next pipeline_depth() particles
+  // are prefetched before each. All particles fail in that case if two
+  // simulation states share a random engine
+  void simulate_batch(
+      const std::vector<TFCSSimulationState*>& simulstates,
+      const std::vector<const TFCSTruthState*>& truths,
+      const std::vector<const TFCSExtrapolationState*>& extrapols,
+      std::vector<FCSReturnCode>& return_codes,
+      const TFCSParametrizationBase* hit_chain = nullptr) const;
+
   // Loads the voxel boundaries and (potentially) the average showers for the
   // upscaling
   // TODO: Define HDF5 file format somewhere
@@ -80,6 +180,7 @@ public:
   void set_coordinates(event_bins_t coordinates)
   {
     m_coordinates = coordinates;
+    clear_projections();
   }
 
   std::vector<std::vector<std::vector<std::vector<float>>>>
@@ -101,6 +202,7 @@ public:
     m_sub_bin_distribution = sub_bin_distribution;
     m_upscaling_energies = upscaling_energies;
     m_use_upscaling = true;
+    reset_upscaling_sampler();
   }
 
 protected:
@@ -112,36 +214,39 @@ protected:
       float e_init,
       long unsigned int reference_layer_index) const override;
 
-  // Returns the number of hits that are going to be simulated in the given
-  // layer.
-  virtual long unsigned int get_n_hits(
-      TFCSSimulationState& simulstate,
-      long unsigned int layer_index) const override;
-
   // Used to precompute the number of hits for all layers in the event.
   virtual void compute_n_hits_and_elayer(TFCSSimulationState& simulstate) const;
 
-  // Returns the total deposited energy in the given layer for the current event
-  virtual float get_layer_energy(TFCSSimulationState& simulstate,
-                                 long unsigned int layer_index) const override;
+  // The sampler of the sub-bin distribution if upscaling is enabled
+  virtual std::shared_ptr<const TFCSUpscalingSampler> upscaling_sampler()
+      const override;
 
-  // Returns the position and energy of the corresponding hit in the given
-  // event, layer and bin
-  virtual std::tuple<float, float, float> get_hit_position_and_energy(
+  // Release the data of the current event that was stored in get_event()
+  virtual void delete_event(TFCSSimulationState& simulstate) const override;
+
+  // Voxels of the current event and their bins, for the direct projection
+  virtual TFCSEventLibraryFile::Voxels_t get_layer_voxels(
       TFCSSimulationState& simulstate,
-      long unsigned int layer_index,
-      long unsigned int hit_index) const override;
+      long unsigned int layer_index) const override;
 
-  // Delete all pointers that were created in get_event()
-  virtual void delete_event(TFCSSimulationState& simulstate) const override;
+  virtual long unsigned int get_n_bins(
+      long unsigned int layer_index) const override;
+
+  virtual void get_bin_boundaries(long unsigned int layer_index,
+                                  long unsigned int bin_index,
+                                  float& R_min,
+                                  float& R_max,
+                                  float& alpha_min,
+                                  float& alpha_max) const override;
 
 private:
   // Store the used event library
   event_bins_t m_coordinates;
 
-  std::tuple<float, float> get_coordinates(TFCSSimulationState& simulstate,
-                                           long unsigned int layer_index,
-                                           int bin_index) const;
+  // Store the event in simulstate and precompute the hits per layer
+  void store_event(TFCSSimulationState& simulstate,
+                   TFCSMLCalorimeterSimulator::event_t&& event,
+                   float e_init) const;
 
   // If true, the sub-cell distribution is used to upscale the energy deposition
   bool m_use_upscaling = false;
@@ -152,17 +257,14 @@ private:
       m_sub_bin_distribution;
   std::vector<float> m_upscaling_energies;  // energies of the avg showers
 
-  void upscale(TFCSSimulationState& simulstate,
-               float& R_min,
-               float& R_max,
-               float& alpha_min,
-               float& alpha_max,
-               long unsigned int layer_index,
-               int bin_index) const;
-
-  long unsigned int get_energy_index(TFCSSimulationState& simulstate,
-                                     long unsigned int layer_index,
-                                     long unsigned int hit_index) const;
+  // Sampling tables of the sub-bin distribution. Built when the
+  // distribution is loaded, or on first use after reading from file
+  mutable std::shared_ptr<const TFCSUpscalingSampler>
+      m_upscaling_sampler;  //! Do not persistify
+  mutable std::mutex m_upscaling_sampler_mutex;  //! Do not persistify
+
+  void reset_upscaling_sampler();
+
   // Helper functions to load the HDF5 dataset
   std::tuple<std::vector<float>, std::vector<hsize_t>, bool> load_hdf5_dataset(
       const std::string& filename, const std::string& datasetname);
@@ -175,6 +277,8 @@ private:
 
   // Store a reference to the class that handles the actual ONNX call.
   TFCSMLCalorimeterSimulator* m_ai_simulator = nullptr;
+  TFCSONNXQuantization::Precision m_model_precision =
+      TFCSONNXQuantization::kFP32;  //! Do not persistify
 
   ClassDefOverride(TFCSBinnedShowerONNX, 1)  // TFCSBinnedShowerONNX
 };
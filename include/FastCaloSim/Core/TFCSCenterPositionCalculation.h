@@ -3,9 +3,11 @@
 #ifndef TFCSCenterPositionCalculation_h
 #define TFCSCenterPositionCalculation_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 
-class TFCSCenterPositionCalculation
+class FASTCALOSIM_EXPORT TFCSCenterPositionCalculation
     : public TFCSLateralShapeParametrizationHitBase
 {
 public:
@@ -0,0 +1,242 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * On-disk cache of parsed network and GAN configurations.
+ *
+ * Parsing the lwtnn json of the networks and the GAN binning xml takes
+ * a noticeable part of the startup time when many eta slices are loaded.
+ * The cache stores the parsed result in a binary file, named after a
+ * hash of the parsed text. The next job maps the file into memory and
+ * reads the structures from it instead of parsing again.
+ *
+ * Entries are never out of date: changed text gives another hash and so
+ * another file. A header with the hash, the SHA-256 digest of the text,
+ * the text size and the format version is checked on every load, entries
+ * that don't match are parsed again and overwritten. Entries are written
+ * to a temporary file and renamed, so that concurrent jobs sharing a
+ * directory never see partial entries.
+ *
+ * The cache is off unless a directory is given, either through
+ * setDirectory or the environment variable
+ *
+ *   FCS_CONFIG_CACHE_DIR   directory for the cache files, created if
+ *                          needed
+ **/
+
+#ifndef TFCSCONFIGCACHE_H
+#define TFCSCONFIGCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+namespace lwt
+{
+struct JSONConfig;
+struct GraphConfig;
+}  // namespace lwt
+
+/**
+ * @brief Binary cache of parsed configurations, keyed by content hash.
+ **/
+class FASTCALOSIM_EXPORT TFCSConfigCache
+{
+public:
+  /**
+   * @brief Appends values to a binary payload.
+   **/
+  class Writer
+  {
+  public:
+    template<typename T>
+    void write(const T& value)
+    {
+      static_assert(std::is_trivially_copyable<T>::value,
+                    "Only plain values can be written directly");
+      m_data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    };
+    void write(const std::string& value)
+    {
+      write<std::uint64_t>(value.size());
+      m_data.append(value);
+    };
+    template<typename T>
+    void write(const std::vector<T>& values)
+    {
+      write<std::uint64_t>(values.size());
+      for (const T& value : values)
+        write(value);
+    };
+    template<typename K, typename V>
+    void write(const std::map<K, V>& values)
+    {
+      write<std::uint64_t>(values.size());
+      for (const auto& value : values) {
+        write(value.first);
+        write(value.second);
+      }
+    };
+
+    const std::string& data() const { return m_data; };
+
+  private:
+    std::string m_data;
+  };
+
+  /**
+   * @brief Reads values back from a payload.
+   *
+   * Throws std::runtime_error when reading past the end, which
+   * only happens for damaged entries.
+   **/
+  class Reader
+  {
+  public:
+    Reader(const char* data, std::size_t size)
+        : m_data(data)
+        , m_end(data + size)
+    {
+    }
+
+    template<typename T>
+    void read(T& value)
+    {
+      static_assert(std::is_trivially_copyable<T>::value,
+                    "Only plain values can be read directly");
+      check(sizeof(T));
+      std::memcpy(&value, m_data, sizeof(T));
+      m_data += sizeof(T);
+    };
+    void read(std::string& value)
+    {
+      const std::size_t size = readSize(1);
+      value.assign(m_data, size);
+      m_data += size;
+    };
+    template<typename T>
+    void read(std::vector<T>& values)
+    {
+      values.resize(readSize(std::is_trivially_copyable<T>::value ? sizeof(T)
+                                                                  : 1));
+      for (T& value : values)
+        read(value);
+    };
+    template<typename K, typename V>
+    void read(std::map<K, V>& values)
+    {
+      values.clear();
+      const std::size_t size = readSize(1);
+      for (std::size_t i = 0; i < size; ++i) {
+        K key;
+        read(key);
+        read(values[key]);
+      }
+    };
+    template<typename T>
+    T get()
+    {
+      T value;
+      read(value);
+      return value;
+    };
+
+    bool atEnd() const { return m_data == m_end; };
+    std::size_t remaining() const { return m_end - m_data; };
+
+  private:
+    void check(std::size_t n_bytes) const
+    {
+      if (std::size_t(m_end - m_data) < n_bytes)
+        throw std::runtime_error("Damaged configuration cache entry");
+    };
+    /// Read a size and check that the payload can hold that many elements
+    std::size_t readSize(std::size_t element_size)
+    {
+      std::uint64_t size = 0;
+      read(size);
+      check(size * element_size);
+      return size;
+    };
+
+    const char* m_data;
+    const char* m_end;
+  };
+
+  /**
+   * @brief Set the cache directory, an empty string disables the cache.
+   **/
+  static void setDirectory(const std::string& directory);
+  static std::string directory();
+  static bool enabled() { return !directory().empty(); };
+
+  /**
+   * @brief Payload cached for a text, mapped into memory.
+   *
+   * Returns false if the cache is disabled or has no valid entry,
+   * otherwise calls read with the payload while it is mapped.
+   **/
+  template<typename F>
+  static bool load(const std::string& kind, const std::string& text, F read)
+  {
+    std::size_t size = 0;
+    const char* payload = nullptr;
+    void* mapping = map(kind, text, payload, size);
+    if (!mapping)
+      return false;
+    bool success = true;
+    try {
+      Reader reader(payload, size);
+      read(reader);
+      success = reader.atEnd();
+    } catch (const std::exception&) {
+      success = false;
+    }
+    unmap(mapping, kind, text, success);
+    return success;
+  };
+
+  /**
+   * @brief Store the payload for a text, replacing any older entry.
+   *
+   * Failures are reported and otherwise ignored.
+   **/
+  static void store(const std::string& kind,
+                    const std::string& text,
+                    const Writer& payload);
+
+  /**
+   * @brief lwtnn configurations, taken from the cache if possible,
+   * otherwise parsed and added to the cache.
+   **/
+  static lwt::GraphConfig graphConfig(const std::string& json);
+  static lwt::JSONConfig networkConfig(const std::string& json);
+
+  /// Number of entries found in and added to the cache by this process
+  static unsigned int nHits() { return s_hits.load(); };
+  static unsigned int nStored() { return s_stored.load(); };
+
+private:
+  static std::string entryPath(const std::string& kind,
+                               const std::string& text);
+  static void* map(const std::string& kind,
+                   const std::string& text,
+                   const char*& payload,
+                   std::size_t& size);
+  /// Release the mapping, counting the hit or reporting a bad entry
+  static void unmap(void* mapping,
+                    const std::string& kind,
+                    const std::string& text,
+                    bool success);
+
+  static std::atomic<unsigned int> s_hits;
+  static std::atomic<unsigned int> s_stored;
+};
+
+#endif  // TFCSCONFIGCACHE_H
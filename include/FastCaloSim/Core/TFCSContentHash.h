@@ -0,0 +1,42 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * Hashes of serialized content, e.g. network models and configurations.
+ *
+ * The 64 bit FNV-1a hash is cheap and good for naming and lookups, but
+ * two different inputs can have the same hash. Wherever a match decides
+ * which content is used, the SHA-256 digest is compared as well.
+ **/
+
+#ifndef TFCSCONTENTHASH_H
+#define TFCSCONTENTHASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+class FASTCALOSIM_EXPORT TFCSContentHash
+{
+public:
+  typedef std::array<unsigned char, 32> Digest;
+
+  /**
+   * @brief 64 bit FNV-1a hash of the content.
+   **/
+  static std::uint64_t fnv1a(const void* data, std::size_t size);
+
+  /**
+   * @brief SHA-256 digest of the content.
+   **/
+  static Digest sha256(const void* data, std::size_t size);
+
+  /**
+   * @brief Lower case hex representation of a digest.
+   **/
+  static std::string hex(const Digest& digest);
+};
+
+#endif  // TFCSCONTENTHASH_H
@@ -0,0 +1,246 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * Precompiled evaluation of feed forward lwtnn networks.
+ *
+ * lwtnn evaluates networks through string keyed maps and double precision
+ * vectors allocated on every call. For the small networks used in the
+ * simulation (e.g. the FastCaloGAN generators) this overhead dominates.
+ * TFCSDenseNetwork converts an lwtnn configuration once into a flat list
+ * of steps working on a single float buffer:
+ *
+ *   - input preprocessing as a per variable offset and scale
+ *   - dense layers with contiguous row-major float weights, evaluated
+ *     with Eigen, and the activation fused into the same step
+ *   - normalization layers and concatenations
+ *
+ * Networks using anything else (recurrent layers, maxout, highway,
+ * sequence inputs, ...) are not converted, compile() returns nullptr and
+ * the handlers keep using lwtnn.
+ *
+ * The results agree with lwtnn within float precision. Both can be
+ * compared on every evaluation with the validation mode. Configuration
+ * through the static setters or the environment, read on first use:
+ *
+ *   FCS_LWTNN_DENSE     0 keeps networks created from now on on lwtnn
+ *   FCS_LWTNN_VALIDATE  relative tolerance, > 0 evaluates every network
+ *                       also with lwtnn and warns about differences
+ *
+ * Handlers only build the lwtnn objects, which hold further copies of
+ * all weights, if the network could not be compiled or the validation
+ * was on when they were set up.
+ **/
+
+#ifndef TFCSDENSENETWORK_H
+#define TFCSDENSENETWORK_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/VNetworkBase.h"
+
+namespace lwt
+{
+struct JSONConfig;
+struct GraphConfig;
+struct LayerConfig;
+}  // namespace lwt
+
+/**
+ * @brief Feed forward network compiled from an lwtnn configuration.
+ **/
+class FASTCALOSIM_EXPORT TFCSDenseNetwork
+{
+public:
+  typedef VNetworkBase::TensorInputs TensorInputs;
+  typedef VNetworkBase::TensorOutputs TensorOutputs;
+  typedef VNetworkBase::NetworkOutputs NetworkOutputs;
+
+  /**
+   * @brief Compile a sequential lwtnn network.
+   *
+   * The network has one input node, "node_0", and one output node.
+   * Returns nullptr if the network can not be converted.
+   **/
+  static std::unique_ptr<TFCSDenseNetwork> compile(
+      const lwt::JSONConfig& config);
+
+  /**
+   * @brief Compile an lwtnn graph.
+   *
+   * Input and output nodes are in the order of the configuration.
+   * Returns nullptr if the graph can not be converted.
+   **/
+  static std::unique_ptr<TFCSDenseNetwork> compile(
+      const lwt::GraphConfig& config);
+
+  /**
+   * @brief Whether handlers compile their networks.
+   *
+   * Only affects networks set up after the call.
+   **/
+  static void setEnabled(bool enabled);
+  static bool enabled();
+
+  /**
+   * @brief Relative tolerance of the validation against lwtnn.
+   *
+   * 0 disables the validation. Compiled networks set up while it is
+   * disabled have no lwtnn objects and are never validated.
+   **/
+  static void setValidationTolerance(double tolerance);
+  static double validationTolerance();
+
+  /**
+   * @brief Evaluate the network for one set of inputs.
+   *
+   * Takes one view per input node with the raw values, before the
+   * preprocessing. Fills one vector per output node.
+   **/
+  void compute(TensorInputs const& inputs, TensorOutputs& outputs) const
+  {
+    computeBatch(inputs, 1, outputs);
+  };
+
+  /**
+   * @brief Evaluate the network for n_batch rows at once.
+   *
+   * Each input view holds n_batch rows of its node one after the
+   * other, the outputs are filled the same way.
+   **/
+  void computeBatch(TensorInputs const& inputs,
+                    std::size_t n_batch,
+                    TensorOutputs& outputs) const;
+
+  /**
+   * @brief Fill the values of an input node from a map keyed by the
+   * variable names.
+   *
+   * Variables that are not inputs of the node are ignored, as lwtnn
+   * does. Returns false if a variable of the node is missing.
+   **/
+  bool fillInput(std::size_t node,
+                 const std::map<std::string, double>& values,
+                 std::vector<float>& input) const;
+
+  std::size_t nInputNodes() const { return m_inputs.size(); };
+  std::size_t nOutputNodes() const { return m_outputs.size(); };
+  std::size_t inputSize(std::size_t node) const;
+  std::size_t outputSize(std::size_t node) const;
+  /// Labels of the values of an output node
+  const std::vector<std::string>& outputLabels(std::size_t node) const
+  {
+    return m_outputs.at(node).labels;
+  };
+  /// Number of float parameters, weights and biases
+  std::size_t nParameters() const { return m_params.size(); };
+
+  /**
+   * @brief Compare outputs against the lwtnn reference.
+   *
+   * Returns false and warns if a value differs by more than the
+   * validation tolerance, relative to max(1, |reference|).
+   **/
+  static bool validate(const char* where,
+                       TensorOutputs const& values,
+                       TensorOutputs const& reference);
+  static bool validate(const char* where,
+                       NetworkOutputs const& values,
+                       NetworkOutputs const& reference);
+
+private:
+  TFCSDenseNetwork() = default;
+
+  enum StepType_t
+  {
+    kInput,
+    kDense,
+    kNormalization,
+    kConcatenate
+  };
+
+  enum Activation_t
+  {
+    kLinear,
+    kSigmoid,
+    kHardSigmoid,
+    kRelu,
+    kLeakyRelu,
+    kElu,
+    kSwish,
+    kTanh,
+    kAbs,
+    kSoftmax
+  };
+
+  /// Values of one node, per row at offset * n_batch in the buffer
+  struct Slot_t
+  {
+    std::size_t offset = 0;
+    std::size_t size = 0;
+  };
+
+  struct Step_t
+  {
+    StepType_t type = kInput;
+    /// Input node for kInput, source slots otherwise
+    std::vector<std::size_t> sources;
+    std::size_t target = 0;
+    /// Positions in m_params: offsets and scales for kInput,
+    /// weights and bias otherwise
+    std::size_t weights = 0;
+    std::size_t bias = 0;
+    bool has_bias = false;
+    Activation_t activation = kLinear;
+    float alpha = 0;
+  };
+
+  struct InputNode_t
+  {
+    std::size_t slot = 0;
+    /// Variable names in alphabetical order and their positions,
+    /// matching the iteration order of the input maps
+    std::vector<std::string> sorted_names;
+    std::vector<std::size_t> sorted_index;
+  };
+
+  struct OutputNode_t
+  {
+    std::size_t slot = 0;
+    std::vector<std::string> labels;
+  };
+
+  std::size_t addSlot(std::size_t size);
+  std::size_t addInput(const std::vector<std::string>& names,
+                       const std::vector<double>& offsets,
+                       const std::vector<double>& scales);
+  /// Returns false and sets reason if the layer can not be converted
+  bool addLayer(std::size_t source,
+                const lwt::LayerConfig& layer,
+                std::size_t& target,
+                std::string& reason);
+  std::size_t addConcatenate(const std::vector<std::size_t>& sources);
+  void addOutput(std::size_t slot, const std::vector<std::string>& labels);
+
+  void run(const Step_t& step,
+           TensorInputs const& inputs,
+           std::size_t n_batch,
+           float* buffer) const;
+  void activate(const Step_t& step, float* values, std::size_t n_values,
+                std::size_t row_size) const;
+
+  std::vector<Slot_t> m_slots;
+  std::vector<Step_t> m_steps;
+  std::vector<InputNode_t> m_inputs;
+  std::vector<OutputNode_t> m_outputs;
+  /// All weights, biases, offsets and scales, contiguous per step
+  std::vector<float> m_params;
+  /// Floats per row for all slots together
+  std::size_t m_bufferSize = 0;
+};
+
+#endif  // TFCSDENSENETWORK_H
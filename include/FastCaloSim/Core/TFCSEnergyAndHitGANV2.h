@@ -4,13 +4,18 @@
 #define ISF_FASTCALOSIMEVENT_TFCSEnergyAndHitGANV2_h
 
 #include <string>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
 
 #include "FastCaloSim/Core/TFCSGANEtaSlice.h"
 #include "FastCaloSim/Core/TFCSGANXMLParameters.h"
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
 #include "FastCaloSim/Core/TFCSParametrizationBinnedChain.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 
 class CaloGeo;
+class TFCSInferencePipeline;
 
 // forward declare lwtnn dependencies
 namespace lwt
@@ -18,7 +23,8 @@ namespace lwt
 class LightweightGraph;
 }
 
-class TFCSEnergyAndHitGANV2 : public TFCSParametrizationBinnedChain
+class FASTCALOSIM_EXPORT TFCSEnergyAndHitGANV2
+    : public TFCSParametrizationBinnedChain
 {
 public:
   TFCSEnergyAndHitGANV2(const char* name = nullptr,
@@ -97,6 +103,45 @@ public:
       const TFCSTruthState* truth,
       const TFCSExtrapolationState* extrapol) const override;
 
+  /// Evaluate prefetched particles in the background with at most depth
+  /// evaluations queued, 0 disables it. See TFCSInferencePipeline. Must
+  /// not be changed while particles are prefetched
+  void set_pipeline_depth(unsigned int depth);
+  unsigned int pipeline_depth() const;
+
+  /// Precision of the weights of ONNX networks, see TFCSONNXQuantization.
+  /// Used by the next initializeNetwork call, which loads the variant
+  /// files of this precision if there are any. Already loaded networks
+  /// are quantized to int8 right away, other precisions need
+  /// initializeNetwork. lwtnn networks always use single precision
+  void set_model_precision(TFCSONNXQuantization::Precision precision);
+  TFCSONNXQuantization::Precision model_precision() const
+  {
+    return m_model_precision;
+  };
+
+  /// Start the GAN evaluation of a particle that is simulated next with
+  /// simulate(), so that it overlaps with the hits of the current
+  /// particle. The latent noise is drawn from simulstate right away. Needs
+  /// its own simulation state with its own random engine for each
+  /// particle in flight, otherwise the random numbers of a particle depend
+  /// on the pipeline depth. Returns false if the particle is evaluated in
+  /// simulate() instead. simulate() fails for a particle that does not
+  /// match the prefetched one
+  bool prefetch(TFCSSimulationState& simulstate,
+                const TFCSTruthState* truth,
+                const TFCSExtrapolationState* extrapol) const;
+
+  /// Same as simulate() for many particles. With a pipeline depth > 0,
+  /// the GAN evaluation of the next particles is prefetched while the
+  /// hits of the current one are simulated. All particles fail in that
+  /// case if two simulation states share a random engine
+  void simulate_batch(
+      const std::vector<TFCSSimulationState*>& simulstates,
+      const std::vector<const TFCSTruthState*>& truths,
+      const std::vector<const TFCSExtrapolationState*>& extrapols,
+      std::vector<FCSReturnCode>& return_codes) const;
+
   virtual void Print(Option_t* option = "") const override;
 
 protected:
@@ -107,6 +152,13 @@ protected:
                                 std::string FastCaloGANInputFolderName);
 
 private:
+  /// GAN evaluation of a particle, see prefetch
+  struct PipelineJob_t;
+  TFCSGANEtaSlice::NetworkOutputs GetNetworkOutputs(
+      TFCSSimulationState& simulstate,
+      const TFCSTruthState* truth,
+      const TFCSExtrapolationState* extrapol) const;
+
   static int GetBinsInFours(double const& bins);
   int GetAlphaBinsForRBin(const TAxis* x, int ix, int yBinNum) const;
 
@@ -120,6 +172,10 @@ private:
   TFCSGANEtaSlice* m_slice = nullptr;
   TFCSGANXMLParameters m_param;
 
+  TFCSInferencePipeline* m_pipeline = nullptr;  //! Do not persistify
+  TFCSONNXQuantization::Precision m_model_precision =
+      TFCSONNXQuantization::kFP32;  //! Do not persistify
+
   ClassDefOverride(TFCSEnergyAndHitGANV2, 2)  // TFCSEnergyAndHitGANV2
 };
 
@@ -3,9 +3,11 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSEnergyParametrization_h
 #define ISF_FASTCALOSIMEVENT_TFCSEnergyParametrization_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrization.h"
 
-class TFCSEnergyParametrization : public TFCSParametrization
+class FASTCALOSIM_EXPORT TFCSEnergyParametrization : public TFCSParametrization
 {
 public:
   TFCSEnergyParametrization(const char* name = nullptr,
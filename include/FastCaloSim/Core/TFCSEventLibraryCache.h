@@ -0,0 +1,129 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#ifndef TFCSEventLibraryCache_h
+#define TFCSEventLibraryCache_h
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
+
+/** On-demand access to the events of an HDF5 event library
+Libraries with the full statistics don't fit into the memory of a grid job.
+This class keeps only the matching information of all events (phi_mod,
+center_eta and e_init) in memory. The voxels of an event are read from the
+energy_layer_<N> datasets when the event is requested: the row of the event is
+selected in every layer, and HDF5 only decompresses the chunks holding it. The
+decoded events are kept in a least recently used cache with a bounded size.
+
+All methods are thread-safe. Events are returned as shared pointers, so they
+stay valid while they are used, also if another thread evicts them from the
+cache. HDF5 is not assumed to be thread-safe, all reads are serialised.
+
+Batches of particles can announce the events they will use with prefetch(),
+which reads all missing events with one selection per layer.
+*/
+
+class FASTCALOSIM_EXPORT TFCSEventLibraryCache
+{
+public:
+  /// Voxels of one event in all layers, in compressed sparse row form
+  struct Event_t
+  {
+    std::vector<std::uint64_t> offsets;  // n_layers+1 entries
+    std::vector<std::uint32_t> bin_index;
+    std::vector<float> E;
+
+    TFCSEventLibraryFile::Voxels_t voxels(std::size_t layer) const;
+    std::size_t bytes() const;
+  };
+
+  struct Stats_t
+  {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t n_cached = 0;
+    std::size_t bytes = 0;
+  };
+
+  ~TFCSEventLibraryCache();
+
+  /// Open the HDF5 library and read the matching information. Layers
+  /// without data in the file are empty. Returns nullptr on error
+  static std::shared_ptr<TFCSEventLibraryCache> Open(
+      const std::string& path,
+      const std::vector<long unsigned int>& layers,
+      std::size_t max_bytes);
+
+  std::size_t n_events() const { return m_n_events; };
+  std::size_t n_layers() const { return m_n_layers; };
+  std::size_t max_bytes() const { return m_max_bytes; };
+  const std::string& path() const { return m_path; };
+
+  /// Matching information of an event, 0 if it is not in the file
+  float phi_mod(std::size_t event) const
+  {
+    return m_phi_mod.empty() ? 0 : m_phi_mod[event];
+  };
+  float center_eta(std::size_t event) const
+  {
+    return m_center_eta.empty() ? 0 : m_center_eta[event];
+  };
+  float e_init(std::size_t event) const
+  {
+    return m_e_init.empty() ? 0 : m_e_init[event];
+  };
+
+  /// The event, read from the file if it is not cached. nullptr if the
+  /// event does not exist or can't be read
+  std::shared_ptr<const Event_t> get(std::size_t event);
+
+  /// Read all events that are not cached yet. Only as many events as fit
+  /// into the cache are read
+  void prefetch(const std::vector<std::size_t>& events);
+
+  Stats_t stats() const;
+
+private:
+  TFCSEventLibraryCache() = default;
+
+  /// Read events from the file, sorted and without duplicates
+  std::vector<std::shared_ptr<const Event_t>> read(
+      const std::vector<std::size_t>& events);
+  /// Add an event to the cache and evict the least recently used ones.
+  /// Returns the cached event, which is an older copy if there was one
+  std::shared_ptr<const Event_t> insert(std::size_t event,
+                                        std::shared_ptr<const Event_t> data);
+
+  std::string m_path;
+  std::size_t m_n_events = 0;
+  std::size_t m_n_layers = 0;
+  std::size_t m_max_bytes = 0;
+  std::vector<float> m_phi_mod;
+  std::vector<float> m_center_eta;
+  std::vector<float> m_e_init;
+
+  // HDF5 file and datasets, only used with m_read_mutex locked
+  struct Hdf5_t;
+  std::unique_ptr<Hdf5_t> m_hdf5;
+  std::mutex m_read_mutex;
+
+  // Cached events, the most recently used first
+  typedef std::list<std::pair<std::size_t, std::shared_ptr<const Event_t>>>
+      lru_t;
+  lru_t m_lru;
+  std::unordered_map<std::size_t, lru_t::iterator> m_cached;
+  std::size_t m_bytes = 0;
+  Stats_t m_stats;
+  mutable std::mutex m_cache_mutex;
+};
+
+#endif
@@ -0,0 +1,214 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#ifndef TFCSEventLibraryFile_h
+#define TFCSEventLibraryFile_h
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+/** Memory-mapped, columnar event library for TFCSBinnedShower
+Reading an HDF5 event library puts every event and layer into its own pair of
+vectors, which takes long for large libraries, fragments the heap and has to
+be repeated in every process. In this format the voxels of all events of a
+layer are stored in compressed sparse row form: the voxels of event i are the
+entries [offsets[i], offsets[i+1]) of the bin index and energy arrays. The file
+is mapped read-only into memory and the simulation reads the events directly
+from the mapped pages, which the operating system shares between all processes
+using the same file and only loads when they are accessed.
+
+Files are written with TFCSEventLibraryWriter, or converted from the HDF5
+format with convert_event_library.
+
+File layout (version 1, native byte order), every part starting at a multiple
+of kAlignment bytes:
+- Header_t
+- Layer_t for each of the n_layers layers
+- the arrays, at the positions given in the header and the layer table:
+  - phi_mod, center_eta and e_init, float[n_events] each
+  - for every layer with data:
+    - offsets, uint64[n_events+1]
+    - bin indices, uint32[n_entries]
+    - energies relative to e_init, float[n_entries]
+    - R_lower, R_size, alpha_lower and alpha_size, float[n_bins] each
+*/
+
+class FASTCALOSIM_EXPORT TFCSEventLibraryFile
+{
+public:
+  static constexpr std::uint32_t kVersion = 1;
+  static constexpr std::uint32_t kByteOrderMark = 0x01020304;
+  static constexpr std::size_t kAlignment = 64;
+
+  struct Header_t
+  {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t n_events;
+    std::uint64_t n_layers;
+    std::uint64_t file_size;
+    // Positions of the per event arrays in the file, 0 if not stored
+    std::uint64_t phi_mod;
+    std::uint64_t center_eta;
+    std::uint64_t e_init;
+  };
+
+  struct Layer_t
+  {
+    std::uint64_t n_entries;
+    std::uint64_t n_bins;
+    // Positions of the arrays in the file, all 0 for layers without data
+    std::uint64_t offsets;
+    std::uint64_t bin_index;
+    std::uint64_t energy;
+    std::uint64_t R_lower;
+    std::uint64_t R_size;
+    std::uint64_t alpha_lower;
+    std::uint64_t alpha_size;
+  };
+
+  /// Voxels of one event in one layer, pointing into the mapped file
+  struct Voxels_t
+  {
+    const std::uint32_t* bin_index = nullptr;
+    const float* E = nullptr;
+    std::size_t size = 0;
+  };
+
+  ~TFCSEventLibraryFile();
+
+  /// Map a library file into memory. Returns nullptr on error
+  static std::shared_ptr<const TFCSEventLibraryFile> Open(
+      const std::string& path);
+
+  std::uint64_t n_events() const { return m_header.n_events; };
+  std::uint64_t n_layers() const { return m_header.n_layers; };
+  std::size_t size() const { return m_size; };
+  const std::string& path() const { return m_path; };
+
+  bool has_layer(std::size_t layer) const
+  {
+    return layer < m_layers.size() && m_layers[layer].offsets != nullptr;
+  };
+
+  /// Voxels of an event in a layer, empty for layers without data
+  Voxels_t voxels(std::size_t event, std::size_t layer) const
+  {
+    Voxels_t result;
+    if (!has_layer(layer) || event >= m_header.n_events)
+      return result;
+    const LayerView_t& view = m_layers[layer];
+    const std::uint64_t begin = view.offsets[event];
+    const std::uint64_t end = view.offsets[event + 1];
+    if (begin > end || end > view.n_entries)
+      return result;
+    result.bin_index = view.bin_index + begin;
+    result.E = view.energy + begin;
+    result.size = end - begin;
+    return result;
+  };
+
+  /// Matching information of an event, 0 if it is not stored in the file
+  float phi_mod(std::size_t event) const
+  {
+    return m_phi_mod ? m_phi_mod[event] : 0;
+  };
+  float center_eta(std::size_t event) const
+  {
+    return m_center_eta ? m_center_eta[event] : 0;
+  };
+  float e_init(std::size_t event) const
+  {
+    return m_e_init ? m_e_init[event] : 0;
+  };
+
+  /// Copy the bin boundaries of a layer, false for layers without data
+  bool bin_boundaries(std::size_t layer,
+                      std::vector<float>& R_lower,
+                      std::vector<float>& R_size,
+                      std::vector<float>& alpha_lower,
+                      std::vector<float>& alpha_size) const;
+
+private:
+  TFCSEventLibraryFile() = default;
+
+  struct LayerView_t
+  {
+    std::uint64_t n_entries = 0;
+    std::uint64_t n_bins = 0;
+    const std::uint64_t* offsets = nullptr;
+    const std::uint32_t* bin_index = nullptr;
+    const float* energy = nullptr;
+    const float* bins[4] = {};
+  };
+
+  std::string m_path;
+  void* m_mapping = nullptr;
+  std::size_t m_size = 0;
+  Header_t m_header {};
+  std::vector<LayerView_t> m_layers;
+  const float* m_phi_mod = nullptr;
+  const float* m_center_eta = nullptr;
+  const float* m_e_init = nullptr;
+};
+
+/** Writer for the TFCSEventLibraryFile format
+The layers can be added in any order and one at a time, so that a converter
+only needs to hold one layer of the library in memory.
+*/
+
+class FASTCALOSIM_EXPORT TFCSEventLibraryWriter
+{
+public:
+  TFCSEventLibraryWriter(const std::string& path,
+                         std::uint64_t n_events,
+                         std::uint64_t n_layers);
+  ~TFCSEventLibraryWriter();
+
+  bool is_open() const { return m_file != nullptr; };
+  std::uint64_t size() const { return m_header.file_size; };
+
+  /// Matching information of all events. Empty vectors are not stored
+  bool set_event_info(const std::vector<float>& phi_mod,
+                      const std::vector<float>& center_eta,
+                      const std::vector<float>& e_init);
+
+  /// Voxels of all events in a layer: offsets has n_events+1 entries, the
+  /// voxels of event i are the entries [offsets[i], offsets[i+1]) of
+  /// bin_index and E. The bin boundaries all have the same size
+  bool add_layer(std::size_t layer,
+                 const std::vector<std::uint64_t>& offsets,
+                 const std::vector<std::uint32_t>& bin_index,
+                 const std::vector<float>& E,
+                 const std::vector<float>& R_lower,
+                 const std::vector<float>& R_size,
+                 const std::vector<float>& alpha_lower,
+                 const std::vector<float>& alpha_size);
+
+  /// Write the final header and layer table and close the file
+  bool Close();
+
+private:
+  /// Append an array and return its position in the file
+  std::uint64_t append(const void* data, std::size_t bytes);
+
+  std::string m_path;
+  std::FILE* m_file = nullptr;
+  bool m_ok = true;
+  TFCSEventLibraryFile::Header_t m_header {};
+  std::vector<TFCSEventLibraryFile::Layer_t> m_layers;
+};
+
+/// Convert the HDF5 event library of a TFCSBinnedShower into a library file,
+/// see TFCSBinnedShower::convert_event_library. Returns false on any error
+FASTCALOSIM_EXPORT bool convert_event_library(
+    const std::string& hdf5_file,
+    const std::string& library_file,
+    const std::vector<long unsigned int>& layers);
+
+#endif
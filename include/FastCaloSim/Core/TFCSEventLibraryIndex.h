@@ -0,0 +1,147 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * k-d tree for the nearest neighbour search in shower event libraries.
+ *
+ * TFCSBinnedShower picks the library event closest to a particle in
+ * eta, log2 of the energy and optionally the phi position within the
+ * cell. Scanning the whole library for every particle dominates the
+ * simulation time for libraries with hundreds of thousands of showers.
+ *
+ * The tree is built once over the matching coordinates of all events
+ * and only visits the leaves whose bounding box can contain a closer
+ * event. Each coordinate has a weight given with the query, so that
+ * normalisations which depend on the particle, like the phi cell size,
+ * need no rebuild. A zero weight ignores a coordinate.
+ *
+ * The tree only decides which events are compared. The distance of each
+ * visited event comes from the caller, so the result is the same as a
+ * scan with that distance over all events: the event with the smallest
+ * distance, the lowest index among equal distances, and none if no
+ * distance is below the largest float. Boxes are only skipped if their
+ * bound exceeds the best distance by a margin, which covers the rounding
+ * differences between the bound and the caller's distance.
+ **/
+
+#ifndef TFCSEVENTLIBRARYINDEX_H
+#define TFCSEVENTLIBRARYINDEX_H
+
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+/**
+ * @brief Nearest neighbour index over up to three weighted coordinates.
+ **/
+class FASTCALOSIM_EXPORT TFCSEventLibraryIndex
+{
+public:
+  static constexpr unsigned int kMaxDims = 3;
+  static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+  /**
+   * @brief Build the tree.
+   *
+   * @param points     n_dims coordinates per event, event after event
+   * @param n_dims     number of coordinates, at most kMaxDims
+   * @param leaf_size  maximal number of events in a leaf
+   **/
+  TFCSEventLibraryIndex(const std::vector<double>& points,
+                        unsigned int n_dims,
+                        std::size_t leaf_size = 16);
+
+  unsigned int n_dims() const { return m_n_dims; };
+  std::size_t size() const { return m_n_points; };
+
+  /**
+   * @brief Index of the event with the smallest distance, npos if none.
+   *
+   * @param query     n_dims coordinates of the particle
+   * @param weights   scale of each coordinate in the distance
+   * @param distance  exact distance of an event, a float like callable
+   *                  with the event index as argument
+   **/
+  template<typename F>
+  std::size_t nearest(const double* query,
+                      const double* weights,
+                      F&& distance) const
+  {
+    std::size_t best = npos;
+    float best_distance = std::numeric_limits<float>::max();
+    auto visit = [&](std::size_t index)
+    {
+      const float d = distance(index);
+      if (d < best_distance || (d == best_distance && index < best)) {
+        best_distance = d;
+        best = index;
+      }
+    };
+
+    // Events with coordinates that are not finite are not in the tree
+    for (std::size_t index : m_unindexed)
+      visit(index);
+    if (m_nodes.empty())
+      return best;
+
+    struct Entry_t
+    {
+      std::size_t node;
+      double bound;
+    };
+    std::vector<Entry_t> stack;
+    stack.push_back({0, lowerBound(m_nodes[0], query, weights)});
+    while (!stack.empty()) {
+      const Entry_t entry = stack.back();
+      stack.pop_back();
+      if (skip(entry.bound, best_distance))
+        continue;
+      const Node_t& node = m_nodes[entry.node];
+      if (node.left == npos) {
+        for (std::size_t i = node.begin; i < node.end; ++i)
+          visit(m_order[i]);
+        continue;
+      }
+      // The nearer child is searched first
+      Entry_t left = {node.left,
+                      lowerBound(m_nodes[node.left], query, weights)};
+      Entry_t right = {node.right,
+                       lowerBound(m_nodes[node.right], query, weights)};
+      if (left.bound < right.bound)
+        std::swap(left, right);
+      stack.push_back(left);
+      stack.push_back(right);
+    }
+    return best;
+  };
+
+private:
+  struct Node_t
+  {
+    std::size_t begin = 0;  // range of the events in m_order
+    std::size_t end = 0;
+    std::size_t left = npos;  // children, npos for leaves
+    std::size_t right = npos;
+    double lo[kMaxDims] = {};  // bounding box
+    double hi[kMaxDims] = {};
+  };
+
+  std::size_t build(std::size_t begin, std::size_t end, std::size_t leaf_size);
+  double lowerBound(const Node_t& node,
+                    const double* query,
+                    const double* weights) const;
+  /// Check that a box with this bound can't hold an event at least as
+  /// close as the best one
+  static bool skip(double bound, float best_distance);
+
+  unsigned int m_n_dims;
+  std::size_t m_n_points;
+  std::vector<double> m_points;
+  std::vector<std::size_t> m_order;
+  std::vector<std::size_t> m_unindexed;
+  std::vector<Node_t> m_nodes;
+};
+
+#endif  // TFCSEVENTLIBRARYINDEX_H
@@ -69,6 +69,13 @@ public:
     return m_CaloOK.at({layer, subpos});
   }
 
+  // Same as OK, but false if the layer was never extrapolated to
+  auto is_valid(int layer, int subpos) const -> bool
+  {
+    const auto it = m_CaloOK.find({layer, subpos});
+    return it != m_CaloOK.end() && it->second;
+  }
+
   auto eta(int layer, int subpos) const -> double
   {
     return m_etaCalo.at({layer, subpos});
@@ -0,0 +1,127 @@
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#ifndef ISF_FASTCALOSIMEVENT_TFCSFlatArrayStore_h
+#define ISF_FASTCALOSIMEVENT_TFCSFlatArrayStore_h
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+/** Flat, memory-mappable storage for large numeric arrays
+A parametrization can be exported such that the object structure is still
+written with ROOT streaming, but the content of large numeric arrays
+(TFCS1DFunction_Array, i.e. histogram contents and bin edges) is written into
+one flat binary file. The ROOT file then only contains a reference (store id
+and offset) for these arrays.
+
+When reading, the flat file is mapped into memory with TFCSFlatArrayStore::
+Attach() and the arrays point directly into the mapped pages. The pages are
+mapped copy-on-write, so they are shared between all processes reading the same
+file, also after a fork(). The store has to be attached before the ROOT objects
+are read and must stay attached as long as they are in use. Arrays that can
+not be resolved are reported once when the objects using them are read.
+
+ROOT matrices and vectors (TMatrixD, TVectorD) keep their own streamers. They
+are small compared to the histograms, and the PCA copies them into contiguous
+caches when it is read.
+
+File layout (version 1, native byte order):
+- Header_t, padded to kAlignment bytes
+- arrays, each starting at a multiple of kAlignment bytes
+*/
+
+class FASTCALOSIM_EXPORT TFCSFlatArrayStore
+{
+public:
+  static constexpr std::uint32_t kVersion = 1;
+  static constexpr std::uint32_t kByteOrderMark = 0x01020304;
+  static constexpr std::size_t kAlignment = 64;
+
+  struct Header_t
+  {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t id;
+    std::uint64_t n_arrays;
+    std::uint64_t file_size;
+  };
+
+  ~TFCSFlatArrayStore();
+
+  /// Map the flat file into memory and register it, so that ROOT objects
+  /// referencing it can be read. Attaching the same file twice returns the
+  /// already existing store. Returns nullptr on error
+  static std::shared_ptr<TFCSFlatArrayStore> Attach(const std::string& path);
+  /// Unregister a store. The mapping is removed once the last reference to the
+  /// store is gone, objects still pointing into it must be deleted before
+  static void Detach(const std::shared_ptr<TFCSFlatArrayStore>& store);
+
+  /// Used by the streamers: pointer to bytes at offset in the store with the
+  /// given id, nullptr if the store is not attached or the range is invalid
+  static const void* Resolve(std::uint64_t id,
+                             std::uint64_t offset,
+                             std::size_t bytes);
+
+  std::uint64_t id() const { return m_header.id; };
+  std::uint64_t n_arrays() const { return m_header.n_arrays; };
+  std::size_t size() const { return m_size; };
+  const std::string& path() const { return m_path; };
+
+private:
+  TFCSFlatArrayStore() = default;
+
+  std::string m_path;
+  void* m_mapping = nullptr;
+  std::size_t m_size = 0;
+  Header_t m_header {};
+};
+
+/** Writer for the TFCSFlatArrayStore file format
+While a writer is active (between Begin() and End(), per thread), the streamer
+of TFCS1DFunction_Array writes arrays of at least min_bytes into the flat file
+and only a reference into the ROOT buffer.
+*/
+
+class FASTCALOSIM_EXPORT TFCSFlatArrayWriter
+{
+public:
+  TFCSFlatArrayWriter(const std::string& path, std::size_t min_bytes = 64);
+  ~TFCSFlatArrayWriter();
+
+  bool is_open() const { return m_file != nullptr; };
+  std::uint64_t id() const { return m_header.id; };
+  std::uint64_t n_arrays() const { return m_header.n_arrays; };
+  std::uint64_t size() const { return m_header.file_size; };
+  /// false if writing any array failed so far
+  bool ok() const { return m_ok; };
+
+  /// Make this writer the active one for the current thread
+  void Begin();
+  /// Deactivate the writer for the current thread
+  void End();
+  /// Write the final header and close the file
+  bool Close();
+
+  /// Active writer of the current thread, nullptr if none
+  static TFCSFlatArrayWriter* Current();
+
+  bool accepts(std::size_t bytes) const
+  {
+    return is_open() && bytes >= m_min_bytes;
+  };
+  /// Append an array and return its offset in the file
+  std::uint64_t append(const void* data, std::size_t bytes);
+
+private:
+  std::string m_path;
+  std::FILE* m_file = nullptr;
+  bool m_ok = true;
+  std::size_t m_min_bytes;
+  TFCSFlatArrayStore::Header_t m_header {};
+};
+
+#endif
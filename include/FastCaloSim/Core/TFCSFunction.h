@@ -3,10 +3,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSFunction_h
 #define ISF_FASTCALOSIMEVENT_TFCSFunction_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/MLogging.h"
 #include "TObject.h"
 
-class TFCSFunction
+class FASTCALOSIM_EXPORT TFCSFunction
     : public TObject
     , public ISF_FCS::MLogging
 {
@@ -21,6 +23,10 @@ public:
   /// Return the number of dimensions for the function
   virtual int ndim() const { return 0; };
 
+  /// false if the function could not be read completely, e.g. because its
+  /// arrays are in a TFCSFlatArrayStore that is not attached
+  virtual bool is_valid() const { return true; };
+
   /// Function gets array of random numbers rnd[] in the range [0,1) as
   /// arguments and returns function value in array value. For a n-dimensional
   /// function, value and rnd should both have n elements.
@@ -14,6 +14,7 @@
 #include "FastCaloSim/Core/MLogging.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
 #include "FastCaloSim/Core/TFCSGANXMLParameters.h"
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "FastCaloSim/Core/TFCSTruthState.h"
 
@@ -39,13 +40,27 @@ public:
   typedef std::map<std::string, std::map<std::string, double>> NetworkInputs;
   typedef std::map<std::string, double> NetworkOutputs;
 
-  bool LoadGAN();
+  /// Load the networks, ONNX networks optionally in reduced precision,
+  /// see TFCSNetworkFactory::create
+  bool LoadGAN(TFCSONNXQuantization::Precision precision =
+                   TFCSONNXQuantization::kFP32);
+  /// Replace the loaded ONNX networks with their dynamically quantized
+  /// int8 variants. Returns false if a network was not converted
+  bool QuantizeInt8();
   void CalculateMeanPointFromDistributionOfR();
   void ExtractExtrapolatorMeansFromInputs();
 
   NetworkOutputs GetNetworkOutputs(const TFCSTruthState* truth,
                                    const TFCSExtrapolationState* extrapol,
                                    TFCSSimulationState simulstate) const;
+  /// Conditioning and latent noise of a particle, drawn from simulstate
+  NetworkInputs GetNetworkInputs(const TFCSTruthState* truth,
+                                 const TFCSExtrapolationState* extrapol,
+                                 TFCSSimulationState& simulstate) const;
+  /// Evaluate the network selected by the particle momentum. Uses no
+  /// random numbers, so it can run on another thread
+  NetworkOutputs GetNetworkOutputs(const NetworkInputs& inputs,
+                                   double momentum) const;
 
   bool IsGanCorrectlyLoaded() const;
   FitResultsPerLayer GetFitResults() const { return m_allFitResults; }
@@ -24,10 +24,13 @@
 #ifndef TFCSGANLWTNNHANDLER_H
 #define TFCSGANLWTNNHANDLER_H
 
+#include "FastCaloSim/Core/TFCSDenseNetwork.h"
 #include "FastCaloSim/Core/VNetworkLWTNN.h"
 
 // Because we have a field of type LightweightGraph
+#include "lwtnn/FastGraph.hh"
 #include "lwtnn/LightweightGraph.hh"
+#include "lwtnn/Stack.hh"
 
 // For writing to a tree
 #include <memory>
@@ -76,6 +79,44 @@ public:
    **/
   NetworkOutputs compute(NetworkInputs const& inputs) const override;
 
+  /**
+   * @brief Function to pass typed values to the network.
+   *
+   * Takes one input node per input of the graph, in the order of
+   * the json description, each with the values in the order of the
+   * variables of that input. Gives one output node per output of
+   * the graph, in the order of getOutputNodes.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param outputs  output parameter, the output of the network
+   * @see VNetworkBase::TensorInputs
+   * @see VNetworkBase::TensorOutputs
+   **/
+  void computeTensors(TensorInputs const& inputs,
+                      TensorOutputs& outputs) const override;
+
+  /**
+   * @brief Evaluate n_batch entries in one call.
+   *
+   * Uses the precompiled network if there is one, otherwise
+   * evaluates entry by entry.
+   *
+   * @see VNetworkBase::computeTensorsBatch
+   **/
+  void computeTensorsBatch(TensorInputs const& inputs,
+                           std::size_t n_batch,
+                           TensorOutputs& outputs) const override;
+
+  /**
+   * @brief List the names of the input nodes.
+   **/
+  std::vector<std::string> getInputNodes() const override;
+
+  /**
+   * @brief List the names of the output nodes.
+   **/
+  std::vector<std::string> getOutputNodes() const override;
+
   /**
    * @brief List the names of the outputs.
    *
@@ -102,9 +143,94 @@ private:
   // unique ptr deletes the object when it goes out of scope
   /**
    * @brief The network that we are wrapping here.
+   *
+   * This and the other lwtnn objects are only built if m_dense does
+   * not exist or the validation is on, see TFCSDenseNetwork.
    **/
   std::unique_ptr<lwt::LightweightGraph> m_lwtnn_graph;  //! Do not persistify
 
+  /**
+   * @brief The same graph with inputs indexed by position.
+   *
+   * Used by computeTensors.
+   **/
+  std::unique_ptr<lwt::FastGraph> m_lwtnn_fast_graph;  //! Do not persistify
+
+  /**
+   * @brief One node of the graph, for computeTensors without m_dense.
+   *
+   * The fast graph evaluates all nodes again for each output node,
+   * these are evaluated once and shared by all outputs.
+   **/
+  struct GraphNode_t
+  {
+    lwt::NodeConfig::Type type;
+    std::vector<size_t> sources;
+    // Input preprocessing, (x + offset) * scale
+    Eigen::VectorXd offset;
+    Eigen::VectorXd scale;
+    std::unique_ptr<lwt::Stack> stack;
+  };
+
+  /**
+   * @brief The graph nodes and the order they are evaluated in.
+   *
+   * The order is empty for graphs with node types that are not
+   * supported, e.g. sequences, those use the fast graph.
+   **/
+  std::vector<GraphNode_t> m_graphNodes;  //! Do not persistify
+  std::vector<size_t> m_graphOrder;  //! Do not persistify
+
+  /**
+   * @brief The same graph precompiled for fast evaluation.
+   *
+   * Used instead of the lwtnn graphs if it exists, see
+   * TFCSDenseNetwork for the supported graphs.
+   **/
+  std::unique_ptr<TFCSDenseNetwork> m_dense;  //! Do not persistify
+
+  /**
+   * @brief Names and sizes of the input nodes, in graph order.
+   **/
+  std::vector<std::string> m_inputNodes;  //! Do not persistify
+  std::vector<size_t> m_inputNodeSize;  //! Do not persistify
+
+  /**
+   * @brief Names and graph indices of the output nodes.
+   **/
+  std::vector<std::string> m_outputNodes;  //! Do not persistify
+  std::vector<size_t> m_outputNodeIndex;  //! Do not persistify
+
+  /**
+   * @brief Make m_lwtnn_graph and the members used by computeTensors.
+   **/
+  void buildGraph(const lwt::GraphConfig& config);
+
+  /**
+   * @brief Add a node and its sources to m_graphNodes and m_graphOrder.
+   *
+   * Returns the size of the node output, 0 if it is not supported.
+   **/
+  size_t addGraphNode(const lwt::GraphConfig& config,
+                      size_t index,
+                      std::vector<size_t>& sizes);
+
+  /**
+   * @brief Evaluate with lwtnn, bypassing m_dense.
+   **/
+  NetworkOutputs computeLWTNN(NetworkInputs const& inputs) const;
+  void computeTensorsLWTNN(TensorInputs const& inputs,
+                           TensorOutputs& outputs) const;
+
+  /**
+   * @brief Evaluate string keyed inputs with m_dense.
+   *
+   * Returns false if the inputs do not match the input nodes
+   * exactly, those are left to lwtnn.
+   **/
+  bool computeDense(NetworkInputs const& inputs,
+                    NetworkOutputs& outputs) const;
+
   /**
    * @brief List of names that index the output layer.
    **/
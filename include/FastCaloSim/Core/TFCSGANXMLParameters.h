@@ -19,6 +19,7 @@
 #include <libxml/xpathInternals.h>
 
 #include "FastCaloSim/Core/MLogging.h"
+#include "FastCaloSim/Core/TFCSConfigCache.h"
 #include "TH2D.h"
 
 class TFCSGANXMLParameters : public ISF_FCS::MLogging
@@ -43,6 +44,17 @@ public:
 
 private:
   static bool ReadBooleanAttribute(const std::string& name, xmlNodePtr node);
+  /// Parse the xml file. If cache is given, it is filled with what is
+  /// needed to repeat the same settings without parsing
+  void ParseXML(int pid,
+                int etaMid,
+                const std::string& xmlFullFileName,
+                TFCSConfigCache::Writer* cache);
+  void AddLayer(int pid,
+                int regionId,
+                int layer,
+                const std::vector<double>& edges,
+                int binsInAlpha);
 
   bool m_symmetrisedAlpha;
   Binning m_binning;
@@ -3,12 +3,17 @@
 #ifndef TFCSHitCellMapping_h
 #define TFCSHitCellMapping_h
 
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 #include "FastCaloSim/Geometry/Cell.h"
 
 class CaloGeo;
 
-class TFCSHitCellMapping : public TFCSLateralShapeParametrizationHitBase
+class FASTCALOSIM_EXPORT TFCSHitCellMapping
+    : public TFCSLateralShapeParametrizationHitBase
 {
 public:
   TFCSHitCellMapping(const char* name = nullptr,
@@ -25,6 +30,14 @@ public:
       const TFCSTruthState* truth,
       const TFCSExtrapolationState* extrapol) override;
 
+  /// fills many hits of the layer into calorimeter cells, with the same
+  /// result as simulate_hit for each of them. Consecutive hits in the same
+  /// cell are summed and deposited at once, so hits close to each other
+  /// should be consecutive
+  void simulate_hits(TFCSSimulationState& simulstate,
+                     const std::vector<Position>& positions,
+                     const std::vector<float>& E) const;
+
   virtual bool operator==(const TFCSParametrizationBase& ref) const override;
 
   void Print(Option_t* option) const override;
@@ -0,0 +1,107 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * Background network evaluation that overlaps with the hit simulation of
+ * the calling thread.
+ *
+ * A simulation thread submits the network evaluation of a particle it
+ * will simulate next, then continues with the hits of the current
+ * particle. The job runs in the background in the meantime. When the
+ * next particle is simulated, its result is collected, waiting only if
+ * the job has not finished yet.
+ *
+ * All pipelines share one TBB task arena, so the number of inference
+ * threads does not grow with the number of parametrizations. The jobs of
+ * one pipeline run one at a time, in the order they were submitted. A
+ * caller that would have to wait for a job that has not started runs it
+ * itself, so the pipeline makes progress even if the arena is busy.
+ *
+ * Jobs are identified by a key, the simulation state of the particle.
+ * Each key has at most one job. Submitting again for a key whose job was
+ * not collected, e.g. because the simulation state is reused for another
+ * particle, discards the old job.
+ *
+ * Backpressure: at most max_pending() jobs wait for or are in their
+ * evaluation. Submitting more blocks the caller until the pipeline has
+ * caught up, so a fast producer can never queue unbounded work. Finished
+ * jobs that were not collected do not count.
+ *
+ * Jobs should do nothing but the evaluation. Random numbers are drawn by
+ * the submitting thread before a job is queued, so the results do not
+ * depend on the timing of the evaluation. Configuration through the
+ * environment, read on first use:
+ *
+ *   FCS_INFERENCE_THREADS  threads of the shared arena, default 1
+ **/
+
+#ifndef TFCSINFERENCEPIPELINE_H
+#define TFCSINFERENCEPIPELINE_H
+
+#include <memory>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+/**
+ * @brief Bounded queue of network evaluations run in the background.
+ **/
+class FASTCALOSIM_EXPORT TFCSInferencePipeline
+{
+public:
+  /**
+   * @brief Evaluation of one particle, with its inputs and outputs.
+   **/
+  class Job
+  {
+  public:
+    virtual ~Job() = default;
+    /// Evaluate the network
+    virtual bool run() = 0;
+  };
+
+  explicit TFCSInferencePipeline(unsigned int max_pending = 2);
+  /// Drop the jobs that have not started and wait for the running one
+  ~TFCSInferencePipeline();
+
+  TFCSInferencePipeline(const TFCSInferencePipeline&) = delete;
+  TFCSInferencePipeline& operator=(const TFCSInferencePipeline&) = delete;
+
+  /**
+   * @brief Queue a job, blocking while max_pending jobs are queued.
+   *
+   * An earlier job of key that was not collected is discarded.
+   **/
+  bool submit(const void* key, std::shared_ptr<Job> job);
+
+  /**
+   * @brief Wait for the job of key and hand it back.
+   *
+   * Returns nullptr if no job was submitted for key. ok is set to the
+   * return value of Job::run, false if it threw.
+   **/
+  std::shared_ptr<Job> collect(const void* key, bool& ok);
+
+  /**
+   * @brief Forget the job of key without waiting for it.
+   *
+   * For particles that were submitted but will not be simulated.
+   **/
+  void discard(const void* key);
+
+  /// Check if key has a job that was not collected
+  bool has(const void* key) const;
+
+  unsigned int max_pending() const { return m_max_pending; };
+
+  /// Number of threads of the arena shared by all pipelines
+  static unsigned int n_threads();
+
+private:
+  /// Queue and slots, shared with the tasks in the arena, which can
+  /// outlive the pipeline
+  struct State_t;
+
+  const unsigned int m_max_pending;
+  std::shared_ptr<State_t> m_state;
+};
+
+#endif  // TFCSINFERENCEPIPELINE_H
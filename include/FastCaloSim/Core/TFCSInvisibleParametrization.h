@@ -3,9 +3,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSInvisibleParametrization_h
 #define ISF_FASTCALOSIMEVENT_TFCSInvisibleParametrization_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrization.h"
 
-class TFCSInvisibleParametrization : public TFCSParametrization
+class FASTCALOSIM_EXPORT TFCSInvisibleParametrization
+    : public TFCSParametrization
 {
 public:
   TFCSInvisibleParametrization(const char* name = nullptr,
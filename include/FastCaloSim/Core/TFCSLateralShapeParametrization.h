@@ -3,9 +3,12 @@
 #ifndef TFCSLateralShapeParametrization_h
 #define TFCSLateralShapeParametrization_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrization.h"
 
-class TFCSLateralShapeParametrization : public TFCSParametrization
+class FASTCALOSIM_EXPORT TFCSLateralShapeParametrization
+    : public TFCSParametrization
 {
 public:
   TFCSLateralShapeParametrization(const char* name = nullptr,
@@ -3,9 +3,11 @@
 #ifndef TFCSLateralShapeParametrizationFixedHitChain_h
 #define TFCSLateralShapeParametrizationFixedHitChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitChain.h"
 
-class TFCSLateralShapeParametrizationFixedHitChain
+class FASTCALOSIM_EXPORT TFCSLateralShapeParametrizationFixedHitChain
     : public TFCSLateralShapeParametrizationHitChain
 {
 public:
@@ -3,9 +3,11 @@
 #ifndef TFCSLateralShapeParametrizationHitBase_h
 #define TFCSLateralShapeParametrizationHitBase_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSLateralShapeParametrization.h"
 
-class TFCSLateralShapeParametrizationHitBase
+class FASTCALOSIM_EXPORT TFCSLateralShapeParametrizationHitBase
     : public TFCSLateralShapeParametrization
 {
 public:
@@ -45,6 +47,7 @@ public:
         , m_z(0.)
         , m_E(0.)
         , m_useXYZ(false)
+        , m_deposited(false)
         , m_center_r(0.)
         , m_center_z(0.)
         , m_center_eta(0.)
@@ -55,6 +58,7 @@ public:
         , m_phi_y(phi)
         , m_E(E)
         , m_useXYZ(false)
+        , m_deposited(false)
         , m_center_r(0.)
         , m_center_z(0.)
         , m_center_eta(0.)
@@ -65,6 +69,7 @@ public:
         , m_z(z)
         , m_E(E)
         , m_useXYZ(true)
+        , m_deposited(false)
         , m_center_r(0.)
         , m_center_z(0.)
         , m_center_eta(0.)
@@ -102,6 +107,7 @@ public:
       m_z = 0.;
       m_E = 0.;
       m_useXYZ = false;
+      m_deposited = false;
     }
 
     inline const auto& eta() const { return m_eta_x; };
@@ -110,6 +116,9 @@ public:
     inline const auto& y() const { return m_phi_y; };
     inline const auto& E() const { return m_E; };
     inline const auto& z() const { return m_z; };
+    // The energy of the hit was already deposited into the cells by the
+    // step that simulated it, the cell mapping must not deposit it again
+    inline bool deposited() const { return m_deposited; };
     inline const auto r() const
     {
       if (m_useXYZ)
@@ -131,6 +140,10 @@ public:
     inline void set_phi_y(float phi_y) { m_phi_y = phi_y; }
     inline void set_z(float z) { m_z = z; }
     inline void set_E(float E) { m_E = E; }
+    inline void set_deposited(bool deposited = true)
+    {
+      m_deposited = deposited;
+    }
     inline void set_idx(long unsigned int hit_index)
     {
       m_hit_index = hit_index;
@@ -142,6 +155,7 @@ public:
     float m_z;
     float m_E;
     bool m_useXYZ;
+    bool m_deposited;
     // Variables used to store extrapolated position
     float m_center_r;
     float m_center_z;
@@ -3,12 +3,16 @@
 #ifndef TFCSLateralShapeParametrizationHitChain_h
 #define TFCSLateralShapeParametrizationHitChain_h
 
+#include <atomic>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSLateralShapeParametrization.h"
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 
 class CaloGeo;
 
-class TFCSLateralShapeParametrizationHitChain
+class FASTCALOSIM_EXPORT TFCSLateralShapeParametrizationHitChain
     : public TFCSLateralShapeParametrization
 {
 public:
@@ -78,6 +82,10 @@ public:
   static constexpr float s_max_sigma2_fluctuation =
       1000;  //! Do not persistify!
 
+  /// Number of simulate_hit() calls that returned FCSRetry
+  unsigned long long retry_count() const { return m_retry_count; };
+  void reset_retry_count() { m_retry_count = 0; };
+
   void Print(Option_t* option = "") const override;
 
 protected:
@@ -96,6 +104,9 @@ private:
   TFCSLateralShapeParametrizationHitBase* m_number_of_hits_simul;
   unsigned int m_ninit = 0;
 
+  mutable std::atomic<unsigned long long> m_retry_count {
+      0};  //! Do not persistify!
+
   ClassDefOverride(TFCSLateralShapeParametrizationHitChain,
                    2)  // TFCSLateralShapeParametrizationHitChain
 };
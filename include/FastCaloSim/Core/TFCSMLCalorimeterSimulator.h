@@ -3,16 +3,23 @@
 #ifndef TFCSMLCALORIMETERSIMULATOR_H
 #define TFCSMLCALORIMETERSIMULATOR_H
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/MLogging.h"
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
+#include "FastCaloSim/Core/TFCSONNXRuntime.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 
 // generic network class
 #include "FastCaloSim/Core/VNetworkBase.h"
 
-class TFCSMLCalorimeterSimulator : public ISF_FCS::MLogging
+class TFCSInferencePipeline;
+
+class FASTCALOSIM_EXPORT TFCSMLCalorimeterSimulator : public ISF_FCS::MLogging
 {
 public:
   TFCSMLCalorimeterSimulator();
@@ -29,16 +36,87 @@ public:
     std::vector<layer_t> event_data;
   } event_t;
 
-  bool loadSimulator(std::string filename);
+  // Load the network, optionally in reduced precision, see
+  // TFCSNetworkFactory::create
+  bool loadSimulator(std::string filename,
+                     TFCSONNXQuantization::Precision precision =
+                         TFCSONNXQuantization::kFP32);
+  // Use an already created network, e.g. from TFCSNetworkFactory, with
+  // weights of the given precision. Returns false if it lacks one of the
+  // input nodes
+  bool setNetwork(std::unique_ptr<VNetworkBase> network,
+                  TFCSONNXQuantization::Precision precision =
+                      TFCSONNXQuantization::kFP32);
 
   void Print() const;
 
-  VNetworkBase::NetworkOutputs predictVoxels(TFCSSimulationState& simulstate,
-                                             float eta,
-                                             float energy) const;
+  // Voxel energies in MeV, empty on error
+  std::vector<float> predictVoxels(TFCSSimulationState& simulstate,
+                                   float eta,
+                                   float energy) const;
   event_t getEvent(TFCSSimulationState& simulstate,
                    float eta,
                    float energy) const;
+
+  // Events for many particles at once. The network is evaluated in batches
+  // of at most max_batch_size() particles. The random numbers of each
+  // particle are drawn from its own simulation state in the same order as
+  // in getEvent, so each particle gets the same inputs as with getEvent
+  // if the states use separate random engines.
+  std::vector<event_t> getEvents(
+      const std::vector<TFCSSimulationState*>& simulstates,
+      const std::vector<float>& etas,
+      const std::vector<float>& energies) const;
+
+  // Maximal number of particles evaluated in one network call. An int8
+  // network scales its inputs by their range over the whole batch, it
+  // evaluates each particle on its own so that the result does not depend
+  // on the other particles
+  void set_max_batch_size(unsigned int max_batch_size)
+  {
+    m_max_batch_size = max_batch_size > 0 ? max_batch_size : 1;
+  };
+  unsigned int max_batch_size() const { return m_max_batch_size; };
+
+  // If larger than zero, getEvent calls from concurrent threads are
+  // collected for at most this many microseconds, or until max_batch_size
+  // particles are waiting, and then evaluated in one network call. Not
+  // used for int8 networks
+  void set_max_batch_latency(double microseconds)
+  {
+    m_max_batch_latency = microseconds;
+  };
+  double max_batch_latency() const { return m_max_batch_latency; };
+
+  // If larger than zero, events announced with submitEvent are evaluated
+  // in the background, with at most this many evaluations queued, see
+  // TFCSInferencePipeline. Must not be changed while events
+  // are submitted
+  void set_pipeline_depth(unsigned int depth);
+  unsigned int pipeline_depth() const;
+
+  // Start the evaluation of a particle that is simulated next. The noise
+  // is drawn from simulstate right away, in the same order as in
+  // getEvent, and the network runs in the background. The next
+  // getEvent call with the same simulstate, eta and energy returns the
+  // result. Returns false if pipelining is disabled or the request could
+  // not be queued, getEvent then evaluates the particle itself. The
+  // random numbers of a particle only stay the same as without
+  // pipelining if each simulstate in flight has its own random engine
+  bool submitEvent(TFCSSimulationState& simulstate,
+                   float eta,
+                   float energy) const;
+
+  // Recreate the onnxruntime session of the loaded network with other
+  // options. Returns false if no ONNX network is loaded
+  bool set_session_config(const TFCSONNXRuntime::SessionConfig& config);
+
+  // Replace the loaded network with its dynamically quantized int8
+  // variant, see TFCSONNXQuantization. Returns false if no ONNX network
+  // is loaded or it can't be converted
+  bool quantize_int8();
+  bool is_int8() const { return m_int8; };
+
   VNetworkBase::NetworkOutputs predictVoxels() const;
 
   void setInputShapes(std::vector<long unsigned int> layer_boundaries,
@@ -64,9 +142,81 @@ public:
   };
 
 private:
+  // Network inputs and output of one particle. The noise is only kept
+  // for requests that are evaluated by another thread, otherwise it is
+  // drawn straight into the network inputs
+  typedef struct
+  {
+    float eta;
+    float energy;
+    std::size_t n_rows;  // network rows, m_nEvents or 1 for retries
+    std::vector<float> z_shape;
+    std::vector<float> z_energy;
+    std::vector<float> voxels;
+  } request_t;
+
+  // Collects requests from concurrent getEvent calls, see
+  // set_max_batch_latency
+  struct BatchQueue_t;
+
+  // Request evaluated in the background, see submitEvent
+  struct PipelineJob_t;
+  // Submitted request of simulstate, nullptr if there is none. A request
+  // submitted for another eta or energy is an error, it is evaluated again
+  // with the noise that was drawn for it
+  std::shared_ptr<PipelineJob_t> collectJob(TFCSSimulationState& simulstate,
+                                            float eta,
+                                            float energy,
+                                            bool& ok) const;
+
+  // Position of the eta, energy, z_shape and z_energy input nodes
+  bool findInputNodes(std::vector<int>& node_index) const;
+
+  void prepareRequest(float eta, float energy, request_t& request) const;
+  // Prepare the request and store its noise in it
+  void sampleInputs(TFCSSimulationState& simulstate,
+                    float eta,
+                    float energy,
+                    request_t& request) const;
+  // Standard normal noise for n_rows network rows, generated in bulk
+  void sampleNoise(TFCSSimulationState& simulstate,
+                   std::size_t n_rows,
+                   float* z_shape,
+                   float* z_energy) const;
+  // Particles evaluated together, 1 for int8 networks
+  std::size_t batch_limit() const { return m_int8 ? 1 : m_max_batch_size; };
+  // Evaluate the network on the n_rows rows in the buffers of this thread
+  bool evaluate(std::size_t n_rows) const;
+  void distributeOutputs(request_t* const* requests,
+                         std::size_t n,
+                         std::size_t n_rows) const;
+  // Evaluate the network for n requests with stored noise in one call
+  bool runBatch(request_t* const* requests, std::size_t n) const;
+  // Draw the noise of n requests into the network inputs and evaluate
+  // them in one call
+  bool runSampled(TFCSSimulationState* const* simulstates,
+                  request_t* const* requests,
+                  std::size_t n) const;
+  // Queue the request and wait until it has been evaluated
+  bool runQueued(request_t& request) const;
+  // Resample the noise of the rows whose output contains NaN, at most 5
+  // times. All affected rows of the n requests are evaluated together.
+  // The outputs of a request are cleared if its retry fails
+  void retryNaN(TFCSSimulationState* const* simulstates,
+                request_t* const* requests,
+                std::size_t n) const;
+  event_t makeEvent(const std::vector<float>& voxels, float energy) const;
+
   std::unique_ptr<VNetworkBase> m_onnx_model = nullptr;
+  std::vector<int> m_inputNodeIndex;  //! Do not persistify
+  bool m_int8 = false;  //! Do not persistify
+
+  unsigned int m_max_batch_size = 64;  //! Do not persistify
+  double m_max_batch_latency = 0;  //! Do not persistify
+  std::unique_ptr<BatchQueue_t> m_batch_queue;  //! Do not persistify
+  std::unique_ptr<TFCSInferencePipeline> m_pipeline;  //! Do not persistify
 
-  int m_nEvents = 1;  // Currently no batching supported from ONNX handler
+  int m_nEvents = 1;  // Network rows per particle
 
   // Default shapes for the photon barrel-CFM
   // Should be set using setInputShapes for other models
@@ -21,9 +21,12 @@
 #include <string>
 #include <vector>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
 #include "FastCaloSim/Core/VNetworkBase.h"
 
-class TFCSNetworkFactory
+class FASTCALOSIM_EXPORT TFCSNetworkFactory
 {
 public:
   // Unspecified TFCSGANLWTNNHandler or TFCSSimpleLWTNNHandler, take a guess
@@ -72,6 +75,22 @@ public:
   static std::unique_ptr<VNetworkBase> create(std::string input,
                                               bool graph_form);
 
+  /**
+   * @brief Given a string, make a network with reduced precision.
+   *
+   * Same as create(input), but for onnx files the variant with the given
+   * precision is loaded if it exists next to the file, see
+   * TFCSONNXQuantization::variantPath. Without one, an int8 variant is
+   * made from the file when it is loaded, other precisions fall back to
+   * the file itself. lwtnn networks are always in single precision.
+   *
+   * @param input      Either a file path, or the content of a file.
+   * @param precision  Precision of the weights of an onnx network.
+   *
+   **/
+  static std::unique_ptr<VNetworkBase> create(
+      std::string input, TFCSONNXQuantization::Precision precision);
+
   /**
    * @brief Given a vector of chars (bytes), make a network.
    *
@@ -21,6 +21,9 @@
 // inherits from
 #include <iostream>
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/TFCSONNXRuntime.h"
 #include "FastCaloSim/Core/VNetworkBase.h"
 
 // ONNX Runtime include(s).
@@ -33,6 +36,12 @@
 // For storing the lambda function
 #include <functional>
 
+// For the per thread IO bindings
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
 /**
  * @brief A handler specific for an ONNX network
  *
@@ -40,7 +49,7 @@
  * such that it can be used interchangeably with other network
  * formats and libraries.
  **/
-class TFCSONNXHandler : public VNetworkBase
+class FASTCALOSIM_EXPORT TFCSONNXHandler : public VNetworkBase
 {
 public:
   // Don't lose the default constructor
@@ -96,6 +105,86 @@ public:
    **/
   NetworkOutputs compute(NetworkInputs const& inputs) const override;
 
+  /**
+   * @brief Function to pass typed values to the network.
+   *
+   * Each input view must have exactly as many values as the
+   * corresponding input node. If the output shapes are fixed, each
+   * thread runs the network through its own IO binding. For single
+   * precision networks the input views and the output vectors are
+   * bound directly, so no values are copied, and no memory is
+   * allocated once the output vectors have their size. Networks of
+   * other types convert through preallocated buffers.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param outputs  output parameter, the output of the network
+   * @see VNetworkBase::TensorInputs
+   * @see VNetworkBase::TensorOutputs
+   **/
+  void computeTensors(TensorInputs const& inputs,
+                      TensorOutputs& outputs) const override;
+
+  /**
+   * @brief Function to pass a batch of typed values to the network.
+   *
+   * If the first dimension of all input nodes is symbolic, the batch
+   * is passed through the network in a single run with that dimension
+   * set to n_batch. Otherwise each entry is run on its own.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param n_batch  number of entries in the batch
+   * @param outputs  output parameter, the output of the network
+   **/
+  void computeTensorsBatch(TensorInputs const& inputs,
+                           std::size_t n_batch,
+                           TensorOutputs& outputs) const override;
+
+  /**
+   * @brief Check if the network takes a dynamic batch dimension.
+   **/
+  bool hasDynamicBatch() const;
+
+  /**
+   * @brief Recreate the session with different options.
+   *
+   * Sessions are created with TFCSONNXRuntime::defaultSessionConfig().
+   * This replaces the options of this network only. Must not be called
+   * while another thread runs the network.
+   *
+   * @param config  options for the new session
+   **/
+  void setSessionConfig(const TFCSONNXRuntime::SessionConfig& config);
+
+  /**
+   * @brief Run the dynamically quantized int8 variant of the model.
+   *
+   * See TFCSONNXQuantization. The session is created from a quantized
+   * copy, the persisted model stays in single precision. Needs the model
+   * bytes, so must be called before the session is created if the bytes
+   * are released afterwards. Returns false, keeping the model, if it
+   * can't be converted. Must not be called while another thread runs the
+   * network.
+   **/
+  bool quantizeDynamicInt8();
+
+  /**
+   * @brief Options the current session was created with.
+   **/
+  const TFCSONNXRuntime::SessionConfig& getSessionConfig() const
+  {
+    return m_sessionConfig;
+  };
+
+  /**
+   * @brief List the names of the input nodes.
+   **/
+  std::vector<std::string> getInputNodes() const override;
+
+  /**
+   * @brief List the names of the output nodes.
+   **/
+  std::vector<std::string> getOutputNodes() const override;
+
   // Output to a ttree file
   using VNetworkBase::writeNetToTTree;
 
@@ -159,7 +248,8 @@ protected:
    * Will be called in the streamer or class constructor
    * after the inputs have been set (either automaically by the
    * streamer or by setupPersistedVariables in the constructor).
-   * Does not delete any resources used.
+   * The session itself is only created on first use, so networks
+   * that are never evaluated cost no more than their model bytes.
    *
    **/
   void setupNet() override;
@@ -197,7 +287,6 @@ private:
    **/
   void writeBytesToTTree(TTree& tree, const std::vector<char>& bytes);
 
-  // unique ptr deletes the object when it goes out of scope
   /**
    * @brief The network session itself
    *
@@ -205,20 +294,110 @@ private:
    * contains information about the network and can run inputs
    * through it.
    *
-   * Held as a unique pointer to prevent the need for manual
-   * memory management
+   * Shared with all networks with the same model and options,
+   * see TFCSONNXRuntime::session. Created on first use.
    **/
-  std::unique_ptr<Ort::Session> m_session;  //! Do not persistify
+  std::shared_ptr<Ort::Session> m_session;  //! Do not persistify
+  /**
+   * @brief true once m_session and the node information exist
+   **/
+  mutable std::atomic<bool> m_sessionReady {false};  //! Do not persistify
+  mutable std::mutex m_sessionMutex;  //! Do not persistify
+  /**
+   * @brief Options used to create the session
+   **/
+  TFCSONNXRuntime::SessionConfig m_sessionConfig =
+      TFCSONNXRuntime::defaultSessionConfig();  //! Do not persistify
+  /**
+   * @brief Unique id of the current session
+   *
+   * Never reused, so that per thread caches can not confuse
+   * a new session with a deleted one.
+   **/
+  std::uint64_t m_sessionId = 0;  //! Do not persistify
+  /**
+   * @brief Create sessions from the int8 variant of m_bytes
+   **/
+  bool m_quantizedInt8 = false;  //! Do not persistify
+
+  /**
+   * @brief Type independent base of IoBindingState
+   **/
+  struct IoBindingBase
+  {
+    virtual ~IoBindingBase() = default;
+  };
+  /**
+   * @brief IO binding with preallocated buffers for one thread
+   *
+   * Defined in the source file.
+   **/
+  template<typename Tin, typename Tout>
+  struct IoBindingState;
+  /**
+   * @brief IO bindings of all threads that used the current session
+   *
+   * Threads only keep weak references. A thread in the middle of a call
+   * holds its binding, and through it the session, until the call
+   * returns, so the bindings can be dropped when the session changes.
+   **/
+  mutable std::vector<std::shared_ptr<IoBindingBase>>
+      m_bindings;  //! Do not persistify
+  mutable std::mutex m_bindingMutex;  //! Do not persistify
+
+  /**
+   * @brief The IO binding of the calling thread
+   *
+   * Created on the first call of each thread with the current session.
+   **/
+  template<typename Tin, typename Tout>
+  std::shared_ptr<IoBindingState<Tin, Tout>> ioBinding() const;
+  /**
+   * @brief Binding of the own buffers for a batch of n_batch entries
+   *
+   * Buffers only grow. Each batch size is bound once, to views of the
+   * same buffers, and only bound again if the buffers had to grow.
+   **/
+  template<typename Tin, typename Tout>
+  Ort::IoBinding& prepareBinding(IoBindingState<Tin, Tout>& state,
+                                 size_t n_batch) const;
+  /**
+   * @brief Bind the caller's input values and output vectors
+   *
+   * The output vectors are resized to fit a batch of n_batch entries.
+   * Replaces the buffers bound by prepareBinding.
+   **/
+  void bindTensors(IoBindingState<float, float>& state,
+                   TensorInputs const& inputs,
+                   size_t n_batch,
+                   TensorOutputs& outputs) const;
   /**
    * @brief Using content of the proto (.onnx) file make a session.
    *
-   * The m_session variable is initialized from the m_bytes variable
-   * so that the net can be run.
-   * Requires that the m_bytes variable is retained while the net is
-   * used.
+   * The m_session variable is initialized from the m_bytes variable,
+   * quantized first if requested, so that the net can be run.
    *
    **/
   void readSerializedSession();
+  /**
+   * @brief Fill the node names, dimensions and compute functions
+   * from m_session.
+   **/
+  void readNodeInfo();
+  /**
+   * @brief Create the session and the node information.
+   *
+   * Afterwards the model bytes are released, unless
+   * TFCSONNXRuntime::releaseModelBytes is switched off.
+   **/
+  void initSession();
+  /**
+   * @brief Call initSession once, thread-safe.
+   *
+   * Everything filled by initSession is a cache of the persisted
+   * model, so this can be called from const methods.
+   **/
+  void ensureSession() const;
 
   /**
    * @brief names that index the input nodes
@@ -277,6 +456,20 @@ private:
    * @see TFCSONNXHandler::m_inputNodeNames
    **/
   std::vector<std::vector<int64_t>> m_inputNodeDims;  //! Do not persistify
+  /**
+   * @brief total elements in each named input node
+   *
+   * For internal use only, gives the total number of elements in
+   * the input nodes.
+   * @see TFCSONNXHandler::m_inputNodeDims
+   **/
+  std::vector<int64_t> m_inputNodeSize;  //! Do not persistify
+  /**
+   * @brief true if the first dimension of all input nodes is symbolic
+   *
+   * Such networks can evaluate a batch of inputs in one run.
+   **/
+  bool m_dynamicBatch = false;  //! Do not persistify
   /**
    * @brief dimension lengths in each named output node
    *
@@ -293,22 +486,60 @@ private:
    * @see TFCSONNXHandler::m_inputNodeDims
    **/
   std::vector<int64_t> m_outputNodeSize;  //! Do not persistify
+  /**
+   * @brief true if the output shapes are known before running
+   *
+   * Only the first dimension of an output may be symbolic, then it is
+   * taken as the batch dimension. Networks with such outputs use the
+   * preallocated IO bindings.
+   **/
+  bool m_fixedOutputShapes = false;  //! Do not persistify
+  /**
+   * @brief true if the first dimension of all output nodes is symbolic
+   **/
+  bool m_outputDynamicBatch = false;  //! Do not persistify
+
+  /**
+   * @brief Run the session on flat input buffers.
+   *
+   * One buffer per input node, each holding n_batch times the number
+   * of elements given by m_inputNodeSize. The buffers are not copied
+   * and must stay alive until the call returns.
+   **/
+  template<typename Tin>
+  std::vector<Ort::Value> runSession(std::vector<Tin*> const& inputs,
+                                     size_t n_batch = 1) const;
 
   /**
    * @brief Computation template with adjustable types for input.
    *
+   * Adapter from the string keyed NetworkInputs to runSession.
    * A lambda function will be used to make the correct type choice
    * for the session/net used as a member variable during setupNet.
    **/
   template<typename Tin, typename Tout>
-  NetworkOutputs computeTemplate(NetworkInputs const& input);
+  NetworkOutputs computeTemplate(NetworkInputs const& input) const;
+
+  /**
+   * @brief Typed computation template with adjustable types for input.
+   **/
+  template<typename Tin, typename Tout>
+  void computeTensorsTemplate(TensorInputs const& inputs,
+                              size_t n_batch,
+                              TensorOutputs& outputs) const;
 
   /**
    * @brief computeTemplate with apropreate types selected.
    **/
-  std::function<NetworkOutputs(NetworkInputs)>
+  std::function<NetworkOutputs(NetworkInputs const&)>
       m_computeLambda;  //! Do not persistify
 
+  /**
+   * @brief computeTensorsTemplate with apropreate types selected.
+   **/
+  std::function<void(TensorInputs const&, size_t, TensorOutputs&)>
+      m_computeTensorsLambda;  //! Do not persistify
+
   /**
    * @brief Specifies memory behavior for vectors in ONNX.
    **/
@@ -0,0 +1,129 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * Reduced precision variants of ONNX shower models.
+ *
+ * The dense layers of the shower networks dominate their evaluation time.
+ * With integer weights and activations they run several times faster on
+ * CPUs with int8 dot product instructions, at a small cost in accuracy.
+ *
+ * Two kinds of variants are supported:
+ *
+ *   int8   dynamic quantization. Every MatMul, and every Gemm without
+ *          transposed input, with a constant 2D weight is replaced by
+ *          DynamicQuantizeLinear, MatMulInteger and a rescaling of the
+ *          result. The weights are quantized symmetrically per output
+ *          column, activations per tensor while the network runs. This
+ *          is the same graph as onnxruntime's quantize_dynamic produces,
+ *          onnxruntime fuses it into its DynamicQuantizeMatMul kernel.
+ *          As the activation scale covers the whole batch, the outputs
+ *          of a row depend on the other rows. TFCSMLCalorimeterSimulator
+ *          evaluates int8 networks one particle at a time for that reason.
+ *          The conversion is done here, either offline with the
+ *          quantizeONNXModel executable or when a model is loaded.
+ *   fp16   half precision weights with single precision inputs and
+ *          outputs. Only used if a converted file is shipped alongside
+ *          the model, there is no converter in FastCaloSim.
+ *
+ * A variant of model.onnx is looked for as model.int8.onnx or
+ * model.fp16.onnx, see variantPath.
+ *
+ * Reduced precision changes the simulated showers, compare must show
+ * that the voxel energy distributions agree with the single precision
+ * model before a variant is used in production.
+ **/
+
+#ifndef TFCSONNXQUANTIZATION_H
+#define TFCSONNXQUANTIZATION_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+/**
+ * @brief Conversion and validation of reduced precision ONNX models.
+ **/
+class FASTCALOSIM_EXPORT TFCSONNXQuantization
+{
+public:
+  enum Precision
+  {
+    kFP32 = 0,
+    kFP16 = 1,
+    kInt8 = 2
+  };
+
+  /// Name of a precision, also the suffix of its variant files
+  static std::string name(Precision precision);
+  /// Precision from its name, false if the name is unknown
+  static bool parse(const std::string& name, Precision& precision);
+
+  /**
+   * @brief Path of the variant of an .onnx file with another precision.
+   *
+   * The path itself for kFP32 or if it does not end in .onnx.
+   **/
+  static std::string variantPath(const std::string& path, Precision precision);
+
+  /**
+   * @brief What quantizeDynamicInt8 changed.
+   **/
+  struct Report
+  {
+    unsigned int n_quantized = 0;  // converted MatMul and Gemm nodes
+    unsigned int n_skipped = 0;  // MatMul and Gemm nodes left as they were
+    std::size_t n_weights = 0;  // weights stored as int8
+  };
+
+  /**
+   * @brief Dynamically quantized copy of a serialised ONNX model.
+   *
+   * Nodes that can't be converted, because their weight is not a constant
+   * or they use Gemm options without an integer equivalent, are kept.
+   * Everything else in the model is copied unchanged. Returns an empty
+   * vector if the model can't be parsed or its opset is older than 11.
+   *
+   * @param model   content of an onnx file
+   * @param report  optional summary of the conversion
+   **/
+  static std::vector<char> quantizeDynamicInt8(const std::vector<char>& model,
+                                               Report* report = nullptr);
+
+  /**
+   * @brief Agreement of two samples of voxel energies.
+   *
+   * The samples hold one vector of voxel energies per event. Shifts are
+   * relative to the mean summed absolute voxel energy of the reference.
+   **/
+  struct Comparison
+  {
+    std::size_t n_events = 0;
+    /// Shift of the mean total energy
+    double total_mean_shift = 0;
+    /// Ratio of the RMS of the total energy, candidate over reference
+    double total_rms_ratio = 1;
+    /// Kolmogorov-Smirnov distance of the total energy distributions
+    double total_ks_distance = 0;
+    /// Largest shift of the mean energy of a single voxel
+    double max_voxel_mean_shift = 0;
+    /// Mean difference of paired events, summed over the voxels. Only
+    /// meaningful if both samples were made with the same random numbers
+    double mean_event_difference = 0;
+
+    /// Check that all shifts and distances are below tolerance
+    bool agrees(double tolerance) const;
+  };
+
+  /**
+   * @brief Compare the voxel energies of two models.
+   *
+   * Both samples must have the same number of events and voxels,
+   * otherwise the returned comparison has no events.
+   **/
+  static Comparison compare(const std::vector<std::vector<float>>& reference,
+                            const std::vector<std::vector<float>>& candidate);
+};
+
+#endif  // TFCSONNXQUANTIZATION_H
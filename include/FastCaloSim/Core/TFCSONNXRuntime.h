@@ -0,0 +1,168 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+/**
+ * Process-wide onnxruntime context shared by all TFCSONNXHandler objects.
+ *
+ * Holds the single Ort::Env of the process and the default session
+ * options. Everything can be configured through the static setters or
+ * through environment variables, which are read once when the context
+ * is first used:
+ *
+ *   FCS_ONNX_INTRA_OP_THREADS         threads per session for one operator
+ *   FCS_ONNX_INTER_OP_THREADS         threads per session across operators
+ *   FCS_ONNX_GLOBAL_INTRA_OP_THREADS  size of the shared intra-op pool,
+ *                                     > 0 makes all sessions use the
+ *                                     global pools instead of their own
+ *   FCS_ONNX_GLOBAL_INTER_OP_THREADS  size of the shared inter-op pool
+ *   FCS_ONNX_OPT_LEVEL                graph optimization level,
+ *                                     0, 1, 2 or 99 (all)
+ *   FCS_ONNX_MEM_ARENA                0 disables the CPU memory arena
+ *   FCS_ONNX_MEM_PATTERN              0 disables memory pattern planning
+ *   FCS_ONNX_PARALLEL_EXECUTION       1 runs independent nodes in parallel
+ *   FCS_ONNX_ALLOW_SPINNING           1 lets idle pool threads spin
+ *   FCS_ONNX_DETERMINISTIC            1 requests deterministic kernels
+ *   FCS_ONNX_KEEP_MODEL_BYTES         1 keeps the serialized model in
+ *                                     memory after the session exists
+ *
+ * Sessions are shared: networks with identical model content, compared
+ * by SHA-256 digest, and identical options use the same Ort::Session,
+ * which is deleted with the last network using it.
+ *
+ * The defaults (one thread, no spinning) keep onnxruntime from competing
+ * with the caller's own worker threads, e.g. the TBB workers used for
+ * the transport. With many worker threads each running small networks
+ * this is also the fastest configuration. Larger thread counts only
+ * pay off if few threads run large networks.
+ **/
+
+#ifndef TFCSONNXRUNTIME_H
+#define TFCSONNXRUNTIME_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+namespace Ort
+{
+struct Env;
+struct Session;
+struct SessionOptions;
+}  // namespace Ort
+
+/**
+ * @brief Shared onnxruntime environment and session configuration.
+ **/
+class FASTCALOSIM_EXPORT TFCSONNXRuntime
+{
+public:
+  /**
+   * @brief Options used to create one onnxruntime session.
+   **/
+  struct SessionConfig
+  {
+    /// Threads used inside one operator, ignored with the global pools
+    int intra_op_threads = 1;
+    /// Threads used to run operators in parallel, ignored with the global
+    /// pools and for sequential execution
+    int inter_op_threads = 1;
+    /// 0 disabled, 1 basic, 2 extended, 99 all optimizations
+    int graph_optimization_level = 99;
+    bool cpu_mem_arena = true;
+    bool mem_pattern = true;
+    bool parallel_execution = false;
+    /// Let idle threads of the session pools spin. Lowers the latency,
+    /// but wastes CPU time that other threads of the process could use
+    bool allow_spinning = false;
+    /// Request deterministic kernels, needs onnxruntime 1.17 or newer
+    bool deterministic = false;
+    /// Use the process-wide thread pools, only possible if they have
+    /// been configured before the environment was created
+    bool use_global_threads = false;
+  };
+
+  /**
+   * @brief Set the sizes of the process-wide thread pools.
+   *
+   * Has to be called before the first network is created, as the pools
+   * belong to the environment. A size of 0 or less disables the global
+   * pools. Returns false if the environment already exists.
+   **/
+  static bool setGlobalThreads(int intra_op_threads, int inter_op_threads);
+
+  /**
+   * @brief Check if the environment was created with global pools.
+   **/
+  static bool hasGlobalThreads();
+
+  /**
+   * @brief Set the options for sessions created from now on.
+   **/
+  static void setDefaultSessionConfig(const SessionConfig& config);
+
+  /**
+   * @brief Options for newly created sessions.
+   *
+   * Initially taken from the environment variables.
+   **/
+  static SessionConfig defaultSessionConfig();
+
+  /**
+   * @brief The environment shared by all sessions of the process.
+   *
+   * Created on first use and never destroyed, so that sessions
+   * deleted during static destruction still find it.
+   **/
+  static Ort::Env& env();
+
+  /**
+   * @brief Translate a configuration into onnxruntime session options.
+   **/
+  static void applyConfig(const SessionConfig& config,
+                          Ort::SessionOptions& options);
+
+  /**
+   * @brief Session for a serialized model, shared with all other
+   * callers asking for the same content and options.
+   *
+   * Creates the session if no live one exists. Thread-safe.
+   **/
+  static std::shared_ptr<Ort::Session> session(const std::vector<char>& bytes,
+                                               const SessionConfig& config);
+
+  /**
+   * @brief Number of sessions currently alive in the registry.
+   **/
+  static std::size_t nSessions();
+
+  /**
+   * @brief Whether networks drop their serialized model once the
+   * session exists.
+   *
+   * On by default. Networks without their model can not be written
+   * to file anymore, so workflows that evaluate networks before
+   * writing them must switch this off.
+   **/
+  static void setReleaseModelBytes(bool release);
+  static bool releaseModelBytes();
+
+private:
+  TFCSONNXRuntime();
+  static TFCSONNXRuntime& instance();
+
+  std::mutex m_mutex;
+  Ort::Env* m_env = nullptr;
+  int m_globalIntraOpThreads = 0;
+  int m_globalInterOpThreads = 0;
+  SessionConfig m_defaultConfig;
+  bool m_releaseModelBytes = true;
+
+  /// Live sessions by content hash, model size and options
+  std::mutex m_registryMutex;
+  std::map<std::string, std::weak_ptr<Ort::Session>> m_sessions;
+};
+
+#endif  // TFCSONNXRUNTIME_H
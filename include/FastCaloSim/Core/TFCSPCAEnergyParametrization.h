@@ -3,6 +3,8 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSPCAEnergyParametrization_h
 #define ISF_FASTCALOSIMEVENT_TFCSPCAEnergyParametrization_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/IntArray.h"
 #include "FastCaloSim/Core/TFCS1DFunction.h"
 #include "FastCaloSim/Core/TFCSEnergyParametrization.h"
@@ -13,7 +15,8 @@
 
 class TH1;
 
-class TFCSPCAEnergyParametrization : public TFCSEnergyParametrization
+class FASTCALOSIM_EXPORT TFCSPCAEnergyParametrization
+    : public TFCSEnergyParametrization
 {
 public:
   enum FCSReturnCodePCA
@@ -38,6 +41,15 @@ public:
       const TFCSTruthState* truth,
       const TFCSExtrapolationState* extrapol) const override;
 
+  /// Simulate several particles at once. The Gaussian vectors of all
+  /// particles in the same PCA bin are transformed with one matrix-matrix
+  /// product. status[i] is set to what simulate() would return for states[i].
+  /// The random numbers are drawn in the same order per state as in
+  /// simulate(), so results are identical as long as the states do not share
+  /// one random engine
+  void simulate_batch(const std::vector<TFCSSimulationState*>& states,
+                      std::vector<FCSReturnCode>& status) const;
+
   int n_pcabins() const { return m_numberpcabins; };
   virtual int n_bins() const override { return m_numberpcabins; };
   const std::vector<int>& get_layers() const { return m_RelevantLayers; };
@@ -49,6 +61,12 @@ public:
 
   static void P2X(
       TVectorD*, TVectorD*, TMatrixD*, int, const double*, double*, int);
+  /// Same as P2X() for nvectors consecutive input vectors p of PCA bin pcabin,
+  /// using the cached transformation matrix
+  void P2X_batch(int pcabin, const double* p, double* x, int nvectors) const;
+  /// Cache the PCA back-transformation matrices in contiguous storage. Called
+  /// by loadInputs() and when reading from file
+  void prepare_P2X();
   bool loadInputs(TFile* file);
   bool loadInputs(TFile* file, const std::string&);
 
@@ -74,6 +92,26 @@ protected:
   CaloGeo* m_geo;  //! do not persistify
 
 private:
+  /// Draw the Gaussian input vector of the PCA for one particle
+  void draw_gauss(TFCSSimulationState& simulstate,
+                  int pcabin,
+                  double* input_data) const;
+  /// Everything after the PCA back-transformation: inverse cumulative
+  /// distributions, rescaling, hit-and-miss reweighting and filling of the
+  /// layer energies
+  FCSReturnCode fill_energies(TFCSSimulationState& simulstate,
+                              int pcabin,
+                              const double* output_data,
+                              double* simdata) const;
+  void set_empty(TFCSSimulationState& simulstate) const;
+  /// Check once after loading that the cumulative distributions of every
+  /// PCA bin were read completely, see TFCSFunction::is_valid()
+  void check_cumulative();
+  bool is_valid_pcabin(int pcabin) const
+  {
+    return pcabin > (int)m_pcabin_valid.size() || m_pcabin_valid[pcabin - 1];
+  };
+
   std::vector<int> m_RelevantLayers;
 
   std::vector<TMatrixD*> m_EV;
@@ -89,6 +127,13 @@ private:
 
   float m_total_energy_normalization {1};
 
+  /// Per PCA bin the row-major matrix SigmaValues(i)*EV(i,j)
+  std::vector<std::vector<double>> m_P2X_matrix;  //! Do not persistify!
+  /// Index into m_RelevantLayers for each calo sample, -1 if not relevant
+  std::vector<int> m_layer_index;  //! Do not persistify!
+  /// Per PCA bin false if a cumulative distribution could not be read
+  std::vector<bool> m_pcabin_valid;  //! Do not persistify!
+
   ClassDefOverride(TFCSPCAEnergyParametrization,
                    3)  // TFCSPCAEnergyParametrization
 };
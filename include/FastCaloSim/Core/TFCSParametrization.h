@@ -6,9 +6,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrization_h
 #  define ISF_FASTCALOSIMEVENT_TFCSParametrization_h
 
+#  include <FastCaloSim/FastCaloSim_export.h>
+
 #  include "FastCaloSim/Core/TFCSParametrizationBase.h"
 
-class TFCSParametrization : public ::TFCSParametrizationBase
+class FASTCALOSIM_EXPORT TFCSParametrization
+    : public ::TFCSParametrizationBase
 {
 public:
   TFCSParametrization(const char* name = nullptr, const char* title = nullptr);
@@ -3,9 +3,11 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationAbsEtaSelectChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationAbsEtaSelectChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationEtaSelectChain.h"
 
-class TFCSParametrizationAbsEtaSelectChain
+class FASTCALOSIM_EXPORT TFCSParametrizationAbsEtaSelectChain
     : public TFCSParametrizationEtaSelectChain
 {
 public:
@@ -3,9 +3,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationBinnedChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationBinnedChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationChain.h"
 
-class TFCSParametrizationBinnedChain : public TFCSParametrizationChain
+class FASTCALOSIM_EXPORT TFCSParametrizationBinnedChain
+    : public TFCSParametrizationChain
 {
 public:
   TFCSParametrizationBinnedChain(const char* name = nullptr,
@@ -24,6 +27,8 @@ public:
   {
     return m_bin_start.size() - 1;
   };
+  /// Index of the first chain entry per bin, see m_bin_start
+  const std::vector<unsigned int>& bin_start() const { return m_bin_start; };
 
   /// this method should determine in derived classes which bin to simulate, so
   /// that the simulate method can call the appropriate TFCSParametrizationBase
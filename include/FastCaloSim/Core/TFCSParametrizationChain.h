@@ -3,9 +3,15 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationChain_h
 
+#include <atomic>
+#include <cstdint>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrization.h"
+#include "FastCaloSim/Core/TFCSSimulationState.h"
 
-class TFCSParametrizationChain : public TFCSParametrization
+class FASTCALOSIM_EXPORT TFCSParametrizationChain : public TFCSParametrization
 {
 public:
   TFCSParametrizationChain(const char* name = nullptr,
@@ -26,7 +32,11 @@ public:
                   ///< of all objects in the chain use >1GB of memory, which
                   ///< can't be handled by TBuffer. Drawback is that identical
                   ///< objects will get stored as multiple instances
-    kRetryChainFromStart = BIT(17)
+    kRetryChainFromStart = BIT(17),
+    kRollbackOnRetry =
+        BIT(19)  ///< Set this bit in the TObject bit field if all changes of
+                 ///< the TFCSSimulationState done by a failed attempt should
+                 ///< be rolled back before a retry
   };
 
   bool SplitChainObjects() const { return TestBit(kSplitChainObjects); };
@@ -34,8 +44,44 @@ public:
   void reset_SplitChainObjects() { ResetBit(kSplitChainObjects); };
 
   bool RetryChainFromStart() const { return TestBit(kRetryChainFromStart); };
-  void set_RetryChainFromStart() { SetBit(kRetryChainFromStart); };
-  void reset_RetryChainFromStart() { ResetBit(kRetryChainFromStart); };
+  void set_RetryChainFromStart()
+  {
+    SetBit(kRetryChainFromStart);
+    invalidate_dispatch();
+  };
+  void reset_RetryChainFromStart()
+  {
+    ResetBit(kRetryChainFromStart);
+    invalidate_dispatch();
+  };
+
+  bool RollbackOnRetry() const { return TestBit(kRollbackOnRetry); };
+  void set_RollbackOnRetry()
+  {
+    SetBit(kRollbackOnRetry);
+    invalidate_dispatch();
+  };
+  void reset_RollbackOnRetry()
+  {
+    ResetBit(kRollbackOnRetry);
+    invalidate_dispatch();
+  };
+
+  /// Mark dispatch tables that contain this chain as outdated. Called by all
+  /// mutators of the chain, call it by hand after changing the pdgid,
+  /// Ekin_nominal or kMatchAllPDGID bit of an object in the chain
+  void invalidate_dispatch()
+  {
+    m_dispatch_generation.fetch_add(1, std::memory_order_relaxed);
+  };
+  std::uint64_t dispatch_generation() const
+  {
+    return m_dispatch_generation.load(std::memory_order_relaxed);
+  };
+
+  /// Number of FCSRetry return codes this chain received from its daughters
+  unsigned long long retry_count() const { return m_retry_count; };
+  void reset_retry_count() { m_retry_count = 0; };
 
   typedef std::vector<TFCSParametrizationBase*> Chain_t;
   virtual unsigned int size() const override { return m_chain.size(); };
@@ -52,12 +98,19 @@ public:
                             TFCSParametrizationBase* param) override
   {
     m_chain.at(ind) = param;
+    invalidate_dispatch();
   };
   const Chain_t& chain() const { return m_chain; };
-  Chain_t& chain() { return m_chain; };
+  /// Non-const access counts as a change of the chain
+  Chain_t& chain()
+  {
+    invalidate_dispatch();
+    return m_chain;
+  };
   void push_back(const Chain_t::value_type& param)
   {
     m_chain.push_back(param);
+    invalidate_dispatch();
     recalc();
   };
 
@@ -95,8 +148,16 @@ protected:
       TFCSSimulationState& simulstate,
       const TFCSTruthState* truth,
       const TFCSExtrapolationState* extrapol) const;
+  /// With a dispatch table, the PDGID select chain runs the retries of the
+  /// flattened select chains below it for them
+  friend class TFCSParametrizationPDGIDSelectChain;
+
+  mutable std::atomic<unsigned long long> m_retry_count {
+      0};  //! Do not persistify!
 
 private:
+  std::atomic<std::uint64_t> m_dispatch_generation {
+      0};  //! Do not persistify!
   Chain_t m_chain;
 
   // Ensure all objects to be written by the streamer live long enough.
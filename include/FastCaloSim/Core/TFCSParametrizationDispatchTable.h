@@ -0,0 +1,133 @@
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationDispatchTable_h
+#define ISF_FASTCALOSIMEVENT_TFCSParametrizationDispatchTable_h
+
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+class TFCSParametrizationBase;
+class TFCSParametrizationChain;
+class TFCSParametrizationPDGIDSelectChain;
+class TFCSSimulationState;
+class TFCSTruthState;
+class TFCSExtrapolationState;
+
+/** Precompiled lookup for PDGID -> Ekin -> eta selection trees
+The table is built from a TFCSParametrizationPDGIDSelectChain and flattens all
+nested TFCSParametrizationEkinSelectChain, TFCSParametrizationEtaSelectChain
+and TFCSParametrizationAbsEtaSelectChain objects into one node array. For a
+particle, find() walks the nodes without virtual calls and returns the first
+object that is not a flattened select chain. Bins are found with a direct
+index if the bin edges are uniform in the value (eta) or in log(value) (Ekin),
+otherwise with a binary search. The result is always identical to the
+TFCSParametrizationFloatSelectChain::val_to_bin() result.
+
+A select chain is only flattened if it runs exactly one object per bin (or
+none) and nothing before or after the bins, and if neither
+RetryChainFromStart() nor RollbackOnRetry() is set. Otherwise it is returned as
+is and simulated normally. find() also returns the flattened select chain the
+object belongs to, its retries are done and counted for this chain. Particles
+outside the binning of a node also get the node itself returned, so that the
+usual warnings are printed. Random numbers for the Ekin interpolation are drawn
+in the same order as TFCSParametrizationEkinSelectChain::get_bin() does, so
+that results are reproducible with and without the table.
+
+The table remembers the dispatch generation of the PDGID select chain it was
+built for and of every select chain below it. All mutators of a
+TFCSParametrizationChain, including the non-const chain() accessor and the
+retry bit setters, call invalidate_dispatch() on that chain. If the owning
+chain changed, the table is rebuilt before its next use. If a select chain
+below it changed, find() returns that chain to be simulated as is and the
+table is rebuilt afterwards. Changes of pdgid, Ekin_nominal or the
+kMatchAllPDGID bit of an object inside a chain are not seen by the chain, call
+invalidate_dispatch() on the chain holding the object by hand after such
+changes.
+*/
+
+class FASTCALOSIM_EXPORT TFCSParametrizationDispatchTable
+{
+public:
+  TFCSParametrizationDispatchTable(
+      const TFCSParametrizationPDGIDSelectChain& chain);
+
+  /// False if the owning chain changed or find() met a changed select chain
+  bool is_current() const;
+
+  /// Indices of the top level nodes to run for a pdgid, in chain order
+  const std::vector<int>& nodes_for_pdgid(int pdgid) const;
+
+  /// Walk down from a top level node. Returns the object to simulate, or
+  /// nullptr if the selected bin is empty and nothing should be simulated.
+  /// parent is set to the flattened select chain holding the object, or to
+  /// nullptr if the object is the top level node itself
+  TFCSParametrizationBase* find(int node,
+                                TFCSSimulationState& simulstate,
+                                const TFCSTruthState* truth,
+                                const TFCSExtrapolationState* extrapol,
+                                const TFCSParametrizationChain*& parent) const;
+
+  unsigned int n_nodes() const { return m_nodes.size(); };
+  /// Number of flattened select chains using a direct bin index
+  unsigned int n_direct_indexed() const;
+
+private:
+  enum Variable_t
+  {
+    kLeaf,
+    kEkin,
+    kEta,
+    kAbsEta
+  };
+  enum Lookup_t
+  {
+    kSearch,
+    kLinear,
+    kLog
+  };
+
+  struct Node_t
+  {
+    TFCSParametrizationBase* param = nullptr;
+    /// Select chain and its dispatch generation when the table was built,
+    /// nullptr for objects that are not select chains
+    const TFCSParametrizationChain* chain = nullptr;
+    std::uint64_t generation = 0;
+    Variable_t variable = kLeaf;
+    Lookup_t lookup = kSearch;
+    std::vector<float> edges;
+    double offset = 0;
+    double scale = 0;
+    /// node index per bin, -1 for an empty bin
+    std::vector<int> target;
+
+    /// Ekin interpolation: nominal Ekin of the first object per bin
+    bool random_interpolation = false;
+    std::vector<char> has_nominal;
+    std::vector<double> Ekin_nominal;
+    std::vector<float> log_Ekin_nominal;
+  };
+
+  int add_node(TFCSParametrizationBase* param);
+  void set_lookup(Node_t& node) const;
+  int val_to_bin(const Node_t& node, float val) const;
+  int interpolate_Ekin(const Node_t& node,
+                       int bin,
+                       float Ekin,
+                       float rnd) const;
+
+  std::vector<Node_t> m_nodes;
+  std::unordered_map<const TFCSParametrizationBase*, int> m_node_index;
+  std::unordered_map<int, std::vector<int>> m_pdgid_nodes;
+  /// Top level nodes valid for all pdgids, used for pdgids not in the map
+  std::vector<int> m_all_pdgid_nodes;
+  const TFCSParametrizationPDGIDSelectChain* m_owner;
+  std::uint64_t m_generation;
+  mutable std::atomic<bool> m_stale {false};
+};
+
+#endif
@@ -3,10 +3,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationEkinSelectChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationEkinSelectChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationFloatSelectChain.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 
-class TFCSParametrizationEkinSelectChain
+class FASTCALOSIM_EXPORT TFCSParametrizationEkinSelectChain
     : public TFCSParametrizationFloatSelectChain
 {
 public:
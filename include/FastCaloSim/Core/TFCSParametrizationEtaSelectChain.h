@@ -3,9 +3,11 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationEtaSelectChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationEtaSelectChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationFloatSelectChain.h"
 
-class TFCSParametrizationEtaSelectChain
+class FASTCALOSIM_EXPORT TFCSParametrizationEtaSelectChain
     : public TFCSParametrizationFloatSelectChain
 {
 public:
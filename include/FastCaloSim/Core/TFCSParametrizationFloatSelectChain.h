@@ -3,9 +3,11 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationFloatSelectChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationFloatSelectChain_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationBinnedChain.h"
 
-class TFCSParametrizationFloatSelectChain
+class FASTCALOSIM_EXPORT TFCSParametrizationFloatSelectChain
     : public TFCSParametrizationBinnedChain
 {
 public:
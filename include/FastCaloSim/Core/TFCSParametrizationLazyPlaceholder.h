@@ -0,0 +1,114 @@
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationLazyPlaceholder_h
+#define ISF_FASTCALOSIMEVENT_TFCSParametrizationLazyPlaceholder_h
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/TFCSParametrizationPlaceholder.h"
+
+class TDirectory;
+
+/** Placeholder that reads the real parametrization on first use
+If lazy loading is enabled through set_LazyLoading(), the streamer of
+TFCSParametrizationChain replaces every TFCSParametrizationPlaceholder of a
+chain written with SplitChainObjects() by an instance of this class instead of
+reading the real object immediately. Only the directory and the key name are
+kept; the subtree is streamed in on the first call of simulate() (or an
+explicit resolve()). Loading is thread-safe and done exactly once per
+placeholder, unless the object is evicted again.
+
+With a memory budget set through set_MemoryBudget(), the least recently used
+loaded subtrees (typically cold eta slices) are deleted again once the sum of
+the uncompressed key sizes exceeds the budget. Objects still used by a running
+simulate() call are only deleted after that call returned.
+
+The directory the parametrization was read from must stay open as long as
+lazily loaded objects are in use. A tree containing instances of this class
+can not be written out again, call resolve() on all placeholders or disable
+lazy loading before reading a file that should be modified.
+*/
+
+class FASTCALOSIM_EXPORT TFCSParametrizationLazyPlaceholder
+    : public TFCSParametrizationPlaceholder
+{
+public:
+  TFCSParametrizationLazyPlaceholder(const char* name = nullptr,
+                                     const char* title = nullptr)
+      : TFCSParametrizationPlaceholder(name, title) {};
+  TFCSParametrizationLazyPlaceholder(const TFCSParametrizationPlaceholder& ref,
+                                     TDirectory* dir);
+  virtual ~TFCSParametrizationLazyPlaceholder();
+
+  /// Global switch to enable lazy loading while reading parametrization files
+  static void set_LazyLoading(bool lazy = true);
+  static bool LazyLoading();
+
+  /// Memory budget in bytes for all lazily loaded objects, 0 means no limit
+  static void set_MemoryBudget(std::size_t bytes);
+  static std::size_t MemoryBudget();
+  /// Sum of the uncompressed key sizes of all currently loaded objects
+  static std::size_t MemoryUsed();
+
+  virtual bool is_match_pdgid(int id) const override;
+  virtual bool is_match_Ekin(float Ekin) const override;
+  virtual bool is_match_eta(float eta) const override;
+  virtual bool is_match_all_pdgid() const override;
+  virtual bool is_match_all_Ekin() const override;
+  virtual bool is_match_all_eta() const override;
+
+  virtual const std::set<int>& pdgid() const override;
+  virtual double Ekin_nominal() const override;
+  virtual double Ekin_min() const override;
+  virtual double Ekin_max() const override;
+  virtual double eta_nominal() const override;
+  virtual double eta_min() const override;
+  virtual double eta_max() const override;
+
+  virtual void set_geometry(CaloGeo* geo) override;
+  using TFCSParametrizationBase::setLevel;
+  virtual void setLevel(int level, bool recursive) override;
+
+  virtual FCSReturnCode simulate(
+      TFCSSimulationState& simulstate,
+      const TFCSTruthState* truth,
+      const TFCSExtrapolationState* extrapol) const override;
+
+  /// Return the real parametrization, reading it from the file if needed.
+  /// Returns nullptr if the object could not be read
+  std::shared_ptr<TFCSParametrizationBase> resolve() const;
+  bool is_loaded() const { return std::atomic_load(&m_param) != nullptr; };
+  /// Delete the real parametrization, it is read again on the next use
+  void evict() const;
+
+  void Print(Option_t* option = "") const override;
+
+private:
+  /// Read the object from m_dir, bytes is set to the uncompressed key size
+  std::shared_ptr<TFCSParametrizationBase> load(std::size_t& bytes) const;
+  /// Files written before the placeholder stored the pdgid, Ekin and eta
+  /// range need the real object to answer selection queries
+  void ensure_match_info() const;
+
+  TDirectory* m_dir = nullptr;  //! Do not persistify!
+  CaloGeo* m_geo = nullptr;  //! Do not persistify!
+  bool m_level_recursive = false;  //! Do not persistify!
+
+  mutable std::once_flag m_match_once;  //! Do not persistify!
+  mutable std::mutex m_load_mutex;  //! Do not persistify!
+  mutable std::shared_ptr<TFCSParametrizationBase>
+      m_param;  //! Do not persistify!
+  mutable std::atomic<std::uint64_t> m_last_used {0};  //! Do not persistify!
+
+  friend class TFCSLazyLoadRegistry;
+
+  ClassDefOverride(TFCSParametrizationLazyPlaceholder,
+                   1)  // TFCSParametrizationLazyPlaceholder
+};
+
+#endif
@@ -3,9 +3,16 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationPDGIDSelectChain_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationPDGIDSelectChain_h
 
+#include <memory>
+#include <mutex>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationChain.h"
+#include "FastCaloSim/Core/TFCSParametrizationDispatchTable.h"
 
-class TFCSParametrizationPDGIDSelectChain : public TFCSParametrizationChain
+class FASTCALOSIM_EXPORT TFCSParametrizationPDGIDSelectChain
+    : public TFCSParametrizationChain
 {
 public:
   TFCSParametrizationPDGIDSelectChain(const char* name = nullptr,
@@ -25,14 +32,27 @@ public:
   enum FCSPDGIDStatusBits
   {
     kSimulateOnlyOnePDGID = BIT(
-        15)  ///< Set this bit in the TObject bit field if the PDGID selection
-             ///< loop should be aborted after the first successful match
+        15),  ///< Set this bit in the TObject bit field if the PDGID selection
+              ///< loop should be aborted after the first successful match
+    kUseDispatchTable =
+        BIT(18)  ///< Set this bit in the TObject bit field if the PDGID, Ekin
+                 ///< and eta selection below this chain should be done with a
+                 ///< precompiled TFCSParametrizationDispatchTable
   };
 
   bool SimulateOnlyOnePDGID() const { return TestBit(kSimulateOnlyOnePDGID); };
   void set_SimulateOnlyOnePDGID() { SetBit(kSimulateOnlyOnePDGID); };
   void reset_SimulateOnlyOnePDGID() { ResetBit(kSimulateOnlyOnePDGID); };
 
+  bool UseDispatchTable() const { return TestBit(kUseDispatchTable); };
+  void set_UseDispatchTable() { SetBit(kUseDispatchTable); };
+  void reset_UseDispatchTable() { ResetBit(kUseDispatchTable); };
+
+  /// Return the dispatch table, (re)building it if the tree changed since the
+  /// last call. Returns nullptr if the table can not be used for this chain
+  std::shared_ptr<const TFCSParametrizationDispatchTable> dispatch_table()
+      const;
+
   virtual FCSReturnCode simulate(
       TFCSSimulationState& simulstate,
       const TFCSTruthState* truth,
@@ -41,7 +61,17 @@ public:
 protected:
   virtual void recalc() override;
 
+  FCSReturnCode simulate_dispatch(
+      const TFCSParametrizationDispatchTable& table,
+      TFCSSimulationState& simulstate,
+      const TFCSTruthState* truth,
+      const TFCSExtrapolationState* extrapol) const;
+
 private:
+  mutable std::mutex m_dispatch_mutex;  //! Do not persistify!
+  mutable std::shared_ptr<const TFCSParametrizationDispatchTable>
+      m_dispatch;  //! Do not persistify!
+
   ClassDefOverride(TFCSParametrizationPDGIDSelectChain,
                    1)  // TFCSParametrizationPDGIDSelectChain
 };
@@ -3,9 +3,12 @@
 #ifndef ISF_FASTCALOSIMEVENT_TFCSParametrizationPlaceholder_h
 #define ISF_FASTCALOSIMEVENT_TFCSParametrizationPlaceholder_h
 
+#include <FastCaloSim/FastCaloSim_export.h>
+
 #include "FastCaloSim/Core/TFCSParametrizationBase.h"
 
-class TFCSParametrizationPlaceholder : public TFCSParametrizationBase
+class FASTCALOSIM_EXPORT TFCSParametrizationPlaceholder
+    : public TFCSParametrizationBase
 {
 public:
   TFCSParametrizationPlaceholder(const char* name = nullptr,
@@ -26,9 +29,25 @@ public:
       const TFCSTruthState* truth,
       const TFCSExtrapolationState* extrapol) const override;
 
+  /// Store the pdgid, Ekin and eta range of the object this placeholder
+  /// stands for, so that selection chains can be evaluated without reading
+  /// the real object from the file (see TFCSParametrizationLazyPlaceholder)
+  void set_match_info(const TFCSParametrizationBase& ref);
+  bool has_match_info() const { return m_has_match_info; };
+
+protected:
+  bool m_has_match_info = false;
+  std::set<int> m_match_pdgid;
+  double m_match_Ekin_nominal = init_Ekin_nominal;
+  double m_match_Ekin_min = init_Ekin_min;
+  double m_match_Ekin_max = init_Ekin_max;
+  double m_match_eta_nominal = init_eta_nominal;
+  double m_match_eta_min = init_eta_min;
+  double m_match_eta_max = init_eta_max;
+
 private:
   ClassDefOverride(TFCSParametrizationPlaceholder,
-                   1)  // TFCSParametrizationPlaceholder
+                   2)  // TFCSParametrizationPlaceholder
 };
 
 #endif
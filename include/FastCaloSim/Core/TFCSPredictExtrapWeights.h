@@ -13,6 +13,7 @@ namespace lwt
 {
 class LightweightNeuralNetwork;
 }
+class TFCSDenseNetwork;
 
 class TFCSPredictExtrapWeights : public TFCSLateralShapeParametrizationHitBase
 {
@@ -85,6 +86,8 @@ private:
   std::string* m_input = nullptr;
   std::vector<int>* m_relevantLayers = nullptr;
   lwt::LightweightNeuralNetwork* m_nn = nullptr;  //! Do not persistify
+  // m_nn precompiled for fast evaluation, used instead of m_nn if it exists
+  TFCSDenseNetwork* m_dense = nullptr;  //! Do not persistify
   std::vector<int>* m_normLayers =
       nullptr;  // vector of index layers (-1 corresponds to truth energy)
   std::vector<float>* m_normMeans =
@@ -0,0 +1,75 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#ifndef TFCSScratchSlots_h
+#define TFCSScratchSlots_h
+
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
+
+/** Typed scratch objects of a simulation state
+Parametrizations often need working memory for the particle that is simulated,
+like the hit counts of all voxels of a binned shower. Storing it as void*
+AuxInfo needs a new allocation for every particle and a cleanup that frees it
+again. A scratch slot instead holds an object of any default constructible
+type, which is created on first use and then lives as long as the state.
+Vectors in a slot keep their capacity when they are cleared, so after the
+first particles no memory is allocated anymore.
+
+Slots are identified by a _FCShash key. Asking for a slot with another type
+than it holds replaces the object by a new one of the requested type.
+Copies start without scratch objects, they are never shared between states.
+*/
+
+class TFCSScratchSlots
+{
+public:
+  TFCSScratchSlots() = default;
+  TFCSScratchSlots(const TFCSScratchSlots&) {}
+  TFCSScratchSlots& operator=(const TFCSScratchSlots&) { return *this; }
+
+  /// The object in the slot, default constructed on first use
+  template<class T>
+  T& get(std::uint32_t key)
+  {
+    std::unique_ptr<SlotBase_t>& slot = m_slots[key];
+    if (!slot || slot->type() != typeid(T))
+      slot.reset(new Slot_t<T>());
+    return static_cast<Slot_t<T>*>(slot.get())->value;
+  };
+
+  /// The object in the slot, nullptr if the slot is empty or holds
+  /// another type
+  template<class T>
+  T* find(std::uint32_t key) const
+  {
+    auto it = m_slots.find(key);
+    if (it == m_slots.end() || it->second->type() != typeid(T))
+      return nullptr;
+    return &static_cast<Slot_t<T>*>(it->second.get())->value;
+  };
+
+  std::size_t size() const { return m_slots.size(); };
+
+  /// Destroy all objects, which also releases their memory
+  void clear() { m_slots.clear(); };
+
+private:
+  struct SlotBase_t
+  {
+    virtual ~SlotBase_t() = default;
+    virtual const std::type_info& type() const = 0;
+  };
+
+  template<class T>
+  struct Slot_t final : SlotBase_t
+  {
+    T value {};
+    const std::type_info& type() const override { return typeid(T); };
+  };
+
+  std::unordered_map<std::uint32_t, std::unique_ptr<SlotBase_t>> m_slots;
+};
+
+#endif
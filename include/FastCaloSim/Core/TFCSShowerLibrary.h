@@ -0,0 +1,138 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#ifndef TFCSShowerLibrary_h
+#define TFCSShowerLibrary_h
+
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+#include "FastCaloSim/Core/TFCSParametrization.h"
+
+class CaloGeo;
+
+/** Precomputed cell-level showers
+Simulating the energies and hits of the many low energy photons and electrons
+costs a lot compared to their importance. A shower library instead stores the
+cell energies of a few full showers and deposits one of them for each
+particle, without any hits.
+
+The showers are binned in the pdgid, the kinetic energy, |eta| at the
+calorimeter boundary and the phi position of the particle within its impact
+cell in the reference layer. Each bin holds any number of showers, one of them
+is picked at random. The cells of a shower are stored relative to the impact
+cell of the particle in their layer, as offsets in units of the size of the
+impact cell in eta and phi. For particles with negative eta the eta offsets
+are mirrored. The cell energies are fractions of the particle energy and are
+scaled to the energy of the simulation state, e.g. set by TFCSInitWithEkin.
+Cells in layers that the particle was not extrapolated to are skipped, their
+energy is lost.
+
+The library is meant to be placed below an energy threshold in the Ekin and
+eta select chains, instead of the energy and lateral shape parametrizations.
+*/
+
+class FASTCALOSIM_EXPORT TFCSShowerLibrary : public TFCSParametrization
+{
+public:
+  /// One cell of a shower. The layer is stored in 8 bits and the offsets
+  /// in 16 bits, add_shower rejects showers with cells outside that range
+  struct ShowerCell_t
+  {
+    int layer;
+    // Offsets from the impact cell in units of its eta and phi size
+    int deta;
+    int dphi;
+    // Fraction of the particle energy
+    float E;
+  };
+
+  TFCSShowerLibrary(const char* name = nullptr,
+                    const char* title = nullptr,
+                    CaloGeo* geo = nullptr);
+
+  virtual void set_geometry(CaloGeo* geo) override { m_geo = geo; };
+  CaloGeo* get_geometry() { return m_geo; };
+
+  virtual bool is_match_Ekin_bin(int /*Ekin_bin*/) const override
+  {
+    return true;
+  };
+  virtual bool is_match_calosample(int /*calosample*/) const override
+  {
+    return true;
+  };
+
+  /// Defines the bins of the library and removes all showers. The pdgids are
+  /// also the ones the parametrization matches. Energies below the first or
+  /// above the last edge use the first or last energy bin, the same for eta
+  void set_binning(const std::vector<int>& pdgids,
+                   const std::vector<float>& Ekin_edges,
+                   const std::vector<float>& abs_eta_edges,
+                   unsigned int n_phi_bins);
+
+  /// The phi position within the impact cell is taken in this layer
+  void set_reference_layer(int layer) { m_reference_layer = layer; };
+  int get_reference_layer() const { return m_reference_layer; };
+
+  /// Adds a shower to a bin. Returns false if the bin does not exist or a
+  /// cell can't be stored, see ShowerCell_t
+  bool add_shower(int pdgid,
+                  unsigned int Ekin_bin,
+                  unsigned int eta_bin,
+                  unsigned int phi_bin,
+                  const std::vector<ShowerCell_t>& cells);
+
+  std::size_t n_showers() const
+  {
+    return m_shower_begin.empty() ? 0 : m_shower_begin.size() - 1;
+  };
+  std::size_t n_showers(int pdgid,
+                        unsigned int Ekin_bin,
+                        unsigned int eta_bin,
+                        unsigned int phi_bin) const;
+
+  /// Bin of a particle, -1 if its pdgid is not in the library
+  int get_bin(int pdgid, float Ekin, float abs_eta, float phi_in_cell) const;
+
+  virtual FCSReturnCode simulate(
+      TFCSSimulationState& simulstate,
+      const TFCSTruthState* truth,
+      const TFCSExtrapolationState* extrapol) const override;
+
+  virtual bool operator==(const TFCSParametrizationBase& ref) const override;
+
+  void Print(Option_t* option = "") const override;
+
+protected:
+  CaloGeo* m_geo;  //! do not persistify
+
+private:
+  // Index of a bin, -1 if it does not exist
+  int bin_index(int pdgid,
+                unsigned int Ekin_bin,
+                unsigned int eta_bin,
+                unsigned int phi_bin) const;
+
+  int m_reference_layer = 2;
+
+  // Bins, all particles are in bin
+  // ((pdgid_index * n_Ekin + Ekin_bin) * n_eta + eta_bin) * n_phi + phi_bin
+  std::vector<int> m_pdgids;
+  std::vector<float> m_Ekin_edges;
+  std::vector<float> m_abs_eta_edges;
+  unsigned int m_n_phi_bins = 1;
+  std::vector<std::vector<unsigned int>> m_bin_showers;
+
+  // Cells of all showers, the cells of shower i are
+  // [m_shower_begin[i], m_shower_begin[i+1])
+  std::vector<unsigned int> m_shower_begin;
+  std::vector<unsigned char> m_cell_layer;
+  std::vector<short> m_cell_deta;
+  std::vector<short> m_cell_dphi;
+  std::vector<float> m_cell_E;
+
+  ClassDefOverride(TFCSShowerLibrary, 1)  // TFCSShowerLibrary
+};
+
+#endif
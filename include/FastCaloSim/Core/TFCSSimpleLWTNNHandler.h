@@ -25,10 +25,12 @@
 
 #include <iostream>
 
+#include "FastCaloSim/Core/TFCSDenseNetwork.h"
 #include "FastCaloSim/Core/VNetworkLWTNN.h"
 
 // Because we have a field of type LightweightNeuralNetwork
 #include "lwtnn/LightweightNeuralNetwork.hh"
+#include "lwtnn/Stack.hh"
 
 // For writing to a tree
 #include "TTree.h"
@@ -75,6 +77,49 @@ public:
    **/
   NetworkOutputs compute(NetworkInputs const& inputs) const override;
 
+  /**
+   * @brief Function to pass typed values to the network.
+   *
+   * Takes exactly one input node, with the values in the order
+   * of the inputs in the json description. Gives one output node,
+   * with the values in the order of the outputs in the json.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param outputs  output parameter, the output of the network
+   * @see VNetworkBase::TensorInputs
+   * @see VNetworkBase::TensorOutputs
+   **/
+  void computeTensors(TensorInputs const& inputs,
+                      TensorOutputs& outputs) const override;
+
+  /**
+   * @brief Evaluate n_batch entries in one call.
+   *
+   * Uses the precompiled network if there is one, otherwise
+   * evaluates entry by entry.
+   *
+   * @see VNetworkBase::computeTensorsBatch
+   **/
+  void computeTensorsBatch(TensorInputs const& inputs,
+                           std::size_t n_batch,
+                           TensorOutputs& outputs) const override;
+
+  /**
+   * @brief List the names of the input nodes.
+   *
+   * A simple lwtnn network has one unnamed input node,
+   * it is called "node_0" here.
+   **/
+  std::vector<std::string> getInputNodes() const override;
+
+  /**
+   * @brief List the names of the output nodes.
+   *
+   * A simple lwtnn network has one unnamed output node,
+   * it is called "node_0" here.
+   **/
+  std::vector<std::string> getOutputNodes() const override;
+
   /**
    * @brief List the names of the outputs.
    *
@@ -101,6 +146,9 @@ private:
   // unique ptr deletes the object when it goes out of scope
   /**
    * @brief The network that we are wrapping here.
+   *
+   * This and m_lwtnn_stack are only built if m_dense does not exist
+   * or the validation is on, see TFCSDenseNetwork.
    **/
   std::unique_ptr<lwt::LightweightNeuralNetwork>
       m_lwtnn_neural;  //! Do not persistify
@@ -109,6 +157,39 @@ private:
    **/
   std::vector<std::string> m_outputLayers;  //! Do not persistify
 
+  /**
+   * @brief The layers of the network, used by computeTensors.
+   *
+   * Same layers as inside m_lwtnn_neural, which doesn't allow
+   * access to them.
+   **/
+  std::unique_ptr<lwt::Stack> m_lwtnn_stack;  //! Do not persistify
+  /**
+   * @brief Offset and scale applied to each input before m_lwtnn_stack.
+   **/
+  std::vector<double> m_inputOffsets;  //! Do not persistify
+  std::vector<double> m_inputScales;  //! Do not persistify
+
+  /**
+   * @brief The same network precompiled for fast evaluation.
+   *
+   * Used instead of lwtnn if it exists, see TFCSDenseNetwork
+   * for the supported networks.
+   **/
+  std::unique_ptr<TFCSDenseNetwork> m_dense;  //! Do not persistify
+
+  /**
+   * @brief Make m_lwtnn_neural and the members used by computeTensors.
+   **/
+  void buildNet(const lwt::JSONConfig& config);
+
+  /**
+   * @brief Evaluate with lwtnn, bypassing m_dense.
+   **/
+  NetworkOutputs computeLWTNN(NetworkInputs const& inputs) const;
+  void computeTensorsLWTNN(TensorInputs const& inputs,
+                           TensorOutputs& outputs) const;
+
   // Supplying a ClassDef for writing to file.
   ClassDefOverride(TFCSSimpleLWTNNHandler, 1);
 };
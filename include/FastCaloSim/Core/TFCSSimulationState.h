@@ -5,12 +5,15 @@
 
 #include <cstdint>
 #include <set>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <FastCaloSim/FastCaloSim_export.h>
 #include <TObject.h>
 
 #include "FastCaloSim/Core/MLogging.h"
+#include "FastCaloSim/Core/TFCSScratchSlots.h"
 class TFCSParametrizationBase;
 
 namespace CLHEP
@@ -40,15 +43,36 @@ public:
   double Efrac(int sample) const { return m_Efrac.at(sample); };
   int Ebin() const { return m_Ebin; };
 
-  void set_Ebin(int bin) { m_Ebin = bin; };
-  void set_E(int sample, double Esample) { m_E[sample] = Esample; };
+  void set_Ebin(int bin)
+  {
+    if (has_checkpoint())
+      journal(kJournalEbin, 0);
+    m_Ebin = bin;
+  };
+  void set_E(int sample, double Esample)
+  {
+    if (has_checkpoint())
+      journal(kJournalE, sample);
+    m_E[sample] = Esample;
+  };
   void set_Efrac(int sample, double Efracsample)
   {
+    if (has_checkpoint())
+      journal(kJournalEfrac, sample);
     m_Efrac[sample] = Efracsample;
   };
-  void set_E(double E) { m_Etot = E; };
+  void set_E(double E)
+  {
+    if (has_checkpoint())
+      journal(kJournalEtot, 0);
+    m_Etot = E;
+  };
   void add_E(int sample, double Esample)
   {
+    if (has_checkpoint()) {
+      journal(kJournalE, sample);
+      journal(kJournalEtot, 0);
+    }
     m_E[sample] += Esample;
     m_Etot += Esample;
   };
@@ -56,6 +80,7 @@ public:
   // maps the cell id to the energy deposited in the cell
   using cellmap = std::unordered_map<unsigned long long, float>;
 
+  // Changes through the non-const cells() are not recorded for rollback()
   cellmap& cells() { return m_cells; };
   const cellmap& cells() const { return m_cells; };
 
@@ -69,9 +94,72 @@ public:
   void set_SF(double mysf) { setAuxInfo<double>("SF"_FCShash, mysf); };
   double get_SF() { return getAuxInfo<double>("SF"_FCShash); }
 
+  // Also drops all checkpoints
   void clear();
 
+  // Checkpoints for a clean retry of a simulation step: while a checkpoint is
+  // active, all changes of Ebin, the energies, the deposits and of AuxInfo
+  // values that are not pointers are recorded in a journal. rollback() undoes
+  // them in reverse order. Pointer AuxInfo usually owns memory that is
+  // released by CleanAuxInfo(), so it is never rolled back.
+  // Checkpoints can be nested, checkpoint() returns the id to pass to
+  // rollback() and commit(). Nothing is recorded without active checkpoint.
+  // A cell is recorded only once per checkpoint, further deposits into the
+  // same cell only need its value at the checkpoint. Committing a nested
+  // checkpoint merges its cell entries into the enclosing one, so the journal
+  // holds at most one entry per cell and active checkpoint.
+  std::size_t checkpoint();
+  // Undo all changes since the checkpoint, the checkpoint stays active and
+  // newer checkpoints are dropped
+  void rollback(std::size_t cp);
+  // Keep all changes and drop the checkpoint and all newer ones
+  void commit(std::size_t cp);
+  bool has_checkpoint() const { return !m_checkpoints.empty(); };
+  std::size_t journal_size() const { return m_journal.size(); };
+
+  // Checkpoint that is committed when going out of scope
+  // Use as TFCSSimulationState::Checkpoint_t checkpoint(simulstate);
+  //     ... if (retry) checkpoint.rollback();
+  class Checkpoint_t
+  {
+  public:
+    Checkpoint_t(TFCSSimulationState& simulstate, bool active = true)
+        : m_state(active ? &simulstate : nullptr)
+        , m_cp(active ? simulstate.checkpoint() : 0)
+    {
+    }
+    ~Checkpoint_t()
+    {
+      if (m_state)
+        m_state->commit(m_cp);
+    }
+    Checkpoint_t(const Checkpoint_t&) = delete;
+    Checkpoint_t& operator=(const Checkpoint_t&) = delete;
+
+    void rollback()
+    {
+      if (m_state)
+        m_state->rollback(m_cp);
+    }
+
+  private:
+    TFCSSimulationState* m_state;
+    std::size_t m_cp;
+  };
+
 private:
+  enum JournalKind_t : char
+  {
+    kJournalEbin,
+    kJournalEtot,
+    kJournalE,
+    kJournalEfrac,
+    kJournalCell,
+    kJournalAuxInfo
+  };
+  // Record the current value of an entry before it is changed
+  void journal(JournalKind_t kind, unsigned long long key);
+
   CLHEP::HepRandomEngine* m_randomEngine;
 
   int m_Ebin;
@@ -146,17 +234,60 @@ public:
   template<class T>
   inline void setAuxInfo(std::uint32_t index, const T& val)
   {
+    if (!std::is_pointer<T>::value && has_checkpoint())
+      journal(kJournalAuxInfo, index);
     m_AuxInfo[index].set<T>(val);
   }
 
   void AddAuxInfoCleanup(const TFCSParametrizationBase* para);
   void DoAuxInfoCleanup();
 
+  // Per particle working memory of the parametrizations that is reused for
+  // the next particle, see TFCSScratchSlots. Not affected by clear() and
+  // never rolled back.
+  // Use as TFCSSimulationState::getScratch<MyScratch_t>("MyScratch"_FCShash)
+  template<class T>
+  inline T& getScratch(std::uint32_t index)
+  {
+    return m_scratch.get<T>(index);
+  }
+  template<class T>
+  inline T* findScratch(std::uint32_t index) const
+  {
+    return m_scratch.find<T>(index);
+  }
+
 private:
   std::unordered_map<std::uint32_t, AuxInfo_t> m_AuxInfo;  //! Do not persistify
+  TFCSScratchSlots m_scratch;  //! Do not persistify
   std::set<const TFCSParametrizationBase*>
       m_AuxInfoCleanup;  //! Do not persistify
 
+  struct JournalEntry_t
+  {
+    JournalKind_t kind;
+    bool existed;
+    unsigned long long key;
+    AuxInfo_t value;
+    /// Previous journal entry of the same cell, kNoEntry if none
+    std::size_t prev;
+  };
+  static constexpr std::size_t kNoEntry = ~std::size_t(0);
+
+  // Undo all changes recorded after a journal position
+  void rewind(std::size_t position);
+  // Merge the cell entries recorded after position into the entries of the
+  // innermost active checkpoint
+  void merge(std::size_t position);
+
+  // Journal of previous values and journal size at each active checkpoint
+  std::vector<JournalEntry_t> m_journal;  //! Do not persistify
+  std::vector<std::size_t> m_checkpoints;  //! Do not persistify
+  // Latest journal entry of each recorded cell
+  std::unordered_map<unsigned long long, std::size_t>
+      m_journal_cells;  //! Do not persistify
+  std::vector<std::size_t> m_merge_target;  //! Do not persistify
+
   ClassDef(TFCSSimulationState, 3)  // TFCSSimulationState
 };
 
@@ -0,0 +1,98 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#ifndef TFCSUpscalingSampler_h
+#define TFCSUpscalingSampler_h
+
+#include <cstdint>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
+
+namespace CLHEP
+{
+class HepRandomEngine;
+}
+
+/** Sub-bin upscaling of the hits of a binned shower
+The upscaling places the hits of a voxel into one of its halves in alpha and
+R, using the probabilities of an average shower with a higher resolution.
+The average showers are given for a few energies and are interpolated in the
+log of the particle energy. For each voxel and energy there are three
+cumulative probabilities: the lower alpha half with the lower R half, the
+lower R half in total and the lower alpha half in total. In layer 2 the R
+position follows a linear pdf instead of a choice between the two halves.
+
+The probabilities are stored in one flat table when the sampler is built.
+The interpolation weights of the energies depend only on the particle and
+are computed once by weights(), the sampling parameters of a voxel once by
+voxel(). Sampling a hit then needs two random numbers and, in layer 2, one
+square root.
+*/
+
+class FASTCALOSIM_EXPORT TFCSUpscalingSampler
+{
+public:
+  /// Probabilities as [energy][layer][bin][3], energies in increasing order
+  typedef std::vector<std::vector<std::vector<std::vector<float>>>>
+      distribution_t;
+
+  /// Interpolation between two energy points, or a single one if low < 0.
+  /// No energy point at all if both are < 0
+  struct Weights_t
+  {
+    int low = -1;
+    int high = -1;
+    float f_low = 0;
+    float f_high = 0;
+  };
+
+  /// Sampling parameters of one voxel, for the lower and upper alpha half
+  struct Voxel_t
+  {
+    float p_alpha_low = 0.5;
+    // Probability of the lower R half in the alpha half
+    float p_r[2] = {0.5, 0.5};
+    // Linear pdf in R: the position is a -/+ sqrt(a*a + p / c), uniform in
+    // the full R range if not linear
+    bool linear_r = false;
+    bool linear[2] = {false, false};
+    double a[2] = {0, 0};
+    double a2[2] = {0, 0};
+    double c[2] = {1, 1};
+  };
+
+  TFCSUpscalingSampler(const distribution_t& distribution,
+                       const std::vector<float>& energies);
+
+  std::size_t n_energies() const { return m_energies.size(); };
+
+  /// The energy points and their weights for a particle energy
+  Weights_t weights(float e_init) const;
+
+  /// Sampling parameters of a voxel bin in a layer
+  Voxel_t voxel(const Weights_t& weights,
+                long unsigned int layer_index,
+                long unsigned int bin_index) const;
+
+  /// Shrink the boundaries of a voxel to the sub-bin of a hit
+  static void sample(CLHEP::HepRandomEngine* engine,
+                     const Voxel_t& voxel,
+                     float& R_min,
+                     float& R_max,
+                     float& alpha_min,
+                     float& alpha_max);
+
+private:
+  // The three probabilities of a bin, nullptr if there are none
+  const float* probabilities(int energy_index,
+                             long unsigned int layer_index,
+                             long unsigned int bin_index) const;
+
+  std::vector<float> m_energies;
+  // Probabilities of all energies, layers and bins, three per bin. The bins
+  // of layer l at energy point e are [m_begin[e][l], m_begin[e][l+1]) / 3
+  std::vector<float> m_probabilities;
+  std::vector<std::vector<std::uint64_t>> m_begin;
+};
+
+#endif
@@ -56,7 +56,13 @@ protected:
   std::vector<TMatrixD> m_EigenVectors;  // Eigen-vectors of covariance
   std::vector<TVectorD> m_EigenValues;  // Eigen-values of covariance
 
+  /// Per Ebin false if a transformation could not be read
+  std::vector<bool> m_Ebin_valid;  //! Do not persistify
+
   void MultiGaus(TFCSSimulationState& simulstate, TVectorD& genPars) const;
+  /// Check once after reading that all transformations were read
+  /// completely, see TFCSFunction::is_valid()
+  void check_transform();
 
   ClassDefOverride(TFCSVoxelHistoLateralCovarianceFluctuations,
                    1)  // TFCSVoxelHistoLateralCovarianceFluctuations
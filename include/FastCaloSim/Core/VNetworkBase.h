@@ -20,8 +20,12 @@
 #define VNETWORKBASE_H
 
 // For conversion to ostream
+#include <cstddef>
 #include <iostream>
 #include <map>
+#include <vector>
+
+#include <FastCaloSim/FastCaloSim_export.h>
 
 // For reading and writing
 #include "TFile.h"
@@ -36,7 +40,7 @@
  * Has various subclasses to cover differing network
  * libraries and save formats.
  **/
-class VNetworkBase : public ISF_FCS::MLogging
+class FASTCALOSIM_EXPORT VNetworkBase : public ISF_FCS::MLogging
 {
 public:
   /**
@@ -142,6 +146,109 @@ public:
    **/
   virtual NetworkOutputs compute(NetworkInputs const& inputs) const = 0;
 
+  /**
+   * @brief Read-only view of the flat values of one network node.
+   *
+   * Stands in for std::span<const float>, which needs C++20.
+   * The view does not own the values, they must stay alive
+   * while the view is in use.
+   **/
+  struct TensorView
+  {
+    const float* data = nullptr;
+    std::size_t size = 0;
+
+    TensorView() = default;
+    TensorView(const float* values, std::size_t n_values)
+        : data(values)
+        , size(n_values)
+    {
+    }
+    TensorView(const std::vector<float>& values)
+        : data(values.data())
+        , size(values.size())
+    {
+    }
+
+    const float& operator[](std::size_t i) const { return data[i]; }
+    const float* begin() const { return data; }
+    const float* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+  };
+
+  /**
+   * @brief Format for typed network inputs.
+   *
+   * One view per input node, in the order given by getInputNodes.
+   * Each view holds the flattened values of that node.
+   **/
+  typedef std::vector<TensorView> TensorInputs;
+
+  /**
+   * @brief Format for typed network outputs.
+   *
+   * One flat vector per output node, in the order given by
+   * getOutputNodes. The vectors are resized by computeTensors,
+   * so keeping the outputs between calls avoids reallocation.
+   **/
+  typedef std::vector<std::vector<float>> TensorOutputs;
+
+  // pure virtual, derived classes must implement this
+  /**
+   * @brief Function to pass typed values to the network.
+   *
+   * Faster alternative to compute, with the input and output nodes
+   * identified by their position instead of by strings.
+   * Where the network library allows it the input values are
+   * passed on without being copied.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param outputs  output parameter, the output of the network
+   * @see VNetworkBase::TensorInputs
+   * @see VNetworkBase::TensorOutputs
+   **/
+  virtual void computeTensors(TensorInputs const& inputs,
+                              TensorOutputs& outputs) const = 0;
+
+  /**
+   * @brief Function to pass a batch of typed values to the network.
+   *
+   * Each input view holds n_batch consecutive copies of the input node,
+   * and each output vector is filled with n_batch consecutive copies of
+   * the output node. Networks with a dynamic batch dimension evaluate
+   * the whole batch at once, the default implementation calls
+   * computeTensors for every entry of the batch.
+   *
+   * @param inputs   values to be evaluated by the network
+   * @param n_batch  number of entries in the batch
+   * @param outputs  output parameter, the output of the network
+   **/
+  virtual void computeTensorsBatch(TensorInputs const& inputs,
+                                   std::size_t n_batch,
+                                   TensorOutputs& outputs) const;
+
+  /**
+   * @brief List the names of the input nodes.
+   *
+   * Gives the order of the nodes expected by computeTensors.
+   **/
+  virtual std::vector<std::string> getInputNodes() const = 0;
+
+  /**
+   * @brief List the names of the output nodes.
+   *
+   * Gives the order of the nodes filled by computeTensors.
+   **/
+  virtual std::vector<std::string> getOutputNodes() const = 0;
+
+  /**
+   * @brief Position of an input node for computeTensors.
+   *
+   * @param node_name  name of the input node
+   * @return           index of the node, or -1 if there is no such node
+   **/
+  int inputNodeIndex(std::string const& node_name) const;
+
   // Conversion to ostream
   // It's not possible to have a virtual friend function
   // so instead, have a friend function that calls a virtual protected method
@@ -39,6 +39,13 @@ public:
   virtual auto get_cell(unsigned int layer, const Position& pos) const
       -> const Cell&;
 
+  // Retrieve the best matching cells for many positions in a layer. A
+  // position inside the cell of the previous position reuses that cell
+  // without a lookup, so positions close to each other should be consecutive
+  void get_cells(unsigned int layer,
+                 const std::vector<Position>& positions,
+                 std::vector<const Cell*>& cells) const;
+
   // Retrieve the id of the best matching cell for a given position
   auto get_cell_id(unsigned int layer, const Position& pos) const
       -> unsigned long long;
@@ -23,6 +23,7 @@
 #include "FastCaloSim/Core/MLogging.h"
 #include "FastCaloSim/Core/TFCSParametrizationBase.h"
 #include "FastCaloSim/Core/TFCSParametrizationPlaceholder.h"
+#include "FastCaloSim/Core/TFCSParametrizationLazyPlaceholder.h"
 #include "FastCaloSim/Core/TFCSParametrization.h"
 #include "FastCaloSim/Core/TFCSInvisibleParametrization.h"
 #include "FastCaloSim/Core/TFCSInitWithEkin.h"
@@ -47,6 +48,7 @@
 #include "FastCaloSim/Core/TFCSBinnedShower.h"
 #include "FastCaloSim/Core/TFCSBinnedShowerONNX.h"
 #include "FastCaloSim/Core/TFCSMLCalorimeterSimulator.h"
+#include "FastCaloSim/Core/TFCSShowerLibrary.h"
 
 #ifndef __FastCaloSimNoLWTNN__
 #include "FastCaloSim/Core/TFCSGANXMLParameters.h"
@@ -590,6 +592,7 @@
 #pragma link C++ class ISF_FCS::MLogging + ;
 #pragma link C++ class TFCSParametrizationBase + ;
 #pragma link C++ class TFCSParametrizationPlaceholder + ;
+#pragma link C++ class TFCSParametrizationLazyPlaceholder + ;
 #pragma link C++ class TFCSParametrization + ;
 #pragma link C++ class TFCSInvisibleParametrization + ;
 #pragma link C++ class TFCSInitWithEkin + ;
@@ -614,6 +617,7 @@
 #pragma link C++ class TFCSBinnedShower - ;
 #pragma link C++ class TFCSBinnedShowerONNX - ;
 #pragma link C++ class TFCSMLCalorimeterSimulator + ;
+#pragma link C++ class TFCSShowerLibrary + ;
 #ifndef __FastCaloSimNoLWTNN__
 #pragma link C++ class TFCSGANXMLParameters + ;
 #pragma link C++ class TFCSGANLWTNNHandler - ;
@@ -648,7 +652,7 @@
 #pragma link C++ class TFCSHitCellMappingWiggle + ;
 #pragma link C++ class TFCSHitCellMappingWiggleEMB + ;
 #pragma link C++ class TFCSEnergyRenormalization + ;
-#pragma link C++ class TFCSVoxelHistoLateralCovarianceFluctuations + ;
+#pragma link C++ class TFCSVoxelHistoLateralCovarianceFluctuations - ;
 
 #pragma link C++ class TFCSTruthState + ;
 #pragma link C++ class TFCSExtrapolationState + ;
@@ -0,0 +1,47 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+// -- Core FastCaloSim includes
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
+
+// Convert the HDF5 event library of a TFCSBinnedShower into the memory-mapped
+// format of TFCSEventLibraryFile. To use it:
+//   binned_shower->load_event_library_file("library.evlib");
+// or, to map it whenever the parametrization is read:
+//   binned_shower->set_library_file_path("library.evlib");
+auto main(int argc, char** argv) -> int
+{
+  if (argc < 3) {
+    fmt::print(
+        "Usage: {} <input.h5> <output.evlib> [number of layers, default 24]\n",
+        argv[0]);
+    return 1;
+  }
+  const std::string input = argv[1];
+  const std::string output = argv[2];
+  const int n_layers = argc > 3 ? std::atoi(argv[3]) : 24;
+
+  std::vector<long unsigned int> layers;
+  for (int layer = 0; layer < n_layers; ++layer)
+    layers.push_back(layer);
+  if (!convert_event_library(input, output, layers)) {
+    fmt::print("Could not convert {}\n", input);
+    return 1;
+  }
+
+  auto library = TFCSEventLibraryFile::Open(output);
+  if (!library) {
+    fmt::print("Could not read back {}\n", output);
+    return 1;
+  }
+  fmt::print("Converted {} events with {} bytes to {}\n",
+             library->n_events(),
+             library->size(),
+             output);
+  return 0;
+}
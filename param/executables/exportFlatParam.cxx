@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <string>
+
+#include <fmt/core.h>
+
+// -- Core FastCaloSim includes
+#include "FastCaloSim/Core/TFCSFlatArrayStore.h"
+#include "FastCaloSim/Core/TFCSParametrizationBase.h"
+#include "TFile.h"
+
+// Export a parametrization such that all large numeric arrays are written into
+// a flat, memory-mappable file next to a ROOT file holding the object
+// structure. To read it back:
+//   auto store = TFCSFlatArrayStore::Attach("param.flat");
+//   TFile file("param.root");
+//   auto* param = (TFCSParametrizationBase*)file.Get("SelPDGID");
+auto main(int argc, char** argv) -> int
+{
+  if (argc < 5) {
+    fmt::print(
+        "Usage: {} <input.root> <object name> <output.root> <output.flat> "
+        "[min. array size in bytes, default 64]\n",
+        argv[0]);
+    return 1;
+  }
+  const std::string input = argv[1];
+  const std::string name = argv[2];
+  const std::string output = argv[3];
+  const std::string flat = argv[4];
+  const std::size_t min_bytes =
+      argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 64;
+
+  TFile in(input.c_str(), "READ");
+  auto* param = dynamic_cast<TFCSParametrizationBase*>(in.Get(name.c_str()));
+  if (!param) {
+    fmt::print("Could not read {} from {}\n", name, input);
+    return 1;
+  }
+
+  TFCSFlatArrayWriter writer(flat, min_bytes);
+  if (!writer.is_open())
+    return 1;
+
+  TFile out(output.c_str(), "RECREATE");
+  writer.Begin();
+  out.WriteTObject(param);
+  writer.End();
+  out.Close();
+
+  const std::size_t n_arrays = writer.n_arrays();
+  const std::size_t flat_size = writer.size();
+  if (!writer.Close()) {
+    fmt::print("Could not write {}\n", flat);
+    return 1;
+  }
+  fmt::print(
+      "Exported {} arrays with {} bytes to {}\n", n_arrays, flat_size, flat);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <CLHEP/Random/RanluxEngine.h>
+#include <fmt/core.h>
+
+// -- Core FastCaloSim includes
+#include "FastCaloSim/Core/TFCSMLCalorimeterSimulator.h"
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
+#include "FastCaloSim/Core/TFCSSimulationState.h"
+
+// Write the dynamically quantized int8 variant of an ONNX shower model,
+// by default next to the model where TFCSBinnedShowerONNX and
+// TFCSEnergyAndHitGANV2 look for it with
+//   set_model_precision(TFCSONNXQuantization::kInt8);
+// If the model is a TFCSMLCalorimeterSimulator network, the voxel energies
+// of both models are compared on a grid of eta and energy points, with the
+// same random numbers for both. The exit code is 2 if they disagree by
+// more than the tolerance.
+auto main(int argc, char** argv) -> int
+{
+  if (argc < 2) {
+    fmt::print(
+        "Usage: {} <input.onnx> [output.onnx, default input.int8.onnx] "
+        "[events per point, default 1000] [tolerance, default 0.02]\n",
+        argv[0]);
+    return 1;
+  }
+  const std::string input = argv[1];
+  const std::string output = argc > 2
+      ? argv[2]
+      : TFCSONNXQuantization::variantPath(input, TFCSONNXQuantization::kInt8);
+  const int n_events = argc > 3 ? std::atoi(argv[3]) : 1000;
+  const double tolerance = argc > 4 ? std::atof(argv[4]) : 0.02;
+
+  std::ifstream in(input, std::ios::binary);
+  const std::vector<char> model((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+  if (model.empty()) {
+    fmt::print("Could not read {}\n", input);
+    return 1;
+  }
+  TFCSONNXQuantization::Report report;
+  const std::vector<char> quantized =
+      TFCSONNXQuantization::quantizeDynamicInt8(model, &report);
+  if (quantized.empty() || report.n_quantized == 0) {
+    fmt::print("Could not quantize {}\n", input);
+    return 1;
+  }
+  std::ofstream out(output, std::ios::binary);
+  out.write(quantized.data(), quantized.size());
+  if (!out.good()) {
+    fmt::print("Could not write {}\n", output);
+    return 1;
+  }
+  fmt::print(
+      "Quantized {} of {} matrix products, {} weights, {} -> {} bytes\n",
+      report.n_quantized,
+      report.n_quantized + report.n_skipped,
+      report.n_weights,
+      model.size(),
+      quantized.size());
+  out.close();
+
+  TFCSMLCalorimeterSimulator reference;
+  TFCSMLCalorimeterSimulator candidate;
+  if (n_events <= 0 || !reference.loadSimulator(input)
+      || !candidate.loadSimulator(output))
+  {
+    fmt::print("Not validated, {} is no calorimeter simulator model\n",
+               input);
+    return 0;
+  }
+
+  // Covers the barrel, and the energy range of the photon models
+  const std::vector<float> etas = {0.2, 0.7, 1.2};
+  const std::vector<float> energies = {1024, 16384, 262144};
+  bool agrees = true;
+  long seed = 42;
+  for (float eta : etas) {
+    for (float energy : energies) {
+      CLHEP::RanluxEngine reference_engine(seed);
+      CLHEP::RanluxEngine candidate_engine(seed++);
+      TFCSSimulationState reference_state(&reference_engine);
+      TFCSSimulationState candidate_state(&candidate_engine);
+      std::vector<std::vector<float>> reference_voxels;
+      std::vector<std::vector<float>> candidate_voxels;
+      for (int event = 0; event < n_events; ++event) {
+        reference_voxels.push_back(
+            reference.predictVoxels(reference_state, eta, energy));
+        candidate_voxels.push_back(
+            candidate.predictVoxels(candidate_state, eta, energy));
+      }
+      const TFCSONNXQuantization::Comparison comparison =
+          TFCSONNXQuantization::compare(reference_voxels, candidate_voxels);
+      const bool point_agrees = comparison.agrees(tolerance);
+      agrees = agrees && point_agrees;
+      fmt::print(
+          "eta {:4.2f} E {:7.0f} MeV: mean shift {:.4f}, rms ratio {:.4f}, "
+          "KS {:.4f}, voxel shift {:.4f}, event difference {:.4f} {}\n",
+          eta,
+          energy,
+          comparison.total_mean_shift,
+          comparison.total_rms_ratio,
+          comparison.total_ks_distance,
+          comparison.max_voxel_mean_shift,
+          comparison.mean_event_difference,
+          point_agrees ? "OK" : "FAILED");
+    }
+  }
+  if (!agrees) {
+    fmt::print("The quantized model disagrees by more than {}\n", tolerance);
+    return 2;
+  }
+  return 0;
+}
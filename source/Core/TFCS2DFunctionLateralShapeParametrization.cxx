@@ -67,7 +67,7 @@ FCSReturnCode TFCS2DFunctionLateralShapeParametrization::simulate_hit(
   if (!simulstate.randomEngine()) {
     return FCSFatal;
   }
-  if (!m_function) {
+  if (!m_function || !m_function->is_valid()) {
     return FCSFatal;
   }
 
@@ -1,7 +1,11 @@
 // Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <deque>
+#include <future>
 #include <regex>
+#include <thread>
 
 #include "FastCaloSim/Core/TFCSBinnedShower.h"
 
@@ -15,6 +19,9 @@
 #include "CLHEP/Random/RandFlat.h"
 #include "FastCaloSim/Core/TFCSBinnedShowerBase.h"
 #include "FastCaloSim/Core/TFCSCenterPositionCalculation.h"
+#include "FastCaloSim/Core/TFCSEventLibraryCache.h"
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
+#include "FastCaloSim/Core/TFCSEventLibraryIndex.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
 #include "FastCaloSim/Core/TFCSInitWithEkin.h"
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
@@ -25,6 +32,33 @@
 #include "FastCaloSim/Geometry/CaloGeo.h"
 #include "TBuffer.h"
 #include "TClass.h"
+#include "TError.h"
+
+namespace
+{
+// Matching distance between a library event and a particle. The eta
+// difference is normalized by the (usual) eta range of 0.05, the energy
+// difference uses powers of two (distance between usual energy points)
+float match_distance(float event_center_eta,
+                     float event_e_init,
+                     float event_phi_mod,
+                     float eta_center,
+                     float e_init,
+                     bool phi_mod_matching,
+                     float phi_within_cell,
+                     float phi_cell_size)
+{
+  float eta_diff = (event_center_eta - eta_center) / 0.05;
+  float e_diff = std::log(event_e_init / e_init) / std::log(2);
+
+  float dist2 = eta_diff * eta_diff + e_diff * e_diff;
+  if (phi_mod_matching) {
+    float phi_diff = (event_phi_mod - phi_within_cell) / phi_cell_size;
+    dist2 = dist2 + phi_diff * phi_diff;
+  }
+  return TMath::Sqrt(dist2);
+}
+}  // namespace
 
 //=============================================
 //======= TFCSBinnedShower =========
@@ -45,9 +79,13 @@ void TFCSBinnedShower::set_layer_energy(
     const std::vector<unsigned int> bin_index_vector,
     const std::vector<float> E_vector)
 {
+  m_library_view.reset();
+  m_library_cache.reset();
+
   // Assert that the event index is valid
   if (event_index >= m_eventlibrary.size()) {
     m_eventlibrary.resize(event_index + 1);
+    reset_library_index();
   }
 
   // Assert that the layer index is valid
@@ -67,6 +105,7 @@ void TFCSBinnedShower::set_bin_boundaries(long unsigned int layer_index,
                                           std::vector<float> alpha_lower,
                                           std::vector<float> alpha_size)
 {
+  clear_projections();
   if (layer_index >= m_coordinates.size()) {
     m_coordinates.resize(layer_index + 1);
   }
@@ -94,6 +133,8 @@ void TFCSBinnedShower::set_shower_center_information(
     phi_within_cell += phi_cell_size;
   }
 
+  m_library_view.reset();
+  m_library_cache.reset();
   if (m_eventlibrary.size() <= event_index) {
     m_eventlibrary.resize(event_index + 1);
   }
@@ -103,6 +144,7 @@ void TFCSBinnedShower::set_shower_center_information(
   }
   m_eventlibrary.at(event_index).center_eta = eta_center;
   m_eventlibrary.at(event_index).phi_mod = phi_within_cell;
+  reset_library_index();
 }
 
 long unsigned int TFCSBinnedShower::find_best_match(
@@ -112,7 +154,7 @@ long unsigned int TFCSBinnedShower::find_best_match(
     long unsigned int reference_layer_index,
     bool phi_mod_matching) const
 {
-  float phi_cell_size, phi_within_cell;
+  float phi_cell_size = 1, phi_within_cell = 0;
 
   if (phi_mod_matching) {
     Position pos {};
@@ -130,77 +172,209 @@ long unsigned int TFCSBinnedShower::find_best_match(
       phi_within_cell += phi_cell_size;
   }
 
-  // Find the event with the closest eta_center and phi_mod (L2 distance)
-  float best_distance = std::numeric_limits<float>::max();
-  long unsigned int best_match = m_eventlibrary.size() + 1;
-
-  for (long unsigned int event_index = 0; event_index < m_eventlibrary.size();
-       ++event_index)
+  // Find the event with the closest eta_center and phi_mod (L2 distance).
+  // The index returns the same event as a scan over the whole library
+  const double query[3] = {
+      eta_center / 0.05, std::log2(double(e_init)), phi_within_cell};
+  const double weights[3] = {1, 1, phi_mod_matching ? 1 / phi_cell_size : 0};
+  auto distance = [&](std::size_t event_index)
   {
-    // Absolute eta difference. Normalized by the (usual) eta range of 0.05...
-    float eta_diff =
-        (m_eventlibrary.at(event_index).center_eta - eta_center) / 0.05;
-
-    // Logarithmic energy difference. Use power of two (distance between usual
-    // energy points) as reasonable distance measure.
-    float e_diff =
-        std::log(m_eventlibrary.at(event_index).e_init / e_init) / std::log(2);
-
-    // float dist2 = eta_diff * eta_diff;
-    float dist2 = eta_diff * eta_diff + e_diff * e_diff;
-
-    if (phi_mod_matching) {
-      float phi_mod = m_eventlibrary.at(event_index).phi_mod;
-      float phi_diff = (phi_mod - phi_within_cell) / phi_cell_size;
-      dist2 = dist2 + phi_diff * phi_diff;
-    }
-    float distance = TMath::Sqrt(dist2);
-
-    if (distance < best_distance) {
-      best_distance = distance;
-      best_match = event_index;
-    }
-  }
-
-  if (best_match == m_eventlibrary.size() + 1) {
+    return match_distance(event_center_eta(event_index),
+                          event_e_init(event_index),
+                          event_phi_mod(event_index),
+                          eta_center,
+                          e_init,
+                          phi_mod_matching,
+                          phi_within_cell,
+                          phi_cell_size);
+  };
+  const std::size_t match =
+      library_index(phi_mod_matching)->nearest(query, weights, distance);
+  long unsigned int best_match = match == TFCSEventLibraryIndex::npos
+      ? n_library_events() + 1
+      : match;
+
+  if (best_match == n_library_events() + 1) {
     FCS_MSG_ERROR("No best match found");
   } else {
     FCS_MSG_INFO("Best match found for eta "
-                 << eta_center << " / "
-                 << m_eventlibrary.at(best_match).center_eta << " with energy "
-                 << e_init << " / " << m_eventlibrary.at(best_match).e_init);
+                 << eta_center << " / " << event_center_eta(best_match)
+                 << " with energy " << e_init << " / "
+                 << event_e_init(best_match));
   }
 
   return best_match;
 }
 
+std::shared_ptr<const TFCSEventLibraryIndex> TFCSBinnedShower::library_index(
+    bool phi_mod_matching) const
+{
+  const unsigned int n_dims = phi_mod_matching ? 3 : 2;
+  const long unsigned int n_events = n_library_events();
+  auto usable = [&](const std::shared_ptr<const TFCSEventLibraryIndex>& index)
+  {
+    return index && index->n_dims() == n_dims && index->size() == n_events;
+  };
+  std::shared_ptr<const TFCSEventLibraryIndex> index =
+      std::atomic_load(&m_library_index);
+  if (usable(index))
+    return index;
+
+  std::lock_guard<std::mutex> lock(m_library_index_mutex);
+  index = std::atomic_load(&m_library_index);
+  if (usable(index))
+    return index;
+  std::vector<double> points;
+  points.reserve(n_dims * n_events);
+  for (long unsigned int i = 0; i < n_events; ++i) {
+    points.push_back(event_center_eta(i) / 0.05);
+    points.push_back(std::log2(double(event_e_init(i))));
+    if (phi_mod_matching)
+      points.push_back(event_phi_mod(i));
+  }
+  index = std::make_shared<const TFCSEventLibraryIndex>(points, n_dims);
+  std::atomic_store(&m_library_index, index);
+  FCS_MSG_DEBUG("Built matching index for " << n_events << " library events");
+  return index;
+}
+
+void TFCSBinnedShower::reset_library_index()
+{
+  std::atomic_store(&m_library_index,
+                    std::shared_ptr<const TFCSEventLibraryIndex>());
+}
+
+void TFCSBinnedShower::prefetch_events(
+    const std::vector<long unsigned int>& event_indices) const
+{
+  if (m_library_cache)
+    m_library_cache->prefetch(std::vector<std::size_t>(event_indices.begin(),
+                                                       event_indices.end()));
+}
+
+void TFCSBinnedShower::prefetch_matched_events(
+    const std::vector<float>& eta_centers,
+    const std::vector<float>& phi_centers,
+    const std::vector<float>& e_inits,
+    long unsigned int reference_layer_index) const
+{
+  if (!m_library_cache
+      || !(m_use_event_cherry_picking || m_use_eta_matching))
+    return;
+  std::vector<long unsigned int> event_indices;
+  for (long unsigned int i = 0; i < eta_centers.size()
+       && i < phi_centers.size() && i < e_inits.size();
+       ++i)
+  {
+    long unsigned int event_index = find_best_match(eta_centers[i],
+                                                    phi_centers[i],
+                                                    e_inits[i],
+                                                    reference_layer_index,
+                                                    m_use_event_cherry_picking);
+    if (event_index < n_library_events())
+      event_indices.push_back(event_index);
+  }
+  prefetch_events(event_indices);
+}
+
+long unsigned int TFCSBinnedShower::n_library_events() const
+{
+  if (m_library_view)
+    return m_library_view->n_events();
+  if (m_library_cache)
+    return m_library_cache->n_events();
+  return m_eventlibrary.size();
+}
+
+long unsigned int TFCSBinnedShower::n_event_layers(
+    long unsigned int event_index) const
+{
+  if (m_library_view)
+    return m_library_view->n_layers();
+  if (m_library_cache)
+    return m_library_cache->n_layers();
+  return m_eventlibrary[event_index].event_data.size();
+}
+
+float TFCSBinnedShower::event_center_eta(long unsigned int event_index) const
+{
+  if (m_library_view)
+    return m_library_view->center_eta(event_index);
+  if (m_library_cache)
+    return m_library_cache->center_eta(event_index);
+  return m_eventlibrary[event_index].center_eta;
+}
+
+float TFCSBinnedShower::event_phi_mod(long unsigned int event_index) const
+{
+  if (m_library_view)
+    return m_library_view->phi_mod(event_index);
+  if (m_library_cache)
+    return m_library_cache->phi_mod(event_index);
+  return m_eventlibrary[event_index].phi_mod;
+}
+
+float TFCSBinnedShower::event_e_init(long unsigned int event_index) const
+{
+  if (m_library_view)
+    return m_library_view->e_init(event_index);
+  if (m_library_cache)
+    return m_library_cache->e_init(event_index);
+  return m_eventlibrary[event_index].e_init;
+}
+
+TFCSEventLibraryFile::Voxels_t TFCSBinnedShower::event_voxels(
+    TFCSSimulationState& simulstate,
+    long unsigned int event_index,
+    long unsigned int layer_index) const
+{
+  if (m_library_view)
+    return m_library_view->voxels(event_index, layer_index);
+  if (m_library_cache) {
+    // The event read in get_event
+    const auto* event =
+        simulstate.findScratch<cached_event_t>("BSLibraryEvent"_FCShash);
+    return event && *event ? (*event)->voxels(layer_index)
+                           : TFCSEventLibraryFile::Voxels_t();
+  }
+
+  TFCSEventLibraryFile::Voxels_t voxels;
+  const layer_t& layer = m_eventlibrary[event_index].event_data[layer_index];
+  voxels.bin_index = layer.bin_index_vector.data();
+  voxels.E = layer.E_vector.data();
+  voxels.size = std::min(layer.bin_index_vector.size(), layer.E_vector.size());
+  return voxels;
+}
+
 void TFCSBinnedShower::get_event(TFCSSimulationState& simulstate,
                                  float eta_center,
                                  float phi_center,
                                  float e_init,
                                  long unsigned int reference_layer_index) const
 {
-  if (m_eventlibrary.empty()) {
+  EventScratch_t& scratch = event_scratch(simulstate);
+  scratch.clear();
+  const long unsigned int n_events = n_library_events();
+  if (n_events == 0) {
     FCS_MSG_ERROR(
         "No event library loaded. Please load an event library for "
         "TFCSBinnedShower::get_event.");
     return;
   }
 
-  simulstate.setAuxInfo<float>("BSEinit"_FCShash, e_init);
+  scratch.e_init = e_init;
 
   long unsigned int event_index;
   if (simulstate.hasAuxInfo("EventNr"_FCShash) && m_use_event_matching) {
     int requested = simulstate.getAuxInfo<int>("EventNr"_FCShash);
-    if (requested < 0
-        || static_cast<long unsigned int>(requested) >= m_eventlibrary.size())
+    if (requested < 0 || static_cast<long unsigned int>(requested) >= n_events)
     {
       FCS_MSG_WARNING("EventNr "
                       << requested
                       << " is outside the loaded event library of size "
-                      << m_eventlibrary.size() << " — falling back to random");
-      event_index = std::floor(CLHEP::RandFlat::shoot(
-          simulstate.randomEngine(), 0, m_eventlibrary.size()));
+                      << n_events << " — falling back to random");
+      event_index = std::floor(
+          CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, n_events));
     } else {
       event_index = static_cast<long unsigned int>(requested);
     }
@@ -212,22 +386,32 @@ void TFCSBinnedShower::get_event(TFCSSimulationState& simulstate,
                                   reference_layer_index,
                                   m_use_event_cherry_picking);
 
-    if (event_index >= m_eventlibrary.size()) {
-      event_index = std::floor(CLHEP::RandFlat::shoot(
-          simulstate.randomEngine(), 0, m_eventlibrary.size()));
+    if (event_index >= n_events) {
+      event_index = std::floor(
+          CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, n_events));
     }
 
   } else {
-    event_index = std::floor(CLHEP::RandFlat::shoot(
-        simulstate.randomEngine(), 0, m_eventlibrary.size()));
+    event_index = std::floor(
+        CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, n_events));
   }
 
   FCS_MSG_DEBUG("Using event index " << event_index << " for eta " << eta_center
                                      << " and phi " << phi_center);
 
-  // Store a pointer to the event
-  event_t* event_ptr = new event_t(m_eventlibrary.at(event_index));
-  simulstate.setAuxInfo<void*>("BSEventData"_FCShash, event_ptr);
+  // Store the index of the event, its data is read from the library
+  scratch.event_index = event_index;
+
+  // Events read on demand are kept until delete_event, also if the cache
+  // evicts them meanwhile
+  if (m_library_cache) {
+    cached_event_t& event =
+        simulstate.getScratch<cached_event_t>("BSLibraryEvent"_FCShash);
+    event = m_library_cache->get(event_index);
+    if (!event)
+      FCS_MSG_ERROR("Could not read event " << event_index << " from "
+                                            << m_library_cache->path());
+  }
 
   compute_n_hits_and_elayer(simulstate);
 }
@@ -235,377 +419,161 @@ void TFCSBinnedShower::get_event(TFCSSimulationState& simulstate,
 void TFCSBinnedShower::compute_n_hits_and_elayer(
     TFCSSimulationState& simulstate) const
 {
-  event_t* event = static_cast<event_t*>(
-      simulstate.getAuxInfo<void*>("BSEventData"_FCShash));
-  if (!event) {
+  EventScratch_t& scratch = event_scratch(simulstate);
+  if (scratch.event_index < 0) {
     FCS_MSG_ERROR(
-        "compute_n_hits_and_elayer called without BSEventData; "
+        "compute_n_hits_and_elayer called without an event; "
         "get_event must run first");
     return;
   }
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
-
-  // Loop over all layers
-  long unsigned int n_layers = event->event_data.size();
-  std::vector<std::vector<long unsigned int>> hits_per_layer;
-  std::vector<float> elayer;
-  hits_per_layer.resize(n_layers);
-  elayer.resize(n_layers, 0.0f);
 
+  begin_hits(scratch);
+  const long unsigned int n_layers = n_event_layers(scratch.event_index);
   for (long unsigned int layer_index = 0; layer_index < n_layers; ++layer_index)
   {
-    layer_t& layer = event->event_data.at(layer_index);
-
-    // Loop over all voxels in the layer
-    long unsigned int n_hits = 0;
-    for (float e_voxel : layer.E_vector) {
-      long unsigned int hits_per_bin;
-      if (e_voxel > std::numeric_limits<float>::epsilon()) {
-        hits_per_bin =
-            std::min(std::max(int(e_voxel * e_init / m_default_hit_energy), 1),
-                     m_max_hits_per_voxel);
-        elayer.at(layer_index) += e_voxel * e_init;
-
-      } else {
-        hits_per_bin = 0;
-      }
-      n_hits += hits_per_bin;
-      hits_per_layer.at(layer_index).push_back(n_hits);
-    }
+    const TFCSEventLibraryFile::Voxels_t voxels =
+        event_voxels(simulstate, scratch.event_index, layer_index);
+    add_layer_hits(scratch, voxels.E, voxels.size);
   }
-  // Store the hits per layer vector
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      new std::vector<std::vector<long unsigned int>>(hits_per_layer);
-  simulstate.setAuxInfo<void*>("BSNHits"_FCShash, hits_per_layer_ptr);
-
-  // Store the energy per layer
-  std::vector<float>* elayer_ptr = new std::vector<float>(elayer);
-  simulstate.setAuxInfo<void*>("BSELayer"_FCShash, elayer_ptr);
 }
 
-long unsigned int TFCSBinnedShower::get_n_hits(
-    TFCSSimulationState& simulstate, long unsigned int layer_index) const
+std::shared_ptr<const TFCSUpscalingSampler>
+TFCSBinnedShower::upscaling_sampler() const
 {
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-
-  if (!hits_per_layer_ptr) {
-    FCS_MSG_ERROR("Invalid hits per layer information");
-    return 0;
-  }
-
-  return hits_per_layer_ptr->at(layer_index).back();
+  if (!m_use_upscaling)
+    return nullptr;
+  std::shared_ptr<const TFCSUpscalingSampler> sampler =
+      std::atomic_load(&m_upscaling_sampler);
+  if (sampler)
+    return sampler;
+
+  std::lock_guard<std::mutex> lock(m_upscaling_sampler_mutex);
+  sampler = std::atomic_load(&m_upscaling_sampler);
+  if (sampler)
+    return sampler;
+  sampler = std::make_shared<const TFCSUpscalingSampler>(
+      m_sub_bin_distribution, m_upscaling_energies);
+  std::atomic_store(&m_upscaling_sampler, sampler);
+  FCS_MSG_DEBUG("Built upscaling sampler for " << sampler->n_energies()
+                                               << " energies");
+  return sampler;
 }
 
-float TFCSBinnedShower::get_layer_energy(TFCSSimulationState& simulstate,
-                                         long unsigned int layer_index) const
+void TFCSBinnedShower::reset_upscaling_sampler()
 {
-  std::vector<float>* elayer_ptr = static_cast<std::vector<float>*>(
-      simulstate.getAuxInfo<void*>("BSELayer"_FCShash));
-  if (!elayer_ptr) {
-    FCS_MSG_ERROR("Invalid layer energy information");
-    return 0.0f;
-  }
-  if (layer_index >= elayer_ptr->size()) {
-    return 0.0f;
-  }
-  return elayer_ptr->at(layer_index);
+  std::atomic_store(&m_upscaling_sampler,
+                    std::shared_ptr<const TFCSUpscalingSampler>());
 }
 
-long unsigned int TFCSBinnedShower::get_energy_index(
-    TFCSSimulationState& simulstate,
-    long unsigned int layer_index,
-    long unsigned int hit_index) const
-{
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-  if (!hits_per_layer_ptr) {
-    FCS_MSG_ERROR("Invalid hits per layer information");
-    return 0;
-  }
-
-  if (layer_index >= hits_per_layer_ptr->size()) {
-    FCS_MSG_ERROR("Layer index out of bounds: " << layer_index << " >= "
-                                                << hits_per_layer_ptr->size());
-    return 0;
-  }
-
-  // Find the hit index in the hit vector for the given layer
-  const std::vector<long unsigned int>& hits =
-      hits_per_layer_ptr->at(layer_index);
-  auto it = std::upper_bound(hits.begin(), hits.end(), hit_index);
-  long unsigned int energy_index = std::distance(hits.begin(), it);
-
-  if (energy_index >= hits.size()) {
-    FCS_MSG_ERROR("Energy index out of bounds: " << energy_index
-                                                 << " >= " << hits.size());
-    // Print full hits for debugging
-    FCS_MSG_ERROR("Hits per layer: ");
-    for (const auto& hit : hits) {
-      FCS_MSG_ERROR("Hit: " << hit);
-    }
-    return 0;
-  }
-
-  return energy_index;
-}
-
-std::tuple<float, float> TFCSBinnedShower::get_coordinates(
-    TFCSSimulationState& simulstate,
-    long unsigned int layer_index,
-    int bin_index) const
+void TFCSBinnedShower::delete_event(TFCSSimulationState& simulstate) const
 {
-  float R_min = m_coordinates.at(layer_index).R_lower.at(bin_index);
-  float R_max = m_coordinates.at(layer_index).R_size.at(bin_index)
-      + m_coordinates.at(layer_index).R_lower.at(bin_index);
+  // The event data itself stays in the library, the scratch memory is kept
+  // for the next event
+  event_scratch(simulstate).clear();
 
-  float alpha_min = m_coordinates.at(layer_index).alpha_lower.at(bin_index);
-  float alpha_max = m_coordinates.at(layer_index).alpha_size.at(bin_index)
-      + m_coordinates.at(layer_index).alpha_lower.at(bin_index);
-
-  if (m_use_upscaling) {
-    upscale(
-        simulstate, R_min, R_max, alpha_min, alpha_max, layer_index, bin_index);
-  }
-  float R;
-  if (TMath::Abs(R_max - R_min) > std::numeric_limits<float>::epsilon()) {
-    R = CLHEP::RandFlat::shoot(simulstate.randomEngine(), R_min, R_max);
-  } else {
-    R = R_min;  // If the range is too small, just use the minimum value
+  // Release the event read on demand
+  if (cached_event_t* event =
+          simulstate.findScratch<cached_event_t>("BSLibraryEvent"_FCShash))
+  {
+    event->reset();
   }
-  float alpha =
-      CLHEP::RandFlat::shoot(simulstate.randomEngine(), alpha_min, alpha_max);
-
-  return std::make_tuple(R, alpha);
 }
 
-void TFCSBinnedShower::upscale(TFCSSimulationState& simulstate,
-                               float& R_min,
-                               float& R_max,
-                               float& alpha_min,
-                               float& alpha_max,
-                               long unsigned int layer_index,
-                               int bin_index) const
+TFCSEventLibraryFile::Voxels_t TFCSBinnedShower::get_layer_voxels(
+    TFCSSimulationState& simulstate, long unsigned int layer_index) const
 {
-  float p = CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, 1);
-
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
-  std::vector<float> available_energies = m_upscaling_energies;
-
-  unsigned int e_index = 0;
-
-  std::vector<float> probabilities = {0.25f, 0.5f, 0.75f};
-
-  if (available_energies.size() > 1) {
-    // find closest energy index using binary search
-    auto it = std::upper_bound(
-        available_energies.begin(), available_energies.end(), e_init);
-    if (it != available_energies.end()) {
-      e_index = std::distance(available_energies.begin(), it);
-    } else {
-      e_index = available_energies.size() - 1;
-    }
-
-    float e_high = available_energies.at(e_index);
-    if (e_high < e_init || e_index == 0) {
-      if (m_sub_bin_distribution.at(e_index).size() > layer_index) {
-        probabilities =
-            m_sub_bin_distribution.at(e_index).at(layer_index).at(bin_index);
-      }
-    } else {
-      if (m_sub_bin_distribution.at(e_index).size() > layer_index
-          && m_sub_bin_distribution.at(e_index - 1).size() > layer_index)
-      {
-        float e_low = available_energies.at(e_index - 1);
-        float f_low = std::log(e_high / e_init) / (std::log(e_high / e_low));
-        float f_high = 1 - f_low;
-        for (unsigned int i = 0; i < 3; ++i) {
-          float p_low = m_sub_bin_distribution.at(e_index - 1)
-                            .at(layer_index)
-                            .at(bin_index)
-                            .at(i);
-          float p_high = m_sub_bin_distribution.at(e_index)
-                             .at(layer_index)
-                             .at(bin_index)
-                             .at(i);
-          probabilities[i] = f_low * p_low + f_high * p_high;
-        }
-      }
-    }
-  }
-
-  else if (available_energies.size() == 1)
+  const EventScratch_t& scratch = event_scratch(simulstate);
+  if (scratch.event_index < 0
+      || layer_index >= n_event_layers(scratch.event_index))
   {
-    probabilities = m_sub_bin_distribution.at(0).at(layer_index).at(bin_index);
-  }
-
-  float p_alpha_low = probabilities[2] - probabilities[1] + probabilities[0];
-  float p_r;
-
-  if (p < p_alpha_low) {
-    alpha_max = (alpha_min + alpha_max) / 2.;
-    p_r = probabilities[0] / (p_alpha_low);
-  } else {
-    alpha_min = (alpha_min + alpha_max) / 2.;
-    p_r = (probabilities[1] - probabilities[0]) / (1 - p_alpha_low);
-  }
-
-  p = CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, 1);
-  if (layer_index != 2) {
-    // if ((layer_index != 2) && (layer_index != 1)) {
-    if (p > p_r) {
-      R_min = (R_min + R_max) / 2.;
-      return;
-    } else {
-      R_max = (R_min + R_max) / 2.;
-      return;
-    }
-  }
-
-  // Use linear interpolation for layer 2
-  // It works better than uniform sampling for the second layer...
-  if (p_r < 0.25) {
-    p_r = 0.25;  // Values below 0.25 are not allowed for linear pdf
-  } else if (p_r > 0.75) {
-    p_r = 0.75;  // Values above 0.75 are not allowed for linear pdf
-  } else if (TMath::Abs(p_r - 0.5) < std::numeric_limits<float>::epsilon()) {
-    return;  // Best upscaling is uniform sampling. Nothing to do here.
+    return TFCSEventLibraryFile::Voxels_t();
   }
-
-  // Inverse CDF for linear pdf
-  float r = (1. - 4. * p_r) / (2. - 4. * p_r)
-      - TMath::Sqrt(((1. - 4. * p_r) / (2. - 4. * p_r))
-                        * ((1. - 4. * p_r) / (2. - 4. * p_r))
-                    + p / ((1. / 2.) - p_r));
-  if (r < 0) {
-    r = (1. - 4. * p_r) / (2. - 4. * p_r)
-        + TMath::Sqrt(((1. - 4. * p_r) / (2. - 4. * p_r))
-                          * ((1. - 4. * p_r) / (2. - 4. * p_r))
-                      + p / ((1. / 2.) - p_r));
-  }
-
-  R_min = R_min + r / 2 * (R_max - R_min);
-  R_max = R_min;
-
-  return;
+  return event_voxels(simulstate, scratch.event_index, layer_index);
 }
 
-std::tuple<float, float, float> TFCSBinnedShower::get_hit_position_and_energy(
-    TFCSSimulationState& simulstate,
-    long unsigned int layer_index,
-    long unsigned int hit_index) const
+long unsigned int TFCSBinnedShower::get_n_bins(
+    long unsigned int layer_index) const
 {
-  event_t* event = static_cast<event_t*>(
-      simulstate.getAuxInfo<void*>("BSEventData"_FCShash));
-  if (!event) {
-    FCS_MSG_ERROR("No BSEventData available in get_hit_position_and_energy");
-    return std::make_tuple(0.0f, 0.0f, 0.0f);
-  }
-
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
-
-  if (layer_index >= event->event_data.size()) {
-    FCS_MSG_ERROR("Layer index out of bounds: " << layer_index << " >= "
-                                                << event->event_data.size());
-    return std::make_tuple(0.0f, 0.0f, 0.0f);
-  }
-
-  long unsigned int energy_index = get_energy_index(
-      simulstate, layer_index, hit_index);  // Get the bin index for the hit
-
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-
-  long unsigned int hits_per_bin;
-  if (energy_index == 0) {
-    hits_per_bin = hits_per_layer_ptr->at(layer_index).at(energy_index);
-  } else {
-    hits_per_bin = hits_per_layer_ptr->at(layer_index).at(energy_index)
-        - hits_per_layer_ptr->at(layer_index).at(energy_index - 1);
-  }
-
-  float r, alpha;
-
-  layer_t& layer = event->event_data.at(layer_index);
-
-  std::tie(r, alpha) = get_coordinates(
-      simulstate, layer_index, layer.bin_index_vector.at(energy_index));
-
-  float E = layer.E_vector.at(energy_index) * e_init / hits_per_bin;
-
-  return std::make_tuple(r, alpha, E);
+  if (layer_index >= m_coordinates.size())
+    return 0;
+  return m_coordinates[layer_index].R_lower.size();
 }
 
-void TFCSBinnedShower::delete_event(TFCSSimulationState& simulstate) const
+void TFCSBinnedShower::get_bin_boundaries(long unsigned int layer_index,
+                                          long unsigned int bin_index,
+                                          float& R_min,
+                                          float& R_max,
+                                          float& alpha_min,
+                                          float& alpha_max) const
 {
-  // Delete the event data
-  void* event_ptr = simulstate.getAuxInfo<void*>("BSEventData"_FCShash);
-  if (event_ptr) {
-    delete static_cast<event_t*>(event_ptr);
-    simulstate.setAuxInfo<void*>("BSEventData"_FCShash, nullptr);
-  }
-
-  void* n_hits_ptr = simulstate.getAuxInfo<void*>("BSNHits"_FCShash);
-  if (n_hits_ptr) {
-    delete static_cast<std::vector<std::vector<long unsigned int>>*>(
-        n_hits_ptr);
-    simulstate.setAuxInfo<void*>("BSNHits"_FCShash, nullptr);
-  }
-
-  void* elayer_ptr = simulstate.getAuxInfo<void*>("BSELayer"_FCShash);
-  if (elayer_ptr) {
-    delete static_cast<std::vector<float>*>(elayer_ptr);
-    simulstate.setAuxInfo<void*>("BSELayer"_FCShash, nullptr);
-  }
+  const layer_bins_t& bins = m_coordinates.at(layer_index);
+  R_min = bins.R_lower.at(bin_index);
+  R_max = R_min + bins.R_size.at(bin_index);
+  alpha_min = bins.alpha_lower.at(bin_index);
+  alpha_max = alpha_min + bins.alpha_size.at(bin_index);
 }
 
 void TFCSBinnedShower::load_event_library(
     const std::string& filename,
     std::vector<long unsigned int>& layers,
-    bool only_load_meta_data)
+    bool only_load_meta_data,
+    unsigned int n_threads)
 {
   if (!only_load_meta_data) {
     m_eventlibrary.clear();
+    m_library_view.reset();
+    m_library_cache.reset();
   }
 
   m_coordinates.clear();
+  clear_projections();
 
   if (m_use_upscaling) {
     m_sub_bin_distribution.clear();
+    reset_upscaling_sampler();
   }
 
+  // Open the HDF5 file once for all datasets
+  H5::H5File file(filename, H5F_ACC_RDONLY);
+
   // layer dependent variables
   for (long unsigned int layer_index : layers) {
     FCS_MSG_INFO("Loading layer " << layer_index << " from file: " << filename);
 
     // Load the bin boundaries for this layer
-    load_bin_boundaries(filename, layer_index);
+    load_bin_boundaries(file, layer_index);
+  }
 
-    if (!only_load_meta_data) {
-      // Load the layer energies
-      load_layer_energy(filename, layer_index);
-    }
+  if (!only_load_meta_data && !is_on_demand_loading()) {
+    // Load the layer energies
+    load_layer_energies(file, layers, n_threads);
   }
 
-  if ((m_use_event_cherry_picking || m_use_eta_matching)
-      && !only_load_meta_data)
+  if (!only_load_meta_data && is_on_demand_loading()) {
+    // Only the matching information is read now, the events when they
+    // are used
+    m_library_cache = TFCSEventLibraryCache::Open(
+        filename, layers, m_on_demand_cache_mb << 20);
+    if (m_library_cache && (m_use_event_cherry_picking || m_use_eta_matching))
+    {
+      reset_library_index();
+      library_index(m_use_event_cherry_picking);
+    }
+  } else if ((m_use_event_cherry_picking || m_use_eta_matching)
+             && !only_load_meta_data)
   {
-    load_shower_center_information(filename);
+    load_shower_center_information(file);
+    reset_library_index();
+    library_index(m_use_event_cherry_picking);
   }
 
   return;
 }
 
 std::tuple<std::vector<float>, std::vector<hsize_t>, bool>
-TFCSBinnedShower::load_hdf5_dataset(const std::string& filename,
+TFCSBinnedShower::load_hdf5_dataset(H5::H5File& file,
                                     const std::string& datasetname)
 {
-  // Open the HDF5 file and dataset
-  H5::H5File file(filename, H5F_ACC_RDONLY);
-
   // check if the dataset exists
   if (!file.exists(datasetname)) {
     return std::make_tuple(
@@ -631,56 +599,122 @@ TFCSBinnedShower::load_hdf5_dataset(const std::string& filename,
   // Read the dataset into a buffer
   std::vector<float> data(totalSize);
   dataset.read(data.data(), H5::PredType::NATIVE_FLOAT);
-  file.close();
   return std::make_tuple(data, dims_out, true);
 }
 
-void TFCSBinnedShower::load_layer_energy(const std::string& filename,
-                                         long unsigned int layer_index)
+void TFCSBinnedShower::load_layer_energies(
+    H5::H5File& file,
+    const std::vector<long unsigned int>& layers,
+    unsigned int n_threads)
 {
-  std::string datasetname = "energy_layer_" + std::to_string(layer_index);
-
-  std::vector<float> data;
-  std::vector<hsize_t> dims;
-  bool success;
-  std::tie(data, dims, success) = load_hdf5_dataset(filename, datasetname);
-  if (!success) {
-    FCS_MSG_ERROR("Error while extracting the layer energy for layer "
-                  << layer_index << " from " << filename << ".");
-    return;
-  }
+  const auto start = std::chrono::steady_clock::now();
 
-  // Store the data in the event library
-  std::vector<unsigned int> bin_index_vector;
-  std::vector<float> E_vector;
-
-  for (size_t i = 0; i < data.size(); ++i) {
-    long unsigned int event_index = i / dims.at(1);
-    float bin_index = i % dims.at(1);
-
-    if (bin_index == 0) {
-      bin_index_vector.clear();
-      E_vector.clear();
+  // The events are sized before decoding, so that the layers can be filled
+  // into them concurrently
+  std::vector<long unsigned int> layers_with_data;
+  hsize_t n_events = 0;
+  long unsigned int n_layers = 0;
+  for (long unsigned int layer_index : layers) {
+    std::string datasetname = "energy_layer_" + std::to_string(layer_index);
+    hsize_t dims[2] = {0, 0};
+    if (file.exists(datasetname)) {
+      H5::DataSpace space = file.openDataSet(datasetname).getSpace();
+      if (space.getSimpleExtentNdims() == 2)
+        space.getSimpleExtentDims(dims);
     }
-
-    if (data.at(i) != 0.0) {
-      bin_index_vector.push_back(bin_index);
-      E_vector.push_back(data.at(i));
+    if (dims[1] == 0) {
+      FCS_MSG_ERROR("Error while extracting the layer energy for layer "
+                    << layer_index << " from " << file.getFileName() << ".");
+      continue;
     }
+    layers_with_data.push_back(layer_index);
+    n_events = std::max(n_events, dims[0]);
+    n_layers = std::max(n_layers, layer_index + 1);
+  }
+  if (layers_with_data.empty())
+    return;
 
-    if (bin_index
-        == dims.at(1)
-            - 1)  // True for the last voxel of the event in this layer
-    {
-      set_layer_energy(event_index, layer_index, bin_index_vector, E_vector);
+  if (n_events > m_eventlibrary.size())
+    m_eventlibrary.resize(n_events);
+  for (event_t& event : m_eventlibrary)
+    if (event.event_data.size() < n_layers)
+      event.event_data.resize(n_layers);
+  reset_library_index();
+
+  if (n_threads == 0)
+    n_threads = std::thread::hardware_concurrency();
+  if (n_threads == 0 || n_threads > layers_with_data.size())
+    n_threads = layers_with_data.size();
+
+  // HDF5 is not thread-safe, the datasets are read one after the other on
+  // this thread. The dense layers are decoded meanwhile, at most n_threads
+  // of them are kept in memory
+  std::deque<std::future<void>> decoding;
+  double MB = 0;
+  for (std::size_t i = 0; i < layers_with_data.size(); ++i) {
+    const long unsigned int layer_index = layers_with_data[i];
+    if (decoding.size() >= n_threads) {
+      decoding.front().get();
+      decoding.pop_front();
     }
+
+    const auto read_start = std::chrono::steady_clock::now();
+    std::string datasetname = "energy_layer_" + std::to_string(layer_index);
+    auto data = std::make_shared<std::vector<float>>();
+    std::vector<hsize_t> dims;
+    bool success;
+    std::tie(*data, dims, success) = load_hdf5_dataset(file, datasetname);
+    const double read_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                      - read_start)
+            .count();
+    const double layer_MB = data->size() * sizeof(float) / 1e6;
+    MB += layer_MB;
+    FCS_MSG_INFO("Read layer " << layer_index << " (" << i + 1 << "/"
+                               << layers_with_data.size() << "): "
+                               << layer_MB << " MB in " << read_seconds
+                               << " s");
+
+    const hsize_t n_bins = dims.at(1);
+    eventvector_t& library = m_eventlibrary;
+    decoding.push_back(std::async(
+        std::launch::async,
+        [data, n_bins, layer_index, &library]()
+        {
+          const std::size_t n_layer_events = data->size() / n_bins;
+          for (std::size_t event = 0; event < n_layer_events; ++event) {
+            layer_t& layer = library[event].event_data[layer_index];
+            layer.bin_index_vector.clear();
+            layer.E_vector.clear();
+            const float* energies = data->data() + event * n_bins;
+            for (hsize_t bin = 0; bin < n_bins; ++bin) {
+              if (energies[bin] != 0.0) {
+                layer.bin_index_vector.push_back(bin);
+                layer.E_vector.push_back(energies[bin]);
+              }
+            }
+          }
+        }));
   }
+  for (std::future<void>& layer : decoding)
+    layer.get();
+
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  FCS_MSG_INFO("Loaded " << n_events << " events in "
+                         << layers_with_data.size() << " layers from "
+                         << file.getFileName() << ": " << MB << " MB in "
+                         << seconds << " s (" << MB / seconds
+                         << " MB/s) with " << n_threads
+                         << " decoding threads");
 }
 
-void TFCSBinnedShower::load_bin_boundaries(const std::string& filename,
+void TFCSBinnedShower::load_bin_boundaries(H5::H5File& file,
                                            long unsigned int layer_index)
 {
   // Assert that the layer index is valid
+  clear_projections();
   if (layer_index >= m_coordinates.size()) {
     m_coordinates.resize(layer_index + 1);
   }
@@ -695,10 +729,10 @@ void TFCSBinnedShower::load_bin_boundaries(const std::string& filename,
     std::vector<float> data;
     std::vector<hsize_t> dims;
     bool success;
-    std::tie(data, dims, success) = load_hdf5_dataset(filename, datasetname);
+    std::tie(data, dims, success) = load_hdf5_dataset(file, datasetname);
     if (!success) {
       FCS_MSG_ERROR("Error while extracting the bin boundaries for layer "
-                    << layer_index << " from " << filename << "."
+                    << layer_index << " from " << file.getFileName() << "."
                     << "Specifically, the key " << datasetname
                     << " could not be loaded.");
       return;
@@ -723,12 +757,8 @@ void TFCSBinnedShower::load_bin_boundaries(const std::string& filename,
   }
 }
 
-void TFCSBinnedShower::load_shower_center_information(
-    const std::string& filename)
+void TFCSBinnedShower::load_shower_center_information(H5::H5File& file)
 {
-  // Open the HDF5 file
-  H5::H5File file(filename, H5F_ACC_RDONLY);
-
   // Open the dataset
   std::vector<std::string> datasetnames = {
       "phi_mod", "center_eta", "incident_energy"};
@@ -738,7 +768,7 @@ void TFCSBinnedShower::load_shower_center_information(
     std::vector<float> data;
     std::vector<hsize_t> dims;
     bool success;
-    std::tie(data, dims, success) = load_hdf5_dataset(filename, datasetname);
+    std::tie(data, dims, success) = load_hdf5_dataset(file, datasetname);
     if (!success) {
       if (datasetname == "phi_mod" && m_use_eta_matching) {
         // We do not necessarily need the phi_mod for eta matching, so we can
@@ -747,7 +777,7 @@ void TFCSBinnedShower::load_shower_center_information(
       } else {
         FCS_MSG_ERROR(
             "Error while extracting the shower center information from "
-            << filename << "."
+            << file.getFileName() << "."
             << "Specifically, the key " << datasetname
             << " could not be loaded.");
       }
@@ -772,25 +802,223 @@ void TFCSBinnedShower::load_shower_center_information(
   }
 }
 
+bool TFCSBinnedShower::convert_event_library(
+    const std::string& hdf5_file,
+    const std::string& library_file,
+    const std::vector<long unsigned int>& layers)
+{
+  try {
+    H5::H5File file(hdf5_file, H5F_ACC_RDONLY);
+    return write_event_library(file, hdf5_file, library_file, layers);
+  } catch (const H5::Exception& e) {
+    ::Error("TFCSBinnedShower::convert_event_library",
+            "Could not read %s: %s",
+            hdf5_file.c_str(),
+            e.getCDetailMsg());
+    return false;
+  }
+}
+
+// Declared with the library file format in TFCSEventLibraryFile.h
+bool convert_event_library(const std::string& hdf5_file,
+                           const std::string& library_file,
+                           const std::vector<long unsigned int>& layers)
+{
+  return TFCSBinnedShower::convert_event_library(
+      hdf5_file, library_file, layers);
+}
+
+bool TFCSBinnedShower::write_event_library(
+    H5::H5File& file,
+    const std::string& hdf5_file,
+    const std::string& library_file,
+    const std::vector<long unsigned int>& layers)
+{
+  // The number of events is the same in all layers
+  hsize_t n_events = 0;
+  long unsigned int n_layers = 0;
+  std::vector<long unsigned int> stored_layers;
+  for (long unsigned int layer_index : layers) {
+    std::string datasetname = "energy_layer_" + std::to_string(layer_index);
+    if (!file.exists(datasetname)) {
+      ::Info("TFCSBinnedShower::convert_event_library",
+             "No data for layer %lu in %s",
+             layer_index,
+             hdf5_file.c_str());
+      continue;
+    }
+    H5::DataSpace space = file.openDataSet(datasetname).getSpace();
+    hsize_t dims[2] = {0, 0};
+    if (space.getSimpleExtentNdims() == 2)
+      space.getSimpleExtentDims(dims);
+    if (dims[1] == 0 || (!stored_layers.empty() && dims[0] != n_events)) {
+      ::Error("TFCSBinnedShower::convert_event_library",
+              "%s in %s is no matrix with %llu events",
+              datasetname.c_str(),
+              hdf5_file.c_str(),
+              (unsigned long long)n_events);
+      return false;
+    }
+    n_events = dims[0];
+    n_layers = std::max(n_layers, layer_index + 1);
+    stored_layers.push_back(layer_index);
+  }
+
+  TFCSEventLibraryWriter writer(library_file, n_events, n_layers);
+  if (!writer.is_open())
+    return false;
+
+  // Matching information, optional for libraries that are sampled randomly
+  const std::vector<std::string> infonames = {
+      "phi_mod", "center_eta", "incident_energy"};
+  std::vector<std::vector<float>> info(infonames.size());
+  for (long unsigned int i = 0; i < infonames.size(); ++i) {
+    std::vector<hsize_t> dims;
+    bool success;
+    std::tie(info[i], dims, success) = load_hdf5_dataset(file, infonames[i]);
+    if (success && info[i].size() != n_events) {
+      ::Warning("TFCSBinnedShower::convert_event_library",
+                "%s in %s has %zu instead of %llu entries, not converted",
+                infonames[i].c_str(),
+                hdf5_file.c_str(),
+                info[i].size(),
+                (unsigned long long)n_events);
+      info[i].clear();
+    }
+  }
+  if (!writer.set_event_info(info[0], info[1], info[2]))
+    return false;
+
+  const std::vector<std::string> binnames = {"binstart_radius_layer_",
+                                             "binsize_radius_layer_",
+                                             "binstart_alpha_layer_",
+                                             "binsize_alpha_layer_"};
+  for (long unsigned int layer_index : stored_layers) {
+    std::vector<std::vector<float>> bins(binnames.size());
+    for (long unsigned int i = 0; i < binnames.size(); ++i) {
+      std::string datasetname = binnames[i] + std::to_string(layer_index);
+      std::vector<hsize_t> dims;
+      bool success;
+      std::tie(bins[i], dims, success) = load_hdf5_dataset(file, datasetname);
+      if (!success) {
+        ::Error("TFCSBinnedShower::convert_event_library",
+                "Could not load %s from %s",
+                datasetname.c_str(),
+                hdf5_file.c_str());
+        return false;
+      }
+    }
+
+    // Read the energies in blocks of events, only the voxels with energy
+    // of one layer are kept in memory
+    H5::DataSet dataset =
+        file.openDataSet("energy_layer_" + std::to_string(layer_index));
+    H5::DataSpace space = dataset.getSpace();
+    hsize_t dims[2];
+    space.getSimpleExtentDims(dims);
+    const hsize_t block = std::max<hsize_t>(1, (hsize_t(1) << 22) / dims[1]);
+    std::vector<std::uint64_t> offsets = {0};
+    std::vector<std::uint32_t> bin_index;
+    std::vector<float> E;
+    std::vector<float> data;
+    for (hsize_t first = 0; first < dims[0]; first += block) {
+      hsize_t count[2] = {std::min(block, dims[0] - first), dims[1]};
+      hsize_t start[2] = {first, 0};
+      space.selectHyperslab(H5S_SELECT_SET, count, start);
+      H5::DataSpace memspace(2, count);
+      data.resize(count[0] * count[1]);
+      dataset.read(data.data(), H5::PredType::NATIVE_FLOAT, memspace, space);
+      for (hsize_t event = 0; event < count[0]; ++event) {
+        for (hsize_t bin = 0; bin < dims[1]; ++bin) {
+          const float e_voxel = data[event * dims[1] + bin];
+          if (e_voxel != 0.0) {
+            bin_index.push_back(bin);
+            E.push_back(e_voxel);
+          }
+        }
+        offsets.push_back(bin_index.size());
+      }
+    }
+    if (!writer.add_layer(layer_index,
+                          offsets,
+                          bin_index,
+                          E,
+                          bins[0],
+                          bins[1],
+                          bins[2],
+                          bins[3]))
+      return false;
+    ::Info("TFCSBinnedShower::convert_event_library",
+           "Converted layer %lu with %zu voxels of %llu events",
+           layer_index,
+           E.size(),
+           (unsigned long long)n_events);
+  }
+
+  return writer.Close();
+}
+
+bool TFCSBinnedShower::load_event_library_file(const std::string& filename)
+{
+  std::shared_ptr<const TFCSEventLibraryFile> library =
+      TFCSEventLibraryFile::Open(filename);
+  if (!library) {
+    FCS_MSG_ERROR("Could not map the event library " << filename);
+    return false;
+  }
+
+  // The bin boundaries are small and copied, the events stay in the mapping
+  m_coordinates.clear();
+  clear_projections();
+  m_coordinates.resize(library->n_layers());
+  for (long unsigned int layer_index = 0; layer_index < library->n_layers();
+       ++layer_index)
+  {
+    layer_bins_t& bins = m_coordinates.at(layer_index);
+    library->bin_boundaries(layer_index,
+                            bins.R_lower,
+                            bins.R_size,
+                            bins.alpha_lower,
+                            bins.alpha_size);
+  }
+  eventvector_t().swap(m_eventlibrary);
+  m_library_cache.reset();
+  m_library_view = library;
+
+  reset_library_index();
+  if (m_use_event_cherry_picking || m_use_eta_matching)
+    library_index(m_use_event_cherry_picking);
+  FCS_MSG_INFO("Mapped event library of size " << n_library_events()
+                                               << " from " << filename);
+  return true;
+}
+
 void TFCSBinnedShower::Streamer(TBuffer& R__b)
 {
   // Stream an object of class TFCSBinnedShower
 
   if (R__b.IsReading()) {
     R__b.ReadClassBuffer(TFCSBinnedShower::Class(), this);
+    reset_upscaling_sampler();
 
     // Load the event library from file
-    if (!m_hdf5_file.empty()) {
+    if (!m_library_file.empty()) {
+      FCS_MSG_INFO("Mapping event library from " << m_library_file);
+      ((TFCSBinnedShower*)this)->load_event_library_file(m_library_file);
+    } else if (!m_hdf5_file.empty()) {
       std::vector<long unsigned int> layers;
       for (long unsigned int i = 0; i < m_geo->n_layers(); ++i) {
         layers.push_back(i);
       }
       FCS_MSG_INFO("Loading event library from " << m_hdf5_file);
       ((TFCSBinnedShower*)this)->load_event_library(m_hdf5_file, layers);
-      FCS_MSG_INFO("Size after loading" << m_eventlibrary.size());
+      FCS_MSG_INFO("Size after loading " << n_library_events());
     } else {
       FCS_MSG_INFO(
           "Using existing event library of size: " << m_eventlibrary.size());
+      reset_library_index();
+      if (m_use_event_cherry_picking || m_use_eta_matching)
+        library_index(m_use_event_cherry_picking);
     }
 
   } else {
@@ -874,4 +1102,6 @@ void TFCSBinnedShower::load_sub_bin_distribution(const std::string& filename)
 
   m_upscaling_energies = energies;
   m_sub_bin_distribution = data;
+  reset_upscaling_sampler();
+  upscaling_sampler();
 }
@@ -1,7 +1,10 @@
 // Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
+#include <unordered_map>
 
 #include "FastCaloSim/Core/TFCSBinnedShowerBase.h"
 
@@ -17,9 +20,20 @@
 #include "FastCaloSim/Core/TFCSTruthState.h"
 #include "FastCaloSim/Definitions/ParticleData.h"
 #include "FastCaloSim/Geometry/CaloGeo.h"
+#include "FastCaloSim/Geometry/Cell.h"
 #include "TBuffer.h"
 #include "TClass.h"
 
+namespace
+{
+// Projections kept at most, the oldest ones are dropped all at once
+constexpr std::size_t kMaxProjections = 1 << 14;
+
+// Distance of a hit to the closest cell at which it is dropped, as in
+// TFCSHitCellMapping
+constexpr double kMaxCellDistance = 0.005;
+}  // namespace
+
 //=============================================
 //======= TFCSBinnedShowerBase =========
 //=============================================
@@ -42,9 +56,29 @@ FCSReturnCode TFCSBinnedShowerBase::simulate(
 
   // select a random event from the library
   float eta_center, phi_center;
+  long unsigned int reference_layer_index;
+  get_event_center(extrapol, eta_center, phi_center, reference_layer_index);
+
+  // Fill the total energy and layer energies into simulstate
+  const float Einit = get_initial_energy(simulstate, truth);
+
+  // Reset the total energy
+  simulstate.set_E(0);
+
+  get_event(simulstate, eta_center, phi_center, Einit, reference_layer_index);
+
+  return fill_layer_energies(simulstate);
+}
+
+void TFCSBinnedShowerBase::get_event_center(
+    const TFCSExtrapolationState* extrapol,
+    float& eta_center,
+    float& phi_center,
+    long unsigned int& reference_layer_index) const
+{
   // NOTE: This is ATLAS specific
   // layer 2 is EMB2
-  long unsigned int reference_layer_index = 2;
+  reference_layer_index = 2;
   eta_center = extrapol->eta(reference_layer_index, Cell::SubPos::MID);
   if (eta_center > 1.4) {  // Endcap becomes more relevant
     // NOTE: This is ATLAS specific
@@ -54,21 +88,19 @@ FCSReturnCode TFCSBinnedShowerBase::simulate(
   // TODO: What about the endcap?
   eta_center = extrapol->eta(reference_layer_index, Cell::SubPos::MID);
   phi_center = extrapol->phi(reference_layer_index, Cell::SubPos::MID);
+}
 
-  // Fill the total energy and layer energies into simulstate
-  float Einit;
-  const float Ekin = truth->Ekin();
-
+float TFCSBinnedShowerBase::get_initial_energy(
+    const TFCSSimulationState& simulstate, const TFCSTruthState* truth) const
+{
   if (OnlyScaleEnergy())
-    Einit = simulstate.E();
-  else
-    Einit = Ekin;
-
-  // Reset the total energy
-  simulstate.set_E(0);
-
-  get_event(simulstate, eta_center, phi_center, Einit, reference_layer_index);
+    return simulstate.E();
+  return truth->Ekin();
+}
 
+FCSReturnCode TFCSBinnedShowerBase::fill_layer_energies(
+    TFCSSimulationState& simulstate) const
+{
   for (long unsigned int layer_index = 0; layer_index < m_geo->n_layers();
        ++layer_index)
   {
@@ -87,6 +119,235 @@ FCSReturnCode TFCSBinnedShowerBase::simulate(
   return FCSSuccess;
 }
 
+void TFCSBinnedShowerBase::EventScratch_t::clear()
+{
+  event_index = -1;
+  e_init = 0;
+  n_hits.clear();
+  layer_begin.clear();
+  elayer.clear();
+  hit_voxel = HitVoxel_t();
+  upscaling.reset();
+}
+
+void TFCSBinnedShowerBase::begin_hits(EventScratch_t& scratch) const
+{
+  scratch.n_hits.clear();
+  scratch.elayer.clear();
+  scratch.layer_begin.assign(1, 0);
+  scratch.hit_voxel = HitVoxel_t();
+
+  // The energy interpolation of the upscaling only depends on the particle
+  scratch.upscaling = upscaling_sampler();
+  if (scratch.upscaling)
+    scratch.upscaling_weights = scratch.upscaling->weights(scratch.e_init);
+}
+
+void TFCSBinnedShowerBase::add_layer_hits(EventScratch_t& scratch,
+                                          const float* E,
+                                          long unsigned int n_voxels) const
+{
+  const float e_init = scratch.e_init;
+  long unsigned int n_hits = 0;
+  float elayer = 0.0f;
+  for (long unsigned int i = 0; i < n_voxels; ++i) {
+    const float e_voxel = E[i];
+    long unsigned int hits_per_bin = 0;
+    if (e_voxel > std::numeric_limits<float>::epsilon()) {
+      hits_per_bin =
+          std::min(std::max(int(e_voxel * e_init / m_default_hit_energy), 1),
+                   m_max_hits_per_voxel);
+      elayer += e_voxel * e_init;
+    }
+    n_hits += hits_per_bin;
+    scratch.n_hits.push_back(n_hits);
+  }
+  scratch.elayer.push_back(elayer);
+  scratch.layer_begin.push_back(scratch.n_hits.size());
+}
+
+bool TFCSBinnedShowerBase::find_hit_voxel(
+    const EventScratch_t& scratch,
+    long unsigned int layer_index,
+    long unsigned int hit_index,
+    long unsigned int& voxel_index,
+    long unsigned int& hits_in_voxel) const
+{
+  if (layer_index >= scratch.n_layers()) {
+    FCS_MSG_ERROR("Layer index out of bounds: " << layer_index << " >= "
+                                                << scratch.n_layers());
+    return false;
+  }
+
+  // The first voxel whose cumulative number of hits exceeds the hit index
+  auto begin = scratch.n_hits.begin() + scratch.layer_begin[layer_index];
+  auto end = scratch.n_hits.begin() + scratch.layer_begin[layer_index + 1];
+  auto it = std::upper_bound(begin, end, hit_index);
+  if (it == end) {
+    FCS_MSG_ERROR("Hit " << hit_index << " out of bounds in layer "
+                         << layer_index << " with "
+                         << (begin == end ? 0 : *(end - 1)) << " hits");
+    return false;
+  }
+
+  voxel_index = std::distance(begin, it);
+  hits_in_voxel = it == begin ? *it : *it - *(it - 1);
+  return true;
+}
+
+bool TFCSBinnedShowerBase::first_hit_voxel(TFCSSimulationState& simulstate,
+                                           long unsigned int layer_index,
+                                           HitVoxel_t& voxel) const
+{
+  const EventScratch_t& scratch = event_scratch(simulstate);
+  voxel = HitVoxel_t();
+  if (layer_index >= scratch.n_layers())
+    return false;
+  voxel.layer_index = layer_index;
+  voxel.voxels = get_layer_voxels(simulstate, layer_index);
+  return load_hit_voxel(scratch, 0, voxel);
+}
+
+bool TFCSBinnedShowerBase::next_hit_voxel(TFCSSimulationState& simulstate,
+                                          HitVoxel_t& voxel) const
+{
+  const EventScratch_t& scratch = event_scratch(simulstate);
+  if (voxel.layer_index >= scratch.n_layers())
+    return false;
+  return load_hit_voxel(scratch, voxel.voxel_index + 1, voxel);
+}
+
+bool TFCSBinnedShowerBase::load_hit_voxel(const EventScratch_t& scratch,
+                                          long unsigned int voxel_index,
+                                          HitVoxel_t& voxel) const
+{
+  const long unsigned int begin = scratch.layer_begin[voxel.layer_index];
+  const long unsigned int n_voxels =
+      scratch.layer_begin[voxel.layer_index + 1] - begin;
+  const long unsigned int* n_hits = scratch.n_hits.data() + begin;
+
+  for (; voxel_index < n_voxels; ++voxel_index) {
+    const long unsigned int first_hit =
+        voxel_index > 0 ? n_hits[voxel_index - 1] : 0;
+    if (n_hits[voxel_index] == first_hit)
+      continue;
+    if (voxel_index >= voxel.voxels.size) {
+      FCS_MSG_ERROR("Voxel index out of bounds: " << voxel_index << " >= "
+                                                  << voxel.voxels.size);
+      break;
+    }
+    voxel.voxel_index = voxel_index;
+    voxel.first_hit = first_hit;
+    voxel.end_hit = n_hits[voxel_index];
+    voxel.bin_index = voxel.voxels.bin_index[voxel_index];
+    get_bin_boundaries(voxel.layer_index,
+                       voxel.bin_index,
+                       voxel.R_min,
+                       voxel.R_max,
+                       voxel.alpha_min,
+                       voxel.alpha_max);
+    voxel.E = voxel.voxels.E[voxel_index] * scratch.e_init / voxel.n_hits();
+    voxel.upscaled = scratch.upscaling != nullptr;
+    if (voxel.upscaled) {
+      voxel.upscaling = scratch.upscaling->voxel(
+          scratch.upscaling_weights, voxel.layer_index, voxel.bin_index);
+    }
+    return true;
+  }
+
+  // No further hits in the layer
+  voxel.voxel_index = n_voxels;
+  voxel.first_hit = voxel.end_hit = 0;
+  return false;
+}
+
+const TFCSBinnedShowerBase::HitVoxel_t* TFCSBinnedShowerBase::hit_voxel(
+    TFCSSimulationState& simulstate,
+    long unsigned int layer_index,
+    long unsigned int hit_index) const
+{
+  EventScratch_t& scratch = event_scratch(simulstate);
+  HitVoxel_t& voxel = scratch.hit_voxel;
+  if (voxel.n_hits() > 0 && voxel.layer_index == layer_index) {
+    if (voxel.contains(hit_index))
+      return &voxel;
+    // The next voxel with hits starts with the hit after the last one
+    if (hit_index == voxel.end_hit && next_hit_voxel(simulstate, voxel))
+      return &voxel;
+  }
+
+  // Hits out of order and the first hit of a layer
+  long unsigned int voxel_index, hits_in_voxel;
+  voxel = HitVoxel_t();
+  if (!find_hit_voxel(
+          scratch, layer_index, hit_index, voxel_index, hits_in_voxel))
+  {
+    return nullptr;
+  }
+  voxel.layer_index = layer_index;
+  voxel.voxels = get_layer_voxels(simulstate, layer_index);
+  if (!load_hit_voxel(scratch, voxel_index, voxel))
+    return nullptr;
+  return &voxel;
+}
+
+std::tuple<float, float> TFCSBinnedShowerBase::get_hit_position(
+    TFCSSimulationState& simulstate, const HitVoxel_t& voxel) const
+{
+  float R_min = voxel.R_min;
+  float R_max = voxel.R_max;
+  float alpha_min = voxel.alpha_min;
+  float alpha_max = voxel.alpha_max;
+  if (voxel.upscaled) {
+    TFCSUpscalingSampler::sample(simulstate.randomEngine(),
+                                 voxel.upscaling,
+                                 R_min,
+                                 R_max,
+                                 alpha_min,
+                                 alpha_max);
+  }
+  return sample_hit_position(simulstate, R_min, R_max, alpha_min, alpha_max);
+}
+
+std::tuple<float, float> TFCSBinnedShowerBase::sample_hit_position(
+    TFCSSimulationState& simulstate,
+    float R_min,
+    float R_max,
+    float alpha_min,
+    float alpha_max) const
+{
+  float R;
+  if (TMath::Abs(R_max - R_min) > std::numeric_limits<float>::epsilon()) {
+    R = CLHEP::RandFlat::shoot(simulstate.randomEngine(), R_min, R_max);
+  } else {
+    R = R_min;  // If the range is too small, just use the minimum value
+  }
+  float alpha =
+      CLHEP::RandFlat::shoot(simulstate.randomEngine(), alpha_min, alpha_max);
+
+  return std::make_tuple(R, alpha);
+}
+
+long unsigned int TFCSBinnedShowerBase::get_n_hits(
+    TFCSSimulationState& simulstate, long unsigned int layer_index) const
+{
+  const EventScratch_t& scratch = event_scratch(simulstate);
+  if (layer_index >= scratch.n_layers())
+    return 0;
+  const long unsigned int begin = scratch.layer_begin[layer_index];
+  const long unsigned int end = scratch.layer_begin[layer_index + 1];
+  return end > begin ? scratch.n_hits[end - 1] : 0;
+}
+
+float TFCSBinnedShowerBase::get_layer_energy(
+    TFCSSimulationState& simulstate, long unsigned int layer_index) const
+{
+  const EventScratch_t& scratch = event_scratch(simulstate);
+  if (layer_index >= scratch.n_layers())
+    return 0.0f;
+  return scratch.elayer[layer_index];
+}
+
 FCSReturnCode TFCSBinnedShowerBase::simulate_hit(
     Hit& hit,
     TFCSSimulationState& simulstate,
@@ -96,6 +357,9 @@ FCSReturnCode TFCSBinnedShowerBase::simulate_hit(
   // Extrapol unused, but needed for the interface
   (void)extrapol;
 
+  if (is_projected_layer(calosample()))
+    return simulate_projection(hit, simulstate, truth);
+
   const int pdgId = truth->pdgid();
   const float charge = ParticleData::charge(pdgId);
   long unsigned int layer_index = calosample();
@@ -112,12 +376,14 @@ FCSReturnCode TFCSBinnedShowerBase::simulate_hit(
   const float eta_jakobi = TMath::Abs(2.0 * TMath::Exp(-center_eta)
                                       / (1.0 + TMath::Exp(-2 * center_eta)));
 
-  long unsigned int hit_index = hit.idx();
-
-  // Get necessary the hit information
-  float r, alpha, E;
-  std::tie(r, alpha, E) =
-      get_hit_position_and_energy(simulstate, layer_index, hit_index);
+  // Get the voxel of the hit, for hits in order it was already found for
+  // one of the previous hits
+  float r = 0, alpha = 0, E = 0;
+  const HitVoxel_t* voxel = hit_voxel(simulstate, layer_index, hit.idx());
+  if (voxel) {
+    std::tie(r, alpha) = get_hit_position(simulstate, *voxel);
+    E = voxel->E;
+  }
 
   hit.reset();
   hit.set_E(E);
@@ -171,3 +437,231 @@ FCSReturnCode TFCSBinnedShowerBase::simulate_hit(
 
   return FCSSuccess;
 }
+
+FCSReturnCode TFCSBinnedShowerBase::simulate_projection(
+    Hit& hit,
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth) const
+{
+  const int pdgId = truth->pdgid();
+  const float charge = ParticleData::charge(pdgId);
+  const long unsigned int layer_index = calosample();
+  const float center_eta = hit.center_eta();
+  const float center_phi = hit.center_phi();
+  const bool flip_phi = (charge < 0. && pdgId != 11) || pdgId == -11;
+
+  hit.reset();
+  hit.set_eta_x(center_eta);
+  hit.set_phi_y(center_phi);
+  hit.set_deposited();
+
+  // The first hit of the layer deposits all voxels and carries the layer
+  // energy, so that chains that simulate hits until the layer energy is
+  // reached stop after it. Any further hit deposits nothing. The hits are
+  // marked as deposited, so that a cell mapping later in the chain skips
+  // them. The index restarts at 0 for every simulation of the layer, also
+  // after a rollback
+  if (hit.idx() > 0)
+    return FCSSuccess;
+
+  const Position center_pos {0, 0, 0, center_eta, center_phi, 0};
+  const Cell& center_cell = m_geo->get_cell(layer_index, center_pos);
+  std::shared_ptr<const Projection_t> projection = get_projection(
+      layer_index, center_cell, center_eta, center_phi, flip_phi);
+
+  // Find the cells of the projection around the actual central cell
+  std::vector<unsigned long long>& cell_ids =
+      simulstate.getScratch<std::vector<unsigned long long>>(
+          "BSProjectionCells"_FCShash);
+  cell_ids.resize(projection->cell_eta.size());
+  for (std::size_t i = 0; i < cell_ids.size(); ++i) {
+    const Position pos {
+        0,
+        0,
+        0,
+        projection->cell_eta[i],
+        TVector2::Phi_mpi_pi(center_cell.phi() + projection->cell_dphi[i]),
+        0};
+    cell_ids[i] = m_geo->get_cell(layer_index, pos).id();
+  }
+
+  // Same energies as the hits of a voxel together
+  const float e_init = event_scratch(simulstate).e_init;
+  const TFCSEventLibraryFile::Voxels_t voxels =
+      get_layer_voxels(simulstate, layer_index);
+  const long unsigned int n_bins = projection->offsets.size() - 1;
+  double E_sum = 0;
+  for (std::size_t i = 0; i < voxels.size; ++i) {
+    const float e_voxel = voxels.E[i];
+    const std::uint32_t bin = voxels.bin_index[i];
+    if (e_voxel <= std::numeric_limits<float>::epsilon() || bin >= n_bins)
+      continue;
+    for (std::uint32_t j = projection->offsets[bin];
+         j < projection->offsets[bin + 1];
+         ++j)
+    {
+      const float E = e_voxel * e_init * projection->fraction[j];
+      simulstate.deposit(cell_ids[projection->cell[j]], E);
+      E_sum += E;
+    }
+  }
+
+  FCS_MSG_VERBOSE("Projected " << voxels.size << " voxels with E=" << E_sum
+                               << " into " << cell_ids.size()
+                               << " cells in layer " << layer_index);
+
+  hit.set_E(simulstate.E(layer_index));
+  return FCSSuccess;
+}
+
+std::shared_ptr<const TFCSBinnedShowerBase::Projection_t>
+TFCSBinnedShowerBase::get_projection(long unsigned int layer_index,
+                                     const Cell& center_cell,
+                                     float center_eta,
+                                     float center_phi,
+                                     bool flip_phi) const
+{
+  // Bin of the shower center within its cell
+  const int n_offset = m_projection_offset_bins;
+  auto offset_bin = [n_offset](double low, double position, double size)
+  {
+    if (!(size > 0))
+      return 0;
+    const int bin = std::floor((position - low) / size * n_offset);
+    return std::min(std::max(bin, 0), n_offset - 1);
+  };
+  const double eta_low = center_cell.eta() - 0.5 * center_cell.deta();
+  const double phi_low = center_cell.phi() - 0.5 * center_cell.dphi();
+  const int eta_bin = offset_bin(eta_low, center_eta, center_cell.deta());
+  const int phi_bin = offset_bin(
+      phi_low,
+      phi_low + TVector2::Phi_mpi_pi(center_phi - phi_low),
+      center_cell.dphi());
+  const bool flip_eta = center_eta < 0.;
+
+  const ProjectionKey_t key(layer_index,
+                            std::llround(center_cell.eta() * 1e5),
+                            eta_bin,
+                            phi_bin,
+                            flip_eta,
+                            flip_phi);
+  {
+    std::lock_guard<std::mutex> lock(m_projection_mutex);
+    auto it = m_projections.find(key);
+    if (it != m_projections.end())
+      return it->second;
+  }
+
+  // Build the projection for the center of the bin, without holding the lock
+  const double eta = eta_low + (eta_bin + 0.5) / n_offset * center_cell.deta();
+  const double phi = phi_low + (phi_bin + 0.5) / n_offset * center_cell.dphi();
+  std::shared_ptr<const Projection_t> projection = build_projection(
+      layer_index, center_cell, eta, phi, flip_eta, flip_phi);
+
+  std::lock_guard<std::mutex> lock(m_projection_mutex);
+  if (m_projections.size() >= kMaxProjections)
+    m_projections.clear();
+  // Another thread might have built the same projection meanwhile
+  return m_projections.emplace(key, projection).first->second;
+}
+
+std::shared_ptr<const TFCSBinnedShowerBase::Projection_t>
+TFCSBinnedShowerBase::build_projection(long unsigned int layer_index,
+                                       const Cell& center_cell,
+                                       float eta,
+                                       float phi,
+                                       bool flip_eta,
+                                       bool flip_phi) const
+{
+  // Radius and z of the shower center, from the depth of the cell
+  double center_r, center_z;
+  if (m_geo->is_barrel(layer_index)) {
+    center_r = center_cell.r();
+    center_z = center_r * std::sinh(eta);
+  } else {
+    center_z = center_cell.z();
+    center_r = std::abs(eta) > std::numeric_limits<float>::epsilon()
+        ? center_z / std::sinh(eta)
+        : center_cell.r();
+  }
+  const float dist000 =
+      TMath::Sqrt(center_r * center_r + center_z * center_z);
+  const float eta_jakobi =
+      TMath::Abs(2.0 * TMath::Exp(-eta) / (1.0 + TMath::Exp(-2 * eta)));
+
+  auto projection = std::make_shared<Projection_t>();
+  std::unordered_map<unsigned long long, std::uint32_t> cell_index;
+  std::vector<std::pair<std::uint32_t, int>> counts;
+
+  const long unsigned int n_bins = get_n_bins(layer_index);
+  const int n_samples = m_projection_samples;
+  projection->offsets.reserve(n_bins + 1);
+  projection->offsets.push_back(0);
+  for (long unsigned int bin = 0; bin < n_bins; ++bin) {
+    float R_min, R_max, alpha_min, alpha_max;
+    get_bin_boundaries(layer_index, bin, R_min, R_max, alpha_min, alpha_max);
+
+    // Sample the voxel on a regular grid, like the hits uniformly in R and
+    // alpha, and place the points as in simulate_hit()
+    counts.clear();
+    for (int i = 0; i < n_samples; ++i) {
+      const float r = R_min + (i + 0.5f) / n_samples * (R_max - R_min);
+      for (int j = 0; j < n_samples; ++j) {
+        const float alpha =
+            alpha_min + (j + 0.5f) / n_samples * (alpha_max - alpha_min);
+        float delta_eta_mm = r * cos(alpha);
+        float delta_phi_mm = r * sin(alpha);
+        if (flip_eta)
+          delta_eta_mm = -delta_eta_mm;
+        if (flip_phi)
+          delta_phi_mm = -delta_phi_mm;
+        const Position pos {
+            0,
+            0,
+            0,
+            eta + delta_eta_mm / eta_jakobi / dist000,
+            TVector2::Phi_mpi_pi(phi + delta_phi_mm / center_r),
+            0};
+
+        const Cell& cell = m_geo->get_cell(layer_index, pos);
+        if (cell.boundary_proximity(pos) >= kMaxCellDistance)
+          continue;
+        auto inserted = cell_index.emplace(cell.id(), cell_index.size());
+        if (inserted.second) {
+          projection->cell_eta.push_back(cell.eta());
+          projection->cell_dphi.push_back(
+              TVector2::Phi_mpi_pi(cell.phi() - center_cell.phi()));
+        }
+        const std::uint32_t index = inserted.first->second;
+        auto count = std::find_if(
+            counts.begin(),
+            counts.end(),
+            [index](const std::pair<std::uint32_t, int>& c)
+            { return c.first == index; });
+        if (count == counts.end())
+          counts.emplace_back(index, 1);
+        else
+          ++count->second;
+      }
+    }
+
+    // Points outside of all cells lose their energy, like dropped hits
+    for (const std::pair<std::uint32_t, int>& count : counts) {
+      projection->cell.push_back(count.first);
+      projection->fraction.push_back(static_cast<float>(count.second)
+                                     / (n_samples * n_samples));
+    }
+    projection->offsets.push_back(projection->cell.size());
+  }
+
+  FCS_MSG_DEBUG("Built projection of " << n_bins << " bins into "
+                                       << projection->cell_eta.size()
+                                       << " cells in layer " << layer_index);
+  return projection;
+}
+
+void TFCSBinnedShowerBase::clear_projections()
+{
+  std::lock_guard<std::mutex> lock(m_projection_mutex);
+  m_projections.clear();
+}
@@ -3,6 +3,7 @@
 #include <cmath>
 #include <cstdlib>
 #include <regex>
+#include <unordered_set>
 
 #include "FastCaloSim/Core/TFCSBinnedShowerONNX.h"
 
@@ -57,25 +58,121 @@ void TFCSBinnedShowerONNX::get_event(
   (void)reference_layer_index;  // Unused parameter
   (void)phi_center;  // Unused parameter
 
-  const TFCSMLCalorimeterSimulator::event_t& event =
-      m_ai_simulator->getEvent(simulstate, eta_center, e_init);
+  store_event(simulstate,
+              m_ai_simulator->getEvent(simulstate, eta_center, e_init),
+              e_init);
+}
 
-  // Store a pointer to the event
-  TFCSMLCalorimeterSimulator::event_t* event_ptr =
-      new TFCSMLCalorimeterSimulator::event_t(event);
-  simulstate.setAuxInfo<void*>("BSEventData"_FCShash, event_ptr);
-  simulstate.setAuxInfo<float>("BSEinit"_FCShash, e_init);
+void TFCSBinnedShowerONNX::store_event(
+    TFCSSimulationState& simulstate,
+    TFCSMLCalorimeterSimulator::event_t&& event,
+    float e_init) const
+{
+  // Move the event into its scratch slot
+  simulstate.getScratch<TFCSMLCalorimeterSimulator::event_t>(
+      "BSONNXEvent"_FCShash) = std::move(event);
+  EventScratch_t& scratch = event_scratch(simulstate);
+  scratch.event_index = 0;
+  scratch.e_init = e_init;
 
   compute_n_hits_and_elayer(simulstate);
 }
 
+bool TFCSBinnedShowerONNX::prefetch(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  if (!m_ai_simulator || !truth || !extrapol || OnlyScaleEnergy())
+    return false;
+  float eta_center, phi_center;
+  long unsigned int reference_layer_index;
+  get_event_center(extrapol, eta_center, phi_center, reference_layer_index);
+  return m_ai_simulator->submitEvent(
+      simulstate, eta_center, get_initial_energy(simulstate, truth));
+}
+
+void TFCSBinnedShowerONNX::simulate_batch(
+    const std::vector<TFCSSimulationState*>& simulstates,
+    const std::vector<const TFCSTruthState*>& truths,
+    const std::vector<const TFCSExtrapolationState*>& extrapols,
+    std::vector<FCSReturnCode>& return_codes,
+    const TFCSParametrizationBase* hit_chain) const
+{
+  const std::size_t n = simulstates.size();
+  return_codes.assign(n, FCSFatal);
+  if (truths.size() != n || extrapols.size() != n) {
+    FCS_MSG_ERROR("simulate_batch(): need one truth and extrapolation per "
+                  "simulation state");
+    return;
+  }
+  if (!m_ai_simulator) {
+    FCS_MSG_ERROR("simulate_batch(): no simulator loaded");
+    return;
+  }
+
+  const std::size_t depth = pipeline_depth();
+  if (depth > 0) {
+    // The noise of the next particles is drawn before the hits of the
+    // current one, which only keeps the random numbers of each particle
+    // the same if they come from separate engines
+    std::unordered_set<const void*> engines;
+    for (TFCSSimulationState* simulstate : simulstates) {
+      if (!engines.insert(simulstate->randomEngine()).second) {
+        FCS_MSG_ERROR("simulate_batch(): a pipeline depth > 0 needs a "
+                      "separate random engine for each simulation state");
+        return;
+      }
+    }
+
+    // Keep the next depth particles in flight while simulating one
+    std::size_t next = 1;
+    for (std::size_t i = 0; i < n; ++i) {
+      for (; next < n && next <= i + depth; ++next)
+        prefetch(*simulstates[next], truths[next], extrapols[next]);
+      return_codes[i] = simulate(*simulstates[i], truths[i], extrapols[i]);
+      if (hit_chain && return_codes[i] == FCSSuccess)
+        return_codes[i] =
+            hit_chain->simulate(*simulstates[i], truths[i], extrapols[i]);
+    }
+    return;
+  }
+
+  // Same steps as in simulate(), but with the events generated together
+  std::vector<float> eta_centers(n);
+  std::vector<float> e_inits(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    TFCSSimulationState& simulstate = *simulstates[i];
+    delete_event(simulstate);
+    float phi_center;
+    long unsigned int reference_layer_index;
+    get_event_center(
+        extrapols[i], eta_centers[i], phi_center, reference_layer_index);
+    e_inits[i] = get_initial_energy(simulstate, truths[i]);
+    simulstate.set_E(0);
+  }
+
+  std::vector<TFCSMLCalorimeterSimulator::event_t> events =
+      m_ai_simulator->getEvents(simulstates, eta_centers, e_inits);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    store_event(*simulstates[i], std::move(events[i]), e_inits[i]);
+    return_codes[i] = fill_layer_energies(*simulstates[i]);
+    if (hit_chain && return_codes[i] == FCSSuccess)
+      return_codes[i] =
+          hit_chain->simulate(*simulstates[i], truths[i], extrapols[i]);
+  }
+}
+
 void TFCSBinnedShowerONNX::load_meta_data(
     const std::string& filename, std::vector<long unsigned int>& layers)
 {
   m_coordinates.clear();
+  clear_projections();
 
   if (m_use_upscaling) {
     m_sub_bin_distribution.clear();
+    reset_upscaling_sampler();
   }
 
   // layer dependent variables
@@ -129,6 +226,7 @@ void TFCSBinnedShowerONNX::load_bin_boundaries(const std::string& filename,
                                                long unsigned int layer_index)
 {
   // Assert that the layer index is valid
+  clear_projections();
   if (layer_index >= m_coordinates.size()) {
     m_coordinates.resize(layer_index + 1);
   }
@@ -178,6 +276,7 @@ void TFCSBinnedShowerONNX::Streamer(TBuffer& R__b)
 
   if (R__b.IsReading()) {
     R__b.ReadClassBuffer(TFCSBinnedShowerONNX::Class(), this);
+    reset_upscaling_sampler();
 
   } else {
     R__b.WriteClassBuffer(TFCSBinnedShowerONNX::Class(), this);
@@ -190,6 +289,7 @@ void TFCSBinnedShowerONNX::set_bin_boundaries(long unsigned int layer_index,
                                               std::vector<float> alpha_lower,
                                               std::vector<float> alpha_size)
 {
+  clear_projections();
   if (layer_index >= m_coordinates.size()) {
     m_coordinates.resize(layer_index + 1);
   }
@@ -202,335 +302,100 @@ void TFCSBinnedShowerONNX::set_bin_boundaries(long unsigned int layer_index,
 void TFCSBinnedShowerONNX::compute_n_hits_and_elayer(
     TFCSSimulationState& simulstate) const
 {
-  TFCSMLCalorimeterSimulator::event_t* event =
-      static_cast<TFCSMLCalorimeterSimulator::event_t*>(
-          simulstate.getAuxInfo<void*>("BSEventData"_FCShash));
-  if (!event) {
+  EventScratch_t& scratch = event_scratch(simulstate);
+  const TFCSMLCalorimeterSimulator::event_t* event =
+      simulstate.findScratch<TFCSMLCalorimeterSimulator::event_t>(
+          "BSONNXEvent"_FCShash);
+  if (!event || scratch.event_index < 0) {
     FCS_MSG_ERROR(
-        "compute_n_hits_and_elayer called without BSEventData; "
+        "compute_n_hits_and_elayer called without an event; "
         "get_event must run first");
     return;
   }
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
 
-  // Loop over all layers
-  long unsigned int n_layers = event->event_data.size();
-  std::vector<std::vector<long unsigned int>> hits_per_layer;
-  std::vector<float> elayer;
-  hits_per_layer.resize(n_layers);
-  elayer.resize(n_layers, 0.0f);
-
-  for (long unsigned int layer_index = 0; layer_index < n_layers; ++layer_index)
-  {
-    TFCSMLCalorimeterSimulator::layer_t& layer =
-        event->event_data.at(layer_index);
-
-    // Loop over all voxels in the layer
-    long unsigned int n_hits = 0;
-    for (float e_voxel : layer.E_vector) {
-      long unsigned int hits_per_bin;
-      if (e_voxel > std::numeric_limits<float>::epsilon()) {
-        hits_per_bin =
-            std::min(std::max(int(e_voxel * e_init / m_default_hit_energy), 1),
-                     m_max_hits_per_voxel);
-        elayer.at(layer_index) += e_voxel * e_init;
-
-      } else {
-        hits_per_bin = 0;
-      }
-      n_hits += hits_per_bin;
-      hits_per_layer.at(layer_index).push_back(n_hits);
-    }
-  }
-  // Store the hits per layer vector
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      new std::vector<std::vector<long unsigned int>>(hits_per_layer);
-  simulstate.setAuxInfo<void*>("BSNHits"_FCShash, hits_per_layer_ptr);
-
-  // Store the energy per layer
-  std::vector<float>* elayer_ptr = new std::vector<float>(elayer);
-  simulstate.setAuxInfo<void*>("BSELayer"_FCShash, elayer_ptr);
+  begin_hits(scratch);
+  for (const TFCSMLCalorimeterSimulator::layer_t& layer : event->event_data)
+    add_layer_hits(scratch, layer.E_vector.data(), layer.E_vector.size());
 }
 
-long unsigned int TFCSBinnedShowerONNX::get_n_hits(
-    TFCSSimulationState& simulstate, long unsigned int layer_index) const
+std::shared_ptr<const TFCSUpscalingSampler>
+TFCSBinnedShowerONNX::upscaling_sampler() const
 {
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-
-  if (!hits_per_layer_ptr) {
-    FCS_MSG_ERROR("Invalid hits per layer information");
-    return 0;
-  }
-
-  return hits_per_layer_ptr->at(layer_index).back();
+  if (!m_use_upscaling)
+    return nullptr;
+  std::shared_ptr<const TFCSUpscalingSampler> sampler =
+      std::atomic_load(&m_upscaling_sampler);
+  if (sampler)
+    return sampler;
+
+  std::lock_guard<std::mutex> lock(m_upscaling_sampler_mutex);
+  sampler = std::atomic_load(&m_upscaling_sampler);
+  if (sampler)
+    return sampler;
+  sampler = std::make_shared<const TFCSUpscalingSampler>(
+      m_sub_bin_distribution, m_upscaling_energies);
+  std::atomic_store(&m_upscaling_sampler, sampler);
+  FCS_MSG_DEBUG("Built upscaling sampler for " << sampler->n_energies()
+                                               << " energies");
+  return sampler;
 }
 
-float TFCSBinnedShowerONNX::get_layer_energy(
-    TFCSSimulationState& simulstate, long unsigned int layer_index) const
+void TFCSBinnedShowerONNX::reset_upscaling_sampler()
 {
-  std::vector<float>* elayer_ptr = static_cast<std::vector<float>*>(
-      simulstate.getAuxInfo<void*>("BSELayer"_FCShash));
-  if (!elayer_ptr) {
-    FCS_MSG_ERROR("Invalid layer energy information");
-    return 0.0f;
-  }
-  if (layer_index >= elayer_ptr->size()) {
-    return 0.0f;
-  }
-
-  FCS_MSG_DEBUG("returning energy for layer " << layer_index << ": "
-                                              << elayer_ptr->at(layer_index));
-
-  return elayer_ptr->at(layer_index);
+  std::atomic_store(&m_upscaling_sampler,
+                    std::shared_ptr<const TFCSUpscalingSampler>());
 }
 
-long unsigned int TFCSBinnedShowerONNX::get_energy_index(
-    TFCSSimulationState& simulstate,
-    long unsigned int layer_index,
-    long unsigned int hit_index) const
+void TFCSBinnedShowerONNX::delete_event(TFCSSimulationState& simulstate) const
 {
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-  if (!hits_per_layer_ptr) {
-    FCS_MSG_ERROR("Invalid hits per layer information");
-    return 0;
-  }
-
-  if (layer_index >= hits_per_layer_ptr->size()) {
-    FCS_MSG_ERROR("Layer index out of bounds: " << layer_index << " >= "
-                                                << hits_per_layer_ptr->size());
-    return 0;
-  }
-
-  // Find the hit index in the hit vector for the given layer
-  const std::vector<long unsigned int>& hits =
-      hits_per_layer_ptr->at(layer_index);
-  auto it = std::upper_bound(hits.begin(), hits.end(), hit_index);
-  long unsigned int energy_index = std::distance(hits.begin(), it);
-
-  if (energy_index >= hits.size()) {
-    FCS_MSG_ERROR("Energy index out of bounds: " << energy_index
-                                                 << " >= " << hits.size());
-    // Print full hits for debugging
-    FCS_MSG_ERROR("Hits per layer: ");
-    for (const auto& hit : hits) {
-      FCS_MSG_ERROR("Hit: " << hit);
-    }
-    return 0;
-  }
-
-  return energy_index;
+  // The event stays in its scratch slot until the next one replaces it, so
+  // that its memory can be reused
+  event_scratch(simulstate).clear();
 }
 
-std::tuple<float, float> TFCSBinnedShowerONNX::get_coordinates(
-    TFCSSimulationState& simulstate,
-    long unsigned int layer_index,
-    int bin_index) const
+TFCSEventLibraryFile::Voxels_t TFCSBinnedShowerONNX::get_layer_voxels(
+    TFCSSimulationState& simulstate, long unsigned int layer_index) const
 {
-  float R_min = m_coordinates.at(layer_index).R_lower.at(bin_index);
-  float R_max = m_coordinates.at(layer_index).R_size.at(bin_index)
-      + m_coordinates.at(layer_index).R_lower.at(bin_index);
-
-  float alpha_min = m_coordinates.at(layer_index).alpha_lower.at(bin_index);
-  float alpha_max = m_coordinates.at(layer_index).alpha_size.at(bin_index)
-      + m_coordinates.at(layer_index).alpha_lower.at(bin_index);
-
-  if (m_use_upscaling) {
-    upscale(
-        simulstate, R_min, R_max, alpha_min, alpha_max, layer_index, bin_index);
-  }
-
-  float R = CLHEP::RandFlat::shoot(simulstate.randomEngine(), R_min, R_max);
-  float alpha =
-      CLHEP::RandFlat::shoot(simulstate.randomEngine(), alpha_min, alpha_max);
-
-  return std::make_tuple(R, alpha);
+  TFCSEventLibraryFile::Voxels_t voxels;
+  const TFCSMLCalorimeterSimulator::event_t* event =
+      simulstate.findScratch<TFCSMLCalorimeterSimulator::event_t>(
+          "BSONNXEvent"_FCShash);
+  if (!event || event_scratch(simulstate).event_index < 0
+      || layer_index >= event->event_data.size())
+  {
+    return voxels;
+  }
+  const TFCSMLCalorimeterSimulator::layer_t& layer =
+      event->event_data[layer_index];
+  voxels.bin_index = layer.bin_index_vector.data();
+  voxels.E = layer.E_vector.data();
+  voxels.size = std::min(layer.bin_index_vector.size(), layer.E_vector.size());
+  return voxels;
 }
 
-void TFCSBinnedShowerONNX::upscale(TFCSSimulationState& simulstate,
-                                   float& R_min,
-                                   float& R_max,
-                                   float& alpha_min,
-                                   float& alpha_max,
-                                   long unsigned int layer_index,
-                                   int bin_index) const
+long unsigned int TFCSBinnedShowerONNX::get_n_bins(
+    long unsigned int layer_index) const
 {
-  float p = CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, 1);
-
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
-  std::vector<float> available_energies = m_upscaling_energies;
-
-  unsigned int e_index = 0;
-
-  std::vector<float> probabilities = {0.25f, 0.5f, 0.75f};
-
-  if (available_energies.size() > 1) {
-    // find closest energy index using binary search
-    auto it = std::upper_bound(
-        available_energies.begin(), available_energies.end(), e_init);
-    if (it != available_energies.end()) {
-      e_index = std::distance(available_energies.begin(), it);
-    } else {
-      e_index = available_energies.size() - 1;
-    }
-
-    float e_high = available_energies.at(e_index);
-    if (e_high < e_init || e_index == 0) {
-      if (m_sub_bin_distribution.at(e_index).size() > layer_index) {
-        probabilities =
-            m_sub_bin_distribution.at(e_index).at(layer_index).at(bin_index);
-      }
-    } else {
-      if (m_sub_bin_distribution.at(e_index).size() > layer_index
-          && m_sub_bin_distribution.at(e_index - 1).size() > layer_index)
-      {
-        float e_low = available_energies.at(e_index - 1);
-        float f_low = std::log(e_high / e_init) / (std::log(e_high / e_low));
-        float f_high = 1 - f_low;
-        for (unsigned int i = 0; i < 3; ++i) {
-          float p_low = m_sub_bin_distribution.at(e_index - 1)
-                            .at(layer_index)
-                            .at(bin_index)
-                            .at(i);
-          float p_high = m_sub_bin_distribution.at(e_index)
-                             .at(layer_index)
-                             .at(bin_index)
-                             .at(i);
-          probabilities[i] = f_low * p_low + f_high * p_high;
-        }
-      }
-    }
-  }
-
-  else if (available_energies.size() == 1)
-  {
-    probabilities = m_sub_bin_distribution.at(0).at(layer_index).at(bin_index);
-  }
-
-  float p_alpha_low = probabilities[2] - probabilities[1] + probabilities[0];
-  float p_r;
-
-  if (p < p_alpha_low) {
-    alpha_max = (alpha_min + alpha_max) / 2.;
-    p_r = probabilities[0] / (p_alpha_low);
-  } else {
-    alpha_min = (alpha_min + alpha_max) / 2.;
-    p_r = (probabilities[1] - probabilities[0]) / (1 - p_alpha_low);
-  }
-
-  p = CLHEP::RandFlat::shoot(simulstate.randomEngine(), 0, 1);
-  if (layer_index != 2) {
-    // if ((layer_index != 2) && (layer_index != 0)) {
-    if (p > p_r) {
-      R_min = (R_min + R_max) / 2.;
-      return;
-    } else {
-      R_max = (R_min + R_max) / 2.;
-      return;
-    }
-  }
-
-  // Use linear interpolation for layer 2
-  // It works better than uniform sampling for the second layer...
-  if (p_r < 0.25) {
-    p_r = 0.25;  // Values below 0.25 are not allowed for linear pdf
-  } else if (p_r > 0.75) {
-    p_r = 0.75;  // Values above 0.75 are not allowed for linear pdf
-  } else if (TMath::Abs(p_r - 0.5) < std::numeric_limits<float>::epsilon()) {
-    return;  // Best upscaling is uniform sampling. Nothing to do here.
-  }
-
-  // Inverse CDF for linear pdf
-  float r = (1. - 4. * p_r) / (2. - 4. * p_r)
-      - TMath::Sqrt(((1. - 4. * p_r) / (2. - 4. * p_r))
-                        * ((1. - 4. * p_r) / (2. - 4. * p_r))
-                    + p / ((1. / 2.) - p_r));
-  if (r < 0) {
-    r = (1. - 4. * p_r) / (2. - 4. * p_r)
-        + TMath::Sqrt(((1. - 4. * p_r) / (2. - 4. * p_r))
-                          * ((1. - 4. * p_r) / (2. - 4. * p_r))
-                      + p / ((1. / 2.) - p_r));
-  }
-
-  R_min = R_min + r / 2 * (R_max - R_min);
-  R_max = R_min;
+  if (layer_index >= m_coordinates.size())
+    return 0;
+  return m_coordinates[layer_index].R_lower.size();
 }
 
-std::tuple<float, float, float>
-TFCSBinnedShowerONNX::get_hit_position_and_energy(
-    TFCSSimulationState& simulstate,
+void TFCSBinnedShowerONNX::get_bin_boundaries(
     long unsigned int layer_index,
-    long unsigned int hit_index) const
+    long unsigned int bin_index,
+    float& R_min,
+    float& R_max,
+    float& alpha_min,
+    float& alpha_max) const
 {
-  TFCSMLCalorimeterSimulator::event_t* event =
-      static_cast<TFCSMLCalorimeterSimulator::event_t*>(
-          simulstate.getAuxInfo<void*>("BSEventData"_FCShash));
-  if (!event) {
-    FCS_MSG_ERROR("No BSEventData available in get_hit_position_and_energy");
-    return std::make_tuple(0.0f, 0.0f, 0.0f);
-  }
-
-  float e_init = simulstate.getAuxInfo<float>("BSEinit"_FCShash);
-
-  if (layer_index >= event->event_data.size()) {
-    FCS_MSG_ERROR("Layer index out of bounds: " << layer_index << " >= "
-                                                << event->event_data.size());
-    return std::make_tuple(0.0f, 0.0f, 0.0f);
-  }
-
-  long unsigned int energy_index = get_energy_index(
-      simulstate, layer_index, hit_index);  // Get the bin index for the hit
-
-  std::vector<std::vector<long unsigned int>>* hits_per_layer_ptr =
-      static_cast<std::vector<std::vector<long unsigned int>>*>(
-          simulstate.getAuxInfo<void*>("BSNHits"_FCShash));
-
-  long unsigned int hits_per_bin;
-  if (energy_index == 0) {
-    hits_per_bin = hits_per_layer_ptr->at(layer_index).at(energy_index);
-  } else {
-    hits_per_bin = hits_per_layer_ptr->at(layer_index).at(energy_index)
-        - hits_per_layer_ptr->at(layer_index).at(energy_index - 1);
-  }
-
-  float r, alpha;
-
-  TFCSMLCalorimeterSimulator::layer_t& layer =
-      event->event_data.at(layer_index);
-
-  std::tie(r, alpha) = get_coordinates(
-      simulstate, layer_index, layer.bin_index_vector.at(energy_index));
-
-  float E = layer.E_vector.at(energy_index) * e_init / hits_per_bin;
-
-  return std::make_tuple(r, alpha, E);
+  const layer_bins_t& bins = m_coordinates.at(layer_index);
+  R_min = bins.R_lower.at(bin_index);
+  R_max = R_min + bins.R_size.at(bin_index);
+  alpha_min = bins.alpha_lower.at(bin_index);
+  alpha_max = alpha_min + bins.alpha_size.at(bin_index);
 }
 
-void TFCSBinnedShowerONNX::delete_event(TFCSSimulationState& simulstate) const
-{
-  // Delete the event data
-  void* event_ptr = simulstate.getAuxInfo<void*>("BSEventData"_FCShash);
-  if (event_ptr) {
-    delete static_cast<TFCSMLCalorimeterSimulator::event_t*>(event_ptr);
-    simulstate.setAuxInfo<void*>("BSEventData"_FCShash, nullptr);
-  }
-
-  void* n_hits_ptr = simulstate.getAuxInfo<void*>("BSNHits"_FCShash);
-  if (n_hits_ptr) {
-    delete static_cast<std::vector<std::vector<long unsigned int>>*>(
-        n_hits_ptr);
-    simulstate.setAuxInfo<void*>("BSNHits"_FCShash, nullptr);
-  }
-
-  void* elayer_ptr = simulstate.getAuxInfo<void*>("BSELayer"_FCShash);
-  if (elayer_ptr) {
-    delete static_cast<std::vector<float>*>(elayer_ptr);
-    simulstate.setAuxInfo<void*>("BSELayer"_FCShash, nullptr);
-  }
-}
 void TFCSBinnedShowerONNX::load_sub_bin_distribution(
     const std::string& filename)
 {
@@ -602,4 +467,6 @@ void TFCSBinnedShowerONNX::load_sub_bin_distribution(
 
   m_upscaling_energies = energies;
   m_sub_bin_distribution = data;
+  reset_upscaling_sampler();
+  upscaling_sampler();
 }
@@ -0,0 +1,428 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include "FastCaloSim/Core/TFCSConfigCache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FastCaloSim/Core/TFCSContentHash.h"
+#include "TError.h"
+#include "lwtnn/lightweight_network_config.hh"
+#include "lwtnn/parse_json.hh"
+
+std::atomic<unsigned int> TFCSConfigCache::s_hits {0};
+std::atomic<unsigned int> TFCSConfigCache::s_stored {0};
+
+namespace
+{
+/// Changes whenever the layout of the header or any payload changes
+const std::uint32_t format_version = 2;
+const char magic[4] = {'F', 'C', 'S', 'C'};
+
+/// The file name only has the FNV-1a hash, the SHA-256 digest makes sure
+/// that the entry belongs to the text
+struct Header_t
+{
+  char magic[4];
+  std::uint32_t version;
+  std::uint64_t hash;
+  TFCSContentHash::Digest digest;
+  std::uint64_t text_size;
+  std::uint64_t payload_size;
+};
+
+struct Mapping_t
+{
+  void* address;
+  std::size_t length;
+};
+
+std::mutex& directory_mutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::string& cache_directory()
+{
+  static std::string directory = []()
+  {
+    const char* value = std::getenv("FCS_CONFIG_CACHE_DIR");
+    return std::string(value ? value : "");
+  }();
+  return directory;
+}
+
+typedef TFCSConfigCache::Writer Writer;
+typedef TFCSConfigCache::Reader Reader;
+
+// Serialization of the lwtnn configurations. Plain values, strings and
+// maps of those are handled by Writer and Reader, the structures here.
+
+void put(Writer& out, const lwt::Input& input)
+{
+  out.write(input.name);
+  out.write(input.offset);
+  out.write(input.scale);
+}
+
+void get(Reader& in, lwt::Input& input)
+{
+  in.read(input.name);
+  in.read(input.offset);
+  in.read(input.scale);
+}
+
+void put(Writer& out, const lwt::ActivationConfig& activation)
+{
+  out.write<int>(static_cast<int>(activation.function));
+  out.write(activation.alpha);
+}
+
+void get(Reader& in, lwt::ActivationConfig& activation)
+{
+  activation.function = static_cast<lwt::Activation>(in.get<int>());
+  in.read(activation.alpha);
+}
+
+void put(Writer& out, const lwt::EmbeddingConfig& embedding)
+{
+  out.write(embedding.weights);
+  out.write(embedding.index);
+  out.write(embedding.n_out);
+}
+
+void get(Reader& in, lwt::EmbeddingConfig& embedding)
+{
+  in.read(embedding.weights);
+  in.read(embedding.index);
+  in.read(embedding.n_out);
+}
+
+void put(Writer& out, const lwt::LayerConfig& layer);
+void get(Reader& in, lwt::LayerConfig& layer);
+void put(Writer& out, const lwt::InputNodeConfig& node);
+void get(Reader& in, lwt::InputNodeConfig& node);
+void put(Writer& out, const lwt::NodeConfig& node);
+void get(Reader& in, lwt::NodeConfig& node);
+
+template<typename T>
+void put_list(Writer& out, const std::vector<T>& values)
+{
+  out.write<std::uint64_t>(values.size());
+  for (const T& value : values)
+    put(out, value);
+}
+
+template<typename T>
+void get_list(Reader& in, std::vector<T>& values, std::uint64_t size)
+{
+  // Every element takes at least one byte, so damaged sizes are found
+  // before allocating
+  if (size > in.remaining())
+    throw std::runtime_error("Damaged configuration cache entry");
+  values.resize(size);
+  for (T& value : values)
+    get(in, value);
+}
+
+void put(Writer& out, const lwt::LayerConfig& layer)
+{
+  out.write(layer.weights);
+  out.write(layer.bias);
+  out.write(layer.U);
+  put(out, layer.activation);
+  put(out, layer.inner_activation);
+  out.write(layer.go_backwards);
+  out.write(layer.return_sequence);
+  put_list(out, layer.sublayers);
+  out.write<std::uint64_t>(layer.components.size());
+  for (const auto& component : layer.components) {
+    out.write<int>(static_cast<int>(component.first));
+    put(out, component.second);
+  }
+  put_list(out, layer.embedding);
+  out.write<int>(static_cast<int>(layer.architecture));
+}
+
+void get(Reader& in, lwt::LayerConfig& layer)
+{
+  in.read(layer.weights);
+  in.read(layer.bias);
+  in.read(layer.U);
+  get(in, layer.activation);
+  get(in, layer.inner_activation);
+  in.read(layer.go_backwards);
+  in.read(layer.return_sequence);
+  get_list(in, layer.sublayers, in.get<std::uint64_t>());
+  layer.components.clear();
+  const std::uint64_t n_components = in.get<std::uint64_t>();
+  for (std::uint64_t i = 0; i < n_components; ++i) {
+    const int component = in.get<int>();
+    get(in, layer.components[static_cast<lwt::Component>(component)]);
+  }
+  get_list(in, layer.embedding, in.get<std::uint64_t>());
+  layer.architecture = static_cast<lwt::Architecture>(in.get<int>());
+}
+
+void put(Writer& out, const lwt::InputNodeConfig& node)
+{
+  out.write(node.name);
+  put_list(out, node.variables);
+  out.write(node.miscellaneous);
+  out.write(node.defaults);
+}
+
+void get(Reader& in, lwt::InputNodeConfig& node)
+{
+  in.read(node.name);
+  get_list(in, node.variables, in.get<std::uint64_t>());
+  in.read(node.miscellaneous);
+  in.read(node.defaults);
+}
+
+void put(Writer& out, const lwt::NodeConfig& node)
+{
+  out.write<int>(static_cast<int>(node.type));
+  out.write(node.sources);
+  out.write(node.index);
+}
+
+void get(Reader& in, lwt::NodeConfig& node)
+{
+  node.type = static_cast<lwt::NodeConfig::Type>(in.get<int>());
+  in.read(node.sources);
+  in.read(node.index);
+}
+
+void put(Writer& out, const lwt::GraphConfig& config)
+{
+  put_list(out, config.inputs);
+  put_list(out, config.input_sequences);
+  put_list(out, config.nodes);
+  out.write<std::uint64_t>(config.outputs.size());
+  for (const auto& output : config.outputs) {
+    out.write(output.first);
+    out.write(output.second.labels);
+    out.write<std::uint64_t>(output.second.node_index);
+  }
+  put_list(out, config.layers);
+}
+
+void get(Reader& in, lwt::GraphConfig& config)
+{
+  get_list(in, config.inputs, in.get<std::uint64_t>());
+  get_list(in, config.input_sequences, in.get<std::uint64_t>());
+  get_list(in, config.nodes, in.get<std::uint64_t>());
+  config.outputs.clear();
+  const std::uint64_t n_outputs = in.get<std::uint64_t>();
+  for (std::uint64_t i = 0; i < n_outputs; ++i) {
+    lwt::OutputNodeConfig& output = config.outputs[in.get<std::string>()];
+    in.read(output.labels);
+    output.node_index = in.get<std::uint64_t>();
+  }
+  get_list(in, config.layers, in.get<std::uint64_t>());
+}
+
+void put(Writer& out, const lwt::JSONConfig& config)
+{
+  put_list(out, config.layers);
+  put_list(out, config.inputs);
+  out.write(config.outputs);
+  out.write(config.defaults);
+  out.write(config.miscellaneous);
+}
+
+void get(Reader& in, lwt::JSONConfig& config)
+{
+  get_list(in, config.layers, in.get<std::uint64_t>());
+  get_list(in, config.inputs, in.get<std::uint64_t>());
+  in.read(config.outputs);
+  in.read(config.defaults);
+  in.read(config.miscellaneous);
+}
+
+/// Cached or freshly parsed configuration of either type
+template<typename Config, typename Parse>
+Config cached_config(const char* kind, const std::string& json, Parse parse)
+{
+  Config config;
+  if (TFCSConfigCache::enabled()) {
+    if (TFCSConfigCache::load(
+            kind, json, [&](Reader& in) { get(in, config); }))
+      return config;
+  }
+  std::stringstream json_stream(json);
+  config = parse(json_stream);
+  if (TFCSConfigCache::enabled()) {
+    Writer out;
+    put(out, config);
+    TFCSConfigCache::store(kind, json, out);
+  }
+  return config;
+}
+}  // namespace
+
+//=============================================
+//======= TFCSConfigCache =========
+//=============================================
+
+void TFCSConfigCache::setDirectory(const std::string& directory)
+{
+  std::lock_guard<std::mutex> lock(directory_mutex());
+  cache_directory() = directory;
+}
+
+std::string TFCSConfigCache::directory()
+{
+  std::lock_guard<std::mutex> lock(directory_mutex());
+  return cache_directory();
+}
+
+std::string TFCSConfigCache::entryPath(const std::string& kind,
+                                       const std::string& text)
+{
+  char name[64];
+  std::snprintf(name,
+                sizeof(name),
+                "_%016llx_%zu.fcscache",
+                static_cast<unsigned long long>(
+                    TFCSContentHash::fnv1a(text.data(), text.size())),
+                text.size());
+  return (std::filesystem::path(directory()) / (kind + name)).string();
+}
+
+void* TFCSConfigCache::map(const std::string& kind,
+                           const std::string& text,
+                           const char*& payload,
+                           std::size_t& size)
+{
+  const std::string path = entryPath(kind, text);
+  const int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return nullptr;
+  struct stat status;
+  if (::fstat(file, &status) != 0
+      || std::size_t(status.st_size) < sizeof(Header_t))
+  {
+    ::close(file);
+    return nullptr;
+  }
+  const std::size_t length = status.st_size;
+  void* address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+  // The mapping stays valid after closing the file
+  ::close(file);
+  if (address == MAP_FAILED)
+    return nullptr;
+
+  Header_t header;
+  std::memcpy(&header, address, sizeof(Header_t));
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+      || header.version != format_version
+      || header.hash != TFCSContentHash::fnv1a(text.data(), text.size())
+      || header.text_size != text.size()
+      || header.payload_size != length - sizeof(Header_t)
+      || header.digest != TFCSContentHash::sha256(text.data(), text.size()))
+  {
+    ::munmap(address, length);
+    return nullptr;
+  }
+  payload = static_cast<const char*>(address) + sizeof(Header_t);
+  size = header.payload_size;
+  return new Mapping_t {address, length};
+}
+
+void TFCSConfigCache::unmap(void* mapping,
+                            const std::string& kind,
+                            const std::string& text,
+                            bool success)
+{
+  Mapping_t* entry = static_cast<Mapping_t*>(mapping);
+  ::munmap(entry->address, entry->length);
+  delete entry;
+  if (success) {
+    ++s_hits;
+    return;
+  }
+  ::Warning("TFCSConfigCache::load",
+            "Damaged cache entry %s, parsing again",
+            entryPath(kind, text).c_str());
+}
+
+void TFCSConfigCache::store(const std::string& kind,
+                            const std::string& text,
+                            const Writer& payload)
+{
+  const std::string path = entryPath(kind, text);
+  std::error_code error;
+  std::filesystem::create_directories(directory(), error);
+  if (error) {
+    ::Warning("TFCSConfigCache::store",
+              "Can not create cache directory %s: %s",
+              directory().c_str(),
+              error.message().c_str());
+    return;
+  }
+
+  Header_t header;
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = format_version;
+  header.hash = TFCSContentHash::fnv1a(text.data(), text.size());
+  header.digest = TFCSContentHash::sha256(text.data(), text.size());
+  header.text_size = text.size();
+  header.payload_size = payload.data().size();
+
+  // Concurrent jobs write their own file, the rename is atomic
+  std::random_device random;
+  const std::string temporary = path + ".tmp" + std::to_string(::getpid())
+      + "_" + std::to_string(random());
+  {
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(payload.data().data(), payload.data().size());
+    if (!file) {
+      ::Warning("TFCSConfigCache::store",
+                "Can not write cache entry %s",
+                temporary.c_str());
+      file.close();
+      std::filesystem::remove(temporary, error);
+      return;
+    }
+  }
+  std::filesystem::rename(temporary, path, error);
+  if (error) {
+    ::Warning("TFCSConfigCache::store",
+              "Can not write cache entry %s: %s",
+              path.c_str(),
+              error.message().c_str());
+    std::filesystem::remove(temporary, error);
+    return;
+  }
+  ++s_stored;
+}
+
+lwt::GraphConfig TFCSConfigCache::graphConfig(const std::string& json)
+{
+  return cached_config<lwt::GraphConfig>(
+      "lwtnn_graph",
+      json,
+      [](std::istream& stream) { return lwt::parse_json_graph(stream); });
+}
+
+lwt::JSONConfig TFCSConfigCache::networkConfig(const std::string& json)
+{
+  return cached_config<lwt::JSONConfig>(
+      "lwtnn_network",
+      json,
+      [](std::istream& stream) { return lwt::parse_json(stream); });
+}
@@ -0,0 +1,655 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+
+#include "FastCaloSim/Core/TFCSDenseNetwork.h"
+
+#include <Eigen/Dense>
+
+#include "TError.h"
+#include "lwtnn/lightweight_network_config.hh"
+
+namespace
+{
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    RowMatrix;
+
+/// Floating point value of an environment variable, or fallback if unset
+double env_double(const char* name, double fallback)
+{
+  const char* value = std::getenv(name);
+  if (!value || !*value)
+    return fallback;
+  char* end = nullptr;
+  const double parsed = std::strtod(value, &end);
+  if (*end != '\0') {
+    ::Warning("TFCSDenseNetwork",
+              "Ignoring %s=%s, expected a number",
+              name,
+              value);
+    return fallback;
+  }
+  return parsed;
+}
+
+struct Settings_t
+{
+  std::atomic<bool> enabled;
+  std::atomic<double> tolerance;
+  /// Number of validation warnings printed so far
+  std::atomic<int> n_warnings {0};
+
+  Settings_t()
+      : enabled(env_double("FCS_LWTNN_DENSE", 1) != 0)
+      , tolerance(env_double("FCS_LWTNN_VALIDATE", 0))
+  {
+  }
+};
+
+Settings_t& settings()
+{
+  static Settings_t s;
+  return s;
+}
+
+const int max_warnings = 20;
+
+/// Same definition as in lwtnn, which cuts off at +-30
+inline float sigmoid(float x)
+{
+  if (x < -30)
+    return 0;
+  if (x > 30)
+    return 1;
+  return 1 / (1 + std::exp(-x));
+}
+
+/// Difference relative to the reference, absolute for small values
+inline double difference(double value, double reference)
+{
+  if (std::isnan(value) || std::isnan(reference))
+    return std::isnan(value) && std::isnan(reference) ? 0 : HUGE_VAL;
+  return std::abs(value - reference) / std::max(1.0, std::abs(reference));
+}
+
+bool report(const char* where, double max_difference, const std::string& at)
+{
+  const double tolerance = settings().tolerance.load();
+  if (max_difference <= tolerance)
+    return true;
+  const int n_warnings = settings().n_warnings.fetch_add(1);
+  if (n_warnings < max_warnings) {
+    ::Warning(where,
+              "Precompiled network differs from lwtnn by %g at %s, "
+              "tolerance %g",
+              max_difference,
+              at.c_str(),
+              tolerance);
+    if (n_warnings + 1 == max_warnings)
+      ::Warning(where, "Suppressing further validation warnings");
+  }
+  return false;
+}
+}  // namespace
+
+//=============================================
+//======= TFCSDenseNetwork =========
+//=============================================
+
+void TFCSDenseNetwork::setEnabled(bool enabled)
+{
+  settings().enabled.store(enabled);
+}
+
+bool TFCSDenseNetwork::enabled()
+{
+  return settings().enabled.load();
+}
+
+void TFCSDenseNetwork::setValidationTolerance(double tolerance)
+{
+  settings().tolerance.store(tolerance);
+}
+
+double TFCSDenseNetwork::validationTolerance()
+{
+  return settings().tolerance.load();
+}
+
+std::unique_ptr<TFCSDenseNetwork> TFCSDenseNetwork::compile(
+    const lwt::JSONConfig& config)
+{
+  std::unique_ptr<TFCSDenseNetwork> net(new TFCSDenseNetwork());
+  std::vector<std::string> names;
+  std::vector<double> offsets, scales;
+  for (const lwt::Input& input : config.inputs) {
+    names.push_back(input.name);
+    offsets.push_back(input.offset);
+    scales.push_back(input.scale);
+  }
+  std::size_t slot = net->addInput(names, offsets, scales);
+
+  std::string reason;
+  for (const lwt::LayerConfig& layer : config.layers) {
+    if (!net->addLayer(slot, layer, slot, reason)) {
+      ::Info("TFCSDenseNetwork::compile",
+             "Network not precompiled, %s",
+             reason.c_str());
+      return nullptr;
+    }
+  }
+  if (net->m_slots[slot].size != config.outputs.size()) {
+    ::Info("TFCSDenseNetwork::compile",
+           "Network not precompiled, %zu outputs for %zu labels",
+           net->m_slots[slot].size,
+           config.outputs.size());
+    return nullptr;
+  }
+  net->addOutput(slot, config.outputs);
+  return net;
+}
+
+std::unique_ptr<TFCSDenseNetwork> TFCSDenseNetwork::compile(
+    const lwt::GraphConfig& config)
+{
+  std::unique_ptr<TFCSDenseNetwork> net(new TFCSDenseNetwork());
+  std::string reason;
+  if (!config.input_sequences.empty())
+    reason = "sequence inputs are not supported";
+
+  std::vector<std::size_t> input_slots;
+  for (const lwt::InputNodeConfig& node : config.inputs) {
+    std::vector<std::string> names;
+    std::vector<double> offsets, scales;
+    for (const lwt::Input& input : node.variables) {
+      names.push_back(input.name);
+      offsets.push_back(input.offset);
+      scales.push_back(input.scale);
+    }
+    input_slots.push_back(net->addInput(names, offsets, scales));
+  }
+
+  // Nodes may refer to any other node, so they are built recursively.
+  // -1 marks nodes that are not built yet, -2 nodes being built
+  const long n_nodes = config.nodes.size();
+  std::vector<long> node_slots(n_nodes, -1);
+  std::function<long(long)> build = [&](long index) -> long
+  {
+    if (index < 0 || index >= n_nodes) {
+      reason = "graph refers to a missing node";
+      return -1;
+    }
+    if (node_slots[index] >= 0)
+      return node_slots[index];
+    if (node_slots[index] == -2) {
+      reason = "graph has a cycle";
+      return -1;
+    }
+    node_slots[index] = -2;
+
+    const lwt::NodeConfig& node = config.nodes[index];
+    long slot = -1;
+    switch (node.type) {
+      case lwt::NodeConfig::Type::INPUT: {
+        // For input nodes lwtnn stores the input number as the source
+        // and the size as the index
+        if (node.sources.size() != 1
+            || node.sources[0] >= input_slots.size()
+            || net->m_slots[input_slots[node.sources[0]]].size
+                != std::size_t(node.index))
+        {
+          reason = "input node does not match the inputs";
+          break;
+        }
+        slot = input_slots[node.sources[0]];
+        break;
+      }
+      case lwt::NodeConfig::Type::FEED_FORWARD: {
+        if (node.sources.size() != 1 || node.index < 0
+            || std::size_t(node.index) >= config.layers.size())
+        {
+          reason = "feed forward node without single source or layer";
+          break;
+        }
+        const long source = build(node.sources[0]);
+        std::size_t target = 0;
+        if (source >= 0
+            && net->addLayer(source, config.layers[node.index], target, reason))
+          slot = target;
+        break;
+      }
+      case lwt::NodeConfig::Type::CONCATENATE: {
+        std::vector<std::size_t> sources;
+        for (std::size_t source_node : node.sources) {
+          const long source = build(source_node);
+          if (source < 0)
+            return -1;
+          sources.push_back(source);
+        }
+        slot = net->addConcatenate(sources);
+        break;
+      }
+      default:
+        reason = "node type is not supported";
+        break;
+    }
+    node_slots[index] = slot;
+    return slot;
+  };
+
+  // lwtnn orders the outputs by name, like the handlers do
+  for (const auto& output : config.outputs) {
+    const long slot = reason.empty() ? build(output.second.node_index) : -1;
+    if (slot < 0)
+      break;
+    if (net->m_slots[slot].size != output.second.labels.size()) {
+      reason = "output " + output.first + " does not match its labels";
+      break;
+    }
+    net->addOutput(slot, output.second.labels);
+  }
+  if (!reason.empty()) {
+    ::Info("TFCSDenseNetwork::compile",
+           "Graph not precompiled, %s",
+           reason.c_str());
+    return nullptr;
+  }
+  return net;
+}
+
+std::size_t TFCSDenseNetwork::addSlot(std::size_t size)
+{
+  Slot_t slot;
+  slot.offset = m_bufferSize;
+  slot.size = size;
+  m_bufferSize += size;
+  m_slots.push_back(slot);
+  return m_slots.size() - 1;
+}
+
+std::size_t TFCSDenseNetwork::addInput(const std::vector<std::string>& names,
+                                       const std::vector<double>& offsets,
+                                       const std::vector<double>& scales)
+{
+  Step_t step;
+  step.type = kInput;
+  step.sources = {m_inputs.size()};
+  step.target = addSlot(names.size());
+  step.weights = m_params.size();
+  m_params.insert(m_params.end(), offsets.begin(), offsets.end());
+  m_params.insert(m_params.end(), scales.begin(), scales.end());
+  m_steps.push_back(step);
+
+  InputNode_t node;
+  node.slot = step.target;
+  node.sorted_index.resize(names.size());
+  std::iota(node.sorted_index.begin(), node.sorted_index.end(), 0);
+  std::sort(node.sorted_index.begin(),
+            node.sorted_index.end(),
+            [&](std::size_t a, std::size_t b) { return names[a] < names[b]; });
+  for (std::size_t index : node.sorted_index)
+    node.sorted_names.push_back(names[index]);
+  m_inputs.push_back(node);
+  return step.target;
+}
+
+bool TFCSDenseNetwork::addLayer(std::size_t source,
+                                const lwt::LayerConfig& layer,
+                                std::size_t& target,
+                                std::string& reason)
+{
+  if (!layer.sublayers.empty() || !layer.components.empty()) {
+    reason = "layer with sublayers or components";
+    return false;
+  }
+  const std::size_t n_in = m_slots[source].size;
+  Step_t step;
+  step.sources = {source};
+  std::size_t n_out = 0;
+
+  if (layer.architecture == lwt::Architecture::DENSE) {
+    if (n_in == 0 || layer.weights.empty() || layer.weights.size() % n_in != 0)
+    {
+      reason = "dense layer weights do not match its inputs";
+      return false;
+    }
+    n_out = layer.weights.size() / n_in;
+    if (!layer.bias.empty() && layer.bias.size() != n_out) {
+      reason = "dense layer bias does not match its weights";
+      return false;
+    }
+    step.type = kDense;
+    step.has_bias = !layer.bias.empty();
+
+    switch (layer.activation.function) {
+      case lwt::Activation::LINEAR:
+        step.activation = kLinear;
+        break;
+      case lwt::Activation::SIGMOID:
+        step.activation = kSigmoid;
+        break;
+      case lwt::Activation::HARD_SIGMOID:
+        step.activation = kHardSigmoid;
+        break;
+      case lwt::Activation::RECTIFIED:
+        step.activation = kRelu;
+        break;
+      case lwt::Activation::LEAKY_RELU:
+        step.activation = kLeakyRelu;
+        break;
+      case lwt::Activation::ELU:
+        step.activation = kElu;
+        break;
+      case lwt::Activation::SWISH:
+        step.activation = kSwish;
+        break;
+      case lwt::Activation::TANH:
+        step.activation = kTanh;
+        break;
+      case lwt::Activation::ABS:
+        step.activation = kAbs;
+        break;
+      case lwt::Activation::SOFTMAX:
+        step.activation = kSoftmax;
+        break;
+      default:
+        reason = "activation function is not supported";
+        return false;
+    }
+    step.alpha = layer.activation.alpha;
+  } else if (layer.architecture == lwt::Architecture::NORMALIZATION) {
+    // lwtnn applies (x + bias) * weights, without an activation
+    if (layer.weights.size() != n_in || layer.bias.size() != n_in) {
+      reason = "normalization layer does not match its inputs";
+      return false;
+    }
+    n_out = n_in;
+    step.type = kNormalization;
+    step.has_bias = true;
+  } else {
+    reason = "layer architecture is not supported";
+    return false;
+  }
+
+  // Weights are stored as lwtnn has them, row-major n_out x n_in
+  step.weights = m_params.size();
+  m_params.insert(m_params.end(), layer.weights.begin(), layer.weights.end());
+  step.bias = m_params.size();
+  m_params.insert(m_params.end(), layer.bias.begin(), layer.bias.end());
+  step.target = addSlot(n_out);
+  m_steps.push_back(step);
+  target = step.target;
+  return true;
+}
+
+std::size_t TFCSDenseNetwork::addConcatenate(
+    const std::vector<std::size_t>& sources)
+{
+  std::size_t size = 0;
+  for (std::size_t source : sources)
+    size += m_slots[source].size;
+  Step_t step;
+  step.type = kConcatenate;
+  step.sources = sources;
+  step.target = addSlot(size);
+  m_steps.push_back(step);
+  return step.target;
+}
+
+void TFCSDenseNetwork::addOutput(std::size_t slot,
+                                 const std::vector<std::string>& labels)
+{
+  OutputNode_t node;
+  node.slot = slot;
+  node.labels = labels;
+  m_outputs.push_back(node);
+}
+
+std::size_t TFCSDenseNetwork::inputSize(std::size_t node) const
+{
+  return m_slots[m_inputs.at(node).slot].size;
+}
+
+std::size_t TFCSDenseNetwork::outputSize(std::size_t node) const
+{
+  return m_slots[m_outputs.at(node).slot].size;
+}
+
+bool TFCSDenseNetwork::fillInput(std::size_t node,
+                                 const std::map<std::string, double>& values,
+                                 std::vector<float>& input) const
+{
+  const InputNode_t& input_node = m_inputs.at(node);
+  const std::size_t n_names = input_node.sorted_names.size();
+  input.resize(n_names);
+  // Both are sorted, so names are compared without any lookup
+  std::size_t i = 0;
+  for (const auto& value : values) {
+    if (i == n_names)
+      break;
+    const int order = value.first.compare(input_node.sorted_names[i]);
+    if (order < 0)
+      continue;
+    if (order > 0)
+      return false;
+    input[input_node.sorted_index[i]] = value.second;
+    ++i;
+  }
+  return i == n_names;
+}
+
+void TFCSDenseNetwork::computeBatch(TensorInputs const& inputs,
+                                    std::size_t n_batch,
+                                    TensorOutputs& outputs) const
+{
+  if (inputs.size() != m_inputs.size()) {
+    ::Error("TFCSDenseNetwork::computeBatch",
+            "Got %zu input nodes, the network has %zu",
+            inputs.size(),
+            m_inputs.size());
+    throw std::runtime_error("Wrong number of input nodes in computeBatch.");
+  }
+  for (std::size_t node = 0; node < inputs.size(); ++node) {
+    if (inputs[node].size != n_batch * inputSize(node)) {
+      ::Error("TFCSDenseNetwork::computeBatch",
+              "Input node %zu got %zu values, expected %zu",
+              node,
+              inputs[node].size,
+              n_batch * inputSize(node));
+      throw std::runtime_error("Wrong input node size in computeBatch.");
+    }
+  }
+
+  // One buffer per thread, shared by all networks and only ever grown
+  thread_local std::vector<float> buffer;
+  if (buffer.size() < m_bufferSize * n_batch)
+    buffer.resize(m_bufferSize * n_batch);
+
+  for (const Step_t& step : m_steps)
+    run(step, inputs, n_batch, buffer.data());
+
+  outputs.resize(m_outputs.size());
+  for (std::size_t node = 0; node < m_outputs.size(); ++node) {
+    const Slot_t& slot = m_slots[m_outputs[node].slot];
+    const float* values = buffer.data() + slot.offset * n_batch;
+    outputs[node].assign(values, values + slot.size * n_batch);
+  }
+}
+
+void TFCSDenseNetwork::run(const Step_t& step,
+                           TensorInputs const& inputs,
+                           std::size_t n_batch,
+                           float* buffer) const
+{
+  const Slot_t& target = m_slots[step.target];
+  float* out = buffer + target.offset * n_batch;
+  const std::size_t n_out = target.size;
+
+  switch (step.type) {
+    case kInput: {
+      const float* in = inputs[step.sources[0]].data;
+      const float* offsets = m_params.data() + step.weights;
+      const float* scales = offsets + n_out;
+      for (std::size_t row = 0; row < n_batch; ++row)
+        for (std::size_t i = 0; i < n_out; ++i)
+          out[row * n_out + i] =
+              (in[row * n_out + i] + offsets[i]) * scales[i];
+      break;
+    }
+    case kDense: {
+      const Slot_t& source = m_slots[step.sources[0]];
+      const std::size_t n_in = source.size;
+      const float* in = buffer + source.offset * n_batch;
+      Eigen::Map<const RowMatrix> weights(
+          m_params.data() + step.weights, n_out, n_in);
+      if (n_batch == 1) {
+        Eigen::Map<Eigen::VectorXf>(out, n_out).noalias() =
+            weights * Eigen::Map<const Eigen::VectorXf>(in, n_in);
+      } else {
+        Eigen::Map<RowMatrix>(out, n_batch, n_out).noalias() =
+            Eigen::Map<const RowMatrix>(in, n_batch, n_in)
+            * weights.transpose();
+      }
+      if (step.has_bias) {
+        Eigen::Map<const Eigen::VectorXf> bias(m_params.data() + step.bias,
+                                               n_out);
+        for (std::size_t row = 0; row < n_batch; ++row)
+          Eigen::Map<Eigen::VectorXf>(out + row * n_out, n_out) += bias;
+      }
+      activate(step, out, n_batch * n_out, n_out);
+      break;
+    }
+    case kNormalization: {
+      const float* in = buffer + m_slots[step.sources[0]].offset * n_batch;
+      const float* weights = m_params.data() + step.weights;
+      const float* bias = m_params.data() + step.bias;
+      for (std::size_t row = 0; row < n_batch; ++row)
+        for (std::size_t i = 0; i < n_out; ++i)
+          out[row * n_out + i] =
+              (in[row * n_out + i] + bias[i]) * weights[i];
+      break;
+    }
+    case kConcatenate: {
+      for (std::size_t row = 0; row < n_batch; ++row) {
+        float* row_out = out + row * n_out;
+        for (std::size_t source_slot : step.sources) {
+          const Slot_t& source = m_slots[source_slot];
+          const float* in = buffer + source.offset * n_batch;
+          std::memcpy(
+              row_out, in + row * source.size, source.size * sizeof(float));
+          row_out += source.size;
+        }
+      }
+      break;
+    }
+  }
+}
+
+void TFCSDenseNetwork::activate(const Step_t& step,
+                                float* values,
+                                std::size_t n_values,
+                                std::size_t row_size) const
+{
+  const float alpha = step.alpha;
+  switch (step.activation) {
+    case kLinear:
+      break;
+    case kSigmoid:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = sigmoid(values[i]);
+      break;
+    case kHardSigmoid:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = std::min(1.0f, std::max(0.0f, 0.2f * values[i] + 0.5f));
+      break;
+    case kRelu:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = values[i] > 0 ? values[i] : 0;
+      break;
+    case kLeakyRelu:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = values[i] > 0 ? values[i] : alpha * values[i];
+      break;
+    case kElu:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] =
+            values[i] >= 0 ? values[i] : alpha * (std::exp(values[i]) - 1);
+      break;
+    case kSwish:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = values[i] * sigmoid(alpha * values[i]);
+      break;
+    case kTanh:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = std::tanh(values[i]);
+      break;
+    case kAbs:
+      for (std::size_t i = 0; i < n_values; ++i)
+        values[i] = std::abs(values[i]);
+      break;
+    case kSoftmax:
+      // The maximum is subtracted to avoid overflows, lwtnn does not
+      // need this in double precision
+      for (float* row = values; row < values + n_values; row += row_size) {
+        const float max = *std::max_element(row, row + row_size);
+        float sum = 0;
+        for (std::size_t i = 0; i < row_size; ++i) {
+          row[i] = std::exp(row[i] - max);
+          sum += row[i];
+        }
+        for (std::size_t i = 0; i < row_size; ++i)
+          row[i] /= sum;
+      }
+      break;
+  }
+}
+
+bool TFCSDenseNetwork::validate(const char* where,
+                                TensorOutputs const& values,
+                                TensorOutputs const& reference)
+{
+  if (values.size() != reference.size())
+    return report(where, HUGE_VAL, "the number of output nodes");
+  double max_difference = 0;
+  std::string at;
+  for (std::size_t node = 0; node < values.size(); ++node) {
+    if (values[node].size() != reference[node].size())
+      return report(where, HUGE_VAL, "the size of an output node");
+    for (std::size_t i = 0; i < values[node].size(); ++i) {
+      const double diff = difference(values[node][i], reference[node][i]);
+      if (diff > max_difference) {
+        max_difference = diff;
+        at = "node " + std::to_string(node) + " value " + std::to_string(i);
+      }
+    }
+  }
+  return report(where, max_difference, at);
+}
+
+bool TFCSDenseNetwork::validate(const char* where,
+                                NetworkOutputs const& values,
+                                NetworkOutputs const& reference)
+{
+  if (values.size() != reference.size())
+    return report(where, HUGE_VAL, "the number of outputs");
+  double max_difference = 0;
+  std::string at;
+  for (const auto& value : values) {
+    const auto found = reference.find(value.first);
+    if (found == reference.end())
+      return report(where, HUGE_VAL, "output " + value.first);
+    const double diff = difference(value.second, found->second);
+    if (diff > max_difference) {
+      max_difference = diff;
+      at = "output " + value.first;
+    }
+  }
+  return report(where, max_difference, at);
+}
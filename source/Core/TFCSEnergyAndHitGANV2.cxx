@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <limits>
+#include <unordered_set>
 
 #include "FastCaloSim/Core/TFCSEnergyAndHitGANV2.h"
 
@@ -9,6 +10,8 @@
 
 #include "CLHEP/Random/RandFlat.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
+#include "FastCaloSim/Core/TFCSHitCellMapping.h"
+#include "FastCaloSim/Core/TFCSInferencePipeline.h"
 #include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitBase.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "FastCaloSim/Core/TFCSTruthState.h"
@@ -16,6 +19,16 @@
 #include "FastCaloSim/Geometry/CaloGeo.h"
 #include "TF1.h"
 
+namespace
+{
+// Positions and energies of the hits of a layer
+struct HitBatch_t
+{
+  std::vector<Position> positions;
+  std::vector<float> E;
+};
+}  // namespace
+
 //=============================================
 //======= TFCSEnergyAndHitGANV2 =========
 //=============================================
@@ -29,13 +42,92 @@ TFCSEnergyAndHitGANV2::TFCSEnergyAndHitGANV2(const char* name,
   set_GANfreemem();
 }
 
+struct TFCSEnergyAndHitGANV2::PipelineJob_t
+    : public TFCSInferencePipeline::Job
+{
+  const TFCSGANEtaSlice* slice = nullptr;
+  TFCSGANEtaSlice::NetworkInputs inputs;
+  double momentum = 0;
+  TFCSGANEtaSlice::NetworkOutputs outputs;
+
+  bool run() override
+  {
+    outputs = slice->GetNetworkOutputs(inputs, momentum);
+    return true;
+  };
+};
+
 TFCSEnergyAndHitGANV2::~TFCSEnergyAndHitGANV2()
 {
+  // Finish the evaluations before the networks are gone
+  delete m_pipeline;
   if (m_slice != nullptr) {
     delete m_slice;
   }
 }
 
+void TFCSEnergyAndHitGANV2::set_pipeline_depth(unsigned int depth)
+{
+  delete m_pipeline;
+  m_pipeline = depth > 0 ? new TFCSInferencePipeline(depth) : nullptr;
+}
+
+unsigned int TFCSEnergyAndHitGANV2::pipeline_depth() const
+{
+  return m_pipeline ? m_pipeline->max_pending() : 0;
+}
+
+void TFCSEnergyAndHitGANV2::set_model_precision(
+    TFCSONNXQuantization::Precision precision)
+{
+  m_model_precision = precision;
+  if (m_slice != nullptr && precision == TFCSONNXQuantization::kInt8
+      && !m_slice->QuantizeInt8())
+  {
+    FCS_MSG_ERROR("Could not quantize all GAN networks to int8, those that "
+                  "failed stay in single precision");
+  }
+}
+
+bool TFCSEnergyAndHitGANV2::prefetch(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  if (!m_pipeline || !truth || !extrapol || !m_slice
+      || !m_slice->IsGanCorrectlyLoaded())
+  {
+    return false;
+  }
+  auto job = std::make_shared<PipelineJob_t>();
+  job->slice = m_slice;
+  job->inputs = m_slice->GetNetworkInputs(truth, extrapol, simulstate);
+  job->momentum = truth->P();
+  return m_pipeline->submit(&simulstate, std::move(job));
+}
+
+TFCSGANEtaSlice::NetworkOutputs TFCSEnergyAndHitGANV2::GetNetworkOutputs(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  if (m_pipeline) {
+    bool ok = false;
+    auto job = std::static_pointer_cast<PipelineJob_t>(
+        m_pipeline->collect(&simulstate, ok));
+    if (job && ok && job->momentum == truth->P())
+      return std::move(job->outputs);
+    // The noise of the particle was drawn already, evaluating again would
+    // shift the random numbers of everything that follows
+    if (job) {
+      FCS_MSG_ERROR("Prefetched GAN evaluation failed or was done for "
+                    "another particle");
+      return {};
+    }
+  }
+  return m_slice->GetNetworkOutputs(truth, extrapol, simulstate);
+}
+
 bool TFCSEnergyAndHitGANV2::is_match_calosample(int calosample) const
 {
   if (get_Binning().find(calosample) == get_Binning().cend())
@@ -95,7 +187,7 @@ bool TFCSEnergyAndHitGANV2::initializeNetwork(
   m_param.Print();
   m_slice = new TFCSGANEtaSlice(pid, etaMin, etaMax, m_param);
   m_slice->Print();
-  return m_slice->LoadGAN();
+  return m_slice->LoadGAN(m_model_precision);
 }
 
 const std::string TFCSEnergyAndHitGANV2::get_variable_text(
@@ -139,9 +231,11 @@ bool TFCSEnergyAndHitGANV2::fillEnergy(
     return false;
   }
 
-  const TFCSGANEtaSlice::NetworkOutputs& outputs =
-      m_slice->GetNetworkOutputs(truth, extrapol, simulstate);
+  const TFCSGANEtaSlice::NetworkOutputs outputs =
+      GetNetworkOutputs(simulstate, truth, extrapol);
   FCS_MSG_VERBOSE("network outputs size: " << outputs.size());
+  if (outputs.empty())
+    return false;
 
   const TFCSGANXMLParameters::Binning& binsInLayers = m_param.GetBinning();
   const auto ganVersion = m_param.GetGANVersion();
@@ -278,6 +372,25 @@ bool TFCSEnergyAndHitGANV2::fillEnergy(
       }
     }
 
+    // If the hits only need to be mapped to cells, all hits of the layer are
+    // collected and deposited at once instead of running the chain per hit
+    const TFCSHitCellMapping* mapping = nullptr;
+    if (get_number_of_bins() > 0) {
+      const int bin = get_bin(simulstate, truth, extrapol);
+      if (bin >= 0 && bin < (int)get_number_of_bins()) {
+        const unsigned int ichain = m_bin_start[bin] + get_nr_of_init(bin);
+        if (ichain + 1 == m_bin_start[bin + 1]
+            && chain()[ichain]->IsA() == TFCSHitCellMapping::Class())
+        {
+          mapping = (const TFCSHitCellMapping*)(chain()[ichain]);
+        }
+      }
+    }
+    HitBatch_t& batch =
+        simulstate.getScratch<HitBatch_t>("GANHitBatch"_FCShash);
+    batch.positions.clear();
+    batch.E.clear();
+
     int binResolution = 5;
     if (layer == 1 || layer == 5) {
       binResolution = 1;
@@ -457,6 +570,13 @@ bool TFCSEnergyAndHitGANV2::fillEnergy(
                                         << " layer " << layer);
             }
 
+            if (mapping) {
+              batch.positions.push_back(
+                  Position {0, 0, 0, hit.eta(), hit.phi(), 0});
+              batch.E.push_back(hit.E());
+              continue;
+            }
+
             if (get_number_of_bins() > 0) {
               const int bin = get_bin(simulstate, truth, extrapol);
               if (bin >= 0 && bin < (int)get_number_of_bins()) {
@@ -510,6 +630,9 @@ bool TFCSEnergyAndHitGANV2::fillEnergy(
       }
     }
 
+    if (mapping)
+      mapping->simulate_hits(simulstate, batch.positions, batch.E);
+
     FCS_MSG_VERBOSE("Number of voxels " << vox);
     FCS_MSG_VERBOSE("Done layer " << layer);
   }
@@ -548,6 +671,46 @@ FCSReturnCode TFCSEnergyAndHitGANV2::simulate(
   return FCSSuccess;
 }
 
+void TFCSEnergyAndHitGANV2::simulate_batch(
+    const std::vector<TFCSSimulationState*>& simulstates,
+    const std::vector<const TFCSTruthState*>& truths,
+    const std::vector<const TFCSExtrapolationState*>& extrapols,
+    std::vector<FCSReturnCode>& return_codes) const
+{
+  const std::size_t n = simulstates.size();
+  return_codes.assign(n, FCSFatal);
+  if (truths.size() != n || extrapols.size() != n) {
+    FCS_MSG_ERROR("simulate_batch(): need one truth and extrapolation per "
+                  "simulation state");
+    return;
+  }
+
+  // Keep pipeline_depth() particles in flight, including the simulated one
+  const std::size_t depth = pipeline_depth();
+  // The noise of the next particles is drawn before the hits of the
+  // current one, which only keeps the random numbers of each particle
+  // the same if they come from separate engines
+  if (depth > 0) {
+    std::unordered_set<const void*> engines;
+    for (TFCSSimulationState* simulstate : simulstates) {
+      if (!engines.insert(simulstate->randomEngine()).second) {
+        FCS_MSG_ERROR("simulate_batch(): a pipeline depth > 0 needs a "
+                      "separate random engine for each simulation state");
+        return;
+      }
+    }
+  }
+  std::size_t next = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    for (; next < n && next < i + depth; ++next)
+      prefetch(*simulstates[next], truths[next], extrapols[next]);
+    return_codes[i] = simulate(*simulstates[i], truths[i], extrapols[i]);
+    // Not collected if the simulation failed before the GAN evaluation
+    if (m_pipeline)
+      m_pipeline->discard(simulstates[i]);
+  }
+}
+
 void TFCSEnergyAndHitGANV2::Print(Option_t* option) const
 {
   TFCSParametrization::Print(option);
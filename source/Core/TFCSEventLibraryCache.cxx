@@ -0,0 +1,293 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+
+#include "FastCaloSim/Core/TFCSEventLibraryCache.h"
+
+#include <H5Cpp.h>
+
+#include "TError.h"
+
+namespace
+{
+// HDF5 chunk cache of each layer dataset. Large enough for the chunks
+// holding a few rows of the usual chunk layouts, small enough for 24 layers
+// on a grid slot
+constexpr std::size_t kChunkCacheBytes = 4 << 20;
+constexpr std::size_t kChunkCacheSlots = 521;
+
+// Floats read from a dataset at once when prefetching
+constexpr std::size_t kReadFloats = 4 << 20;
+
+// Read a one dimensional dataset with one entry per event, false if it
+// does not exist or has another size
+bool read_event_info(H5::H5File& file,
+                     const std::string& name,
+                     std::size_t n_events,
+                     std::vector<float>& data)
+{
+  if (!file.exists(name))
+    return false;
+  H5::DataSet dataset = file.openDataSet(name);
+  if (dataset.getSpace().getSimpleExtentNpoints() != (hssize_t)n_events)
+    return false;
+  data.resize(n_events);
+  dataset.read(data.data(), H5::PredType::NATIVE_FLOAT);
+  return true;
+}
+}  // namespace
+
+struct TFCSEventLibraryCache::Hdf5_t
+{
+  H5::H5File file;
+  // Energy dataset and number of bins of each layer, nullptr if missing
+  std::vector<std::unique_ptr<H5::DataSet>> datasets;
+  std::vector<hsize_t> n_bins;
+  hsize_t max_bins = 1;
+};
+
+//=============================================
+//======= TFCSEventLibraryCache =========
+//=============================================
+
+TFCSEventLibraryFile::Voxels_t TFCSEventLibraryCache::Event_t::voxels(
+    std::size_t layer) const
+{
+  TFCSEventLibraryFile::Voxels_t result;
+  if (layer + 1 >= offsets.size())
+    return result;
+  result.bin_index = bin_index.data() + offsets[layer];
+  result.E = E.data() + offsets[layer];
+  result.size = offsets[layer + 1] - offsets[layer];
+  return result;
+}
+
+std::size_t TFCSEventLibraryCache::Event_t::bytes() const
+{
+  return sizeof(Event_t) + offsets.capacity() * sizeof(std::uint64_t)
+      + bin_index.capacity() * sizeof(std::uint32_t)
+      + E.capacity() * sizeof(float);
+}
+
+TFCSEventLibraryCache::~TFCSEventLibraryCache() {}
+
+std::shared_ptr<TFCSEventLibraryCache> TFCSEventLibraryCache::Open(
+    const std::string& path,
+    const std::vector<long unsigned int>& layers,
+    std::size_t max_bytes)
+{
+  std::shared_ptr<TFCSEventLibraryCache> cache(new TFCSEventLibraryCache());
+  cache->m_path = path;
+  cache->m_max_bytes = max_bytes;
+  try {
+    cache->m_hdf5.reset(new Hdf5_t());
+    Hdf5_t& hdf5 = *cache->m_hdf5;
+    hdf5.file.openFile(path, H5F_ACC_RDONLY);
+
+    H5::DSetAccPropList access;
+    access.setChunkCache(kChunkCacheSlots, kChunkCacheBytes, 1.0);
+    bool first = true;
+    for (long unsigned int layer : layers) {
+      if (layer >= hdf5.datasets.size()) {
+        hdf5.datasets.resize(layer + 1);
+        hdf5.n_bins.resize(layer + 1, 0);
+      }
+      const std::string name = "energy_layer_" + std::to_string(layer);
+      if (!hdf5.file.exists(name))
+        continue;
+      hdf5.datasets[layer].reset(
+          new H5::DataSet(hdf5.file.openDataSet(name, access)));
+      H5::DataSpace space = hdf5.datasets[layer]->getSpace();
+      hsize_t dims[2] = {0, 0};
+      if (space.getSimpleExtentNdims() == 2)
+        space.getSimpleExtentDims(dims);
+      if (dims[1] == 0 || (!first && dims[0] != cache->m_n_events)) {
+        ::Error("TFCSEventLibraryCache::Open",
+                "%s in %s is no matrix with %zu events",
+                name.c_str(),
+                path.c_str(),
+                cache->m_n_events);
+        return nullptr;
+      }
+      cache->m_n_events = dims[0];
+      hdf5.n_bins[layer] = dims[1];
+      hdf5.max_bins = std::max(hdf5.max_bins, dims[1]);
+      first = false;
+    }
+    cache->m_n_layers = hdf5.datasets.size();
+
+    read_event_info(hdf5.file, "phi_mod", cache->m_n_events, cache->m_phi_mod);
+    read_event_info(
+        hdf5.file, "center_eta", cache->m_n_events, cache->m_center_eta);
+    read_event_info(
+        hdf5.file, "incident_energy", cache->m_n_events, cache->m_e_init);
+  } catch (const H5::Exception& e) {
+    ::Error("TFCSEventLibraryCache::Open",
+            "Could not open %s: %s",
+            path.c_str(),
+            e.getDetailMsg().c_str());
+    return nullptr;
+  }
+
+  ::Info("TFCSEventLibraryCache::Open",
+         "Reading %zu events in %zu layers from %s on demand, caching up to "
+         "%zu bytes",
+         cache->m_n_events,
+         cache->m_n_layers,
+         path.c_str(),
+         max_bytes);
+  return cache;
+}
+
+std::shared_ptr<const TFCSEventLibraryCache::Event_t>
+TFCSEventLibraryCache::get(std::size_t event)
+{
+  if (event >= m_n_events)
+    return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_cache_mutex);
+    auto it = m_cached.find(event);
+    if (it != m_cached.end()) {
+      ++m_stats.hits;
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      return it->second->second;
+    }
+    ++m_stats.misses;
+  }
+
+  // Read without holding the cache lock, so that other threads can use
+  // the cached events meanwhile
+  std::vector<std::shared_ptr<const Event_t>> data = read({event});
+  if (data.empty())
+    return nullptr;
+  return insert(event, data.front());
+}
+
+void TFCSEventLibraryCache::prefetch(const std::vector<std::size_t>& events)
+{
+  std::vector<std::size_t> missing;
+  {
+    std::lock_guard<std::mutex> lock(m_cache_mutex);
+    for (std::size_t event : events)
+      if (event < m_n_events && m_cached.find(event) == m_cached.end())
+        missing.push_back(event);
+  }
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+  const std::size_t batch =
+      std::max<std::size_t>(1, kReadFloats / m_hdf5->max_bins);
+  std::size_t bytes = 0;
+  for (std::size_t first = 0; first < missing.size() && bytes < m_max_bytes;
+       first += batch)
+  {
+    const std::vector<std::size_t> part(
+        missing.begin() + first,
+        missing.begin() + std::min(first + batch, missing.size()));
+    std::vector<std::shared_ptr<const Event_t>> data = read(part);
+    for (std::size_t i = 0; i < data.size() && bytes < m_max_bytes; ++i) {
+      bytes += data[i]->bytes();
+      insert(part[i], data[i]);
+    }
+  }
+}
+
+TFCSEventLibraryCache::Stats_t TFCSEventLibraryCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_cache_mutex);
+  Stats_t stats = m_stats;
+  stats.n_cached = m_lru.size();
+  stats.bytes = m_bytes;
+  return stats;
+}
+
+std::vector<std::shared_ptr<const TFCSEventLibraryCache::Event_t>>
+TFCSEventLibraryCache::read(const std::vector<std::size_t>& events)
+{
+  std::vector<std::shared_ptr<Event_t>> decoded(events.size());
+  for (std::shared_ptr<Event_t>& event : decoded) {
+    event = std::make_shared<Event_t>();
+    event->offsets.reserve(m_n_layers + 1);
+    event->offsets.push_back(0);
+  }
+
+  std::lock_guard<std::mutex> lock(m_read_mutex);
+  std::vector<float> buffer;
+  try {
+    for (std::size_t layer = 0; layer < m_n_layers; ++layer) {
+      const H5::DataSet* dataset = m_hdf5->datasets[layer].get();
+      const hsize_t n_bins = m_hdf5->n_bins[layer];
+      if (dataset) {
+        // Select the rows of all events, consecutive ones as one block
+        H5::DataSpace space = dataset->getSpace();
+        space.selectNone();
+        for (std::size_t i = 0; i < events.size();) {
+          std::size_t j = i + 1;
+          while (j < events.size() && events[j] == events[j - 1] + 1)
+            ++j;
+          hsize_t start[2] = {events[i], 0};
+          hsize_t count[2] = {j - i, n_bins};
+          space.selectHyperslab(H5S_SELECT_OR, count, start);
+          i = j;
+        }
+        hsize_t dims[2] = {events.size(), n_bins};
+        H5::DataSpace memspace(2, dims);
+        buffer.resize(events.size() * n_bins);
+        dataset->read(
+            buffer.data(), H5::PredType::NATIVE_FLOAT, memspace, space);
+      }
+      for (std::size_t i = 0; i < events.size(); ++i) {
+        Event_t& event = *decoded[i];
+        for (hsize_t bin = 0; dataset && bin < n_bins; ++bin) {
+          const float e_voxel = buffer[i * n_bins + bin];
+          if (e_voxel != 0.0) {
+            event.bin_index.push_back(bin);
+            event.E.push_back(e_voxel);
+          }
+        }
+        event.offsets.push_back(event.E.size());
+      }
+    }
+  } catch (const H5::Exception& e) {
+    ::Error("TFCSEventLibraryCache::read",
+            "Could not read %zu events from %s: %s",
+            events.size(),
+            m_path.c_str(),
+            e.getDetailMsg().c_str());
+    return {};
+  }
+
+  std::vector<std::shared_ptr<const Event_t>> result;
+  result.reserve(decoded.size());
+  for (std::shared_ptr<Event_t>& event : decoded) {
+    event->bin_index.shrink_to_fit();
+    event->E.shrink_to_fit();
+    result.push_back(std::move(event));
+  }
+  return result;
+}
+
+std::shared_ptr<const TFCSEventLibraryCache::Event_t>
+TFCSEventLibraryCache::insert(std::size_t event,
+                              std::shared_ptr<const Event_t> data)
+{
+  std::lock_guard<std::mutex> lock(m_cache_mutex);
+  auto it = m_cached.find(event);
+  if (it != m_cached.end()) {
+    // Read by another thread meanwhile
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->second;
+  }
+  m_bytes += data->bytes();
+  m_lru.emplace_front(event, data);
+  m_cached[event] = m_lru.begin();
+
+  // The event just added is kept even if it alone exceeds the limit
+  while (m_bytes > m_max_bytes && m_lru.size() > 1) {
+    m_bytes -= m_lru.back().second->bytes();
+    m_cached.erase(m_lru.back().first);
+    m_lru.pop_back();
+    ++m_stats.evictions;
+  }
+  return data;
+}
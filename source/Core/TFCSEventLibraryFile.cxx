@@ -0,0 +1,326 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <cstring>
+#include <vector>
+
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TError.h"
+
+namespace
+{
+constexpr char kMagic[8] = {'F', 'C', 'S', 'E', 'V', 'L', 'I', 'B'};
+
+std::uint64_t aligned(std::uint64_t pos)
+{
+  const std::uint64_t align = TFCSEventLibraryFile::kAlignment;
+  return (pos + align - 1) / align * align;
+}
+
+// Size of the header and the layer table at the start of the file
+std::uint64_t table_end(std::uint64_t n_layers)
+{
+  return aligned(aligned(sizeof(TFCSEventLibraryFile::Header_t))
+                 + n_layers * sizeof(TFCSEventLibraryFile::Layer_t));
+}
+
+// Check that an array of bytes at pos lies inside the file after the table
+bool valid_range(std::uint64_t pos,
+                 std::uint64_t bytes,
+                 std::uint64_t begin,
+                 std::uint64_t file_size)
+{
+  return pos >= begin && pos % TFCSEventLibraryFile::kAlignment == 0
+      && pos <= file_size && bytes <= file_size - pos;
+}
+}  // namespace
+
+//=============================================
+//======= TFCSEventLibraryFile =========
+//=============================================
+
+TFCSEventLibraryFile::~TFCSEventLibraryFile()
+{
+  if (m_mapping)
+    munmap(m_mapping, m_size);
+}
+
+std::shared_ptr<const TFCSEventLibraryFile> TFCSEventLibraryFile::Open(
+    const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ::Error("TFCSEventLibraryFile::Open", "Could not open %s", path.c_str());
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header_t)) {
+    ::Error("TFCSEventLibraryFile::Open", "%s is too small", path.c_str());
+    close(fd);
+    return nullptr;
+  }
+
+  Header_t header;
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+      || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+  {
+    ::Error("TFCSEventLibraryFile::Open",
+            "%s is not an event library file",
+            path.c_str());
+    close(fd);
+    return nullptr;
+  }
+  if (header.version != kVersion || header.byte_order != kByteOrderMark
+      || header.file_size != (std::uint64_t)st.st_size
+      || header.n_layers > header.file_size / sizeof(Layer_t)
+      || table_end(header.n_layers) > header.file_size)
+  {
+    ::Error("TFCSEventLibraryFile::Open",
+            "%s has version %u, byte order 0x%x and size %llu, expected "
+            "version %u, byte order 0x%x and size %lld",
+            path.c_str(),
+            header.version,
+            header.byte_order,
+            (unsigned long long)header.file_size,
+            kVersion,
+            kByteOrderMark,
+            (long long)st.st_size);
+    close(fd);
+    return nullptr;
+  }
+
+  // Read-only shared mapping: the pages are loaded on first access and
+  // shared with all other processes mapping the same file
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    ::Error("TFCSEventLibraryFile::Open", "Could not map %s", path.c_str());
+    return nullptr;
+  }
+
+  std::shared_ptr<TFCSEventLibraryFile> library(new TFCSEventLibraryFile());
+  library->m_path = path;
+  library->m_mapping = mapping;
+  library->m_size = st.st_size;
+  library->m_header = header;
+
+  const char* base = static_cast<const char*>(mapping);
+  const std::uint64_t begin = table_end(header.n_layers);
+  const std::uint64_t n_events = header.n_events;
+  auto array = [&](std::uint64_t pos, std::uint64_t bytes, bool& ok)
+  {
+    ok = ok && valid_range(pos, bytes, begin, header.file_size);
+    return ok ? static_cast<const void*>(base + pos) : nullptr;
+  };
+  bool ok = n_events < header.file_size / sizeof(float);
+  const std::uint64_t event_bytes = ok ? n_events * sizeof(float) : 0;
+  if (header.phi_mod)
+    library->m_phi_mod =
+        static_cast<const float*>(array(header.phi_mod, event_bytes, ok));
+  if (header.center_eta)
+    library->m_center_eta =
+        static_cast<const float*>(array(header.center_eta, event_bytes, ok));
+  if (header.e_init)
+    library->m_e_init =
+        static_cast<const float*>(array(header.e_init, event_bytes, ok));
+
+  const auto* table = reinterpret_cast<const Layer_t*>(
+      base + aligned(sizeof(Header_t)));
+  library->m_layers.resize(ok ? header.n_layers : 0);
+  for (std::size_t layer = 0; ok && layer < header.n_layers; ++layer) {
+    const Layer_t& entry = table[layer];
+    if (!entry.offsets)
+      continue;
+    LayerView_t& view = library->m_layers[layer];
+    ok = entry.n_entries < header.file_size / sizeof(float)
+        && entry.n_bins < header.file_size / sizeof(float);
+    if (!ok)
+      break;
+    view.n_entries = entry.n_entries;
+    view.n_bins = entry.n_bins;
+    view.offsets = static_cast<const std::uint64_t*>(
+        array(entry.offsets, (n_events + 1) * sizeof(std::uint64_t), ok));
+    view.bin_index = static_cast<const std::uint32_t*>(array(
+        entry.bin_index, entry.n_entries * sizeof(std::uint32_t), ok));
+    view.energy = static_cast<const float*>(
+        array(entry.energy, entry.n_entries * sizeof(float), ok));
+    const std::uint64_t bins[4] = {
+        entry.R_lower, entry.R_size, entry.alpha_lower, entry.alpha_size};
+    for (int i = 0; i < 4; ++i)
+      view.bins[i] = static_cast<const float*>(
+          array(bins[i], entry.n_bins * sizeof(float), ok));
+    // The offsets of single events are checked when they are accessed
+    ok = ok && view.offsets[0] == 0
+        && view.offsets[n_events] == entry.n_entries;
+  }
+  if (!ok) {
+    ::Error("TFCSEventLibraryFile::Open",
+            "%s has an invalid array table",
+            path.c_str());
+    return nullptr;
+  }
+
+  ::Info("TFCSEventLibraryFile::Open",
+         "Mapped %llu events in %llu layers with %llu bytes from %s",
+         (unsigned long long)header.n_events,
+         (unsigned long long)header.n_layers,
+         (unsigned long long)header.file_size,
+         path.c_str());
+  return library;
+}
+
+bool TFCSEventLibraryFile::bin_boundaries(std::size_t layer,
+                                          std::vector<float>& R_lower,
+                                          std::vector<float>& R_size,
+                                          std::vector<float>& alpha_lower,
+                                          std::vector<float>& alpha_size) const
+{
+  if (!has_layer(layer))
+    return false;
+  const LayerView_t& view = m_layers[layer];
+  std::vector<float>* bins[4] = {&R_lower, &R_size, &alpha_lower, &alpha_size};
+  for (int i = 0; i < 4; ++i)
+    bins[i]->assign(view.bins[i], view.bins[i] + view.n_bins);
+  return true;
+}
+
+//=============================================
+//======= TFCSEventLibraryWriter =========
+//=============================================
+
+TFCSEventLibraryWriter::TFCSEventLibraryWriter(const std::string& path,
+                                               std::uint64_t n_events,
+                                               std::uint64_t n_layers)
+    : m_path(path)
+    , m_layers(n_layers, TFCSEventLibraryFile::Layer_t {})
+{
+  std::memcpy(m_header.magic, kMagic, sizeof(kMagic));
+  m_header.version = TFCSEventLibraryFile::kVersion;
+  m_header.byte_order = TFCSEventLibraryFile::kByteOrderMark;
+  m_header.n_events = n_events;
+  m_header.n_layers = n_layers;
+  m_header.file_size = table_end(n_layers);
+
+  m_file = std::fopen(path.c_str(), "wb");
+  if (!m_file) {
+    ::Error("TFCSEventLibraryWriter", "Could not open %s", path.c_str());
+    return;
+  }
+  // Reserve the space for the header and the layer table, they are written
+  // again in Close()
+  std::vector<char> padding(m_header.file_size, 0);
+  m_ok = std::fwrite(padding.data(), 1, padding.size(), m_file)
+      == padding.size();
+}
+
+TFCSEventLibraryWriter::~TFCSEventLibraryWriter()
+{
+  Close();
+}
+
+bool TFCSEventLibraryWriter::set_event_info(
+    const std::vector<float>& phi_mod,
+    const std::vector<float>& center_eta,
+    const std::vector<float>& e_init)
+{
+  if (!is_open())
+    return false;
+  const std::vector<float>* arrays[3] = {&phi_mod, &center_eta, &e_init};
+  std::uint64_t* positions[3] = {
+      &m_header.phi_mod, &m_header.center_eta, &m_header.e_init};
+  for (int i = 0; i < 3; ++i) {
+    if (arrays[i]->empty())
+      continue;
+    if (arrays[i]->size() != m_header.n_events) {
+      ::Error("TFCSEventLibraryWriter::set_event_info",
+              "Got %zu values for %llu events",
+              arrays[i]->size(),
+              (unsigned long long)m_header.n_events);
+      return false;
+    }
+    *positions[i] =
+        append(arrays[i]->data(), arrays[i]->size() * sizeof(float));
+  }
+  return true;
+}
+
+bool TFCSEventLibraryWriter::add_layer(
+    std::size_t layer,
+    const std::vector<std::uint64_t>& offsets,
+    const std::vector<std::uint32_t>& bin_index,
+    const std::vector<float>& E,
+    const std::vector<float>& R_lower,
+    const std::vector<float>& R_size,
+    const std::vector<float>& alpha_lower,
+    const std::vector<float>& alpha_size)
+{
+  if (!is_open())
+    return false;
+  const std::size_t n_bins = R_lower.size();
+  if (layer >= m_layers.size() || offsets.size() != m_header.n_events + 1
+      || offsets.front() != 0 || offsets.back() != bin_index.size()
+      || E.size() != bin_index.size() || R_size.size() != n_bins
+      || alpha_lower.size() != n_bins || alpha_size.size() != n_bins)
+  {
+    ::Error("TFCSEventLibraryWriter::add_layer",
+            "Inconsistent arrays for layer %zu in %s",
+            layer,
+            m_path.c_str());
+    return false;
+  }
+
+  TFCSEventLibraryFile::Layer_t& entry = m_layers[layer];
+  entry.n_entries = bin_index.size();
+  entry.n_bins = n_bins;
+  entry.offsets =
+      append(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+  entry.bin_index =
+      append(bin_index.data(), bin_index.size() * sizeof(std::uint32_t));
+  entry.energy = append(E.data(), E.size() * sizeof(float));
+  entry.R_lower = append(R_lower.data(), n_bins * sizeof(float));
+  entry.R_size = append(R_size.data(), n_bins * sizeof(float));
+  entry.alpha_lower = append(alpha_lower.data(), n_bins * sizeof(float));
+  entry.alpha_size = append(alpha_size.data(), n_bins * sizeof(float));
+  return m_ok;
+}
+
+std::uint64_t TFCSEventLibraryWriter::append(const void* data,
+                                             std::size_t bytes)
+{
+  const std::uint64_t offset = m_header.file_size;
+  if (bytes > 0)
+    m_ok = std::fwrite(data, 1, bytes, m_file) == bytes && m_ok;
+  const std::uint64_t end = aligned(offset + bytes);
+  for (std::uint64_t pos = offset + bytes; pos < end; ++pos)
+    std::fputc(0, m_file);
+  m_header.file_size = end;
+  return offset;
+}
+
+bool TFCSEventLibraryWriter::Close()
+{
+  if (!m_file)
+    return false;
+  std::fseek(m_file, 0, SEEK_SET);
+  bool ok = std::fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+  std::fseek(m_file, aligned(sizeof(m_header)), SEEK_SET);
+  if (!m_layers.empty())
+    ok = std::fwrite(m_layers.data(),
+                     sizeof(TFCSEventLibraryFile::Layer_t),
+                     m_layers.size(),
+                     m_file)
+            == m_layers.size()
+        && ok;
+  ok = (std::fclose(m_file) == 0) && ok && m_ok;
+  m_file = nullptr;
+  if (!ok)
+    ::Error("TFCSEventLibraryWriter::Close",
+            "Could not write %s",
+            m_path.c_str());
+  return ok;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cmath>
+
+#include "FastCaloSim/Core/TFCSEventLibraryIndex.h"
+
+TFCSEventLibraryIndex::TFCSEventLibraryIndex(const std::vector<double>& points,
+                                             unsigned int n_dims,
+                                             std::size_t leaf_size)
+    : m_n_dims(std::min(std::max(n_dims, 1u), kMaxDims))
+    , m_n_points(points.size() / m_n_dims)
+    , m_points(points.begin(), points.begin() + m_n_points * m_n_dims)
+{
+  m_order.reserve(m_n_points);
+  for (std::size_t index = 0; index < m_n_points; ++index) {
+    bool finite = true;
+    for (unsigned int dim = 0; dim < m_n_dims; ++dim)
+      finite = finite && std::isfinite(m_points[index * m_n_dims + dim]);
+    if (finite)
+      m_order.push_back(index);
+    else
+      m_unindexed.push_back(index);
+  }
+  if (!m_order.empty())
+    build(0, m_order.size(), std::max<std::size_t>(leaf_size, 1));
+}
+
+std::size_t TFCSEventLibraryIndex::build(std::size_t begin,
+                                         std::size_t end,
+                                         std::size_t leaf_size)
+{
+  const std::size_t id = m_nodes.size();
+  m_nodes.emplace_back();
+  Node_t node;
+  node.begin = begin;
+  node.end = end;
+  for (unsigned int dim = 0; dim < m_n_dims; ++dim) {
+    node.lo[dim] = std::numeric_limits<double>::max();
+    node.hi[dim] = std::numeric_limits<double>::lowest();
+  }
+  for (std::size_t i = begin; i < end; ++i)
+    for (unsigned int dim = 0; dim < m_n_dims; ++dim) {
+      const double x = m_points[m_order[i] * m_n_dims + dim];
+      node.lo[dim] = std::min(node.lo[dim], x);
+      node.hi[dim] = std::max(node.hi[dim], x);
+    }
+
+  // Split the widest coordinate at its median
+  unsigned int split = 0;
+  for (unsigned int dim = 1; dim < m_n_dims; ++dim)
+    if (node.hi[dim] - node.lo[dim] > node.hi[split] - node.lo[split])
+      split = dim;
+  if (end - begin > leaf_size && node.hi[split] > node.lo[split]) {
+    const std::size_t middle = begin + (end - begin) / 2;
+    std::nth_element(m_order.begin() + begin,
+                     m_order.begin() + middle,
+                     m_order.begin() + end,
+                     [this, split](std::size_t a, std::size_t b)
+                     {
+                       return m_points[a * m_n_dims + split]
+                           < m_points[b * m_n_dims + split];
+                     });
+    node.left = build(begin, middle, leaf_size);
+    node.right = build(middle, end, leaf_size);
+  }
+  m_nodes[id] = node;
+  return id;
+}
+
+double TFCSEventLibraryIndex::lowerBound(const Node_t& node,
+                                         const double* query,
+                                         const double* weights) const
+{
+  double dist2 = 0;
+  for (unsigned int dim = 0; dim < m_n_dims; ++dim) {
+    if (weights[dim] == 0)
+      continue;
+    double gap = 0;
+    if (query[dim] < node.lo[dim])
+      gap = node.lo[dim] - query[dim];
+    else if (query[dim] > node.hi[dim])
+      gap = query[dim] - node.hi[dim];
+    gap *= weights[dim];
+    dist2 += gap * gap;
+  }
+  return std::sqrt(dist2);
+}
+
+bool TFCSEventLibraryIndex::skip(double bound, float best_distance)
+{
+  // Relative and absolute margin for the float rounding of the distances
+  return bound > best_distance * (1 + 1e-4) + 1e-4;
+}
@@ -0,0 +1,243 @@
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "FastCaloSim/Core/TFCSFlatArrayStore.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TError.h"
+
+namespace
+{
+constexpr char kMagic[8] = {'F', 'C', 'S', 'F', 'L', 'A', 'T', '\0'};
+
+std::mutex& store_mutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Attached stores by id. Never deleted, so that objects destroyed during
+// static destruction do not access a destroyed map
+std::map<std::uint64_t, std::shared_ptr<TFCSFlatArrayStore>>& stores()
+{
+  static auto* map =
+      new std::map<std::uint64_t, std::shared_ptr<TFCSFlatArrayStore>>();
+  return *map;
+}
+
+thread_local TFCSFlatArrayWriter* current_writer = nullptr;
+
+std::uint64_t aligned(std::uint64_t pos)
+{
+  const std::uint64_t align = TFCSFlatArrayStore::kAlignment;
+  return (pos + align - 1) / align * align;
+}
+}  // namespace
+
+//=============================================
+//======= TFCSFlatArrayStore =========
+//=============================================
+
+TFCSFlatArrayStore::~TFCSFlatArrayStore()
+{
+  if (m_mapping)
+    munmap(m_mapping, m_size);
+}
+
+std::shared_ptr<TFCSFlatArrayStore> TFCSFlatArrayStore::Attach(
+    const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ::Error("TFCSFlatArrayStore::Attach", "Could not open %s", path.c_str());
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header_t)) {
+    ::Error("TFCSFlatArrayStore::Attach", "%s is too small", path.c_str());
+    close(fd);
+    return nullptr;
+  }
+
+  Header_t header;
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+      || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+  {
+    ::Error("TFCSFlatArrayStore::Attach",
+            "%s is not a flat array file",
+            path.c_str());
+    close(fd);
+    return nullptr;
+  }
+  if (header.version != kVersion || header.byte_order != kByteOrderMark
+      || header.file_size != (std::uint64_t)st.st_size)
+  {
+    ::Error("TFCSFlatArrayStore::Attach",
+            "%s has version %u, byte order 0x%x and size %llu, expected "
+            "version %u, byte order 0x%x and size %lld",
+            path.c_str(),
+            header.version,
+            header.byte_order,
+            (unsigned long long)header.file_size,
+            kVersion,
+            kByteOrderMark,
+            (long long)st.st_size);
+    close(fd);
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(store_mutex());
+  auto existing = stores().find(header.id);
+  if (existing != stores().end()) {
+    close(fd);
+    return existing->second;
+  }
+
+  // Private writable mapping: pages are shared between processes until
+  // someone modifies an array, which then only changes the local copy
+  void* mapping = mmap(nullptr,
+                       st.st_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE,
+                       fd,
+                       0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    ::Error("TFCSFlatArrayStore::Attach", "Could not map %s", path.c_str());
+    return nullptr;
+  }
+
+  std::shared_ptr<TFCSFlatArrayStore> store(new TFCSFlatArrayStore());
+  store->m_path = path;
+  store->m_mapping = mapping;
+  store->m_size = st.st_size;
+  store->m_header = header;
+  stores()[header.id] = store;
+  ::Info("TFCSFlatArrayStore::Attach",
+         "Mapped %llu arrays with %llu bytes from %s",
+         (unsigned long long)header.n_arrays,
+         (unsigned long long)header.file_size,
+         path.c_str());
+  return store;
+}
+
+void TFCSFlatArrayStore::Detach(
+    const std::shared_ptr<TFCSFlatArrayStore>& store)
+{
+  if (!store)
+    return;
+  std::lock_guard<std::mutex> lock(store_mutex());
+  stores().erase(store->id());
+}
+
+const void* TFCSFlatArrayStore::Resolve(std::uint64_t id,
+                                        std::uint64_t offset,
+                                        std::size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(store_mutex());
+  auto it = stores().find(id);
+  if (it == stores().end()) {
+    ::Error("TFCSFlatArrayStore::Resolve",
+            "Flat array store with id 0x%llx is not attached",
+            (unsigned long long)id);
+    return nullptr;
+  }
+  const TFCSFlatArrayStore& store = *it->second;
+  if (offset < sizeof(Header_t) || offset + bytes > store.m_size
+      || offset % kAlignment != 0)
+  {
+    ::Error("TFCSFlatArrayStore::Resolve",
+            "Invalid range [%llu,%llu) in %s",
+            (unsigned long long)offset,
+            (unsigned long long)(offset + bytes),
+            store.m_path.c_str());
+    return nullptr;
+  }
+  return static_cast<const char*>(store.m_mapping) + offset;
+}
+
+//=============================================
+//======= TFCSFlatArrayWriter =========
+//=============================================
+
+TFCSFlatArrayWriter::TFCSFlatArrayWriter(const std::string& path,
+                                         std::size_t min_bytes)
+    : m_path(path)
+    , m_min_bytes(min_bytes)
+{
+  std::memcpy(m_header.magic, kMagic, sizeof(kMagic));
+  m_header.version = TFCSFlatArrayStore::kVersion;
+  m_header.byte_order = TFCSFlatArrayStore::kByteOrderMark;
+  std::random_device rnd;
+  m_header.id = (std::uint64_t(rnd()) << 32) | rnd();
+  m_header.n_arrays = 0;
+  m_header.file_size = aligned(sizeof(m_header));
+
+  m_file = std::fopen(path.c_str(), "wb");
+  if (!m_file) {
+    ::Error("TFCSFlatArrayWriter", "Could not open %s", path.c_str());
+    return;
+  }
+  // Reserve the space for the header, it is written again in Close()
+  std::vector<char> padding(m_header.file_size, 0);
+  m_ok = std::fwrite(padding.data(), 1, padding.size(), m_file)
+      == padding.size();
+}
+
+TFCSFlatArrayWriter::~TFCSFlatArrayWriter()
+{
+  End();
+  Close();
+}
+
+void TFCSFlatArrayWriter::Begin()
+{
+  current_writer = this;
+}
+
+void TFCSFlatArrayWriter::End()
+{
+  if (current_writer == this)
+    current_writer = nullptr;
+}
+
+TFCSFlatArrayWriter* TFCSFlatArrayWriter::Current()
+{
+  return current_writer;
+}
+
+std::uint64_t TFCSFlatArrayWriter::append(const void* data, std::size_t bytes)
+{
+  const std::uint64_t offset = m_header.file_size;
+  if (bytes > 0)
+    m_ok = std::fwrite(data, 1, bytes, m_file) == bytes && m_ok;
+  const std::uint64_t end = aligned(offset + bytes);
+  for (std::uint64_t pos = offset + bytes; pos < end; ++pos)
+    m_ok = std::fputc(0, m_file) != EOF && m_ok;
+  m_header.file_size = end;
+  ++m_header.n_arrays;
+  return offset;
+}
+
+bool TFCSFlatArrayWriter::Close()
+{
+  if (!m_file)
+    return false;
+  std::fseek(m_file, 0, SEEK_SET);
+  bool ok = std::fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+  ok = (std::fclose(m_file) == 0) && ok && m_ok;
+  m_file = nullptr;
+  if (!ok)
+    ::Error(
+        "TFCSFlatArrayWriter::Close", "Could not write %s", m_path.c_str());
+  return ok;
+}
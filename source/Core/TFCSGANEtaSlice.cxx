@@ -15,6 +15,7 @@
 
 #include "CLHEP/Random/RandGauss.h"
 #include "FastCaloSim/Core/TFCSNetworkFactory.h"
+#include "FastCaloSim/Core/TFCSONNXHandler.h"
 #include "TFile.h"
 #include "TFitResult.h"
 #include "TH1D.h"
@@ -75,7 +76,7 @@ bool TFCSGANEtaSlice::IsGanCorrectlyLoaded() const
   return true;
 }
 
-bool TFCSGANEtaSlice::LoadGAN()
+bool TFCSGANEtaSlice::LoadGAN(TFCSONNXQuantization::Precision precision)
 {
   // Now load new data
   std::string inputFileName;
@@ -90,7 +91,7 @@ bool TFCSGANEtaSlice::LoadGAN()
         + std::to_string(m_pid) + "_eta_" + std::to_string(m_etaMin) + "_"
         + std::to_string(m_etaMax) + "_All.*";
     FCS_MSG_DEBUG("Gan input file name " << inputFileName);
-    m_net_all = TFCSNetworkFactory::create(inputFileName);
+    m_net_all = TFCSNetworkFactory::create(inputFileName, precision);
     if (m_net_all == nullptr)
       success = false;
   } else if (m_pid == 2212) {
@@ -98,7 +99,7 @@ bool TFCSGANEtaSlice::LoadGAN()
         + std::to_string(m_pid) + "_eta_" + std::to_string(m_etaMin) + "_"
         + std::to_string(m_etaMax) + "_High10.*";
     FCS_MSG_DEBUG("Gan input file name " << inputFileName);
-    m_net_all = TFCSNetworkFactory::create(inputFileName);
+    m_net_all = TFCSNetworkFactory::create(inputFileName, precision);
     if (m_net_all == nullptr)
       success = false;
   } else {
@@ -106,20 +107,38 @@ bool TFCSGANEtaSlice::LoadGAN()
         + std::to_string(m_pid) + "_eta_" + std::to_string(m_etaMin) + "_"
         + std::to_string(m_etaMax) + "_High12.*";
     FCS_MSG_DEBUG("Gan input file name " << inputFileName);
-    m_net_high = TFCSNetworkFactory::create(inputFileName);
+    m_net_high = TFCSNetworkFactory::create(inputFileName, precision);
     if (m_net_high == nullptr)
       success = false;
 
     inputFileName = m_param.GetInputFolder() + "/neural_net_"
         + std::to_string(m_pid) + "_eta_" + std::to_string(m_etaMin) + "_"
         + std::to_string(m_etaMax) + "_UltraLow12.*";
-    m_net_low = TFCSNetworkFactory::create(inputFileName);
+    m_net_low = TFCSNetworkFactory::create(inputFileName, precision);
     if (m_net_low == nullptr)
       success = false;
   }
   return success;
 }
 
+bool TFCSGANEtaSlice::QuantizeInt8()
+{
+  bool success = true;
+  for (VNetworkBase* net : {m_net_all.get(), m_net_low.get(), m_net_high.get()})
+  {
+    if (net == nullptr)
+      continue;
+    auto* onnx = dynamic_cast<TFCSONNXHandler*>(net);
+    if (onnx == nullptr) {
+      FCS_MSG_WARNING("Only ONNX networks can be quantized");
+      success = false;
+    } else if (!onnx->quantizeDynamicInt8()) {
+      success = false;
+    }
+  }
+  return success;
+}
+
 void TFCSGANEtaSlice::CalculateMeanPointFromDistributionOfR()
 {
   std::string rootFileName = m_param.GetInputFolder() + "/rootFiles/pid"
@@ -182,6 +201,15 @@ VNetworkBase::NetworkOutputs TFCSGANEtaSlice::GetNetworkOutputs(
     const TFCSTruthState* truth,
     const TFCSExtrapolationState* extrapol,
     TFCSSimulationState simulstate) const
+{
+  return GetNetworkOutputs(GetNetworkInputs(truth, extrapol, simulstate),
+                           truth->P());
+}
+
+TFCSGANEtaSlice::NetworkInputs TFCSGANEtaSlice::GetNetworkInputs(
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol,
+    TFCSSimulationState& simulstate) const
 {
   double randUniformZ = 0.;
   NetworkInputs inputs;
@@ -241,12 +269,17 @@ VNetworkBase::NetworkOutputs TFCSGANEtaSlice::GetNetworkOutputs(
       inputs["mycond"].insert(std::pair<std::string, double>("variable_1", 0));
     }
   }
+  return inputs;
+}
 
+VNetworkBase::NetworkOutputs TFCSGANEtaSlice::GetNetworkOutputs(
+    const NetworkInputs& inputs, double momentum) const
+{
   VNetworkBase::NetworkOutputs outputs;
   if (m_param.GetGANVersion() == 1 || m_pid == 211 || m_pid == 2212) {
     outputs = GetNetAll()->compute(inputs);
   } else {
-    if (truth->P() > 4096)
+    if (momentum > 4096)
     {  // This is the momentum, not the energy, because the split is
        // based on the samples which are produced with the momentum
       FCS_MSG_DEBUG("Computing outputs given inputs for high");
@@ -7,8 +7,15 @@
 #include "TTree.h"
 
 // LWTNN
+#include "lwtnn/FastGraph.hh"
 #include "lwtnn/LightweightGraph.hh"
-#include "lwtnn/parse_json.hh"
+
+// Parsed configurations are cached on disk
+#include "FastCaloSim/Core/TFCSConfigCache.h"
+
+// For throwing exceptions
+#include <algorithm>
+#include <stdexcept>
 
 TFCSGANLWTNNHandler::TFCSGANLWTNNHandler(const std::string& inputFile)
     : VNetworkLWTNN(inputFile)
@@ -24,12 +31,129 @@ TFCSGANLWTNNHandler::TFCSGANLWTNNHandler(const TFCSGANLWTNNHandler& copy_from)
   // Cannot take copies of lwt::LightweightGraph
   // (copy constructor disabled)
   FCS_MSG_DEBUG("Making a new m_lwtnn_graph for copied network");
-  std::stringstream json_stream(m_json);
-  const lwt::GraphConfig config = lwt::parse_json_graph(json_stream);
-  m_lwtnn_graph = std::make_unique<lwt::LightweightGraph>(config);
+  const lwt::GraphConfig config = TFCSConfigCache::graphConfig(m_json);
+  buildGraph(config);
   m_outputLayers = copy_from.m_outputLayers;
 };
 
+void TFCSGANLWTNNHandler::buildGraph(const lwt::GraphConfig& config)
+{
+  // The input order for the fast graph is simply the order in the json
+  lwt::InputOrder order;
+  m_inputNodes.clear();
+  m_inputNodeSize.clear();
+  for (const lwt::InputNodeConfig& node : config.inputs) {
+    std::vector<std::string> variables;
+    for (const lwt::Input& variable : node.variables)
+      variables.push_back(variable.name);
+    order.scalar.emplace_back(node.name, variables);
+    m_inputNodes.push_back(node.name);
+    m_inputNodeSize.push_back(variables.size());
+  };
+  m_outputNodes.clear();
+  m_outputNodeIndex.clear();
+  for (const auto& node : config.outputs) {
+    m_outputNodes.push_back(node.first);
+    m_outputNodeIndex.push_back(node.second.node_index);
+  };
+  // lwtnn needs a default output for graphs with several output nodes
+  const std::string default_output =
+      m_outputNodes.empty() ? "" : m_outputNodes.front();
+  m_dense = TFCSDenseNetwork::enabled() ? TFCSDenseNetwork::compile(config)
+                                        : nullptr;
+  m_lwtnn_graph.reset();
+  m_lwtnn_fast_graph.reset();
+  m_graphNodes.clear();
+  m_graphOrder.clear();
+  // The lwtnn objects hold three more copies of the weights, with the
+  // precompiled network they are only needed for the validation
+  if (m_dense && TFCSDenseNetwork::validationTolerance() <= 0)
+    return;
+  m_lwtnn_graph =
+      std::make_unique<lwt::LightweightGraph>(config, default_output);
+  m_lwtnn_fast_graph =
+      std::make_unique<lwt::FastGraph>(config, order, default_output);
+
+  // Sources are added to the order before the nodes using them
+  m_graphNodes.resize(config.nodes.size());
+  std::vector<size_t> sizes(config.nodes.size(), 0);
+  for (size_t index : m_outputNodeIndex) {
+    if (addGraphNode(config, index, sizes) == 0) {
+      FCS_MSG_DEBUG("Graph node " << index << " is not supported, "
+                                  << "computeTensors uses lwt::FastGraph");
+      m_graphNodes.clear();
+      m_graphOrder.clear();
+      break;
+    };
+  };
+};
+
+size_t TFCSGANLWTNNHandler::addGraphNode(const lwt::GraphConfig& config,
+                                         size_t index,
+                                         std::vector<size_t>& sizes)
+{
+  if (index >= config.nodes.size())
+    return 0;
+  if (sizes[index] > 0)
+    return sizes[index];
+  const lwt::NodeConfig& node_config = config.nodes[index];
+  GraphNode_t& node = m_graphNodes[index];
+  node.type = node_config.type;
+  node.sources = node_config.sources;
+
+  size_t size = 0;
+  if (node.type == lwt::NodeConfig::Type::INPUT) {
+    // The source is the input node, not a graph node
+    if (node.sources.size() != 1 || node.sources[0] >= config.inputs.size())
+      return 0;
+    const std::vector<lwt::Input>& variables =
+        config.inputs[node.sources[0]].variables;
+    node.offset.resize(variables.size());
+    node.scale.resize(variables.size());
+    for (size_t i = 0; i < variables.size(); i++) {
+      node.offset[i] = variables[i].offset;
+      node.scale[i] = variables[i].scale;
+    };
+    size = variables.size();
+  } else {
+    std::vector<size_t> source_sizes;
+    for (size_t source : node.sources) {
+      source_sizes.push_back(addGraphNode(config, source, sizes));
+      if (source_sizes.back() == 0)
+        return 0;
+    };
+    switch (node.type) {
+      case lwt::NodeConfig::Type::FEED_FORWARD:
+        if (source_sizes.size() != 1 || node_config.index < 0
+            || size_t(node_config.index) >= config.layers.size())
+          return 0;
+        node.stack = std::make_unique<lwt::Stack>(
+            source_sizes[0],
+            std::vector<lwt::LayerConfig> {config.layers[node_config.index]});
+        size = node.stack->n_outputs();
+        break;
+      case lwt::NodeConfig::Type::CONCATENATE:
+        for (size_t source_size : source_sizes)
+          size += source_size;
+        break;
+      case lwt::NodeConfig::Type::SUM:
+        if (source_sizes.empty()
+            || std::count(source_sizes.begin(),
+                          source_sizes.end(),
+                          source_sizes[0])
+                != long(source_sizes.size()))
+          return 0;
+        size = source_sizes[0];
+        break;
+      default:
+        return 0;
+    };
+  };
+  sizes[index] = size;
+  m_graphOrder.push_back(index);
+  return size;
+};
+
 void TFCSGANLWTNNHandler::setupNet()
 {
   // Backcompatability, previous versions stored this in m_input
@@ -42,9 +166,8 @@ void TFCSGANLWTNNHandler::setupNet()
   FCS_MSG_VERBOSE("m_json has size " << m_json.length());
   FCS_MSG_DEBUG("m_json starts with  " << m_json.substr(0, 10));
   FCS_MSG_VERBOSE("Reading the m_json string stream into a graph network");
-  std::stringstream json_stream(m_json);
-  const lwt::GraphConfig config = lwt::parse_json_graph(json_stream);
-  m_lwtnn_graph = std::make_unique<lwt::LightweightGraph>(config);
+  const lwt::GraphConfig config = TFCSConfigCache::graphConfig(m_json);
+  buildGraph(config);
   // Get the output layers
   FCS_MSG_VERBOSE("Getting output layers for neural network");
   for (auto node : config.outputs) {
@@ -72,6 +195,25 @@ TFCSGANLWTNNHandler::NetworkOutputs TFCSGANLWTNNHandler::compute(
     TFCSGANLWTNNHandler::NetworkInputs const& inputs) const
 {
   FCS_MSG_DEBUG("Running computation on LWTNN graph network");
+  NetworkOutputs outputs;
+  if (!m_dense || !computeDense(inputs, outputs))
+    return computeLWTNN(inputs);
+  removePrefixes(outputs);
+  if (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_graph)
+    TFCSDenseNetwork::validate(
+        "TFCSGANLWTNNHandler::compute", outputs, computeLWTNN(inputs));
+  FCS_MSG_DEBUG("Computation on precompiled graph network done, returning.");
+  return outputs;
+};
+
+TFCSGANLWTNNHandler::NetworkOutputs TFCSGANLWTNNHandler::computeLWTNN(
+    TFCSGANLWTNNHandler::NetworkInputs const& inputs) const
+{
+  if (!m_lwtnn_graph) {
+    FCS_MSG_ERROR("Inputs do not match the input nodes of the "
+                  "precompiled network, and lwtnn was not set up");
+    throw std::runtime_error("Missing inputs in compute.");
+  };
   NetworkInputs local_copy = inputs;
   if (inputs.find("Noise") != inputs.end()) {
     // Graphs from EnergyAndHitsGANV2 have the local_copy encoded as Noise =
@@ -91,6 +233,165 @@ TFCSGANLWTNNHandler::NetworkOutputs TFCSGANLWTNNHandler::compute(
   return outputs;
 };
 
+bool TFCSGANLWTNNHandler::computeDense(
+    TFCSGANLWTNNHandler::NetworkInputs const& inputs,
+    TFCSGANLWTNNHandler::NetworkOutputs& outputs) const
+{
+  // lwtnn evaluates the first output node when given a map
+  if (m_dense->nOutputNodes() == 0)
+    return false;
+  // Same renaming as in computeLWTNN
+  static const std::string noise_node = "node_0";
+  static const std::string mycond_node = "node_1";
+  const bool rename = inputs.find("Noise") != inputs.end();
+
+  thread_local std::vector<std::vector<float>> values;
+  thread_local TensorOutputs results;
+  values.resize(m_inputNodes.size());
+  TensorInputs tensors(m_inputNodes.size());
+  std::size_t n_filled = 0;
+  std::vector<bool> filled(m_inputNodes.size(), false);
+  for (const auto& node : inputs) {
+    const std::string* name = &node.first;
+    if (rename && node.first == "Noise")
+      name = &noise_node;
+    else if (rename && node.first == "mycond")
+      name = &mycond_node;
+    const std::size_t index =
+        std::find(m_inputNodes.begin(), m_inputNodes.end(), *name)
+        - m_inputNodes.begin();
+    // Nodes the graph does not use are ignored, as lwtnn does
+    if (index == m_inputNodes.size())
+      continue;
+    if (filled[index] || !m_dense->fillInput(index, node.second, values[index]))
+      return false;
+    filled[index] = true;
+    ++n_filled;
+    tensors[index] = values[index];
+  };
+  if (n_filled != m_inputNodes.size())
+    return false;
+
+  m_dense->compute(tensors, results);
+  const std::vector<std::string>& labels = m_dense->outputLabels(0);
+  for (size_t i = 0; i < labels.size(); i++)
+    outputs[labels[i]] = results[0][i];
+  return true;
+};
+
+void TFCSGANLWTNNHandler::computeTensors(
+    TFCSGANLWTNNHandler::TensorInputs const& inputs,
+    TFCSGANLWTNNHandler::TensorOutputs& outputs) const
+{
+  if (!m_dense) {
+    computeTensorsLWTNN(inputs, outputs);
+    return;
+  };
+  m_dense->compute(inputs, outputs);
+  if (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_graph) {
+    TensorOutputs reference;
+    computeTensorsLWTNN(inputs, reference);
+    TFCSDenseNetwork::validate(
+        "TFCSGANLWTNNHandler::computeTensors", outputs, reference);
+  };
+};
+
+void TFCSGANLWTNNHandler::computeTensorsBatch(
+    TFCSGANLWTNNHandler::TensorInputs const& inputs,
+    std::size_t n_batch,
+    TFCSGANLWTNNHandler::TensorOutputs& outputs) const
+{
+  // With the validation, computeTensors compares entry by entry
+  if (!m_dense || n_batch == 0
+      || (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_graph))
+  {
+    VNetworkBase::computeTensorsBatch(inputs, n_batch, outputs);
+    return;
+  };
+  m_dense->computeBatch(inputs, n_batch, outputs);
+};
+
+void TFCSGANLWTNNHandler::computeTensorsLWTNN(
+    TFCSGANLWTNNHandler::TensorInputs const& inputs,
+    TFCSGANLWTNNHandler::TensorOutputs& outputs) const
+{
+  if (inputs.size() != m_inputNodeSize.size()) {
+    FCS_MSG_ERROR("Got " << inputs.size() << " input nodes, the graph has "
+                         << m_inputNodeSize.size());
+    throw std::runtime_error("Wrong number of input nodes in computeTensors.");
+  };
+  std::vector<Eigen::VectorXd> nodes(inputs.size());
+  for (size_t node_n = 0; node_n < inputs.size(); node_n++) {
+    if (inputs[node_n].size != m_inputNodeSize[node_n]) {
+      FCS_MSG_ERROR("Input node " << m_inputNodes[node_n] << " got "
+                                  << inputs[node_n].size << " values, expected "
+                                  << m_inputNodeSize[node_n]);
+      throw std::runtime_error("Wrong input node size in computeTensors.");
+    };
+    nodes[node_n] = Eigen::Map<const Eigen::VectorXf>(inputs[node_n].data,
+                                                      inputs[node_n].size)
+                        .cast<double>();
+  };
+  outputs.resize(m_outputNodeIndex.size());
+  if (m_graphOrder.empty()) {
+    for (size_t node_n = 0; node_n < m_outputNodeIndex.size(); node_n++) {
+      const Eigen::VectorXd result =
+          m_lwtnn_fast_graph->compute(nodes, {}, m_outputNodeIndex[node_n]);
+      outputs[node_n].assign(result.data(), result.data() + result.size());
+    };
+    return;
+  };
+
+  // Each node once, nodes shared by several outputs are not recomputed
+  thread_local std::vector<Eigen::VectorXd> values;
+  values.resize(m_graphNodes.size());
+  for (size_t index : m_graphOrder) {
+    const GraphNode_t& node = m_graphNodes[index];
+    Eigen::VectorXd& value = values[index];
+    switch (node.type) {
+      case lwt::NodeConfig::Type::INPUT:
+        value = (nodes[node.sources[0]] + node.offset).cwiseProduct(node.scale);
+        break;
+      case lwt::NodeConfig::Type::FEED_FORWARD:
+        value = node.stack->compute(values[node.sources[0]]);
+        break;
+      case lwt::NodeConfig::Type::CONCATENATE: {
+        Eigen::Index size = 0;
+        for (size_t source : node.sources)
+          size += values[source].size();
+        value.resize(size);
+        Eigen::Index position = 0;
+        for (size_t source : node.sources) {
+          value.segment(position, values[source].size()) = values[source];
+          position += values[source].size();
+        };
+        break;
+      }
+      case lwt::NodeConfig::Type::SUM:
+        value = values[node.sources[0]];
+        for (size_t i = 1; i < node.sources.size(); i++)
+          value += values[node.sources[i]];
+        break;
+      default:
+        break;
+    };
+  };
+  for (size_t node_n = 0; node_n < m_outputNodeIndex.size(); node_n++) {
+    const Eigen::VectorXd& result = values[m_outputNodeIndex[node_n]];
+    outputs[node_n].assign(result.data(), result.data() + result.size());
+  };
+};
+
+std::vector<std::string> TFCSGANLWTNNHandler::getInputNodes() const
+{
+  return m_inputNodes;
+};
+
+std::vector<std::string> TFCSGANLWTNNHandler::getOutputNodes() const
+{
+  return m_outputNodes;
+};
+
 // Giving this it's own streamer to call setupNet
 void TFCSGANLWTNNHandler::Streamer(TBuffer& buf)
 {
@@ -5,6 +5,7 @@
 ///////////////////////////////////////////////////////////////////
 
 // class header include
+#include <fstream>
 #include <iostream>
 #include <sstream>
 
@@ -12,7 +13,12 @@
 
 #include "TMath.h"
 
-TFCSGANXMLParameters::TFCSGANXMLParameters() {}
+TFCSGANXMLParameters::TFCSGANXMLParameters()
+    : m_symmetrisedAlpha(false)
+    , m_ganVersion(0)
+    , m_latentDim(0)
+{
+}
 
 TFCSGANXMLParameters::~TFCSGANXMLParameters() {}
 
@@ -22,6 +28,59 @@ void TFCSGANXMLParameters::InitialiseFromXML(
   m_fastCaloGANInputFolderName = FastCaloGANInputFolderName;
   std::string xmlFullFileName = FastCaloGANInputFolderName + "/binning.xml";
 
+  std::ifstream xmlFile(xmlFullFileName);
+  if (!TFCSConfigCache::enabled() || !xmlFile) {
+    ParseXML(pid, etaMid, xmlFullFileName, nullptr);
+    return;
+  }
+  // The cache entry belongs to the file content and the selected bin
+  std::stringstream key;
+  key << xmlFile.rdbuf() << "\npid " << pid << " etaMid " << etaMid;
+
+  // Only applied once the whole entry was read
+  bool symmetrisedAlpha = false;
+  int ganVersion = 0;
+  int latentDim = 0;
+  std::vector<int> pids, regionIds, layers, binsInAlpha;
+  std::vector<std::vector<double>> edges;
+  auto read = [&](TFCSConfigCache::Reader& cache)
+  {
+    cache.read(symmetrisedAlpha);
+    cache.read(ganVersion);
+    cache.read(latentDim);
+    cache.read(pids);
+    cache.read(regionIds);
+    cache.read(layers);
+    cache.read(edges);
+    cache.read(binsInAlpha);
+  };
+  if (TFCSConfigCache::load("gan_binning", key.str(), read)
+      && pids.size() == layers.size() && regionIds.size() == layers.size()
+      && edges.size() == layers.size() && binsInAlpha.size() == layers.size())
+  {
+    FCS_MSG_DEBUG("Read binning of pid " << pid << " etaMid " << etaMid
+                                         << " from the cache");
+    m_symmetrisedAlpha = symmetrisedAlpha;
+    m_ganVersion = ganVersion;
+    m_latentDim = latentDim;
+    for (std::size_t i = 0; i < layers.size(); ++i)
+      AddLayer(pids[i], regionIds[i], layers[i], edges[i], binsInAlpha[i]);
+    return;
+  }
+  TFCSConfigCache::Writer cache;
+  ParseXML(pid, etaMid, xmlFullFileName, &cache);
+  TFCSConfigCache::store("gan_binning", key.str(), cache);
+}
+
+void TFCSGANXMLParameters::ParseXML(int pid,
+                                    int etaMid,
+                                    const std::string& xmlFullFileName,
+                                    TFCSConfigCache::Writer* cache)
+{
+  // Arguments of AddLayer, recorded for the cache
+  std::vector<int> pids, regionIds, layers, binsInAlphas;
+  std::vector<std::vector<double>> allEdges;
+
   xmlDocPtr doc = xmlParseFile(xmlFullFileName.c_str());
   for (xmlNodePtr nodeRoot = doc->children; nodeRoot != nullptr;
        nodeRoot = nodeRoot->next)
@@ -75,25 +134,12 @@ void TFCSGANXMLParameters::InitialiseFromXML(
                       int layer = atof(
                           (const char*)xmlGetProp(nodeLayer, BAD_CAST "id"));
 
-                      std::string name = "hist_pid_" + std::to_string(nodePid)
-                          + "_region_" + std::to_string(regionId) + "_layer_"
-                          + std::to_string(layer);
-                      int xBins = edges.size() - 1;
-                      if (xBins == 0)
-                        xBins = 1;  // remove warning
-                      else
-                        m_relevantlayers.push_back(layer);
-                      double minAlpha = -TMath::Pi();
-                      if (m_symmetrisedAlpha && binsInAlpha > 1) {
-                        minAlpha = 0;
-                      }
-                      m_binning[layer] = TH2D(name.c_str(),
-                                              name.c_str(),
-                                              xBins,
-                                              &edges[0],
-                                              binsInAlpha,
-                                              minAlpha,
-                                              TMath::Pi());
+                      AddLayer(nodePid, regionId, layer, edges, binsInAlpha);
+                      pids.push_back(nodePid);
+                      regionIds.push_back(regionId);
+                      layers.push_back(layer);
+                      allEdges.push_back(edges);
+                      binsInAlphas.push_back(binsInAlpha);
                     }
                   }
                 }
@@ -105,6 +151,43 @@ void TFCSGANXMLParameters::InitialiseFromXML(
     }
   }
   xmlFreeDoc(doc);
+
+  if (cache) {
+    cache->write(m_symmetrisedAlpha);
+    cache->write(m_ganVersion);
+    cache->write(m_latentDim);
+    cache->write(pids);
+    cache->write(regionIds);
+    cache->write(layers);
+    cache->write(allEdges);
+    cache->write(binsInAlphas);
+  }
+}
+
+void TFCSGANXMLParameters::AddLayer(int pid,
+                                    int regionId,
+                                    int layer,
+                                    const std::vector<double>& edges,
+                                    int binsInAlpha)
+{
+  std::string name = "hist_pid_" + std::to_string(pid) + "_region_"
+      + std::to_string(regionId) + "_layer_" + std::to_string(layer);
+  int xBins = edges.size() - 1;
+  if (xBins == 0)
+    xBins = 1;  // remove warning
+  else
+    m_relevantlayers.push_back(layer);
+  double minAlpha = -TMath::Pi();
+  if (m_symmetrisedAlpha && binsInAlpha > 1) {
+    minAlpha = 0;
+  }
+  m_binning[layer] = TH2D(name.c_str(),
+                          name.c_str(),
+                          xBins,
+                          &edges[0],
+                          binsInAlpha,
+                          minAlpha,
+                          TMath::Pi());
 }
 
 bool TFCSGANXMLParameters::ReadBooleanAttribute(const std::string& name,
@@ -30,6 +30,10 @@ FCSReturnCode TFCSHitCellMapping::simulate_hit(
   FCS_MSG_DEBUG("Got hit with E=" << hit.E() << " eta=" << hit.eta()
                                   << " phi=" << hit.phi());
 
+  // Already in the cells, e.g. from the direct projection of a binned shower
+  if (hit.deposited())
+    return FCSSuccess;
+
   // Position where we will perform the lookup
   Position lookup_pos {0, 0, 0, hit.eta(), hit.phi(), 0};
 
@@ -58,6 +62,33 @@ FCSReturnCode TFCSHitCellMapping::simulate_hit(
   return FCSSuccess;
 }
 
+void TFCSHitCellMapping::simulate_hits(TFCSSimulationState& simulstate,
+                                       const std::vector<Position>& positions,
+                                       const std::vector<float>& E) const
+{
+  std::vector<const Cell*>& cells =
+      simulstate.getScratch<std::vector<const Cell*>>(
+          "HitCellMappingCells"_FCShash);
+  m_geo->get_cells(calosample(), positions, cells);
+
+  const Cell* current = nullptr;
+  double E_current = 0;
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    // Same cut on the distance to the nearest cell as in simulate_hit
+    if (cells[i]->boundary_proximity(positions[i]) >= 0.005)
+      continue;
+    if (cells[i] != current) {
+      if (current)
+        simulstate.deposit(current->id(), E_current);
+      current = cells[i];
+      E_current = 0;
+    }
+    E_current += E[i];
+  }
+  if (current)
+    simulstate.deposit(current->id(), E_current);
+}
+
 bool TFCSHitCellMapping::operator==(const TFCSParametrizationBase& ref) const
 {
   if (TFCSParametrizationBase::compare(ref))
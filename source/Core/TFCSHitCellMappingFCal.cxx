@@ -21,6 +21,10 @@ FCSReturnCode TFCSHitCellMappingFCal::simulate_hit(
   FCS_MSG_DEBUG("Got hit with E=" << hit.E() << " x=" << hit.x()
                                   << " y=" << hit.y());
 
+  // Already in the cells, e.g. from the direct projection of a binned shower
+  if (hit.deposited())
+    return FCSSuccess;
+
   // Position where we perform the lookup
   // The z position here is used to determine the side
   // in the custom FCAL geo handler
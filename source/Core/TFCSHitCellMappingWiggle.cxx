@@ -126,6 +126,10 @@ FCSReturnCode TFCSHitCellMappingWiggle::simulate_hit(
   int bin = std::distance(m_bin_low_edge.begin(), it) - 1;
 
   const TFCS1DFunction* func = get_function(bin);
+  if (func && !func->is_valid()) {
+    FCS_MSG_ERROR("Wiggle function of bin " << bin << " could not be read");
+    return FCSFatal;
+  }
   if (func) {
     double rnd = CLHEP::RandFlat::shoot(simulstate.randomEngine());
 
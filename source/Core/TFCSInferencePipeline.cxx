@@ -0,0 +1,193 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+
+#include "FastCaloSim/Core/TFCSInferencePipeline.h"
+
+#include <tbb/task_arena.h>
+
+#include "TError.h"
+
+namespace
+{
+/// Arena shared by all pipelines, never destroyed so that it outlives
+/// pipelines in static objects
+tbb::task_arena& shared_arena()
+{
+  static tbb::task_arena* arena =
+      new tbb::task_arena(TFCSInferencePipeline::n_threads(), 0);
+  return *arena;
+}
+}  // namespace
+
+struct TFCSInferencePipeline::State_t
+{
+  struct Slot_t
+  {
+    std::shared_ptr<Job> job;
+    bool started = false;
+    bool done = false;
+    bool ok = false;
+  };
+
+  std::mutex mutex;
+  /// Signals finished jobs
+  std::condition_variable done;
+  std::deque<std::shared_ptr<Slot_t>> queue;
+  std::unordered_map<const void*, std::shared_ptr<Slot_t>> slots;
+  /// Jobs queued or running
+  unsigned int n_pending = 0;
+  bool running = false;
+
+  /// Run the oldest queued job on this thread, the lock must be held.
+  /// Returns false if the queue is empty or another job is running
+  bool run_next(std::unique_lock<std::mutex>& lock)
+  {
+    if (running || queue.empty())
+      return false;
+    std::shared_ptr<Slot_t> slot = std::move(queue.front());
+    queue.pop_front();
+    slot->started = true;
+    running = true;
+    lock.unlock();
+
+    bool ok = false;
+    try {
+      ok = slot->job->run();
+    } catch (const std::exception& e) {
+      ::Error("TFCSInferencePipeline::run",
+              "Network evaluation failed with error %s",
+              e.what());
+    }
+
+    lock.lock();
+    slot->ok = ok;
+    slot->done = true;
+    running = false;
+    --n_pending;
+    done.notify_all();
+    return true;
+  }
+
+  /// Remove the slot of key, dropping its job if it has not started
+  void remove(const void* key)
+  {
+    auto it = slots.find(key);
+    if (it == slots.end())
+      return;
+    auto queued = std::find(queue.begin(), queue.end(), it->second);
+    if (queued != queue.end()) {
+      queue.erase(queued);
+      --n_pending;
+      done.notify_all();
+    }
+    slots.erase(it);
+  }
+};
+
+TFCSInferencePipeline::TFCSInferencePipeline(unsigned int max_pending)
+    : m_max_pending(max_pending > 0 ? max_pending : 1)
+    , m_state(std::make_shared<State_t>())
+{
+}
+
+TFCSInferencePipeline::~TFCSInferencePipeline()
+{
+  // Nobody can collect the results anymore, but a running job may use
+  // networks that are deleted after the pipeline
+  std::unique_lock<std::mutex> lock(m_state->mutex);
+  m_state->n_pending -= m_state->queue.size();
+  m_state->queue.clear();
+  m_state->slots.clear();
+  m_state->done.wait(lock, [this] { return !m_state->running; });
+}
+
+unsigned int TFCSInferencePipeline::n_threads()
+{
+  static const unsigned int threads = []
+  {
+    const char* value = std::getenv("FCS_INFERENCE_THREADS");
+    if (!value || !*value)
+      return 1u;
+    char* end = nullptr;
+    const long parsed = std::strtol(value, &end, 10);
+    if (*end != '\0' || parsed < 1) {
+      ::Warning("TFCSInferencePipeline",
+                "Ignoring FCS_INFERENCE_THREADS=%s, expected a positive "
+                "integer",
+                value);
+      return 1u;
+    }
+    return static_cast<unsigned int>(parsed);
+  }();
+  return threads;
+}
+
+bool TFCSInferencePipeline::submit(const void* key, std::shared_ptr<Job> job)
+{
+  auto slot = std::make_shared<State_t::Slot_t>();
+  slot->job = std::move(job);
+
+  State_t& state = *m_state;
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.remove(key);
+  // Help instead of waiting if the arena has not picked up the jobs yet
+  while (state.n_pending >= m_max_pending) {
+    if (!state.run_next(lock))
+      state.done.wait(lock);
+  }
+  state.slots[key] = slot;
+  state.queue.push_back(std::move(slot));
+  ++state.n_pending;
+  lock.unlock();
+
+  // The task runs the queued jobs of this pipeline until none is left,
+  // it finds nothing to do if a caller or an earlier task was faster
+  std::shared_ptr<State_t> shared = m_state;
+  shared_arena().enqueue(
+      [shared]
+      {
+        std::unique_lock<std::mutex> task_lock(shared->mutex);
+        while (shared->run_next(task_lock)) {
+        }
+      });
+  return true;
+}
+
+std::shared_ptr<TFCSInferencePipeline::Job> TFCSInferencePipeline::collect(
+    const void* key, bool& ok)
+{
+  ok = false;
+  State_t& state = *m_state;
+  std::unique_lock<std::mutex> lock(state.mutex);
+  auto it = state.slots.find(key);
+  if (it == state.slots.end())
+    return nullptr;
+  std::shared_ptr<State_t::Slot_t> slot = it->second;
+  state.slots.erase(it);
+  // Run the jobs up to this one if they have not started yet
+  while (!slot->done) {
+    if (slot->started || !state.run_next(lock))
+      state.done.wait(lock);
+  }
+  ok = slot->ok;
+  return std::move(slot->job);
+}
+
+void TFCSInferencePipeline::discard(const void* key)
+{
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  m_state->remove(key);
+}
+
+bool TFCSInferencePipeline::has(const void* key) const
+{
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  return m_state->slots.count(key) > 0;
+}
@@ -284,6 +284,11 @@ FCSReturnCode TFCSLateralShapeParametrizationHitChain::simulate(
       hit.reset();
       hit.set_E(Ehit);
       failed = false;
+      // If the caller set a checkpoint for a clean retry, also the changes of
+      // a single failed hit are rolled back. Committing the hit merges its
+      // deposits into the journal entries of earlier hits in the same cells
+      TFCSSimulationState::Checkpoint_t hit_checkpoint(
+          simulstate, simulstate.has_checkpoint());
       if (debug)
         if (hit.idx() == 2)
           if (!verbose) {
@@ -305,6 +310,8 @@ FCSReturnCode TFCSLateralShapeParametrizationHitChain::simulate(
           return FCSFatal;
         }
         failed = true;
+        hit_checkpoint.rollback();
+        ++m_retry_count;
         ++ifail;
         ++itotalfail;
         retry = status - FCSRetry;
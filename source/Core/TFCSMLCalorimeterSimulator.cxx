@@ -1,131 +1,592 @@
 // Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+
 #include "FastCaloSim/Core/TFCSMLCalorimeterSimulator.h"
 
-#include "CLHEP/Random/RandGauss.h"
+#include "CLHEP/Random/RandGaussZiggurat.h"
+#include "FastCaloSim/Core/TFCSInferencePipeline.h"
 #include "FastCaloSim/Core/TFCSNetworkFactory.h"
+#include "FastCaloSim/Core/TFCSONNXHandler.h"
+
+namespace
+{
+// Input and output buffers of the network, kept per thread between events
+struct MLScratch_t
+{
+  std::vector<float> eta;
+  std::vector<float> energy;
+  std::vector<float> z_shape;
+  std::vector<float> z_energy;
+  VNetworkBase::TensorInputs inputs;
+  VNetworkBase::TensorOutputs outputs;
+};
+
+MLScratch_t& ml_scratch()
+{
+  static thread_local MLScratch_t scratch;
+  return scratch;
+}
 
-TFCSMLCalorimeterSimulator::TFCSMLCalorimeterSimulator() {}
+// Input nodes of the voxel flow model, in the order used in MLScratch_t
+const std::vector<std::string> ml_input_nodes = {
+    "inn_eta_in", "inn_einc_in", "cfm_z_shape", "inn_z_energy"};
+}  // namespace
+
+struct TFCSMLCalorimeterSimulator::BatchQueue_t
+{
+  typedef std::chrono::steady_clock clock;
+
+  struct Entry_t
+  {
+    request_t* request = nullptr;
+    clock::time_point enqueued;
+    bool taken = false;
+    bool done = false;
+    bool ok = false;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Entry_t*> pending;
+};
+
+struct TFCSMLCalorimeterSimulator::PipelineJob_t
+    : public TFCSInferencePipeline::Job
+{
+  const TFCSMLCalorimeterSimulator* simulator = nullptr;
+  request_t request;
+
+  bool run() override
+  {
+    request_t* single = &request;
+    return simulator->runBatch(&single, 1);
+  };
+};
+
+TFCSMLCalorimeterSimulator::TFCSMLCalorimeterSimulator()
+    : m_batch_queue(std::make_unique<BatchQueue_t>())
+{
+}
 
 TFCSMLCalorimeterSimulator::~TFCSMLCalorimeterSimulator() {}
 
-bool TFCSMLCalorimeterSimulator::loadSimulator(std::string filename)
+bool TFCSMLCalorimeterSimulator::loadSimulator(
+    std::string filename, TFCSONNXQuantization::Precision precision)
 {
   // Load the simulator
+  std::unique_ptr<VNetworkBase> network;
   try {
-    m_onnx_model = TFCSNetworkFactory::create(filename);
+    network = TFCSNetworkFactory::create(filename, precision);
   } catch (std::exception& e) {
     FCS_MSG_ERROR("Failed to load simulator from file "
                   << filename << " with error " << e.what());
     return false;
   }
 
-  if (m_onnx_model == nullptr) {
+  if (network == nullptr) {
     FCS_MSG_ERROR("Failed to load simulator from file " << filename);
     return false;
   }
+  return setNetwork(std::move(network), precision);
+}
+
+bool TFCSMLCalorimeterSimulator::setNetwork(
+    std::unique_ptr<VNetworkBase> network,
+    TFCSONNXQuantization::Precision precision)
+{
+  m_onnx_model = std::move(network);
+  m_inputNodeIndex.clear();
+  m_int8 = precision == TFCSONNXQuantization::kInt8;
+  if (!m_onnx_model)
+    return false;
+
+  // The input nodes are only known once the session exists, which can
+  // fail for a broken model
+  try {
+    return findInputNodes(m_inputNodeIndex);
+  } catch (std::exception& e) {
+    FCS_MSG_ERROR("Failed to set up simulator with error " << e.what());
+    return false;
+  }
+}
 
+bool TFCSMLCalorimeterSimulator::set_session_config(
+    const TFCSONNXRuntime::SessionConfig& config)
+{
+  auto* onnx = dynamic_cast<TFCSONNXHandler*>(m_onnx_model.get());
+  if (!onnx) {
+    FCS_MSG_ERROR("No ONNX network loaded, cannot set the session options");
+    return false;
+  }
+  onnx->setSessionConfig(config);
   return true;
 }
 
-VNetworkBase::NetworkOutputs TFCSMLCalorimeterSimulator::predictVoxels(
-    TFCSSimulationState& simulstate, float eta, float energy) const
+bool TFCSMLCalorimeterSimulator::quantize_int8()
+{
+  auto* onnx = dynamic_cast<TFCSONNXHandler*>(m_onnx_model.get());
+  if (!onnx) {
+    FCS_MSG_ERROR("No ONNX network loaded, cannot quantize it");
+    return false;
+  }
+  if (!onnx->quantizeDynamicInt8())
+    return false;
+  m_int8 = true;
+  return true;
+}
+
+void TFCSMLCalorimeterSimulator::set_pipeline_depth(unsigned int depth)
+{
+  m_pipeline.reset();
+  if (depth > 0)
+    m_pipeline = std::make_unique<TFCSInferencePipeline>(depth);
+}
+
+unsigned int TFCSMLCalorimeterSimulator::pipeline_depth() const
+{
+  return m_pipeline ? m_pipeline->max_pending() : 0;
+}
+
+bool TFCSMLCalorimeterSimulator::findInputNodes(
+    std::vector<int>& node_index) const
+{
+  node_index.clear();
+  for (const std::string& node_name : ml_input_nodes) {
+    const int index = m_onnx_model->inputNodeIndex(node_name);
+    if (index < 0) {
+      FCS_MSG_ERROR("Network has no input node named " << node_name);
+      return false;
+    }
+    node_index.push_back(index);
+  }
+  return true;
+}
+
+void TFCSMLCalorimeterSimulator::prepareRequest(float eta,
+                                                float energy,
+                                                request_t& request) const
 {
   // Bring eta into the needed range
-  eta = std::abs(eta) * 10;
+  request.eta = std::abs(eta) * 10;
+  request.energy = energy;
+  request.n_rows = m_nEvents;
+}
 
-  // Initialize the energy and eta input vectors
-  std::vector<float> eta_vector(m_nEvents, eta);
-  std::vector<float> energy_vector(m_nEvents, energy);
+void TFCSMLCalorimeterSimulator::sampleInputs(TFCSSimulationState& simulstate,
+                                              float eta,
+                                              float energy,
+                                              request_t& request) const
+{
+  prepareRequest(eta, energy, request);
+  request.z_shape.resize(request.n_rows * m_nVoxels);
+  request.z_energy.resize(request.n_rows * m_nLayers);
+  sampleNoise(simulstate,
+              request.n_rows,
+              request.z_shape.data(),
+              request.z_energy.data());
+}
+
+void TFCSMLCalorimeterSimulator::sampleNoise(TFCSSimulationState& simulstate,
+                                             std::size_t n_rows,
+                                             float* z_shape,
+                                             float* z_energy) const
+{
+  // sample the z vectors according to a standard normal distribution, in
+  // bulk and straight into the buffers
+  CLHEP::RandGaussZiggurat::shootArray(
+      simulstate.randomEngine(), n_rows * m_nVoxels, z_shape, 0.0, 1.0);
+  CLHEP::RandGaussZiggurat::shootArray(
+      simulstate.randomEngine(), n_rows * m_nLayers, z_energy, 0.0, 1.0);
+}
 
-  // sample the z vectors according to a standard normal distribution
-  std::vector<float> z_shape_vector(m_nEvents * m_nVoxels, 0.0);
-  std::vector<float> z_energy_vector(m_nEvents * m_nLayers, 0.0);
-  for (auto& z_shape : z_shape_vector) {
-    z_shape = CLHEP::RandGauss::shoot(simulstate.randomEngine(), 0.0, 1.0);
+bool TFCSMLCalorimeterSimulator::evaluate(std::size_t n_rows) const
+{
+  if (!m_onnx_model) {
+    FCS_MSG_ERROR("predictVoxels called before a simulator was loaded");
+    return false;
   }
-  for (auto& z_energy : z_energy_vector) {
-    z_energy = CLHEP::RandGauss::shoot(simulstate.randomEngine(), 0.0, 1.0);
+  MLScratch_t& scratch = ml_scratch();
+
+  // Objects read from file have not looked up the input nodes yet
+  std::vector<int> node_index_lookup;
+  if (m_inputNodeIndex.empty() && !findInputNodes(node_index_lookup))
+    return false;
+  const std::vector<int>& node_index =
+      m_inputNodeIndex.empty() ? node_index_lookup : m_inputNodeIndex;
+
+  // Prepare the inputs for the network, the values are not copied
+  scratch.inputs.resize(ml_input_nodes.size());
+  scratch.inputs[node_index[0]] = scratch.eta;
+  scratch.inputs[node_index[1]] = scratch.energy;
+  scratch.inputs[node_index[2]] = scratch.z_shape;
+  scratch.inputs[node_index[3]] = scratch.z_energy;
+
+  // Compute the network outputs
+  try {
+    m_onnx_model->computeTensorsBatch(scratch.inputs, n_rows, scratch.outputs);
+  } catch (std::exception& e) {
+    FCS_MSG_ERROR("Network evaluation failed with error " << e.what());
+    return false;
+  }
+  if (scratch.outputs.empty() || scratch.outputs.front().size() % n_rows != 0)
+  {
+    FCS_MSG_ERROR("Network returned no or incomplete outputs for "
+                  << n_rows << " rows");
+    return false;
   }
+  return true;
+}
 
-  // Prepare the inputs for the network
-  VNetworkBase::NetworkInputs inputs;
+void TFCSMLCalorimeterSimulator::distributeOutputs(request_t* const* requests,
+                                                   std::size_t n,
+                                                   std::size_t n_rows) const
+{
+  // Hand back the outputs of each request
+  const std::vector<float>& voxels = ml_scratch().outputs.front();
+  const std::size_t row_size = voxels.size() / n_rows;
+  std::size_t row = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    request_t& request = *requests[i];
+    request.voxels.assign(voxels.begin() + row * row_size,
+                          voxels.begin() + (row + request.n_rows) * row_size);
+    row += request.n_rows;
+  }
+}
 
-  int i = 0;
-  for (float eta : eta_vector) {
-    inputs["inn_eta_in"].insert(
-        std::pair<std::string, double>("variable_" + std::to_string(i), eta));
-    i++;
+bool TFCSMLCalorimeterSimulator::runBatch(request_t* const* requests,
+                                          std::size_t n) const
+{
+  MLScratch_t& scratch = ml_scratch();
+
+  // Concatenate the inputs of all requests
+  scratch.eta.clear();
+  scratch.energy.clear();
+  scratch.z_shape.clear();
+  scratch.z_energy.clear();
+  std::size_t n_rows = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const request_t& request = *requests[i];
+    scratch.eta.insert(scratch.eta.end(), request.n_rows, request.eta);
+    scratch.energy.insert(scratch.energy.end(), request.n_rows, request.energy);
+    scratch.z_shape.insert(scratch.z_shape.end(),
+                           request.z_shape.begin(),
+                           request.z_shape.end());
+    scratch.z_energy.insert(scratch.z_energy.end(),
+                            request.z_energy.begin(),
+                            request.z_energy.end());
+    n_rows += request.n_rows;
   }
 
-  i = 0;
-  for (float energy : energy_vector) {
-    inputs["inn_einc_in"].insert(std::pair<std::string, double>(
-        "variable_" + std::to_string(i), energy));
-    i++;
+  if (!evaluate(n_rows))
+    return false;
+  distributeOutputs(requests, n, n_rows);
+  return true;
+}
+
+bool TFCSMLCalorimeterSimulator::runSampled(
+    TFCSSimulationState* const* simulstates,
+    request_t* const* requests,
+    std::size_t n) const
+{
+  MLScratch_t& scratch = ml_scratch();
+  std::size_t n_rows = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    n_rows += requests[i]->n_rows;
+  scratch.eta.resize(n_rows);
+  scratch.energy.resize(n_rows);
+  scratch.z_shape.resize(n_rows * m_nVoxels);
+  scratch.z_energy.resize(n_rows * m_nLayers);
+
+  // Draw the noise of each request directly into the network inputs
+  std::size_t row = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const request_t& request = *requests[i];
+    std::fill_n(scratch.eta.begin() + row, request.n_rows, request.eta);
+    std::fill_n(scratch.energy.begin() + row, request.n_rows, request.energy);
+    sampleNoise(*simulstates[i],
+                request.n_rows,
+                scratch.z_shape.data() + row * m_nVoxels,
+                scratch.z_energy.data() + row * m_nLayers);
+    row += request.n_rows;
   }
 
-  i = 0;
-  for (float z_shape : z_shape_vector) {
-    inputs["cfm_z_shape"].insert(std::pair<std::string, double>(
-        "variable_" + std::to_string(i), z_shape));
-    i++;
+  if (!evaluate(n_rows))
+    return false;
+  distributeOutputs(requests, n, n_rows);
+  return true;
+}
+
+bool TFCSMLCalorimeterSimulator::runQueued(request_t& request) const
+{
+  typedef BatchQueue_t::clock clock;
+  BatchQueue_t& queue = *m_batch_queue;
+  const clock::duration latency = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double, std::micro>(m_max_batch_latency));
+
+  BatchQueue_t::Entry_t entry;
+  entry.request = &request;
+  entry.enqueued = clock::now();
+
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  queue.pending.push_back(&entry);
+  // A full batch can be run right away by any of the waiting threads
+  if (queue.pending.size() >= m_max_batch_size)
+    queue.cv.notify_all();
+
+  while (!entry.done) {
+    if (entry.taken) {
+      // Another thread is evaluating this request
+      queue.cv.wait(lock);
+      continue;
+    }
+    const clock::time_point deadline =
+        queue.pending.front()->enqueued + latency;
+    if (queue.pending.size() < m_max_batch_size && clock::now() < deadline) {
+      queue.cv.wait_until(lock, deadline);
+      continue;
+    }
+
+    // Evaluate the oldest requests in this thread
+    const std::size_t n =
+        std::min<std::size_t>(queue.pending.size(), m_max_batch_size);
+    std::vector<BatchQueue_t::Entry_t*> entries(queue.pending.begin(),
+                                                queue.pending.begin() + n);
+    queue.pending.erase(queue.pending.begin(), queue.pending.begin() + n);
+    std::vector<request_t*> batch;
+    for (BatchQueue_t::Entry_t* taken : entries) {
+      taken->taken = true;
+      batch.push_back(taken->request);
+    }
+    lock.unlock();
+    const bool ok = runBatch(batch.data(), batch.size());
+    lock.lock();
+    for (BatchQueue_t::Entry_t* taken : entries) {
+      taken->ok = ok;
+      taken->done = true;
+    }
+    queue.cv.notify_all();
   }
+  return entry.ok;
+}
 
-  i = 0;
-  for (float z_energy : z_energy_vector) {
-    inputs["inn_z_energy"].insert(std::pair<std::string, double>(
-        "variable_" + std::to_string(i), z_energy));
-    i++;
+void TFCSMLCalorimeterSimulator::retryNaN(
+    TFCSSimulationState* const* simulstates,
+    request_t* const* requests,
+    std::size_t n) const
+{
+  // Network rows with NaN in their output, given by request and row
+  std::vector<std::pair<std::size_t, std::size_t>> affected;
+  std::vector<request_t> rows;
+  std::vector<request_t*> row_requests;
+  std::vector<TFCSSimulationState*> row_states;
+
+  for (int retry = 0;; ++retry) {
+    affected.clear();
+    for (std::size_t i = 0; i < n; ++i) {
+      const request_t& request = *requests[i];
+      if (request.voxels.empty() || request.n_rows == 0)
+        continue;
+      const std::size_t row_size = request.voxels.size() / request.n_rows;
+      for (std::size_t row = 0; row < request.n_rows; ++row) {
+        const auto begin = request.voxels.begin() + row * row_size;
+        if (std::any_of(begin,
+                        begin + row_size,
+                        [](float value) { return std::isnan(value); }))
+        {
+          affected.emplace_back(i, row);
+        }
+      }
+    }
+    if (affected.empty())
+      return;
+    if (retry >= 5) {
+      FCS_MSG_WARNING("Network output still contains NaN in "
+                      << affected.size() << " rows after " << retry
+                      << " retries. Giving up.");
+      return;
+    }
+    FCS_MSG_WARNING("Network output contains NaN in "
+                    << affected.size()
+                    << " rows. Retrying these rows (attempt " << retry + 1
+                    << ").");
+
+    // Only the affected rows get new noise, all evaluated in one batch
+    // unless the network is int8
+    rows.resize(affected.size());
+    row_requests.resize(affected.size());
+    row_states.resize(affected.size());
+    for (std::size_t k = 0; k < affected.size(); ++k) {
+      const request_t& request = *requests[affected[k].first];
+      rows[k].eta = request.eta;
+      rows[k].energy = request.energy;
+      rows[k].n_rows = 1;
+      row_requests[k] = &rows[k];
+      row_states[k] = simulstates[affected[k].first];
+    }
+    bool ok = true;
+    const std::size_t step = m_int8 ? 1 : rows.size();
+    for (std::size_t start = 0; ok && start < rows.size(); start += step)
+      ok = runSampled(&row_states[start],
+                      &row_requests[start],
+                      std::min(step, rows.size() - start));
+    if (!ok) {
+      FCS_MSG_ERROR("predictVoxels returned empty outputs on retry; giving up");
+      for (const auto& entry : affected)
+        requests[entry.first]->voxels.clear();
+      return;
+    }
+    for (std::size_t k = 0; k < affected.size(); ++k) {
+      request_t& request = *requests[affected[k].first];
+      const std::size_t row_size = request.voxels.size() / request.n_rows;
+      if (request.voxels.empty() || rows[k].voxels.size() != row_size) {
+        request.voxels.clear();
+        continue;
+      }
+      std::copy(rows[k].voxels.begin(),
+                rows[k].voxels.end(),
+                request.voxels.begin() + affected[k].second * row_size);
+    }
   }
+}
 
-  // Compute the network outputs
-  if (!m_onnx_model) {
-    FCS_MSG_ERROR("predictVoxels called before a simulator was loaded");
+std::vector<float> TFCSMLCalorimeterSimulator::predictVoxels(
+    TFCSSimulationState& simulstate, float eta, float energy) const
+{
+  static thread_local request_t request;
+  prepareRequest(eta, energy, request);
+  TFCSSimulationState* state = &simulstate;
+  request_t* single = &request;
+  if (!runSampled(&state, &single, 1))
     return {};
-  }
-  VNetworkBase::NetworkOutputs outputs = m_onnx_model->compute(inputs);
+  return request.voxels;
+}
 
-  return outputs;
+bool TFCSMLCalorimeterSimulator::submitEvent(TFCSSimulationState& simulstate,
+                                             float eta,
+                                             float energy) const
+{
+  if (!m_pipeline || !m_onnx_model)
+    return false;
+  auto job = std::make_shared<PipelineJob_t>();
+  job->simulator = this;
+  sampleInputs(simulstate, eta, energy, job->request);
+  return m_pipeline->submit(&simulstate, std::move(job));
+}
+
+std::shared_ptr<TFCSMLCalorimeterSimulator::PipelineJob_t>
+TFCSMLCalorimeterSimulator::collectJob(TFCSSimulationState& simulstate,
+                                       float eta,
+                                       float energy,
+                                       bool& ok) const
+{
+  ok = false;
+  if (!m_pipeline)
+    return nullptr;
+  auto job = std::static_pointer_cast<PipelineJob_t>(
+      m_pipeline->collect(&simulstate, ok));
+  if (job
+      && (job->request.eta != std::abs(eta) * 10
+          || job->request.energy != energy))
+  {
+    // Drawing new noise would shift the random numbers of everything that
+    // follows, the noise does not depend on eta and energy
+    FCS_MSG_ERROR("Event was submitted for eta "
+                  << job->request.eta / 10 << " energy " << job->request.energy
+                  << ", evaluating again with the submitted noise");
+    request_t& request = job->request;
+    prepareRequest(eta, energy, request);
+    request_t* single = &request;
+    ok = runBatch(&single, 1);
+  }
+  return job;
 }
 
 TFCSMLCalorimeterSimulator::event_t TFCSMLCalorimeterSimulator::getEvent(
     TFCSSimulationState& simulstate, float eta, float energy) const
 {
-  // Get the voxel energies
-  VNetworkBase::NetworkOutputs outputs = predictVoxels(simulstate, eta, energy);
+  // Get the voxel energies, evaluated already if the event was submitted
+  static thread_local request_t local_request;
+  bool ok = false;
+  std::shared_ptr<PipelineJob_t> job =
+      collectJob(simulstate, eta, energy, ok);
+  request_t& request = job ? job->request : local_request;
+  TFCSSimulationState* state = &simulstate;
+  request_t* single = &request;
+  if (!job) {
+    if (m_max_batch_latency > 0 && batch_limit() > 1) {
+      sampleInputs(simulstate, eta, energy, request);
+      ok = runQueued(request);
+    } else {
+      prepareRequest(eta, energy, request);
+      ok = runSampled(&state, &single, 1);
+    }
+  }
 
-  if (outputs.empty()) {
+  if (!ok || request.voxels.empty()) {
     FCS_MSG_ERROR(
         "predictVoxels returned empty outputs; returning empty event");
     return event_t {};
   }
+  retryNaN(&state, &single, 1);
+  if (request.voxels.empty())
+    return event_t {};
 
-  // Check if any output contains NaN; retry up to 5 times if so
-  auto has_nan = [](const VNetworkBase::NetworkOutputs& out)
-  {
-    for (const auto& kv : out) {
-      if (std::isnan(kv.second))
-        return true;
-    }
-    return false;
-  };
+  return makeEvent(request.voxels, energy);
+}
 
-  int retry = 0;
-  while (has_nan(outputs)) {
-    if (retry >= 5) {
-      FCS_MSG_WARNING("Network output still contains NaN after "
-                      << retry << " retries. Giving up.");
-      break;
+std::vector<TFCSMLCalorimeterSimulator::event_t>
+TFCSMLCalorimeterSimulator::getEvents(
+    const std::vector<TFCSSimulationState*>& simulstates,
+    const std::vector<float>& etas,
+    const std::vector<float>& energies) const
+{
+  const std::size_t n = simulstates.size();
+  if (etas.size() != n || energies.size() != n) {
+    FCS_MSG_ERROR("getEvents needs one eta and energy per simulation state");
+    return std::vector<event_t>(n);
+  }
+
+  std::vector<request_t> requests(n);
+  std::vector<request_t*> pointers(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    prepareRequest(etas[i], energies[i], requests[i]);
+    pointers[i] = &requests[i];
+  }
+  for (std::size_t start = 0; start < n; start += batch_limit()) {
+    const std::size_t n_batch = std::min(batch_limit(), n - start);
+    if (!runSampled(&simulstates[start], &pointers[start], n_batch)) {
+      for (std::size_t i = start; i < start + n_batch; ++i)
+        requests[i].voxels.clear();
     }
-    FCS_MSG_WARNING("Network output contains NaN. Retrying (attempt "
-                    << retry + 1 << ").");
-    outputs = predictVoxels(simulstate, eta, energy);
-    if (outputs.empty()) {
-      FCS_MSG_ERROR("predictVoxels returned empty outputs on retry; giving up");
-      return event_t {};
+  }
+  retryNaN(simulstates.data(), pointers.data(), n);
+
+  std::vector<event_t> events(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    if (requests[i].voxels.empty()) {
+      FCS_MSG_ERROR(
+          "predictVoxels returned empty outputs; returning empty event");
+      continue;
     }
-    retry++;
+    events[i] = makeEvent(requests[i].voxels, energies[i]);
+  }
+  return events;
+}
+
+TFCSMLCalorimeterSimulator::event_t TFCSMLCalorimeterSimulator::makeEvent(
+    const std::vector<float>& outputs, float energy) const
+{
+  if (outputs.size() < m_nVoxels) {
+    FCS_MSG_ERROR("Network returned " << outputs.size() << " values for "
+                                      << m_nVoxels << " voxels");
+    return event_t {};
   }
 
   // Fill the event structure with the voxel energies
@@ -145,15 +606,7 @@ TFCSMLCalorimeterSimulator::event_t TFCSMLCalorimeterSimulator::getEvent(
       layer = m_used_layers.at(layer_index);
     }
 
-    const std::string key = std::to_string(voxel_index);
-    auto it = outputs.find(key);
-    if (it == outputs.end()) {
-      FCS_MSG_ERROR("Voxel key '"
-                    << key << "' not found in network outputs. "
-                    << "Available keys e.g.: " << outputs.begin()->first);
-      return event_t {};
-    }
-    float voxel_energy = it->second;
+    float voxel_energy = outputs[voxel_index];
 
     if (voxel_energy > 0) {
       if (event.event_data.size() <= layer) {
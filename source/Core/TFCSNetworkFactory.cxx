@@ -14,6 +14,7 @@
 
 // For messaging
 #include "FastCaloSim/Core/MLogging.h"
+#include "TError.h"
 
 void TFCSNetworkFactory::resolveGlobs(std::string& filename)
 {
@@ -115,6 +116,43 @@ std::unique_ptr<VNetworkBase> TFCSNetworkFactory::create(std::string input,
   };
 };
 
+std::unique_ptr<VNetworkBase> TFCSNetworkFactory::create(
+    std::string input, TFCSONNXQuantization::Precision precision)
+{
+  ISF_FCS::MLogging logger;
+  resolveGlobs(input);
+  if (precision == TFCSONNXQuantization::kFP32
+      || !(VNetworkBase::isFile(input) && isOnnxFile(input)))
+  {
+    return create(input);
+  };
+  const std::string variant =
+      TFCSONNXQuantization::variantPath(input, precision);
+  if (VNetworkBase::isFile(variant)) {
+    FCS_MSG_NOCLASS(logger,
+                    "Creating ONNX network from "
+                        << TFCSONNXQuantization::name(precision)
+                        << " variant ..."
+                        << variant.substr(variant.length() - 10));
+    std::unique_ptr<VNetworkBase> created(new TFCSONNXHandler(variant));
+    return created;
+  };
+  std::unique_ptr<TFCSONNXHandler> created(new TFCSONNXHandler(input));
+  if (precision == TFCSONNXQuantization::kInt8) {
+    FCS_MSG_NOCLASS(logger, "No int8 variant found, quantizing the network");
+    if (!created->quantizeDynamicInt8())
+      ::Warning("TFCSNetworkFactory::create",
+                "Cannot quantize %s, using single precision",
+                input.c_str());
+  } else {
+    ::Warning("TFCSNetworkFactory::create",
+              "No %s variant of %s found, using single precision",
+              TFCSONNXQuantization::name(precision).c_str(),
+              input.c_str());
+  };
+  return created;
+};
+
 std::unique_ptr<VNetworkBase> TFCSNetworkFactory::create(
     std::vector<char> const& vector_input, std::string string_input)
 {
@@ -3,9 +3,15 @@
 // See header file for documentation.
 #include "FastCaloSim/Core/TFCSONNXHandler.h"
 
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
+
 // For reading the binary onnx files
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iterator>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 // ONNX Runtime include(s).
@@ -19,6 +25,37 @@
 // For throwing exceptions
 #include <stdexcept>
 
+namespace
+{
+std::uint64_t next_session_id()
+{
+  static std::atomic<std::uint64_t> id {0};
+  return ++id;
+}
+}  // namespace
+
+template<typename Tin, typename Tout>
+struct TFCSONNXHandler::IoBindingState : public TFCSONNXHandler::IoBindingBase
+{
+  explicit IoBindingState(std::shared_ptr<Ort::Session> session_ptr)
+      : session(std::move(session_ptr))
+      , binding(*session)
+  {
+  }
+
+  /// Keeps the session alive as long as a thread still uses the binding
+  std::shared_ptr<Ort::Session> session;
+  /// Binding of the caller's memory, see bindTensors
+  Ort::IoBinding binding;
+  /// Bindings of the own buffers, one per batch size seen so far. All of
+  /// them view the same buffers
+  std::unordered_map<size_t, Ort::IoBinding> buffer_bindings;
+  /// Grow-only buffers, one per input and output node
+  std::vector<std::vector<Tin>> inputs;
+  std::vector<std::vector<Tout>> outputs;
+  std::vector<int64_t> dims;
+};
+
 TFCSONNXHandler::TFCSONNXHandler(const std::string& inputFile)
     : VNetworkBase(inputFile)
 {
@@ -42,42 +79,136 @@ TFCSONNXHandler::TFCSONNXHandler(const TFCSONNXHandler& copy_from)
     : VNetworkBase(copy_from)
 {
   FCS_MSG_DEBUG("TFCSONNXHandler copy constructor called");
+  std::lock_guard<std::mutex> lock(copy_from.m_sessionMutex);
   m_bytes = copy_from.m_bytes;
-  // Cannot copy a session
-  // m_session = copy_from.m_session;
-  // But can read it from bytes
-  readSerializedSession();
-  m_inputNodeNames = copy_from.m_inputNodeNames;
-  m_inputNodeDims = copy_from.m_inputNodeDims;
-  m_outputNodeNames = copy_from.m_outputNodeNames;
-  m_outputNodeDims = copy_from.m_outputNodeDims;
-  m_outputLayers = copy_from.m_outputLayers;
+  m_sessionConfig = copy_from.m_sessionConfig;
+  m_quantizedInt8 = copy_from.m_quantizedInt8;
+  if (copy_from.m_sessionReady) {
+    // Sessions are shared, and the bytes may be gone already
+    m_session = copy_from.m_session;
+    m_sessionId = next_session_id();
+    // The node names must point into this object's own storage
+    readNodeInfo();
+    m_sessionReady = true;
+  };
 };
 
 TFCSONNXHandler::NetworkOutputs TFCSONNXHandler::compute(
     TFCSONNXHandler::NetworkInputs const& inputs) const
 {
+  ensureSession();
   return m_computeLambda(inputs);
 };
 
+void TFCSONNXHandler::computeTensors(
+    TFCSONNXHandler::TensorInputs const& inputs,
+    TFCSONNXHandler::TensorOutputs& outputs) const
+{
+  ensureSession();
+  m_computeTensorsLambda(inputs, 1, outputs);
+};
+
+void TFCSONNXHandler::computeTensorsBatch(
+    TFCSONNXHandler::TensorInputs const& inputs,
+    std::size_t n_batch,
+    TFCSONNXHandler::TensorOutputs& outputs) const
+{
+  ensureSession();
+  if (n_batch == 1 || m_dynamicBatch) {
+    m_computeTensorsLambda(inputs, n_batch, outputs);
+  } else {
+    VNetworkBase::computeTensorsBatch(inputs, n_batch, outputs);
+  };
+};
+
+void TFCSONNXHandler::setSessionConfig(
+    const TFCSONNXRuntime::SessionConfig& config)
+{
+  std::lock_guard<std::mutex> lock(m_sessionMutex);
+  if (m_bytes.empty()) {
+    FCS_MSG_ERROR("The onnx bytes were deleted, cannot recreate the session.");
+    return;
+  };
+  m_sessionConfig = config;
+  if (m_sessionReady)
+    initSession();
+};
+
+bool TFCSONNXHandler::quantizeDynamicInt8()
+{
+  std::lock_guard<std::mutex> lock(m_sessionMutex);
+  if (m_bytes.empty()) {
+    FCS_MSG_ERROR("The onnx bytes were deleted, cannot quantize the model.");
+    return false;
+  };
+  if (m_quantizedInt8)
+    return true;
+  // Only checked here, the session is made from a quantized copy so that
+  // the persisted model stays in single precision
+  TFCSONNXQuantization::Report report;
+  std::vector<char> quantized =
+      TFCSONNXQuantization::quantizeDynamicInt8(m_bytes, &report);
+  if (quantized.empty() || report.n_quantized == 0)
+    return false;
+  FCS_MSG_INFO("Quantized " << report.n_quantized << " of "
+                            << report.n_quantized + report.n_skipped
+                            << " matrix products to int8");
+  m_quantizedInt8 = true;
+  if (m_sessionReady)
+    initSession();
+  return true;
+};
+
+bool TFCSONNXHandler::hasDynamicBatch() const
+{
+  ensureSession();
+  return m_dynamicBatch;
+};
+
+std::vector<std::string> TFCSONNXHandler::getInputNodes() const
+{
+  ensureSession();
+  return std::vector<std::string>(m_inputNodeNames.begin(),
+                                  m_inputNodeNames.end());
+};
+
+std::vector<std::string> TFCSONNXHandler::getOutputNodes() const
+{
+  ensureSession();
+  return std::vector<std::string>(m_outputNodeNames.begin(),
+                                  m_outputNodeNames.end());
+};
+
 // Writing out to ttrees
 void TFCSONNXHandler::writeNetToTTree(TTree& tree)
 {
   FCS_MSG_DEBUG("TFCSONNXHandler writing net to tree.");
+  if (m_bytes.empty()) {
+    FCS_MSG_ERROR("The onnx bytes were released after creating the session, "
+                  "see TFCSONNXRuntime::setReleaseModelBytes.");
+    throw std::runtime_error("No onnx bytes to write in TFCSONNXHandler.");
+  };
   this->writeBytesToTTree(tree, m_bytes);
 };
 
 std::vector<std::string> TFCSONNXHandler::getOutputLayers() const
 {
   FCS_MSG_DEBUG("TFCSONNXHandler output layers requested.");
+  ensureSession();
   return m_outputLayers;
 };
 
 void TFCSONNXHandler::deleteAllButNet()
 {
-  // As we don't copy the bytes, and the inputFile
-  // is at most a name, nothing is needed here.
-  FCS_MSG_DEBUG("Deleted nothing for ONNX.");
+  // The bytes are needed until the session exists,
+  // initSession releases them afterwards
+  std::lock_guard<std::mutex> lock(m_sessionMutex);
+  if (m_sessionReady && !m_bytes.empty()) {
+    std::vector<char>().swap(m_bytes);
+    FCS_MSG_DEBUG("Deleted onnx bytes.");
+  } else {
+    FCS_MSG_DEBUG("Deleted nothing for ONNX.");
+  };
 };
 
 void TFCSONNXHandler::print(std::ostream& strm) const
@@ -87,6 +218,11 @@ void TFCSONNXHandler::print(std::ostream& strm) const
   } else {
     strm << m_inputFile;
   };
+  if (!m_sessionReady) {
+    strm << "\nSession not created yet, model has " << m_bytes.size()
+         << " bytes\n";
+    return;
+  };
   strm << "\nHas input nodes (name:dimensions);\n";
   for (size_t inp_n = 0; inp_n < m_inputNodeNames.size(); inp_n++) {
     strm << "\t" << m_inputNodeNames[inp_n] << ":[";
@@ -123,10 +259,51 @@ void TFCSONNXHandler::setupNet()
   // m_session = AthONNX::CreateORTSession(inputFile);
   // This segfaults.
 
-  // TODO; should I be using m_session_options? see
-  // https://github.com/microsoft/onnxruntime-inference-examples/blob/2b42b442526b9454d1e2d08caeb403e28a71da5f/c_cxx/squeezenet/main.cpp#L71
+  // Creating the session is deferred to the first use, networks
+  // for phase space regions that are never simulated cost no
+  // more than their bytes
+  FCS_MSG_INFO("ONNX session will be created on first use.");
+  m_sessionReady = false;
+};
+
+void TFCSONNXHandler::ensureSession() const
+{
+  if (m_sessionReady.load(std::memory_order_acquire))
+    return;
+  std::lock_guard<std::mutex> lock(m_sessionMutex);
+  if (m_sessionReady.load(std::memory_order_relaxed))
+    return;
+  if (m_bytes.empty())
+    throw std::runtime_error("No onnx bytes to create a session from.");
+  // Only caches of the persisted model are filled
+  const_cast<TFCSONNXHandler*>(this)->initSession();
+  m_sessionReady.store(true, std::memory_order_release);
+};
+
+void TFCSONNXHandler::initSession()
+{
   FCS_MSG_INFO("Setting up ONNX session.");
   this->readSerializedSession();
+  this->readNodeInfo();
+  if (TFCSONNXRuntime::releaseModelBytes()) {
+    FCS_MSG_DEBUG("Releasing " << m_bytes.size() << " onnx bytes.");
+    std::vector<char>().swap(m_bytes);
+  };
+};
+
+void TFCSONNXHandler::readNodeInfo()
+{
+  m_inputNodeNames.clear();
+  m_inputNodeDims.clear();
+  m_inputNodeSize.clear();
+  m_outputNodeNames.clear();
+  m_outputNodeDims.clear();
+  m_outputNodeSize.clear();
+  m_outputLayers.clear();
+#if ORT_API_VERSION > 11
+  m_storeInputNodeNames.clear();
+  m_storeOutputNodeNames.clear();
+#endif
 
   // Need the type from the first node (which will be used to set
   // just set it to undefined to avoid not initialized warnings
@@ -137,6 +314,7 @@ void TFCSONNXHandler::setupNet()
   FCS_MSG_DEBUG("Getting input nodes.");
   const int num_input_nodes = m_session->GetInputCount();
   Ort::AllocatorWithDefaultOptions allocator;
+  m_dynamicBatch = num_input_nodes > 0;
   for (int i = 0; i < num_input_nodes; i++) {
 #if ORT_API_VERSION > 11
     Ort::AllocatedStringPtr node_names =
@@ -169,6 +347,9 @@ void TFCSONNXHandler::setupNet()
     std::vector<int64_t> recieved_dimension = tensor_info.GetShape();
     FCS_MSG_VERBOSE("There are " << recieved_dimension.size()
                                  << " dimensions.");
+    // A symbolic first dimension is taken as the batch dimension
+    if (recieved_dimension.empty() || recieved_dimension[0] >= 1)
+      m_dynamicBatch = false;
     // This vector sometimes includes a symbolic dimension
     // which is represented by -1
     // A symbolic dimension is usually a conversion error,
@@ -176,6 +357,7 @@ void TFCSONNXHandler::setupNet()
     // in which case it's safe to treat it as having
     // dimension 1.
     std::vector<int64_t> dimension_of_node;
+    int64_t node_size = 1;
     for (int64_t node_dim : recieved_dimension) {
       if (node_dim < 1) {
         FCS_MSG_WARNING("Found symbolic dimension "
@@ -184,9 +366,11 @@ void TFCSONNXHandler::setupNet()
         dimension_of_node.push_back(1);
       } else {
         dimension_of_node.push_back(node_dim);
+        node_size *= node_dim;
       };
     };
     m_inputNodeDims.push_back(dimension_of_node);
+    m_inputNodeSize.push_back(node_size);
   };
   FCS_MSG_DEBUG("Finished looping on inputs.");
 
@@ -199,6 +383,8 @@ void TFCSONNXHandler::setupNet()
   // iterate over all output nodes
   int num_output_nodes = m_session->GetOutputCount();
   FCS_MSG_DEBUG("Getting " << num_output_nodes << " output nodes.");
+  m_fixedOutputShapes = true;
+  m_outputDynamicBatch = num_output_nodes > 0;
   for (int i = 0; i < num_output_nodes; i++) {
 #if ORT_API_VERSION > 11
     Ort::AllocatedStringPtr node_names =
@@ -229,9 +415,17 @@ void TFCSONNXHandler::setupNet()
     const std::vector<int64_t> recieved_dimension = tensor_info.GetShape();
     FCS_MSG_VERBOSE("There are " << recieved_dimension.size()
                                  << " dimensions.");
+    // Only a symbolic first dimension can be preallocated,
+    // as the batch dimension
+    if (recieved_dimension.empty() || recieved_dimension[0] >= 1)
+      m_outputDynamicBatch = false;
+    for (size_t dim_n = 1; dim_n < recieved_dimension.size(); dim_n++) {
+      if (recieved_dimension[dim_n] < 1)
+        m_fixedOutputShapes = false;
+    };
     // Again, check for symbolic dimensions
     std::vector<int64_t> dimension_of_node;
-    int node_size = 1;
+    int64_t node_size = 1;
     for (int64_t node_dim : recieved_dimension) {
       if (node_dim < 1) {
         FCS_MSG_WARNING("Found symbolic dimension "
@@ -247,7 +441,7 @@ void TFCSONNXHandler::setupNet()
     m_outputNodeSize.push_back(node_size);
 
     // The outputs are treated as a flat vector
-    for (int part_n = 0; part_n < node_size; part_n++) {
+    for (int64_t part_n = 0; part_n < node_size; part_n++) {
       // compose the output name
       std::string layer_name =
           std::string(output_name) + "_" + std::to_string(part_n);
@@ -268,11 +462,19 @@ void TFCSONNXHandler::setupNet()
     // got to capture this in the lambda so it can access class methods
     m_computeLambda = [this](NetworkInputs const& inputs)
     { return computeTemplate<float, float>(inputs); };
+    m_computeTensorsLambda = [this](TensorInputs const& inputs,
+                                    size_t n_batch,
+                                    TensorOutputs& outputs)
+    { computeTensorsTemplate<float, float>(inputs, n_batch, outputs); };
   } else if (first_input_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE
              && first_output_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE)
   {
     m_computeLambda = [this](NetworkInputs const& inputs)
     { return computeTemplate<double, double>(inputs); };
+    m_computeTensorsLambda = [this](TensorInputs const& inputs,
+                                    size_t n_batch,
+                                    TensorOutputs& outputs)
+    { computeTensorsTemplate<double, double>(inputs, n_batch, outputs); };
   } else {
     throw std::runtime_error(
         "Haven't yet implemented that combination of "
@@ -340,66 +542,242 @@ void TFCSONNXHandler::writeBytesToTTree(TTree& tree,
 void TFCSONNXHandler::readSerializedSession()
 {
   FCS_MSG_DEBUG("Transforming bytes to session.");
-  Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "test");
-  Ort::SessionOptions opts;
-  opts.SetInterOpNumThreads(1);
-  opts.SetIntraOpNumThreads(1);
-  // Prevent ONNX from spawning additional threads
-  m_session =
-      std::make_unique<Ort::Session>(env, m_bytes.data(), m_bytes.size(), opts);
+  {
+    // The bindings belong to the old session. Threads still using one keep
+    // it and its session alive until their call returns
+    std::lock_guard<std::mutex> lock(m_bindingMutex);
+    m_bindings.clear();
+  }
+  // Identical models with identical options share one session
+  if (m_quantizedInt8) {
+    m_session = TFCSONNXRuntime::session(
+        TFCSONNXQuantization::quantizeDynamicInt8(m_bytes), m_sessionConfig);
+  } else {
+    m_session = TFCSONNXRuntime::session(m_bytes, m_sessionConfig);
+  };
+  m_sessionId = next_session_id();
   FCS_MSG_DEBUG("Transformed bytes to session.");
 };
 
 template<typename Tin, typename Tout>
-VNetworkBase::NetworkOutputs TFCSONNXHandler::computeTemplate(
-    VNetworkBase::NetworkInputs const& inputs)
+std::shared_ptr<TFCSONNXHandler::IoBindingState<Tin, Tout>>
+TFCSONNXHandler::ioBinding() const
+{
+  // The network owns the bindings, this thread only observes its own.
+  // Session ids are never reused, so entries of deleted sessions or
+  // networks are never found again, they expire and are pruned
+  thread_local std::unordered_map<std::uint64_t,
+                                  std::weak_ptr<IoBindingState<Tin, Tout>>>
+      thread_bindings;
+  auto found = thread_bindings.find(m_sessionId);
+  if (found != thread_bindings.end()) {
+    if (std::shared_ptr<IoBindingState<Tin, Tout>> state = found->second.lock())
+      return state;
+  };
+
+  for (auto it = thread_bindings.begin(); it != thread_bindings.end();) {
+    if (it->second.expired())
+      it = thread_bindings.erase(it);
+    else
+      ++it;
+  }
+  auto state = std::make_shared<IoBindingState<Tin, Tout>>(m_session);
+  {
+    std::lock_guard<std::mutex> lock(m_bindingMutex);
+    m_bindings.push_back(state);
+  }
+  thread_bindings[m_sessionId] = state;
+  return state;
+};
+
+template<typename Tin, typename Tout>
+Ort::IoBinding& TFCSONNXHandler::prepareBinding(
+    IoBindingState<Tin, Tout>& state, size_t n_batch) const
+{
+  auto found = state.buffer_bindings.find(n_batch);
+  if (found != state.buffer_bindings.end())
+    return found->second;
+
+  // The buffers grow geometrically, the bindings of smaller batches view
+  // them and are dropped if a buffer moves
+  const size_t num_input_nodes = m_inputNodeNames.size();
+  const size_t num_output_nodes = m_outputNodeNames.size();
+  state.inputs.resize(num_input_nodes);
+  state.outputs.resize(num_output_nodes);
+  bool moved = false;
+  for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
+    std::vector<Tin>& buffer = state.inputs[node_n];
+    const size_t size = m_inputNodeSize[node_n] * n_batch;
+    if (buffer.size() < size) {
+      buffer.resize(std::max(size, 2 * buffer.size()));
+      moved = true;
+    };
+  }
+  for (size_t node_n = 0; node_n < num_output_nodes; node_n++) {
+    std::vector<Tout>& buffer = state.outputs[node_n];
+    const size_t size = m_outputNodeSize[node_n] * n_batch;
+    if (buffer.size() < size) {
+      buffer.resize(std::max(size, 2 * buffer.size()));
+      moved = true;
+    };
+  }
+  if (moved)
+    state.buffer_bindings.clear();
+
+  FCS_MSG_DEBUG("Binding buffers for a batch of " << n_batch);
+  Ort::IoBinding binding(*state.session);
+  for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
+    state.dims = m_inputNodeDims[node_n];
+    // The batch replaces the first dimension, which is symbolic
+    if (n_batch != 1)
+      state.dims[0] = n_batch;
+    Ort::Value value =
+        Ort::Value::CreateTensor<Tin>(m_memoryInfo,
+                                      state.inputs[node_n].data(),
+                                      m_inputNodeSize[node_n] * n_batch,
+                                      state.dims.data(),
+                                      state.dims.size());
+    binding.BindInput(m_inputNodeNames[node_n], value);
+  }
+  for (size_t node_n = 0; node_n < num_output_nodes; node_n++) {
+    state.dims = m_outputNodeDims[node_n];
+    if (n_batch != 1)
+      state.dims[0] = n_batch;
+    Ort::Value value =
+        Ort::Value::CreateTensor<Tout>(m_memoryInfo,
+                                       state.outputs[node_n].data(),
+                                       m_outputNodeSize[node_n] * n_batch,
+                                       state.dims.data(),
+                                       state.dims.size());
+    binding.BindOutput(m_outputNodeNames[node_n], value);
+  }
+  return state.buffer_bindings.emplace(n_batch, std::move(binding))
+      .first->second;
+};
+
+void TFCSONNXHandler::bindTensors(IoBindingState<float, float>& state,
+                                  TensorInputs const& inputs,
+                                  size_t n_batch,
+                                  TensorOutputs& outputs) const
+{
+  state.binding.ClearBoundInputs();
+  state.binding.ClearBoundOutputs();
+
+  for (size_t node_n = 0; node_n < m_inputNodeNames.size(); node_n++) {
+    state.dims = m_inputNodeDims[node_n];
+    if (n_batch != 1)
+      state.dims[0] = n_batch;
+    // onnxruntime only reads from input tensors
+    Ort::Value value = Ort::Value::CreateTensor<float>(
+        m_memoryInfo,
+        const_cast<float*>(inputs[node_n].data),
+        inputs[node_n].size,
+        state.dims.data(),
+        state.dims.size());
+    state.binding.BindInput(m_inputNodeNames[node_n], value);
+  }
+
+  outputs.resize(m_outputNodeNames.size());
+  for (size_t node_n = 0; node_n < m_outputNodeNames.size(); node_n++) {
+    std::vector<float>& output = outputs[node_n];
+    output.resize(m_outputNodeSize[node_n] * n_batch);
+    state.dims = m_outputNodeDims[node_n];
+    if (n_batch != 1)
+      state.dims[0] = n_batch;
+    Ort::Value value = Ort::Value::CreateTensor<float>(m_memoryInfo,
+                                                       output.data(),
+                                                       output.size(),
+                                                       state.dims.data(),
+                                                       state.dims.size());
+    state.binding.BindOutput(m_outputNodeNames[node_n], value);
+  }
+};
+
+template<typename Tin>
+std::vector<Ort::Value> TFCSONNXHandler::runSession(
+    std::vector<Tin*> const& inputs, size_t n_batch) const
 {
   // working from
   // https://github.com/microsoft/onnxruntime-inference-examples/blob/main/c_cxx/squeezenet/main.cpp#L71
   //  and
   //  https://github.com/microsoft/onnxruntime-inference-examples/blob/main/c_cxx/MNIST/MNIST.cpp
+  const size_t num_input_nodes = m_inputNodeNames.size();
+  std::vector<Ort::Value> node_values;
+  node_values.reserve(num_input_nodes);
+  // The batch replaces the first dimension, which is symbolic
+  std::vector<std::vector<int64_t>> batch_dims;
+  if (n_batch != 1) {
+    batch_dims = m_inputNodeDims;
+    for (std::vector<int64_t>& dims : batch_dims)
+      dims[0] = n_batch;
+  }
+  const std::vector<std::vector<int64_t>>& node_dims =
+      n_batch != 1 ? batch_dims : m_inputNodeDims;
+  for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
+    // Doesn't copy data internally, so the inputs need to stay alive
+    node_values.push_back(
+        Ort::Value::CreateTensor<Tin>(m_memoryInfo,
+                                      inputs[node_n],
+                                      m_inputNodeSize[node_n] * n_batch,
+                                      node_dims[node_n].data(),
+                                      node_dims[node_n].size()));
+  }
+
+  FCS_MSG_DEBUG("Running computation on ONNX network.");
+  return m_session->Run(Ort::RunOptions {nullptr},
+                        m_inputNodeNames.data(),
+                        node_values.data(),
+                        num_input_nodes,
+                        m_outputNodeNames.data(),
+                        m_outputNodeNames.size());
+};
+
+template<typename Tin, typename Tout>
+VNetworkBase::NetworkOutputs TFCSONNXHandler::computeTemplate(
+    VNetworkBase::NetworkInputs const& inputs) const
+{
   FCS_MSG_DEBUG("Setting up inputs for computation on ONNX network.");
   FCS_MSG_DEBUG("Input type " << typeid(Tin).name() << " output type "
                               << typeid(Tout).name());
 
   //  The inputs must be reformatted to the correct data structure.
   const size_t num_input_nodes = m_inputNodeNames.size();
-  //  A pointer to all the nodes we will make
+  //  If the output shapes are known, the buffers of the
+  //  thread's IO binding are filled directly
+  std::shared_ptr<IoBindingState<Tin, Tout>> state;
+  Ort::IoBinding* binding = nullptr;
+  if (m_fixedOutputShapes) {
+    state = ioBinding<Tin, Tout>();
+    binding = &prepareBinding(*state, 1);
+  };
   //  Going to keep the data in each node flat, because that's easier
-  std::vector<std::vector<Tin>> input_values(num_input_nodes);
-  std::vector<Ort::Value> node_values;
+  std::vector<std::vector<Tin>> input_values(state ? 0 : num_input_nodes);
+  std::vector<Tin*> input_pointers(num_input_nodes);
   // Non const values that will be needed at each step.
   std::string node_name;
-  int n_dimensions, elements_in_node, key_number;
+  int elements_in_node, key_number;
   size_t first_digit;
   // Move along the list of node names gathered in the constructor
   // we need both the node name, and the dimension
   // so we cannot iterate directly on the vector.
   FCS_MSG_DEBUG("Looping over " << num_input_nodes
                                 << " input nodes of ONNX network.");
-  for (size_t node_n = 0; node_n < m_inputNodeNames.size(); node_n++) {
-    FCS_MSG_DEBUG("Node n = " << node_n);
+  for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
     node_name = m_inputNodeNames[node_n];
-    FCS_MSG_DEBUG("Node name " << node_name);
-    // Get the shape of this node
-    n_dimensions = m_inputNodeDims[node_n].size();
-    FCS_MSG_DEBUG("Node dimensions " << n_dimensions);
-    elements_in_node = 1;
-    for (int dimension_len : m_inputNodeDims[node_n]) {
-      elements_in_node *= dimension_len;
-    };
-    FCS_MSG_DEBUG("Elements in node " << elements_in_node);
-    for (auto inp : inputs) {
-      FCS_MSG_DEBUG("Have input named " << inp.first);
-    };
-    // Get the node content and remove any common prefix from the elements
-    const std::map<std::string, double> node_inputs = inputs.at(node_name);
-    std::vector<Tin> node_elements(elements_in_node);
+    elements_in_node = m_inputNodeSize[node_n];
+    // Get the node content
+    const std::map<std::string, double>& node_inputs = inputs.at(node_name);
+    std::vector<Tin>& node_elements =
+        state ? state->inputs[node_n] : input_values[node_n];
+    if (state)
+      std::fill_n(node_elements.begin(), elements_in_node, Tin(0));
+    else
+      node_elements.resize(elements_in_node);
 
     FCS_MSG_DEBUG("Found node named " << node_name << " with "
                                       << elements_in_node << " elements.");
     // Then the rest should be numbers from 0 up
-    for (auto element : node_inputs) {
+    for (const auto& element : node_inputs) {
       first_digit = element.first.find_first_of("0123456789");
       // if there is no digit, it's not an element
       if (first_digit < element.first.length()) {
@@ -407,33 +785,15 @@ VNetworkBase::NetworkOutputs TFCSONNXHandler::computeTemplate(
         node_elements[key_number] = element.second;
       }
     }
-    input_values[node_n] = node_elements;
-
-    FCS_MSG_DEBUG("Creating ort tensor n_dimensions = "
-                  << n_dimensions
-                  << ", elements_in_node = " << elements_in_node);
-    // Doesn't copy data internally, so vector arguments need to stay alive
-    Ort::Value node =
-        Ort::Value::CreateTensor<Tin>(m_memoryInfo,
-                                      input_values[node_n].data(),
-                                      elements_in_node,
-                                      m_inputNodeDims[node_n].data(),
-                                      n_dimensions);
-    // Problems with the string steam when compiling separately.
-    // FCS_MSG_DEBUG("Created input node " << node << " from values " <<
-    // input_values[node_n]);
-
-    node_values.push_back(std::move(node));
+    input_pointers[node_n] = node_elements.data();
   }
 
-  FCS_MSG_DEBUG("Running computation on ONNX network.");
   // All inputs have been correctly formatted and the net can be run.
-  auto output_tensors = m_session->Run(Ort::RunOptions {nullptr},
-                                       m_inputNodeNames.data(),
-                                       &node_values[0],
-                                       num_input_nodes,
-                                       m_outputNodeNames.data(),
-                                       m_outputNodeNames.size());
+  std::vector<Ort::Value> output_tensors;
+  if (state)
+    state->session->Run(Ort::RunOptions {nullptr}, *binding);
+  else
+    output_tensors = runSession(input_pointers);
 
   FCS_MSG_DEBUG("Sorting outputs from computation on ONNX network.");
   // Finally, the output must be rearanged in the expected format.
@@ -444,7 +804,9 @@ VNetworkBase::NetworkOutputs TFCSONNXHandler::computeTemplate(
   const Tout* output_node;
   for (size_t node_n = 0; node_n < m_outputNodeNames.size(); node_n++) {
     // get a pointer to the data
-    output_node = output_tensors[node_n].GetTensorMutableData<Tout>();
+    output_node = state
+        ? state->outputs[node_n].data()
+        : output_tensors[node_n].GetTensorMutableData<Tout>();
     FCS_MSG_VERBOSE("output node " << output_node);
     elements_in_node = m_outputNodeSize[node_n];
     node_name = m_outputNodeNames[node_n];
@@ -465,6 +827,88 @@ VNetworkBase::NetworkOutputs TFCSONNXHandler::computeTemplate(
   return outputs;
 };
 
+template<typename Tin, typename Tout>
+void TFCSONNXHandler::computeTensorsTemplate(
+    VNetworkBase::TensorInputs const& inputs,
+    size_t n_batch,
+    VNetworkBase::TensorOutputs& outputs) const
+{
+  const size_t num_input_nodes = m_inputNodeNames.size();
+  if (inputs.size() != num_input_nodes) {
+    FCS_MSG_ERROR("Got " << inputs.size() << " input nodes, the network has "
+                         << num_input_nodes);
+    throw std::runtime_error("Wrong number of input nodes in computeTensors.");
+  };
+  for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
+    if ((int64_t)inputs[node_n].size
+        != m_inputNodeSize[node_n] * (int64_t)n_batch)
+    {
+      FCS_MSG_ERROR("Input node " << m_inputNodeNames[node_n] << " got "
+                                  << inputs[node_n].size << " values, expected "
+                                  << m_inputNodeSize[node_n] * n_batch);
+      throw std::runtime_error("Wrong input node size in computeTensors.");
+    };
+  };
+
+  if (m_fixedOutputShapes && (n_batch == 1 || m_outputDynamicBatch)) {
+    std::shared_ptr<IoBindingState<Tin, Tout>> state_ptr =
+        ioBinding<Tin, Tout>();
+    IoBindingState<Tin, Tout>& state = *state_ptr;
+    if constexpr (std::is_same<Tin, float>::value
+                  && std::is_same<Tout, float>::value)
+    {
+      // The caller's values are bound as they are and the outputs are
+      // written straight into the caller's vectors, nothing is copied
+      bindTensors(state, inputs, n_batch, outputs);
+      state.session->Run(Ort::RunOptions {nullptr}, state.binding);
+      return;
+    };
+    // Other types are converted through the bound buffers
+    Ort::IoBinding& binding = prepareBinding(state, n_batch);
+    for (size_t node_n = 0; node_n < num_input_nodes; node_n++)
+      std::copy(inputs[node_n].begin(),
+                inputs[node_n].end(),
+                state.inputs[node_n].begin());
+    state.session->Run(Ort::RunOptions {nullptr}, binding);
+    outputs.resize(m_outputNodeNames.size());
+    for (size_t node_n = 0; node_n < m_outputNodeNames.size(); node_n++) {
+      const Tout* output_node = state.outputs[node_n].data();
+      outputs[node_n].assign(output_node,
+                             output_node + m_outputNodeSize[node_n] * n_batch);
+    }
+    return;
+  };
+
+  std::vector<Tin*> input_pointers(num_input_nodes);
+  std::vector<std::vector<Tin>> converted;
+  if constexpr (std::is_same<Tin, float>::value) {
+    // onnxruntime only reads from input tensors, so passing
+    // the caller's values without a copy is safe
+    for (size_t node_n = 0; node_n < num_input_nodes; node_n++)
+      input_pointers[node_n] = const_cast<float*>(inputs[node_n].data);
+  } else {
+    converted.resize(num_input_nodes);
+    for (size_t node_n = 0; node_n < num_input_nodes; node_n++) {
+      converted[node_n].assign(inputs[node_n].begin(), inputs[node_n].end());
+      input_pointers[node_n] = converted[node_n].data();
+    }
+  };
+
+  std::vector<Ort::Value> output_tensors =
+      runSession(input_pointers, n_batch);
+
+  outputs.resize(m_outputNodeNames.size());
+  for (size_t node_n = 0; node_n < m_outputNodeNames.size(); node_n++) {
+    const Tout* output_node =
+        output_tensors[node_n].GetTensorMutableData<Tout>();
+    // Take the size from the tensor itself, symbolic dimensions
+    // may be larger than 1 at run time
+    const size_t elements_in_node =
+        output_tensors[node_n].GetTensorTypeAndShapeInfo().GetElementCount();
+    outputs[node_n].assign(output_node, output_node + elements_in_node);
+  }
+};
+
 // Possible to avoid copy?
 // https://github.com/microsoft/onnxruntime/issues/8328
 // https://github.com/microsoft/onnxruntime/pull/11789
@@ -488,6 +932,11 @@ void TFCSONNXHandler::Streamer(TBuffer& buf)
 #endif
   } else {
     FCS_MSG_INFO("Writing buffer in TFCSONNXHandler ");
+    if (m_bytes.empty()) {
+      FCS_MSG_ERROR("The onnx bytes were released after creating the "
+                    "session, see TFCSONNXRuntime::setReleaseModelBytes.");
+      throw std::runtime_error("No onnx bytes to write in TFCSONNXHandler.");
+    };
     // Persist variables
     TFCSONNXHandler::Class()->WriteBuffer(buf, this);
   };
@@ -0,0 +1,762 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
+
+#include "TError.h"
+
+namespace
+{
+// The model is rewritten on the protobuf wire format directly, so that
+// no protobuf or onnx library is needed. Only the fields below are
+// interpreted, everything else is copied byte by byte. Tensor data is
+// little endian, like on every platform FastCaloSim runs on.
+
+enum WireType
+{
+  kVarint = 0,
+  kFixed64 = 1,
+  kBytes = 2,
+  kFixed32 = 5
+};
+
+// Field numbers of onnx.proto
+enum ModelField
+{
+  kModelGraph = 7,
+  kModelOpset = 8
+};
+enum OpsetField
+{
+  kOpsetDomain = 1,
+  kOpsetVersion = 2
+};
+enum GraphField
+{
+  kGraphNode = 1,
+  kGraphInitializer = 5,
+  kGraphInput = 11,
+  kGraphOutput = 12
+};
+enum NodeField
+{
+  kNodeInput = 1,
+  kNodeOutput = 2,
+  kNodeName = 3,
+  kNodeOpType = 4,
+  kNodeAttribute = 5,
+  kNodeDomain = 7
+};
+enum AttributeField
+{
+  kAttributeName = 1,
+  kAttributeFloat = 2,
+  kAttributeInt = 3,
+  kAttributeGraph = 6,
+  kAttributeGraphs = 11,
+  kAttributeType = 20
+};
+enum TensorField
+{
+  kTensorDims = 1,
+  kTensorDataType = 2,
+  kTensorFloatData = 4,
+  kTensorName = 8,
+  kTensorRawData = 9,
+  kTensorDataLocation = 14
+};
+const int kValueInfoName = 1;
+
+const int kTypeFloat = 1;
+const int kTypeInt8 = 3;
+const int kAttributeTypeInt = 2;
+const int kDataLocationExternal = 1;
+
+// DynamicQuantizeLinear exists since opset 11
+const std::int64_t kMinimalOpset = 11;
+
+struct Field_t
+{
+  std::uint32_t number = 0;
+  int wire = 0;
+  std::uint64_t value = 0;  // varint and fixed size payloads
+  std::string_view data;  // length delimited payloads
+  std::string_view raw;  // the whole field, including its tag
+};
+
+bool read_varint(const char*& p, const char* end, std::uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    const auto byte = static_cast<unsigned char>(*p++);
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/// Reads the fields of a message one after the other
+class FieldReader
+{
+public:
+  explicit FieldReader(std::string_view message)
+      : m_p(message.data())
+      , m_end(message.data() + message.size())
+  {
+  }
+
+  /// Next field, false at the end of the message
+  bool next(Field_t& field)
+  {
+    if (m_p == m_end)
+      return false;
+    const char* begin = m_p;
+    std::uint64_t tag = 0;
+    varint(tag);
+    field.number = tag >> 3;
+    field.wire = tag & 7;
+    field.value = 0;
+    field.data = std::string_view();
+    if (field.wire == kVarint) {
+      varint(field.value);
+    } else if (field.wire == kFixed64) {
+      check(8);
+      std::memcpy(&field.value, m_p, 8);
+      m_p += 8;
+    } else if (field.wire == kBytes) {
+      std::uint64_t size = 0;
+      varint(size);
+      check(size);
+      field.data = std::string_view(m_p, size);
+      m_p += size;
+    } else if (field.wire == kFixed32) {
+      check(4);
+      std::uint32_t value = 0;
+      std::memcpy(&value, m_p, 4);
+      field.value = value;
+      m_p += 4;
+    } else {
+      throw std::runtime_error("unsupported protobuf wire type");
+    }
+    field.raw = std::string_view(begin, m_p - begin);
+    return true;
+  }
+
+private:
+  void varint(std::uint64_t& value)
+  {
+    if (!read_varint(m_p, m_end, value))
+      throw std::runtime_error("truncated varint");
+  }
+  void check(std::uint64_t size) const
+  {
+    if (std::uint64_t(m_end - m_p) < size)
+      throw std::runtime_error("truncated field");
+  }
+
+  const char* m_p;
+  const char* m_end;
+};
+
+void put_varint(std::string& out, std::uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(char(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+void put_int(std::string& out, std::uint32_t number, std::int64_t value)
+{
+  put_varint(out, (std::uint64_t(number) << 3) | kVarint);
+  put_varint(out, std::uint64_t(value));
+}
+
+void put_bytes(std::string& out, std::uint32_t number, std::string_view data)
+{
+  put_varint(out, (std::uint64_t(number) << 3) | kBytes);
+  put_varint(out, data.size());
+  out.append(data.data(), data.size());
+}
+
+struct Tensor_t
+{
+  std::string name;
+  int data_type = 0;
+  bool external = false;
+  std::vector<std::int64_t> dims;
+  std::vector<float> values;  // only for float tensors
+};
+
+Tensor_t parse_tensor(std::string_view message)
+{
+  Tensor_t tensor;
+  std::string_view raw_data;
+  std::vector<float> float_data;
+  FieldReader reader(message);
+  Field_t field;
+  while (reader.next(field)) {
+    if (field.number == kTensorDims && field.wire == kBytes) {
+      const char* p = field.data.data();
+      const char* end = p + field.data.size();
+      std::uint64_t dim = 0;
+      while (p < end && read_varint(p, end, dim))
+        tensor.dims.push_back(std::int64_t(dim));
+    } else if (field.number == kTensorDims) {
+      tensor.dims.push_back(std::int64_t(field.value));
+    } else if (field.number == kTensorDataType) {
+      tensor.data_type = int(field.value);
+    } else if (field.number == kTensorFloatData && field.wire == kBytes) {
+      const std::size_t offset = float_data.size();
+      float_data.resize(offset + field.data.size() / sizeof(float));
+      std::memcpy(float_data.data() + offset,
+                  field.data.data(),
+                  (float_data.size() - offset) * sizeof(float));
+    } else if (field.number == kTensorFloatData) {
+      const auto bits = std::uint32_t(field.value);
+      float value = 0;
+      std::memcpy(&value, &bits, sizeof(float));
+      float_data.push_back(value);
+    } else if (field.number == kTensorName) {
+      tensor.name.assign(field.data);
+    } else if (field.number == kTensorRawData) {
+      raw_data = field.data;
+    } else if (field.number == kTensorDataLocation) {
+      tensor.external = field.value == kDataLocationExternal;
+    }
+  }
+  if (tensor.data_type != kTypeFloat)
+    return tensor;
+  if (!raw_data.empty()) {
+    tensor.values.resize(raw_data.size() / sizeof(float));
+    std::memcpy(tensor.values.data(),
+                raw_data.data(),
+                tensor.values.size() * sizeof(float));
+  } else {
+    tensor.values = std::move(float_data);
+  }
+  return tensor;
+}
+
+std::string tensor_proto(const std::string& name,
+                         int data_type,
+                         const std::vector<std::int64_t>& dims,
+                         std::string_view raw_data)
+{
+  std::string out;
+  for (std::int64_t dim : dims)
+    put_int(out, kTensorDims, dim);
+  put_int(out, kTensorDataType, data_type);
+  put_bytes(out, kTensorName, name);
+  put_bytes(out, kTensorRawData, raw_data);
+  return out;
+}
+
+struct Node_t
+{
+  std::vector<std::string> inputs;
+  std::vector<std::string> outputs;
+  std::string name;
+  std::string op_type;
+  std::string domain;
+  std::map<std::string, double> attributes;  // int and float attributes
+  bool has_subgraph = false;
+};
+
+Node_t parse_node(std::string_view message)
+{
+  Node_t node;
+  FieldReader reader(message);
+  Field_t field;
+  while (reader.next(field)) {
+    if (field.number == kNodeInput) {
+      node.inputs.emplace_back(field.data);
+    } else if (field.number == kNodeOutput) {
+      node.outputs.emplace_back(field.data);
+    } else if (field.number == kNodeName) {
+      node.name.assign(field.data);
+    } else if (field.number == kNodeOpType) {
+      node.op_type.assign(field.data);
+    } else if (field.number == kNodeDomain) {
+      node.domain.assign(field.data);
+    } else if (field.number == kNodeAttribute) {
+      std::string name;
+      double value = 0;
+      FieldReader attribute(field.data);
+      Field_t entry;
+      while (attribute.next(entry)) {
+        if (entry.number == kAttributeName) {
+          name.assign(entry.data);
+        } else if (entry.number == kAttributeFloat) {
+          const auto bits = std::uint32_t(entry.value);
+          float f = 0;
+          std::memcpy(&f, &bits, sizeof(float));
+          value = f;
+        } else if (entry.number == kAttributeInt) {
+          value = double(std::int64_t(entry.value));
+        } else if (entry.number == kAttributeGraph
+                   || entry.number == kAttributeGraphs)
+        {
+          node.has_subgraph = true;
+        }
+      }
+      node.attributes[name] = value;
+    }
+  }
+  return node;
+}
+
+std::string node_proto(const std::string& op_type,
+                       const std::vector<std::string>& inputs,
+                       const std::string& output,
+                       const std::string& name,
+                       const std::vector<std::string>& extra_outputs = {})
+{
+  std::string out;
+  for (const std::string& input : inputs)
+    put_bytes(out, kNodeInput, input);
+  put_bytes(out, kNodeOutput, output);
+  for (const std::string& extra : extra_outputs)
+    put_bytes(out, kNodeOutput, extra);
+  put_bytes(out, kNodeName, name);
+  put_bytes(out, kNodeOpType, op_type);
+  return out;
+}
+
+double attribute(const Node_t& node, const std::string& name, double fallback)
+{
+  auto it = node.attributes.find(name);
+  return it == node.attributes.end() ? fallback : it->second;
+}
+
+/// Weight of a node that can be quantized, nullptr for all other nodes
+const Tensor_t* quantizable_weight(
+    const Node_t& node,
+    const std::map<std::string, Tensor_t>& weights)
+{
+  if (!node.domain.empty() && node.domain != "ai.onnx")
+    return nullptr;
+  if (node.outputs.size() != 1 || node.inputs.size() < 2)
+    return nullptr;
+  if (node.op_type == "MatMul") {
+    if (node.inputs.size() != 2)
+      return nullptr;
+  } else if (node.op_type == "Gemm") {
+    // alpha scales the product and beta the bias, transposed A has no
+    // MatMulInteger equivalent
+    const bool has_bias = node.inputs.size() > 2 && !node.inputs[2].empty();
+    if (attribute(node, "alpha", 1) != 1 || attribute(node, "transA", 0) != 0
+        || (has_bias && attribute(node, "beta", 1) != 1))
+      return nullptr;
+  } else {
+    return nullptr;
+  }
+  auto it = weights.find(node.inputs[1]);
+  if (it == weights.end())
+    return nullptr;
+  const Tensor_t& weight = it->second;
+  if (weight.data_type != kTypeFloat || weight.external
+      || weight.dims.size() != 2
+      || weight.values.size() != std::size_t(weight.dims[0] * weight.dims[1])
+      || weight.values.empty())
+    return nullptr;
+  return &weight;
+}
+
+/// Symmetric per column int8 quantization of a K x N weight, or of a
+/// N x K weight that is transposed first
+void quantize_weight(const Tensor_t& weight,
+                     bool transposed,
+                     std::vector<std::int8_t>& quantized,
+                     std::vector<float>& scales)
+{
+  const std::size_t n_rows = weight.dims[transposed ? 1 : 0];
+  const std::size_t n_cols = weight.dims[transposed ? 0 : 1];
+  auto value = [&](std::size_t row, std::size_t col)
+  {
+    return transposed ? weight.values[col * n_rows + row]
+                      : weight.values[row * n_cols + col];
+  };
+
+  scales.assign(n_cols, 0.f);
+  for (std::size_t row = 0; row < n_rows; ++row)
+    for (std::size_t col = 0; col < n_cols; ++col)
+      scales[col] = std::max(scales[col], std::abs(value(row, col)));
+  for (float& scale : scales)
+    scale = scale > 0 ? scale / 127.f : 1.f;
+
+  quantized.resize(n_rows * n_cols);
+  for (std::size_t row = 0; row < n_rows; ++row)
+    for (std::size_t col = 0; col < n_cols; ++col) {
+      const float q = std::round(value(row, col) / scales[col]);
+      quantized[row * n_cols + col] =
+          std::int8_t(std::clamp(q, -127.f, 127.f));
+    }
+}
+
+template<typename T>
+std::string_view as_bytes(const std::vector<T>& values)
+{
+  return std::string_view(reinterpret_cast<const char*>(values.data()),
+                          values.size() * sizeof(T));
+}
+
+std::string quantize_graph(std::string_view graph,
+                           TFCSONNXQuantization::Report& report)
+{
+  // Collect the constant weights, the nodes and how often each tensor is
+  // used. Graph inputs can override initializers and are never constant
+  std::map<std::string, Tensor_t> weights;
+  std::set<std::string> graph_inputs;
+  std::map<std::string, int> n_uses;
+  std::vector<Node_t> nodes;
+  bool has_subgraph = false;
+  {
+    FieldReader reader(graph);
+    Field_t field;
+    while (reader.next(field)) {
+      if (field.number == kGraphNode) {
+        nodes.push_back(parse_node(field.data));
+        has_subgraph = has_subgraph || nodes.back().has_subgraph;
+        for (const std::string& input : nodes.back().inputs)
+          ++n_uses[input];
+      } else if (field.number == kGraphInitializer) {
+        Tensor_t tensor = parse_tensor(field.data);
+        if (tensor.data_type == kTypeFloat && tensor.dims.size() == 2)
+          weights[tensor.name] = std::move(tensor);
+      } else if (field.number == kGraphInput || field.number == kGraphOutput)
+      {
+        FieldReader value_info(field.data);
+        Field_t entry;
+        while (value_info.next(entry))
+          if (entry.number == kValueInfoName) {
+            const std::string name(entry.data);
+            ++n_uses[name];
+            if (field.number == kGraphInput)
+              graph_inputs.insert(name);
+          }
+      }
+    }
+  }
+  for (const std::string& name : graph_inputs)
+    weights.erase(name);
+  // Subgraphs can use the weights of the main graph, which are then kept
+  if (has_subgraph)
+    weights.clear();
+
+  // Replacement of each node that is quantized
+  std::vector<std::string> replacements(nodes.size());
+  std::map<std::string, std::string> new_weights;
+  std::map<std::string, int> n_quantized_uses;
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    const Node_t& node = nodes[i];
+    if (node.op_type != "MatMul" && node.op_type != "Gemm")
+      continue;
+    const Tensor_t* weight = quantizable_weight(node, weights);
+    if (!weight) {
+      ++report.n_skipped;
+      continue;
+    }
+
+    const bool transposed =
+        node.op_type == "Gemm" && attribute(node, "transB", 0) != 0;
+    const std::string weight_name =
+        weight->name + (transposed ? "_transposed" : "");
+    const std::string w_quantized = weight_name + "_quantized";
+    const std::string w_scale = weight_name + "_scale";
+    const std::string w_zero_point = weight_name + "_zero_point";
+    if (!new_weights.count(w_quantized)) {
+      std::vector<std::int8_t> quantized;
+      std::vector<float> scales;
+      quantize_weight(*weight, transposed, quantized, scales);
+      const std::int64_t n_rows = weight->dims[transposed ? 1 : 0];
+      const std::int64_t n_cols = weight->dims[transposed ? 0 : 1];
+      const std::vector<std::int8_t> zero_points(n_cols, 0);
+      new_weights[w_quantized] = tensor_proto(
+          w_quantized, kTypeInt8, {n_rows, n_cols}, as_bytes(quantized));
+      new_weights[w_scale] =
+          tensor_proto(w_scale, kTypeFloat, {n_cols}, as_bytes(scales));
+      new_weights[w_zero_point] = tensor_proto(
+          w_zero_point, kTypeInt8, {n_cols}, as_bytes(zero_points));
+      report.n_weights += quantized.size();
+    }
+    ++n_quantized_uses[weight->name];
+
+    // The output names are unique in the graph, so are names made from them
+    const std::string& output = node.outputs[0];
+    const std::string prefix = output + "_quant";
+    const std::string name = node.name.empty() ? prefix : node.name + "_quant";
+    const std::string x_quantized = prefix + "_input";
+    const std::string x_scale = prefix + "_input_scale";
+    const std::string x_zero_point = prefix + "_input_zero_point";
+    const bool has_bias = node.op_type == "Gemm" && node.inputs.size() > 2
+        && !node.inputs[2].empty();
+
+    std::string& out = replacements[i];
+    put_bytes(out,
+              kGraphNode,
+              node_proto("DynamicQuantizeLinear",
+                         {node.inputs[0]},
+                         x_quantized,
+                         name + "_input",
+                         {x_scale, x_zero_point}));
+    put_bytes(out,
+              kGraphNode,
+              node_proto("MatMulInteger",
+                         {x_quantized, w_quantized, x_zero_point, w_zero_point},
+                         prefix + "_matmul",
+                         name + "_matmul"));
+    std::string cast = node_proto(
+        "Cast", {prefix + "_matmul"}, prefix + "_cast", name + "_cast");
+    std::string to;
+    put_bytes(to, kAttributeName, "to");
+    put_int(to, kAttributeInt, kTypeFloat);
+    put_int(to, kAttributeType, kAttributeTypeInt);
+    put_bytes(cast, kNodeAttribute, to);
+    put_bytes(out, kGraphNode, cast);
+    put_bytes(out,
+              kGraphNode,
+              node_proto("Mul",
+                         {x_scale, w_scale},
+                         prefix + "_scale",
+                         name + "_scale"));
+    put_bytes(out,
+              kGraphNode,
+              node_proto("Mul",
+                         {prefix + "_cast", prefix + "_scale"},
+                         has_bias ? prefix + "_output" : output,
+                         name + "_rescale"));
+    if (has_bias)
+      put_bytes(out,
+                kGraphNode,
+                node_proto("Add",
+                           {prefix + "_output", node.inputs[2]},
+                           output,
+                           name + "_bias"));
+    ++report.n_quantized;
+  }
+
+  // Copy the graph with the replaced nodes, dropping the float weights
+  // nothing uses anymore
+  std::string out;
+  FieldReader reader(graph);
+  Field_t field;
+  std::size_t i_node = 0;
+  while (reader.next(field)) {
+    if (field.number == kGraphNode) {
+      const std::string& replacement = replacements[i_node++];
+      if (!replacement.empty()) {
+        out += replacement;
+        continue;
+      }
+    } else if (field.number == kGraphInitializer) {
+      const std::string name = parse_tensor(field.data).name;
+      auto it = n_quantized_uses.find(name);
+      if (it != n_quantized_uses.end() && it->second == n_uses[name])
+        continue;
+    }
+    out.append(field.raw.data(), field.raw.size());
+  }
+  for (const auto& weight : new_weights)
+    put_bytes(out, kGraphInitializer, weight.second);
+  return out;
+}
+}  // namespace
+
+//=============================================
+//======= TFCSONNXQuantization =========
+//=============================================
+
+std::string TFCSONNXQuantization::name(Precision precision)
+{
+  if (precision == kFP16)
+    return "fp16";
+  if (precision == kInt8)
+    return "int8";
+  return "fp32";
+}
+
+bool TFCSONNXQuantization::parse(const std::string& name,
+                                 Precision& precision)
+{
+  for (Precision candidate : {kFP32, kFP16, kInt8})
+    if (name == TFCSONNXQuantization::name(candidate)) {
+      precision = candidate;
+      return true;
+    }
+  return false;
+}
+
+std::string TFCSONNXQuantization::variantPath(const std::string& path,
+                                              Precision precision)
+{
+  const std::string ending = ".onnx";
+  if (precision == kFP32 || path.size() < ending.size()
+      || path.compare(path.size() - ending.size(), ending.size(), ending) != 0)
+    return path;
+  return path.substr(0, path.size() - ending.size()) + "." + name(precision)
+      + ending;
+}
+
+std::vector<char> TFCSONNXQuantization::quantizeDynamicInt8(
+    const std::vector<char>& model, Report* report)
+{
+  Report summary;
+  std::string out;
+  try {
+    const std::string_view bytes(model.data(), model.size());
+    FieldReader reader(bytes);
+    Field_t field;
+    while (reader.next(field)) {
+      if (field.number != kModelOpset)
+        continue;
+      std::string domain;
+      std::int64_t version = 0;
+      FieldReader opset(field.data);
+      Field_t entry;
+      while (opset.next(entry)) {
+        if (entry.number == kOpsetDomain)
+          domain.assign(entry.data);
+        else if (entry.number == kOpsetVersion)
+          version = std::int64_t(entry.value);
+      }
+      if ((domain.empty() || domain == "ai.onnx") && version < kMinimalOpset) {
+        ::Error("TFCSONNXQuantization::quantizeDynamicInt8",
+                "The model uses opset %lld, at least %lld is needed",
+                (long long)version,
+                (long long)kMinimalOpset);
+        return {};
+      }
+    }
+
+    FieldReader copy(bytes);
+    while (copy.next(field)) {
+      if (field.number == kModelGraph && field.wire == kBytes)
+        put_bytes(out, kModelGraph, quantize_graph(field.data, summary));
+      else
+        out.append(field.raw.data(), field.raw.size());
+    }
+  } catch (const std::exception& e) {
+    ::Error("TFCSONNXQuantization::quantizeDynamicInt8",
+            "Cannot parse the model: %s",
+            e.what());
+    return {};
+  }
+
+  if (summary.n_quantized == 0)
+    ::Warning("TFCSONNXQuantization::quantizeDynamicInt8",
+              "The model has no MatMul or Gemm node that can be quantized");
+  if (report)
+    *report = summary;
+  return std::vector<char>(out.begin(), out.end());
+}
+
+bool TFCSONNXQuantization::Comparison::agrees(double tolerance) const
+{
+  return n_events > 0 && total_mean_shift < tolerance
+      && std::abs(total_rms_ratio - 1) < tolerance
+      && total_ks_distance < tolerance && max_voxel_mean_shift < tolerance
+      && mean_event_difference < tolerance;
+}
+
+TFCSONNXQuantization::Comparison TFCSONNXQuantization::compare(
+    const std::vector<std::vector<float>>& reference,
+    const std::vector<std::vector<float>>& candidate)
+{
+  Comparison result;
+  const std::size_t n_events = reference.size();
+  if (n_events == 0 || candidate.size() != n_events) {
+    ::Error("TFCSONNXQuantization::compare",
+            "The samples have %zu and %zu events",
+            reference.size(),
+            candidate.size());
+    return result;
+  }
+  const std::size_t n_voxels = reference[0].size();
+  for (std::size_t event = 0; event < n_events; ++event)
+    if (reference[event].size() != n_voxels
+        || candidate[event].size() != n_voxels)
+    {
+      ::Error("TFCSONNXQuantization::compare",
+              "Event %zu has a different number of voxels",
+              event);
+      return result;
+    }
+
+  std::vector<double> total_reference(n_events);
+  std::vector<double> total_candidate(n_events);
+  std::vector<double> voxel_shift(n_voxels, 0.);
+  double scale = 0;
+  double event_difference = 0;
+  for (std::size_t event = 0; event < n_events; ++event) {
+    for (std::size_t voxel = 0; voxel < n_voxels; ++voxel) {
+      const double ref = reference[event][voxel];
+      const double cand = candidate[event][voxel];
+      total_reference[event] += ref;
+      total_candidate[event] += cand;
+      voxel_shift[voxel] += cand - ref;
+      scale += std::abs(ref);
+      event_difference += std::abs(cand - ref);
+    }
+  }
+  scale /= n_events;
+  if (scale <= 0)
+    scale = 1;
+
+  auto mean = [n_events](const std::vector<double>& values)
+  {
+    double sum = 0;
+    for (double value : values)
+      sum += value;
+    return sum / n_events;
+  };
+  auto rms = [n_events](const std::vector<double>& values, double mu)
+  {
+    double sum = 0;
+    for (double value : values)
+      sum += (value - mu) * (value - mu);
+    return std::sqrt(sum / n_events);
+  };
+  const double mean_reference = mean(total_reference);
+  const double mean_candidate = mean(total_candidate);
+  const double rms_reference = rms(total_reference, mean_reference);
+  const double rms_candidate = rms(total_candidate, mean_candidate);
+
+  result.n_events = n_events;
+  result.total_mean_shift = std::abs(mean_candidate - mean_reference) / scale;
+  if (rms_reference > 0)
+    result.total_rms_ratio = rms_candidate / rms_reference;
+  else if (rms_candidate > 0)
+    result.total_rms_ratio = HUGE_VAL;
+  for (double shift : voxel_shift)
+    result.max_voxel_mean_shift = std::max(result.max_voxel_mean_shift,
+                                           std::abs(shift) / n_events / scale);
+  result.mean_event_difference = event_difference / n_events / scale;
+
+  // Largest distance of the empirical cumulative distributions
+  std::sort(total_reference.begin(), total_reference.end());
+  std::sort(total_candidate.begin(), total_candidate.end());
+  std::size_t i_ref = 0;
+  std::size_t i_cand = 0;
+  while (i_ref < n_events && i_cand < n_events) {
+    const double x = std::min(total_reference[i_ref], total_candidate[i_cand]);
+    while (i_ref < n_events && total_reference[i_ref] <= x)
+      ++i_ref;
+    while (i_cand < n_events && total_candidate[i_cand] <= x)
+      ++i_cand;
+    result.total_ks_distance =
+        std::max(result.total_ks_distance,
+                 std::abs(double(i_ref) - double(i_cand)) / n_events);
+  }
+  return result;
+}
@@ -0,0 +1,260 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#include "FastCaloSim/Core/TFCSONNXRuntime.h"
+
+#include <onnxruntime_cxx_api.h>
+
+#include "FastCaloSim/Core/TFCSContentHash.h"
+#include "TError.h"
+
+namespace
+{
+/// Integer value of an environment variable, or fallback if it is not set
+int env_int(const char* name, int fallback)
+{
+  const char* value = std::getenv(name);
+  if (!value || !*value)
+    return fallback;
+  char* end = nullptr;
+  const long parsed = std::strtol(value, &end, 10);
+  if (*end != '\0') {
+    ::Warning("TFCSONNXRuntime",
+              "Ignoring %s=%s, expected an integer",
+              name,
+              value);
+    return fallback;
+  }
+  return parsed;
+}
+
+GraphOptimizationLevel optimization_level(int level)
+{
+  if (level <= 0)
+    return ORT_DISABLE_ALL;
+  if (level == 1)
+    return ORT_ENABLE_BASIC;
+  if (level == 2)
+    return ORT_ENABLE_EXTENDED;
+  return ORT_ENABLE_ALL;
+}
+
+/// Registry key: the content and every option that changes the session.
+/// The content is identified by its SHA-256 digest, models with the same
+/// key can safely share a session
+std::string session_key(const std::vector<char>& bytes,
+                        const TFCSONNXRuntime::SessionConfig& config,
+                        bool global_threads)
+{
+  const TFCSContentHash::Digest digest =
+      TFCSContentHash::sha256(bytes.data(), bytes.size());
+  std::ostringstream key;
+  key << TFCSContentHash::hex(digest) << ':' << bytes.size() << ':'
+      << config.intra_op_threads << ':' << config.inter_op_threads << ':'
+      << config.graph_optimization_level << ':' << config.cpu_mem_arena
+      << config.mem_pattern << config.parallel_execution
+      << config.allow_spinning << config.deterministic
+      << (config.use_global_threads && global_threads);
+  return key.str();
+}
+}  // namespace
+
+//=============================================
+//======= TFCSONNXRuntime =========
+//=============================================
+
+TFCSONNXRuntime::TFCSONNXRuntime()
+{
+  m_globalIntraOpThreads = env_int("FCS_ONNX_GLOBAL_INTRA_OP_THREADS", 0);
+  m_globalInterOpThreads = env_int("FCS_ONNX_GLOBAL_INTER_OP_THREADS", 1);
+
+  SessionConfig& config = m_defaultConfig;
+  config.intra_op_threads =
+      env_int("FCS_ONNX_INTRA_OP_THREADS", config.intra_op_threads);
+  config.inter_op_threads =
+      env_int("FCS_ONNX_INTER_OP_THREADS", config.inter_op_threads);
+  config.graph_optimization_level =
+      env_int("FCS_ONNX_OPT_LEVEL", config.graph_optimization_level);
+  config.cpu_mem_arena = env_int("FCS_ONNX_MEM_ARENA", config.cpu_mem_arena);
+  config.mem_pattern = env_int("FCS_ONNX_MEM_PATTERN", config.mem_pattern);
+  config.parallel_execution =
+      env_int("FCS_ONNX_PARALLEL_EXECUTION", config.parallel_execution);
+  config.allow_spinning =
+      env_int("FCS_ONNX_ALLOW_SPINNING", config.allow_spinning);
+  config.deterministic =
+      env_int("FCS_ONNX_DETERMINISTIC", config.deterministic);
+  config.use_global_threads = m_globalIntraOpThreads > 0;
+  m_releaseModelBytes = !env_int("FCS_ONNX_KEEP_MODEL_BYTES", 0);
+}
+
+TFCSONNXRuntime& TFCSONNXRuntime::instance()
+{
+  // Never deleted, sessions may be destroyed during static destruction
+  static TFCSONNXRuntime* runtime = new TFCSONNXRuntime();
+  return *runtime;
+}
+
+bool TFCSONNXRuntime::setGlobalThreads(int intra_op_threads,
+                                       int inter_op_threads)
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  if (runtime.m_env) {
+    ::Error("TFCSONNXRuntime::setGlobalThreads",
+            "The onnxruntime environment already exists, the global thread "
+            "pools can not be changed anymore");
+    return false;
+  }
+  runtime.m_globalIntraOpThreads = intra_op_threads;
+  runtime.m_globalInterOpThreads = inter_op_threads;
+  runtime.m_defaultConfig.use_global_threads = intra_op_threads > 0;
+  return true;
+}
+
+bool TFCSONNXRuntime::hasGlobalThreads()
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  return runtime.m_globalIntraOpThreads > 0;
+}
+
+void TFCSONNXRuntime::setDefaultSessionConfig(const SessionConfig& config)
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  runtime.m_defaultConfig = config;
+}
+
+TFCSONNXRuntime::SessionConfig TFCSONNXRuntime::defaultSessionConfig()
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  return runtime.m_defaultConfig;
+}
+
+Ort::Env& TFCSONNXRuntime::env()
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  if (runtime.m_env)
+    return *runtime.m_env;
+
+  if (runtime.m_globalIntraOpThreads > 0) {
+    Ort::ThreadingOptions threading;
+    threading.SetGlobalIntraOpNumThreads(runtime.m_globalIntraOpThreads);
+    threading.SetGlobalInterOpNumThreads(
+        std::max(1, runtime.m_globalInterOpThreads));
+    // Idle pool threads must not take CPU time from the caller's workers
+    threading.SetGlobalSpinControl(0);
+    runtime.m_env =
+        new Ort::Env(threading, ORT_LOGGING_LEVEL_WARNING, "FastCaloSim");
+    ::Info("TFCSONNXRuntime::env",
+           "Created onnxruntime environment with global thread pools of %d "
+           "intra-op and %d inter-op threads",
+           runtime.m_globalIntraOpThreads,
+           std::max(1, runtime.m_globalInterOpThreads));
+  } else {
+    runtime.m_env = new Ort::Env(ORT_LOGGING_LEVEL_WARNING, "FastCaloSim");
+  }
+  return *runtime.m_env;
+}
+
+void TFCSONNXRuntime::applyConfig(const SessionConfig& config,
+                                  Ort::SessionOptions& options)
+{
+  if (config.use_global_threads && hasGlobalThreads()) {
+    options.DisablePerSessionThreads();
+  } else {
+    if (config.use_global_threads)
+      ::Warning("TFCSONNXRuntime::applyConfig",
+                "No global thread pools configured, using per session "
+                "threads");
+    options.SetIntraOpNumThreads(std::max(1, config.intra_op_threads));
+    options.SetInterOpNumThreads(std::max(1, config.inter_op_threads));
+    const char* spinning = config.allow_spinning ? "1" : "0";
+    options.AddConfigEntry("session.intra_op.allow_spinning", spinning);
+    options.AddConfigEntry("session.inter_op.allow_spinning", spinning);
+  }
+
+  options.SetGraphOptimizationLevel(
+      optimization_level(config.graph_optimization_level));
+  options.SetExecutionMode(config.parallel_execution ? ORT_PARALLEL
+                                                     : ORT_SEQUENTIAL);
+  if (config.cpu_mem_arena)
+    options.EnableCpuMemArena();
+  else
+    options.DisableCpuMemArena();
+  if (config.mem_pattern)
+    options.EnableMemPattern();
+  else
+    options.DisableMemPattern();
+
+  if (config.deterministic) {
+#if ORT_API_VERSION >= 17
+    options.SetDeterministicCompute(true);
+#else
+    ::Warning("TFCSONNXRuntime::applyConfig",
+              "Deterministic compute needs onnxruntime 1.17 or newer");
+#endif
+  }
+}
+
+std::shared_ptr<Ort::Session> TFCSONNXRuntime::session(
+    const std::vector<char>& bytes, const SessionConfig& config)
+{
+  TFCSONNXRuntime& runtime = instance();
+  // Take the environment first, it locks the other mutex
+  Ort::Env& ort_env = env();
+  const std::string key = session_key(bytes, config, hasGlobalThreads());
+
+  // Sessions are created under the lock, so that concurrent first calls
+  // for the same model do not create it twice
+  std::lock_guard<std::mutex> lock(runtime.m_registryMutex);
+  std::weak_ptr<Ort::Session>& entry = runtime.m_sessions[key];
+  std::shared_ptr<Ort::Session> existing = entry.lock();
+  if (existing)
+    return existing;
+
+  Ort::SessionOptions options;
+  applyConfig(config, options);
+  std::shared_ptr<Ort::Session> created = std::make_shared<Ort::Session>(
+      ort_env, bytes.data(), bytes.size(), options);
+  entry = created;
+
+  // Forget sessions that are not used anymore
+  for (auto it = runtime.m_sessions.begin(); it != runtime.m_sessions.end();) {
+    if (it->second.expired())
+      it = runtime.m_sessions.erase(it);
+    else
+      ++it;
+  }
+  return created;
+}
+
+std::size_t TFCSONNXRuntime::nSessions()
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_registryMutex);
+  std::size_t n_alive = 0;
+  for (const auto& entry : runtime.m_sessions)
+    if (!entry.second.expired())
+      ++n_alive;
+  return n_alive;
+}
+
+void TFCSONNXRuntime::setReleaseModelBytes(bool release)
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  runtime.m_releaseModelBytes = release;
+}
+
+bool TFCSONNXRuntime::releaseModelBytes()
+{
+  TFCSONNXRuntime& runtime = instance();
+  std::lock_guard<std::mutex> lock(runtime.m_mutex);
+  return runtime.m_releaseModelBytes;
+}
@@ -1,7 +1,11 @@
 // Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
 
+#include <vector>
+
 #include "FastCaloSim/Core/TFCSPCAEnergyParametrization.h"
 
+#include <Eigen/Core>
+
 #include "CLHEP/Random/RandFlat.h"
 #include "CLHEP/Random/RandGaussZiggurat.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
@@ -15,6 +19,33 @@
 #include "TMatrixD.h"
 #include "TMatrixDSymEigen.h"
 
+namespace
+{
+/// Scratch buffers of simulate(), grown on demand and reused by all later
+/// calls in the same thread
+struct PCAScratch_t
+{
+  std::vector<double> input;
+  std::vector<double> output;
+  std::vector<double> simdata;
+
+  void resize(std::size_t size)
+  {
+    if (input.size() >= size)
+      return;
+    input.resize(size);
+    output.resize(size);
+    simdata.resize(size);
+  }
+};
+
+PCAScratch_t& pca_scratch()
+{
+  thread_local PCAScratch_t scratch;
+  return scratch;
+}
+}  // namespace
+
 //=============================================
 //======= TFCSPCAEnergyParametrization =========
 //=============================================
@@ -122,122 +153,184 @@ TH1* TFCSPCAEnergyParametrization::get_totalE_probability_ratio(
   return m_totalE_probability_ratio[Ekin_bin - 1];
 }
 
-FCSReturnCode TFCSPCAEnergyParametrization::simulate(
-    TFCSSimulationState& simulstate,
-    const TFCSTruthState* /*truth*/,
-    const TFCSExtrapolationState* /*extrapol*/) const
+void TFCSPCAEnergyParametrization::set_empty(
+    TFCSSimulationState& simulstate) const
 {
-  if (!simulstate.randomEngine()) {
-    return FCSFatal;
+  simulstate.set_E(0);
+  for (int s = 0; s < m_geo->n_layers(); s++) {
+    simulstate.set_E(s, 0.0);
+    simulstate.set_Efrac(s, 0.0);
   }
+}
 
-  int pcabin = simulstate.Ebin();
-
-  if (pcabin == 0) {
-    simulstate.set_E(0);
-    for (int s = 0; s < m_geo->n_layers(); s++) {
-      simulstate.set_E(s, 0.0);
-      simulstate.set_Efrac(s, 0.0);
-    }
-  } else {
-    TMatrixD* EV = m_EV[pcabin - 1];
-    TVectorD* MeanValues = m_MeanValues[pcabin - 1];
-    TVectorD* SigmaValues = m_SigmaValues[pcabin - 1];
-    TVectorD* Gauss_means = m_Gauss_means[pcabin - 1];
-    TVectorD* Gauss_rms = m_Gauss_rms[pcabin - 1];
-    std::vector<TFCS1DFunction*> cumulative = m_cumulative[pcabin - 1];
+void TFCSPCAEnergyParametrization::draw_gauss(TFCSSimulationState& simulstate,
+                                              int pcabin,
+                                              double* input_data) const
+{
+  const double* vals_gauss_means = m_Gauss_means[pcabin - 1]->GetMatrixArray();
+  const double* vals_gauss_rms = m_Gauss_rms[pcabin - 1]->GetMatrixArray();
+
+  for (unsigned int l = 0; l <= m_RelevantLayers.size(); l++) {
+    double mean = vals_gauss_means[l];
+    double rms = vals_gauss_rms[l];
+    double gauszz =
+        CLHEP::RandGaussZiggurat::shoot(simulstate.randomEngine(), mean, rms);
+    input_data[l] = gauszz;
+  }
+}
 
-    const std::vector<int>& layerNr = m_RelevantLayers;
+FCSReturnCode TFCSPCAEnergyParametrization::fill_energies(
+    TFCSSimulationState& simulstate,
+    int pcabin,
+    const double* output_data,
+    double* simdata) const
+{
+  const std::vector<TFCS1DFunction*>& cumulative = m_cumulative[pcabin - 1];
+  const std::vector<int>& layerNr = m_RelevantLayers;
 
-    double* vals_gauss_means = (double*)Gauss_means->GetMatrixArray();
-    double* vals_gauss_rms = Gauss_rms->GetMatrixArray();
+  double sum_fraction = 0.0;
+  for (unsigned int l = 0; l <= layerNr.size(); l++) {
+    double simdata_uniform =
+        (TMath::Erf(output_data[l] / 1.414213562) + 1) / 2.f;
 
-    double* output_data = new double[layerNr.size() + 1];
-    double* input_data = new double[layerNr.size() + 1];
+    simdata[l] = cumulative[l]->rnd_to_fct(simdata_uniform);
 
-    for (unsigned int l = 0; l <= layerNr.size(); l++) {
-      double mean = vals_gauss_means[l];
-      double rms = vals_gauss_rms[l];
-      double gauszz =
-          CLHEP::RandGaussZiggurat::shoot(simulstate.randomEngine(), mean, rms);
-      input_data[l] = gauszz;
-    }
+    if (l != layerNr.size())  // sum up the fractions, but not the totalE
+      sum_fraction += simdata[l];
+  }
 
-    P2X(SigmaValues,
-        MeanValues,
-        EV,
-        layerNr.size() + 1,
-        input_data,
-        output_data,
-        layerNr.size() + 1);
+  double scalefactor = 1.0 / sum_fraction;
+  if (!do_rescale)
+    scalefactor = 1.0;
 
-    double* simdata = new double[layerNr.size() + 1];
-    double sum_fraction = 0.0;
-    for (unsigned int l = 0; l <= layerNr.size(); l++) {
-      double simdata_uniform =
-          (TMath::Erf(output_data[l] / 1.414213562) + 1) / 2.f;
+  // Using signed int for better loop optimization and vectorization where
+  // possible
+  int layerNrsize = static_cast<int>(layerNr.size());
+  for (int l = 0; l < layerNrsize; l++) {
+    simdata[l] *= scalefactor;
+  }
 
-      simdata[l] = cumulative[l]->rnd_to_fct(simdata_uniform);
+  // Apply hit-and-miss reweighting of total energy response
+  // This needs to run before simulstate is modified, otherwise a clean retry
+  // is not possible
+  TH1* h_totalE_ratio = get_totalE_probability_ratio(pcabin);
+  if (h_totalE_ratio) {
+    float pass_probability = 0;
+    float Etot = simdata[layerNr.size()];
+    if (Etot > h_totalE_ratio->GetXaxis()->GetXmin()
+        && Etot < h_totalE_ratio->GetXaxis()->GetXmax())
+    {
+      pass_probability = interpolate_get_y(h_totalE_ratio, Etot);
+    }
+    float random = CLHEP::RandFlat::shoot(simulstate.randomEngine());
+    if (random > pass_probability) {
+      return (FCSReturnCode)FCSRetryPCA;
+    }
+  }
 
-      if (l != layerNr.size())  // sum up the fractions, but not the totalE
-        sum_fraction += simdata[l];
+  double total_energy =
+      simdata[layerNr.size()] * simulstate.E() / m_total_energy_normalization;
+  simulstate.set_E(total_energy);
+  FCS_MSG_DEBUG("set E to total_energy=" << total_energy);
+
+  simulstate.set_SF(scalefactor);
+  for (int s = 0; s < m_geo->n_layers(); s++) {
+    int index = -1;
+    if (s < (int)m_layer_index.size()) {
+      index = m_layer_index[s];
+    } else if (m_layer_index.empty()) {
+      for (unsigned int l = 0; l < layerNr.size(); l++) {
+        if (layerNr[l] == s)
+          index = l;
+      }
     }
+    double energyfrac = index >= 0 ? simdata[index] : 0.0;
+    simulstate.set_Efrac(s, energyfrac);
+    simulstate.set_E(s, energyfrac * total_energy);
+  }
 
-    double scalefactor = 1.0 / sum_fraction;
-    if (!do_rescale)
-      scalefactor = 1.0;
+  return FCSSuccess;
+}
 
-    // Using signed int for better loop optimization and vectorization where
-    // possible
-    int layerNrsize = static_cast<int>(layerNr.size());
-    for (int l = 0; l < layerNrsize; l++) {
-      simdata[l] *= scalefactor;
-    }
+FCSReturnCode TFCSPCAEnergyParametrization::simulate(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* /*truth*/,
+    const TFCSExtrapolationState* /*extrapol*/) const
+{
+  if (!simulstate.randomEngine()) {
+    return FCSFatal;
+  }
 
-    // Apply hit-and-miss reweighting of total energy response
-    // This needs to run before simulstate is modified, otherwise a clean retry
-    // is not possible
-    TH1* h_totalE_ratio = get_totalE_probability_ratio(pcabin);
-    if (h_totalE_ratio) {
-      float pass_probability = 0;
-      float Etot = simdata[layerNr.size()];
-      if (Etot > h_totalE_ratio->GetXaxis()->GetXmin()
-          && Etot < h_totalE_ratio->GetXaxis()->GetXmax())
-      {
-        pass_probability = interpolate_get_y(h_totalE_ratio, Etot);
-      }
-      float random = CLHEP::RandFlat::shoot(simulstate.randomEngine());
-      if (random > pass_probability) {
-        delete[] output_data;
-        delete[] input_data;
-        delete[] simdata;
+  int pcabin = simulstate.Ebin();
 
-        return (FCSReturnCode)FCSRetryPCA;
-      }
-    }
+  if (pcabin == 0) {
+    set_empty(simulstate);
+    return FCSSuccess;
+  }
+  if (!is_valid_pcabin(pcabin))
+    return FCSFatal;
 
-    double total_energy =
-        simdata[layerNr.size()] * simulstate.E() / m_total_energy_normalization;
-    simulstate.set_E(total_energy);
-    FCS_MSG_DEBUG("set E to total_energy=" << total_energy);
+  const unsigned int n = m_RelevantLayers.size() + 1;
+  PCAScratch_t& scratch = pca_scratch();
+  scratch.resize(n);
 
-    for (int s = 0; s < m_geo->n_layers(); s++) {
-      double energyfrac = 0.0;
-      for (unsigned int l = 0; l < layerNr.size(); l++) {
-        if (layerNr[l] == s)
-          energyfrac = simdata[l];
-      }
-      simulstate.set_Efrac(s, energyfrac);
-      simulstate.set_E(s, energyfrac * total_energy);
-      simulstate.set_SF(scalefactor);
-    }
+  draw_gauss(simulstate, pcabin, scratch.input.data());
+  P2X_batch(pcabin, scratch.input.data(), scratch.output.data(), 1);
+  return fill_energies(
+      simulstate, pcabin, scratch.output.data(), scratch.simdata.data());
+}
 
-    delete[] output_data;
-    delete[] input_data;
-    delete[] simdata;
+void TFCSPCAEnergyParametrization::simulate_batch(
+    const std::vector<TFCSSimulationState*>& states,
+    std::vector<FCSReturnCode>& status) const
+{
+  status.assign(states.size(), FCSSuccess);
+
+  // Group the particles by PCA bin
+  std::vector<std::vector<std::size_t>> particles_in_bin(m_EV.size() + 1);
+  for (std::size_t i = 0; i < states.size(); ++i) {
+    TFCSSimulationState& simulstate = *states[i];
+    if (!simulstate.randomEngine()) {
+      status[i] = FCSFatal;
+      continue;
+    }
+    int pcabin = simulstate.Ebin();
+    if (pcabin < 0 || pcabin > (int)m_EV.size()) {
+      FCS_MSG_ERROR("simulate_batch(): invalid pcabin " << pcabin);
+      status[i] = FCSFatal;
+      continue;
+    }
+    if (pcabin == 0) {
+      set_empty(simulstate);
+      continue;
+    }
+    if (!is_valid_pcabin(pcabin)) {
+      status[i] = FCSFatal;
+      continue;
+    }
+    particles_in_bin[pcabin].push_back(i);
   }
 
-  return FCSSuccess;
+  const unsigned int n = m_RelevantLayers.size() + 1;
+  PCAScratch_t& scratch = pca_scratch();
+  for (int pcabin = 1; pcabin < (int)particles_in_bin.size(); ++pcabin) {
+    const std::vector<std::size_t>& particles = particles_in_bin[pcabin];
+    if (particles.empty())
+      continue;
+    scratch.resize(n * particles.size());
+
+    for (std::size_t k = 0; k < particles.size(); ++k)
+      draw_gauss(*states[particles[k]], pcabin, &scratch.input[k * n]);
+    P2X_batch(pcabin,
+              scratch.input.data(),
+              scratch.output.data(),
+              particles.size());
+    for (std::size_t k = 0; k < particles.size(); ++k)
+      status[particles[k]] = fill_energies(*states[particles[k]],
+                                           pcabin,
+                                           &scratch.output[k * n],
+                                           &scratch.simdata[k * n]);
+  }
 }
 
 void TFCSPCAEnergyParametrization::P2X(TVectorD* SigmaValues,
@@ -261,6 +354,90 @@ void TFCSPCAEnergyParametrization::P2X(TVectorD* SigmaValues,
   }
 }
 
+void TFCSPCAEnergyParametrization::P2X_batch(int pcabin,
+                                             const double* p,
+                                             double* x,
+                                             int nvectors) const
+{
+  const int n = m_RelevantLayers.size() + 1;
+  if (pcabin > (int)m_P2X_matrix.size()) {
+    // No cached matrix, e.g. for a partially set up object
+    for (int k = 0; k < nvectors; ++k)
+      P2X(m_SigmaValues[pcabin - 1],
+          m_MeanValues[pcabin - 1],
+          m_EV[pcabin - 1],
+          n,
+          p + k * n,
+          x + k * n,
+          n);
+    return;
+  }
+
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      RowMatrix_t;
+  Eigen::Map<const RowMatrix_t> transform(
+      m_P2X_matrix[pcabin - 1].data(), n, n);
+  Eigen::Map<const Eigen::VectorXd> mean(
+      m_MeanValues[pcabin - 1]->GetMatrixArray(), n);
+  Eigen::Map<const Eigen::MatrixXd> input(p, n, nvectors);
+  Eigen::Map<Eigen::MatrixXd> output(x, n, nvectors);
+
+  output.noalias() = transform * input;
+  output.colwise() += mean;
+}
+
+void TFCSPCAEnergyParametrization::prepare_P2X()
+{
+  m_P2X_matrix.clear();
+  m_layer_index.clear();
+
+  const int n = m_RelevantLayers.size() + 1;
+  for (unsigned int bin = 0; bin < m_EV.size(); ++bin) {
+    const TMatrixD* EV = m_EV[bin];
+    const TVectorD* SigmaValues = m_SigmaValues[bin];
+    if (!EV || !SigmaValues || EV->GetNrows() != n || EV->GetNcols() != n
+        || SigmaValues->GetNrows() != n)
+    {
+      FCS_MSG_DEBUG("prepare_P2X(): unexpected dimensions in pcabin "
+                    << bin + 1 << ", using the uncached back-transformation");
+      m_P2X_matrix.clear();
+      break;
+    }
+    const double* sigma = SigmaValues->GetMatrixArray();
+    const double* eigenvectors = EV->GetMatrixArray();
+    std::vector<double> matrix(n * n);
+    for (int i = 0; i < n; ++i)
+      for (int j = 0; j < n; ++j)
+        matrix[i * n + j] = sigma[i] * eigenvectors[i * n + j];
+    m_P2X_matrix.push_back(std::move(matrix));
+  }
+
+  for (unsigned int l = 0; l < m_RelevantLayers.size(); l++) {
+    const int layer = m_RelevantLayers[l];
+    if (layer < 0)
+      continue;
+    if (layer >= (int)m_layer_index.size())
+      m_layer_index.resize(layer + 1, -1);
+    m_layer_index[layer] = l;
+  }
+}
+
+void TFCSPCAEnergyParametrization::check_cumulative()
+{
+  m_pcabin_valid.assign(m_cumulative.size(), true);
+  for (unsigned int bin = 0; bin < m_cumulative.size(); ++bin) {
+    for (unsigned int l = 0; l < m_cumulative[bin].size(); ++l) {
+      const TFCS1DFunction* cumulative = m_cumulative[bin][l];
+      if (cumulative && !cumulative->is_valid()) {
+        FCS_MSG_ERROR("Cumulative distribution " << l << " of PCA bin "
+                                                 << bin + 1
+                                                 << " could not be read");
+        m_pcabin_valid[bin] = false;
+      }
+    }
+  }
+}
+
 bool TFCSPCAEnergyParametrization::loadInputs(TFile* file)
 {
   return loadInputs(file, "");
@@ -376,6 +553,8 @@ bool TFCSPCAEnergyParametrization::loadInputs(TFile* file,
     m_cumulative.emplace_back(std::move(cumulative));
   }
   m_totalE_probability_ratio.resize(m_numberpcabins - 1, nullptr);
+  prepare_P2X();
+  check_cumulative();
 
   return true;
 }
@@ -408,6 +587,8 @@ void TFCSPCAEnergyParametrization::Streamer(TBuffer& R__b)
     if (R__v <= 2) {
       m_totalE_probability_ratio.resize(m_numberpcabins - 1, nullptr);
     }
+    prepare_P2X();
+    check_cumulative();
   } else {
     R__b.WriteClassBuffer(TFCSPCAEnergyParametrization::Class(), this);
   }
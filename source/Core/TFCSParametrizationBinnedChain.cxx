@@ -73,7 +73,13 @@ FCSReturnCode TFCSParametrizationBinnedChain::simulate(
   Int_t retry_warning = 1;
 
   FCSReturnCode status = FCSSuccess;
+  // Only used with RetryChainFromStart(), otherwise simulate_and_retry()
+  // handles all retries
+  TFCSSimulationState::Checkpoint_t checkpoint(
+      simulstate, RollbackOnRetry() && RetryChainFromStart());
   for (int i = 0; i <= retry; i++) {
+    if (i > 0)
+      checkpoint.rollback();
     if (i >= retry_warning)
       FCS_MSG_WARNING(
           "TFCSParametrizationBinnedChain::simulate(): Retry simulate call "
@@ -165,6 +171,8 @@ void TFCSParametrizationBinnedChain::Print(Option_t* option) const
       msgLvl(FCS_MSG::DEBUG) || (msgLvl(FCS_MSG::INFO) && !shortprint);
   TString optprint = opt;
   optprint.ReplaceAll("short", "");
+  if (longprint && retry_count() > 0)
+    FCS_MSG_INFO(optprint << "  retries=" << retry_count());
 
   TString prefix = "- ";
   for (unsigned int ichain = 0; ichain < size(); ++ichain) {
@@ -6,6 +6,7 @@
 #include "FastCaloSim/Core/TFCSParametrizationChain.h"
 
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
+#include "FastCaloSim/Core/TFCSParametrizationLazyPlaceholder.h"
 #include "FastCaloSim/Core/TFCSParametrizationPlaceholder.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "FastCaloSim/Core/TFCSTruthState.h"
@@ -165,7 +166,13 @@ FCSReturnCode TFCSParametrizationChain::simulate(
   Int_t retry_warning = 1;
 
   FCSReturnCode status = FCSSuccess;
+  // Only used with RetryChainFromStart(), otherwise simulate_and_retry()
+  // handles all retries
+  TFCSSimulationState::Checkpoint_t checkpoint(
+      simulstate, RollbackOnRetry() && RetryChainFromStart());
   for (int i = 0; i <= retry; i++) {
+    if (i > 0)
+      checkpoint.rollback();
     if (i >= retry_warning)
       FCS_MSG_WARNING(
           "TFCSParametrizationChain::simulate(): Retry simulate call "
@@ -202,6 +209,8 @@ void TFCSParametrizationChain::Print(Option_t* option) const
 {
   TFCSParametrization::Print(option);
   TString opt(option);
+  if (retry_count() > 0 && msgLvl(FCS_MSG::INFO))
+    FCS_MSG_INFO(opt << "  retries=" << retry_count());
   // bool shortprint=opt.Index("short")>=0;
   // bool longprint=msgLvl(FCS_MSG::DEBUG) || (msgLvl(FCS_MSG::INFO) &&
   // !shortprint);
@@ -253,7 +262,12 @@ void TFCSParametrizationChain::Streamer(TBuffer& R__b)
           if (R__t->InheritsFrom(TFCSParametrizationPlaceholder::Class())) {
             std::unique_ptr<TFCSParametrizationBase> new_R__t = nullptr;
 
-            if (dir) {
+            if (dir && TFCSParametrizationLazyPlaceholder::LazyLoading()) {
+              // Only keep the key, the object is read on first use
+              new_R__t.reset(new TFCSParametrizationLazyPlaceholder(
+                  *static_cast<TFCSParametrizationPlaceholder*>(R__t.get()),
+                  dir));
+            } else if (dir) {
               new_R__t.reset(
                   (TFCSParametrizationBase*)dir->Get(R__t->GetName()));
             }
@@ -296,6 +310,7 @@ void TFCSParametrizationChain::Streamer(TBuffer& R__b)
           dir->WriteTObject(R__t);
           TFCSParametrizationPlaceholder tmp(
               R__t->GetName(), TString("Placeholder for: ") + R__t->GetTitle());
+          tmp.set_match_info(*R__t);
           R__b.WriteObject(&tmp, false);  // tell R__b object with same address
                                           // are actually different
         } else {
@@ -0,0 +1,329 @@
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <set>
+#include <typeinfo>
+
+#include "FastCaloSim/Core/TFCSParametrizationDispatchTable.h"
+
+#include "CLHEP/Random/RandFlat.h"
+#include "FastCaloSim/Core/TFCSExtrapolationState.h"
+#include "FastCaloSim/Core/TFCSParametrizationAbsEtaSelectChain.h"
+#include "FastCaloSim/Core/TFCSParametrizationEkinSelectChain.h"
+#include "FastCaloSim/Core/TFCSParametrizationEtaSelectChain.h"
+#include "FastCaloSim/Core/TFCSParametrizationPDGIDSelectChain.h"
+#include "FastCaloSim/Core/TFCSSimulationState.h"
+#include "FastCaloSim/Core/TFCSTruthState.h"
+#include "TMath.h"
+
+namespace
+{
+/// Maximal deviation of a bin edge from the uniform prediction, in units of
+/// the bin width, up to which the direct index is used
+constexpr double kMaxEdgeDeviation = 0.01;
+}  // namespace
+
+//=============================================
+//======= TFCSParametrizationDispatchTable =========
+//=============================================
+
+TFCSParametrizationDispatchTable::TFCSParametrizationDispatchTable(
+    const TFCSParametrizationPDGIDSelectChain& chain)
+    : m_owner(&chain)
+    , m_generation(chain.dispatch_generation())
+{
+  std::vector<int> top;
+  std::set<int> pdgids;
+  for (TFCSParametrizationBase* param : chain.chain()) {
+    top.push_back(add_node(param));
+    pdgids.insert(param->pdgid().begin(), param->pdgid().end());
+  }
+
+  for (int pdgid : pdgids) {
+    std::vector<int>& nodes = m_pdgid_nodes[pdgid];
+    for (unsigned int i = 0; i < chain.size(); ++i) {
+      if (chain[i]->is_match_pdgid(pdgid)) {
+        nodes.push_back(top[i]);
+        if (chain.SimulateOnlyOnePDGID())
+          break;
+      }
+    }
+  }
+  for (unsigned int i = 0; i < chain.size(); ++i) {
+    if (chain[i]->is_match_all_pdgid()) {
+      m_all_pdgid_nodes.push_back(top[i]);
+      if (chain.SimulateOnlyOnePDGID())
+        break;
+    }
+  }
+}
+
+bool TFCSParametrizationDispatchTable::is_current() const
+{
+  return !m_stale.load(std::memory_order_relaxed)
+      && m_generation == m_owner->dispatch_generation();
+}
+
+int TFCSParametrizationDispatchTable::add_node(TFCSParametrizationBase* param)
+{
+  auto existing = m_node_index.find(param);
+  if (existing != m_node_index.end())
+    return existing->second;
+
+  const int index = m_nodes.size();
+  m_node_index[param] = index;
+  m_nodes.emplace_back();
+  m_nodes[index].param = param;
+
+  // Only the exact select chain classes are flattened, derived classes might
+  // select differently
+  Variable_t variable = kLeaf;
+  if (param) {
+    const std::type_info& type = typeid(*param);
+    if (type == typeid(TFCSParametrizationEkinSelectChain))
+      variable = kEkin;
+    else if (type == typeid(TFCSParametrizationEtaSelectChain))
+      variable = kEta;
+    else if (type == typeid(TFCSParametrizationAbsEtaSelectChain))
+      variable = kAbsEta;
+  }
+  if (variable == kLeaf)
+    return index;
+
+  const auto* select =
+      static_cast<const TFCSParametrizationFloatSelectChain*>(param);
+  // Select chains that are not flattened are also tracked, so that the table
+  // is rebuilt if they can be flattened after a change
+  m_nodes[index].chain = select;
+  m_nodes[index].generation = select->dispatch_generation();
+  const std::vector<unsigned int>& bin_start = select->bin_start();
+  const unsigned int nbins = select->get_number_of_bins();
+  if (select->RetryChainFromStart() || select->RollbackOnRetry() || nbins == 0
+      || bin_start.front() != 0 || bin_start.back() != select->size())
+    return index;
+  for (unsigned int ibin = 0; ibin < nbins; ++ibin)
+    if (bin_start[ibin + 1] - bin_start[ibin] > 1)
+      return index;
+
+  Node_t node;
+  node.param = param;
+  node.chain = select;
+  node.generation = m_nodes[index].generation;
+  node.variable = variable;
+  node.edges.resize(nbins + 1);
+  for (unsigned int ibin = 0; ibin <= nbins; ++ibin)
+    node.edges[ibin] = select->get_bin_low_edge(ibin);
+  set_lookup(node);
+
+  if (variable == kEkin) {
+    const auto* ekin_select =
+        static_cast<const TFCSParametrizationEkinSelectChain*>(select);
+    node.random_interpolation = ekin_select->DoRandomInterpolation();
+    node.has_nominal.resize(nbins, 0);
+    node.Ekin_nominal.resize(nbins, 0);
+    node.log_Ekin_nominal.resize(nbins, 0);
+    for (unsigned int ibin = 0; ibin < nbins; ++ibin) {
+      if (bin_start[ibin + 1] == bin_start[ibin])
+        continue;
+      const TFCSParametrizationBase* first = (*select)[bin_start[ibin]];
+      if (!first)
+        continue;
+      node.has_nominal[ibin] = 1;
+      node.Ekin_nominal[ibin] = first->Ekin_nominal();
+      node.log_Ekin_nominal[ibin] = TMath::Log(first->Ekin_nominal());
+    }
+  }
+
+  node.target.resize(nbins, -1);
+  for (unsigned int ibin = 0; ibin < nbins; ++ibin) {
+    if (bin_start[ibin + 1] == bin_start[ibin])
+      continue;
+    TFCSParametrizationBase* daughter = select->chain().at(bin_start[ibin]);
+    if (daughter)
+      node.target[ibin] = add_node(daughter);
+  }
+
+  m_nodes[index] = std::move(node);
+  return index;
+}
+
+void TFCSParametrizationDispatchTable::set_lookup(Node_t& node) const
+{
+  const std::vector<float>& edges = node.edges;
+  const unsigned int nbins = edges.size() - 1;
+  node.lookup = kSearch;
+  if (nbins < 2)
+    return;
+
+  auto is_uniform = [&](double offset, double scale, bool log)
+  {
+    for (unsigned int i = 0; i <= nbins; ++i) {
+      const double x = log ? std::log((double)edges[i]) : (double)edges[i];
+      if (std::abs((x - offset) * scale - i) > kMaxEdgeDeviation)
+        return false;
+    }
+    return true;
+  };
+
+  const double width = ((double)edges[nbins] - edges[0]) / nbins;
+  if (width > 0 && is_uniform(edges[0], 1 / width, false)) {
+    node.lookup = kLinear;
+    node.offset = edges[0];
+    node.scale = 1 / width;
+    return;
+  }
+  if (node.variable == kEkin && edges[0] > 0) {
+    const double log_low = std::log((double)edges[0]);
+    const double log_width = (std::log((double)edges[nbins]) - log_low) / nbins;
+    if (log_width > 0 && is_uniform(log_low, 1 / log_width, true)) {
+      node.lookup = kLog;
+      node.offset = log_low;
+      node.scale = 1 / log_width;
+    }
+  }
+}
+
+int TFCSParametrizationDispatchTable::val_to_bin(const Node_t& node,
+                                                 float val) const
+{
+  const std::vector<float>& edges = node.edges;
+  const int nbins = edges.size() - 1;
+  if (!(val >= edges[0]) || !(val < edges[nbins]))
+    return -1;
+
+  int bin;
+  switch (node.lookup) {
+    case kLinear:
+      bin = (int)((val - node.offset) * node.scale);
+      break;
+    case kLog:
+      bin = (int)((std::log((double)val) - node.offset) * node.scale);
+      break;
+    default:
+      bin = std::distance(edges.begin(),
+                          std::upper_bound(edges.begin(), edges.end(), val))
+          - 1;
+  }
+
+  // The direct index can be off by one due to rounding, the final bin always
+  // fulfills edges[bin] <= val < edges[bin+1] like the binary search
+  bin = std::max(0, std::min(bin, nbins - 1));
+  while (bin > 0 && val < edges[bin])
+    --bin;
+  while (bin < nbins - 1 && val >= edges[bin + 1])
+    ++bin;
+  return bin;
+}
+
+int TFCSParametrizationDispatchTable::interpolate_Ekin(const Node_t& node,
+                                                       int bin,
+                                                       float Ekin,
+                                                       float rnd) const
+{
+  // Same logic as TFCSParametrizationEkinSelectChain::get_bin()
+  const int nbins = node.target.size();
+  if (!node.has_nominal[bin])
+    return bin;
+
+  if (Ekin < node.Ekin_nominal[bin]) {
+    if (bin == 0)
+      return bin;
+    const int prevbin = bin - 1;
+    if (!node.has_nominal[prevbin])
+      return bin;
+
+    float logEkin = TMath::Log(Ekin);
+    float numerator = logEkin - node.log_Ekin_nominal[prevbin];
+    float denominator =
+        node.log_Ekin_nominal[bin] - node.log_Ekin_nominal[prevbin];
+    if (denominator <= 0)
+      return bin;
+    if (numerator / denominator < rnd)
+      return prevbin;
+  } else {
+    if (bin == nbins - 1)
+      return bin;
+    const int nextbin = bin + 1;
+    if (!node.has_nominal[nextbin])
+      return bin;
+
+    float logEkin = TMath::Log(Ekin);
+    float numerator = logEkin - node.log_Ekin_nominal[bin];
+    float denominator =
+        node.log_Ekin_nominal[nextbin] - node.log_Ekin_nominal[bin];
+    if (denominator <= 0)
+      return bin;
+    if (rnd < numerator / denominator)
+      return nextbin;
+  }
+  return bin;
+}
+
+const std::vector<int>& TFCSParametrizationDispatchTable::nodes_for_pdgid(
+    int pdgid) const
+{
+  auto it = m_pdgid_nodes.find(pdgid);
+  if (it != m_pdgid_nodes.end())
+    return it->second;
+  return m_all_pdgid_nodes;
+}
+
+TFCSParametrizationBase* TFCSParametrizationDispatchTable::find(
+    int inode,
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol,
+    const TFCSParametrizationChain*& parent) const
+{
+  parent = nullptr;
+  while (true) {
+    const Node_t& node = m_nodes[inode];
+    if (node.chain && node.chain->dispatch_generation() != node.generation) {
+      // The select chain changed after the table was built. It is simulated
+      // as is and the table is rebuilt before its next use
+      m_stale.store(true, std::memory_order_relaxed);
+      return node.param;
+    }
+    int bin = -1;
+    switch (node.variable) {
+      case kLeaf:
+        return node.param;
+      case kEkin: {
+        if (!simulstate.randomEngine())
+          return node.param;
+        const float Ekin = truth->Ekin();
+        bin = val_to_bin(node, Ekin);
+        if (bin < 0)
+          return node.param;
+        if (node.random_interpolation) {
+          const float rnd = CLHEP::RandFlat::shoot(simulstate.randomEngine());
+          bin = interpolate_Ekin(node, bin, Ekin, rnd);
+        }
+        break;
+      }
+      case kEta:
+        bin = val_to_bin(node, extrapol->IDCaloBoundary_eta());
+        break;
+      case kAbsEta:
+        bin = val_to_bin(node, TMath::Abs(extrapol->IDCaloBoundary_eta()));
+        break;
+    }
+    if (bin < 0)
+      return node.param;
+    parent = static_cast<const TFCSParametrizationChain*>(node.param);
+    inode = node.target[bin];
+    if (inode < 0)
+      return nullptr;
+  }
+}
+
+unsigned int TFCSParametrizationDispatchTable::n_direct_indexed() const
+{
+  unsigned int count = 0;
+  for (const Node_t& node : m_nodes)
+    if (node.variable != kLeaf && node.lookup != kSearch)
+      ++count;
+  return count;
+}
@@ -0,0 +1,356 @@
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+
+// Copyright (c) 2024 CERN for the benefit of the FastCaloSim project
+
+#include <unordered_map>
+#include <vector>
+
+#include "FastCaloSim/Core/TFCSParametrizationLazyPlaceholder.h"
+
+#include "TDirectory.h"
+#include "TKey.h"
+
+//=============================================
+//======= TFCSLazyLoadRegistry =========
+//=============================================
+
+/// Bookkeeping of all loaded TFCSParametrizationLazyPlaceholder objects for the
+/// memory budget. Lock order is always the load mutex of a placeholder first,
+/// then the registry mutex. The registry itself never takes a load mutex.
+class TFCSLazyLoadRegistry
+{
+public:
+  static TFCSLazyLoadRegistry& instance()
+  {
+    // Never deleted, so that placeholders destroyed during static destruction
+    // can still deregister
+    static TFCSLazyLoadRegistry* registry = new TFCSLazyLoadRegistry();
+    return *registry;
+  }
+
+  void add(const TFCSParametrizationLazyPlaceholder* para, std::size_t bytes)
+  {
+    // Evicted objects are deleted after the registry lock is released, as
+    // their destructors deregister nested placeholders
+    std::vector<std::shared_ptr<TFCSParametrizationBase>> released;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used += bytes;
+    m_loaded[para] = bytes;
+
+    const std::size_t budget = m_budget.load();
+    while (budget > 0 && m_used > budget && m_loaded.size() > 1) {
+      auto victim = m_loaded.end();
+      for (auto it = m_loaded.begin(); it != m_loaded.end(); ++it) {
+        if (it->first == para)
+          continue;
+        if (victim == m_loaded.end()
+            || it->first->m_last_used.load(std::memory_order_relaxed)
+                < victim->first->m_last_used.load(std::memory_order_relaxed))
+          victim = it;
+      }
+      released.push_back(std::atomic_exchange(
+          &victim->first->m_param, std::shared_ptr<TFCSParametrizationBase>()));
+      m_used -= victim->second;
+      m_loaded.erase(victim);
+    }
+  }
+
+  std::shared_ptr<TFCSParametrizationBase> remove(
+      const TFCSParametrizationLazyPlaceholder* para)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_loaded.find(para);
+    if (it != m_loaded.end()) {
+      m_used -= it->second;
+      m_loaded.erase(it);
+    }
+    return std::atomic_exchange(&para->m_param,
+                                std::shared_ptr<TFCSParametrizationBase>());
+  }
+
+  void deregister(const TFCSParametrizationLazyPlaceholder* para)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_loaded.find(para);
+    if (it != m_loaded.end()) {
+      m_used -= it->second;
+      m_loaded.erase(it);
+    }
+  }
+
+  std::size_t used()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_used;
+  }
+
+  std::uint64_t tick() { return ++m_clock; }
+
+  /// TFile access is not thread-safe, all lazy reads are serialized
+  std::mutex m_io_mutex;
+  std::atomic<bool> m_lazy {false};
+  std::atomic<std::size_t> m_budget {0};
+
+private:
+  std::mutex m_mutex;
+  std::unordered_map<const TFCSParametrizationLazyPlaceholder*, std::size_t>
+      m_loaded;
+  std::size_t m_used = 0;
+  std::atomic<std::uint64_t> m_clock {0};
+};
+
+//=============================================
+//======= TFCSParametrizationLazyPlaceholder =========
+//=============================================
+
+TFCSParametrizationLazyPlaceholder::TFCSParametrizationLazyPlaceholder(
+    const TFCSParametrizationPlaceholder& ref, TDirectory* dir)
+    : TFCSParametrizationPlaceholder(ref)
+    , m_dir(dir)
+{
+}
+
+TFCSParametrizationLazyPlaceholder::~TFCSParametrizationLazyPlaceholder()
+{
+  TFCSLazyLoadRegistry::instance().deregister(this);
+}
+
+void TFCSParametrizationLazyPlaceholder::set_LazyLoading(bool lazy)
+{
+  TFCSLazyLoadRegistry::instance().m_lazy = lazy;
+}
+
+bool TFCSParametrizationLazyPlaceholder::LazyLoading()
+{
+  return TFCSLazyLoadRegistry::instance().m_lazy;
+}
+
+void TFCSParametrizationLazyPlaceholder::set_MemoryBudget(std::size_t bytes)
+{
+  TFCSLazyLoadRegistry::instance().m_budget = bytes;
+}
+
+std::size_t TFCSParametrizationLazyPlaceholder::MemoryBudget()
+{
+  return TFCSLazyLoadRegistry::instance().m_budget;
+}
+
+std::size_t TFCSParametrizationLazyPlaceholder::MemoryUsed()
+{
+  return TFCSLazyLoadRegistry::instance().used();
+}
+
+std::shared_ptr<TFCSParametrizationBase>
+TFCSParametrizationLazyPlaceholder::load(std::size_t& bytes) const
+{
+  if (!m_dir) {
+    FCS_MSG_ERROR("No directory to read " << GetName() << " from");
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> io_lock(
+      TFCSLazyLoadRegistry::instance().m_io_mutex);
+  TKey* key = m_dir->GetKey(GetName());
+  if (!key) {
+    FCS_MSG_ERROR("Could not find key " << GetName() << " in "
+                                        << m_dir->GetName());
+    return nullptr;
+  }
+  std::shared_ptr<TFCSParametrizationBase> param(
+      dynamic_cast<TFCSParametrizationBase*>(key->ReadObj()));
+  if (!param) {
+    FCS_MSG_ERROR("Could not read " << GetName() << " from "
+                                    << m_dir->GetName());
+    return nullptr;
+  }
+  if (m_geo)
+    param->set_geometry(m_geo);
+  if (m_level_recursive)
+    param->setLevel(level(), true);
+
+  bytes = key->GetObjlen();
+  FCS_MSG_DEBUG("Lazily loaded " << GetName() << " with " << bytes
+                                 << " bytes");
+  return param;
+}
+
+std::shared_ptr<TFCSParametrizationBase>
+TFCSParametrizationLazyPlaceholder::resolve() const
+{
+  TFCSLazyLoadRegistry& registry = TFCSLazyLoadRegistry::instance();
+  std::shared_ptr<TFCSParametrizationBase> param = std::atomic_load(&m_param);
+  if (!param) {
+    std::lock_guard<std::mutex> lock(m_load_mutex);
+    // Another thread might have loaded the object while waiting for the lock
+    param = std::atomic_load(&m_param);
+    if (!param) {
+      std::size_t bytes = 0;
+      param = load(bytes);
+      if (!param)
+        return nullptr;
+      std::atomic_store(&m_param, param);
+      m_last_used.store(registry.tick(), std::memory_order_relaxed);
+      registry.add(this, bytes);
+    }
+  }
+  m_last_used.store(registry.tick(), std::memory_order_relaxed);
+  return param;
+}
+
+void TFCSParametrizationLazyPlaceholder::evict() const
+{
+  // Delete the object only after the lock is released
+  std::shared_ptr<TFCSParametrizationBase> released;
+  std::lock_guard<std::mutex> lock(m_load_mutex);
+  released = TFCSLazyLoadRegistry::instance().remove(this);
+}
+
+void TFCSParametrizationLazyPlaceholder::ensure_match_info() const
+{
+  std::call_once(m_match_once,
+                 [this]()
+                 {
+                   if (m_has_match_info)
+                     return;
+                   std::shared_ptr<TFCSParametrizationBase> param = resolve();
+                   if (param)
+                     const_cast<TFCSParametrizationLazyPlaceholder*>(this)
+                         ->set_match_info(*param);
+                 });
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_pdgid(int id) const
+{
+  ensure_match_info();
+  return TestBit(kMatchAllPDGID)
+      || m_match_pdgid.find(id) != m_match_pdgid.end();
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_Ekin(float Ekin) const
+{
+  ensure_match_info();
+  return (Ekin >= m_match_Ekin_min) && (Ekin < m_match_Ekin_max);
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_eta(float eta) const
+{
+  ensure_match_info();
+  return (eta >= m_match_eta_min) && (eta < m_match_eta_max);
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_all_pdgid() const
+{
+  ensure_match_info();
+  return TestBit(kMatchAllPDGID);
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_all_Ekin() const
+{
+  ensure_match_info();
+  return m_match_Ekin_min == init_Ekin_min && m_match_Ekin_max == init_Ekin_max;
+}
+
+bool TFCSParametrizationLazyPlaceholder::is_match_all_eta() const
+{
+  ensure_match_info();
+  return m_match_eta_min == init_eta_min && m_match_eta_max == init_eta_max;
+}
+
+const std::set<int>& TFCSParametrizationLazyPlaceholder::pdgid() const
+{
+  ensure_match_info();
+  return m_match_pdgid;
+}
+
+double TFCSParametrizationLazyPlaceholder::Ekin_nominal() const
+{
+  ensure_match_info();
+  return m_match_Ekin_nominal;
+}
+
+double TFCSParametrizationLazyPlaceholder::Ekin_min() const
+{
+  ensure_match_info();
+  return m_match_Ekin_min;
+}
+
+double TFCSParametrizationLazyPlaceholder::Ekin_max() const
+{
+  ensure_match_info();
+  return m_match_Ekin_max;
+}
+
+double TFCSParametrizationLazyPlaceholder::eta_nominal() const
+{
+  ensure_match_info();
+  return m_match_eta_nominal;
+}
+
+double TFCSParametrizationLazyPlaceholder::eta_min() const
+{
+  ensure_match_info();
+  return m_match_eta_min;
+}
+
+double TFCSParametrizationLazyPlaceholder::eta_max() const
+{
+  ensure_match_info();
+  return m_match_eta_max;
+}
+
+void TFCSParametrizationLazyPlaceholder::set_geometry(CaloGeo* geo)
+{
+  m_geo = geo;
+  std::shared_ptr<TFCSParametrizationBase> param = std::atomic_load(&m_param);
+  if (param)
+    param->set_geometry(geo);
+}
+
+void TFCSParametrizationLazyPlaceholder::setLevel(int level, bool recursive)
+{
+  this->setLevel(level);
+  m_level_recursive = recursive;
+  if (!recursive)
+    return;
+  std::shared_ptr<TFCSParametrizationBase> param = std::atomic_load(&m_param);
+  if (param)
+    param->setLevel(level, recursive);
+}
+
+FCSReturnCode TFCSParametrizationLazyPlaceholder::simulate(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  // Keep a reference, so that an eviction by another thread does not delete
+  // the object during the simulation
+  std::shared_ptr<TFCSParametrizationBase> param = resolve();
+  if (!param) {
+    FCS_MSG_ERROR(
+        "TFCSParametrizationLazyPlaceholder::simulate(): could not read "
+        << GetName() << " from the parametrization file");
+    return FCSFatal;
+  }
+  return param->simulate(simulstate, truth, extrapol);
+}
+
+void TFCSParametrizationLazyPlaceholder::Print(Option_t* option) const
+{
+  std::shared_ptr<TFCSParametrizationBase> param = std::atomic_load(&m_param);
+  if (param) {
+    param->Print(option);
+    return;
+  }
+  TFCSParametrizationBase::Print(option);
+  TString opt(option);
+  bool shortprint = opt.Index("short") >= 0;
+  bool longprint =
+      msgLvl(FCS_MSG::DEBUG) || (msgLvl(FCS_MSG::INFO) && !shortprint);
+  TString optprint = opt;
+  optprint.ReplaceAll("short", "");
+  if (longprint)
+    FCS_MSG_INFO(optprint << "  not loaded yet, key " << GetName());
+}
+
+#pragma GCC diagnostic pop
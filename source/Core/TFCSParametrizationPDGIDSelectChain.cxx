@@ -24,16 +24,77 @@ void TFCSParametrizationPDGIDSelectChain::recalc()
   chain().shrink_to_fit();
 }
 
+std::shared_ptr<const TFCSParametrizationDispatchTable>
+TFCSParametrizationPDGIDSelectChain::dispatch_table() const
+{
+  // With RetryChainFromStart() a retry of an object in a flattened select
+  // chain would restart this chain instead of only the object
+  if (RetryChainFromStart())
+    return nullptr;
+
+  std::shared_ptr<const TFCSParametrizationDispatchTable> table =
+      std::atomic_load(&m_dispatch);
+  if (table && table->is_current())
+    return table;
+
+  std::lock_guard<std::mutex> lock(m_dispatch_mutex);
+  table = std::atomic_load(&m_dispatch);
+  if (!table || !table->is_current()) {
+    table = std::make_shared<TFCSParametrizationDispatchTable>(*this);
+    std::atomic_store(&m_dispatch, table);
+    FCS_MSG_DEBUG("Built dispatch table with "
+                  << table->n_nodes() << " nodes, "
+                  << table->n_direct_indexed() << " with direct bin index");
+  }
+  return table;
+}
+
+FCSReturnCode TFCSParametrizationPDGIDSelectChain::simulate_dispatch(
+    const TFCSParametrizationDispatchTable& table,
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  for (int node : table.nodes_for_pdgid(truth->pdgid())) {
+    const TFCSParametrizationChain* parent = nullptr;
+    TFCSParametrizationBase* param =
+        table.find(node, simulstate, truth, extrapol, parent);
+    if (!param)
+      continue;
+    FCS_MSG_DEBUG("pdgid=" << truth->pdgid()
+                           << ", dispatch to: " << param->GetName());
+    // Retries of objects in a flattened select chain are done as that chain
+    // would do them. The table only flattens chains without retry bits, so
+    // only this chain can return FCSRetry
+    const TFCSParametrizationChain* owner = parent ? parent : this;
+    FCSReturnCode status =
+        owner->simulate_and_retry(param, simulstate, truth, extrapol);
+    if (status != FCSSuccess)
+      return status;
+  }
+  return FCSSuccess;
+}
+
 FCSReturnCode TFCSParametrizationPDGIDSelectChain::simulate(
     TFCSSimulationState& simulstate,
     const TFCSTruthState* truth,
     const TFCSExtrapolationState* extrapol) const
 {
+  std::shared_ptr<const TFCSParametrizationDispatchTable> table;
+  if (UseDispatchTable())
+    table = dispatch_table();
+
   Int_t retry = 0;
   Int_t retry_warning = 1;
 
   FCSReturnCode status = FCSSuccess;
+  // Only used with RetryChainFromStart(), otherwise simulate_and_retry()
+  // handles all retries
+  TFCSSimulationState::Checkpoint_t checkpoint(
+      simulstate, RollbackOnRetry() && RetryChainFromStart());
   for (int i = 0; i <= retry; i++) {
+    if (i > 0)
+      checkpoint.rollback();
     if (i >= retry_warning)
       FCS_MSG_WARNING(
           "TFCSParametrizationPDGIDSelectChain::simulate(): Retry "
@@ -41,31 +102,43 @@ FCSReturnCode TFCSParametrizationPDGIDSelectChain::simulate(
           << i << "/" << retry);
 
     FCS_MSG_DEBUG("Running for pdgid=" << truth->pdgid());
-    for (const auto& param : chain()) {
-      FCS_MSG_DEBUG("Now testing: "
-                    << param->GetName()
-                    << ((SimulateOnlyOnePDGID() == true)
-                            ? ", abort PDGID loop afterwards"
-                            : ", continue PDGID loop afterwards"));
-      if (param->is_match_pdgid(truth->pdgid())) {
-        FCS_MSG_DEBUG("pdgid=" << truth->pdgid()
-                               << ", now run: " << param->GetName()
-                               << ((SimulateOnlyOnePDGID() == true)
-                                       ? ", abort PDGID loop afterwards"
-                                       : ", continue PDGID loop afterwards"));
-        status = simulate_and_retry(param, simulstate, truth, extrapol);
-        if (status >= FCSRetry) {
-          retry = status - FCSRetry;
-          retry_warning = retry >> 1;
-          if (retry_warning < 1)
-            retry_warning = 1;
-          break;
-        }
-        if (status == FCSFatal)
-          return FCSFatal;
+    if (table) {
+      status = simulate_dispatch(*table, simulstate, truth, extrapol);
+      if (status >= FCSRetry) {
+        retry = status - FCSRetry;
+        retry_warning = retry >> 1;
+        if (retry_warning < 1)
+          retry_warning = 1;
+      }
+      if (status == FCSFatal)
+        return FCSFatal;
+    } else {
+      for (const auto& param : chain()) {
+        FCS_MSG_DEBUG("Now testing: "
+                      << param->GetName()
+                      << ((SimulateOnlyOnePDGID() == true)
+                              ? ", abort PDGID loop afterwards"
+                              : ", continue PDGID loop afterwards"));
+        if (param->is_match_pdgid(truth->pdgid())) {
+          FCS_MSG_DEBUG("pdgid=" << truth->pdgid()
+                                 << ", now run: " << param->GetName()
+                                 << ((SimulateOnlyOnePDGID() == true)
+                                         ? ", abort PDGID loop afterwards"
+                                         : ", continue PDGID loop afterwards"));
+          status = simulate_and_retry(param, simulstate, truth, extrapol);
+          if (status >= FCSRetry) {
+            retry = status - FCSRetry;
+            retry_warning = retry >> 1;
+            if (retry_warning < 1)
+              retry_warning = 1;
+            break;
+          }
+          if (status == FCSFatal)
+            return FCSFatal;
 
-        if (SimulateOnlyOnePDGID())
-          break;
+          if (SimulateOnlyOnePDGID())
+            break;
+        }
       }
     }
 
@@ -18,3 +18,20 @@ FCSReturnCode TFCSParametrizationPlaceholder::simulate(
       "class was not replaced with the real parametrization");
   return FCSFatal;
 }
+
+void TFCSParametrizationPlaceholder::set_match_info(
+    const TFCSParametrizationBase& ref)
+{
+  m_has_match_info = true;
+  if (ref.is_match_all_pdgid())
+    set_match_all_pdgid();
+  else
+    reset_match_all_pdgid();
+  m_match_pdgid = ref.pdgid();
+  m_match_Ekin_nominal = ref.Ekin_nominal();
+  m_match_Ekin_min = ref.Ekin_min();
+  m_match_Ekin_max = ref.Ekin_max();
+  m_match_eta_nominal = ref.eta_nominal();
+  m_match_eta_min = ref.eta_min();
+  m_match_eta_max = ref.eta_max();
+}
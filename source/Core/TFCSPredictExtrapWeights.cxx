@@ -7,6 +7,8 @@
 
 #include <CLHEP/Random/RanluxEngine.h>
 
+#include "FastCaloSim/Core/TFCSConfigCache.h"
+#include "FastCaloSim/Core/TFCSDenseNetwork.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "FastCaloSim/Core/TFCSTruthState.h"
@@ -15,7 +17,6 @@
 #include "TClass.h"
 // LWTNN
 #include "lwtnn/LightweightNeuralNetwork.hh"
-#include "lwtnn/parse_json.hh"
 
 // XML reader
 #include <libxml/parser.h>
@@ -60,6 +61,9 @@ TFCSPredictExtrapWeights::~TFCSPredictExtrapWeights()
   if (m_nn != nullptr) {
     delete m_nn;
   }
+  if (m_dense != nullptr) {
+    delete m_dense;
+  }
 }
 
 bool TFCSPredictExtrapWeights::operator==(
@@ -191,16 +195,34 @@ FCSReturnCode TFCSPredictExtrapWeights::simulate(
   std::map<std::string, double> inputVariables =
       prepareInputs(simulstate, truth->E() * 0.001);
 
-  // Get predicted extrapolation weights
-  auto outputs = m_nn->compute(inputVariables);
+  // Get predicted extrapolation weights, in the order of m_relevantLayers,
+  // which is the order of the network outputs
+  thread_local std::vector<float> values;
+  thread_local VNetworkBase::TensorOutputs weights;
+  if (m_dense && m_dense->fillInput(0, inputVariables, values)) {
+    m_dense->compute({values}, weights);
+    if (TFCSDenseNetwork::validationTolerance() > 0) {
+      VNetworkBase::NetworkOutputs outputs;
+      const std::vector<std::string>& labels = m_dense->outputLabels(0);
+      for (std::size_t i = 0; i < labels.size(); ++i)
+        outputs[labels[i]] = weights[0][i];
+      TFCSDenseNetwork::validate("TFCSPredictExtrapWeights::simulate",
+                                 outputs,
+                                 m_nn->compute(inputVariables));
+    }
+  } else {
+    auto outputs = m_nn->compute(inputVariables);
+    weights.assign(1, {});
+    for (int layer : *m_relevantLayers)
+      weights[0].push_back(outputs["extrapWeight_" + std::to_string(layer)]);
+  }
   for (int ilayer = 0; ilayer < m_geo->n_layers(); ++ilayer) {
-    if (std::find(m_relevantLayers->cbegin(), m_relevantLayers->cend(), ilayer)
-        != m_relevantLayers->cend())
-    {
+    auto itr = std::find(
+        m_relevantLayers->cbegin(), m_relevantLayers->cend(), ilayer);
+    if (itr != m_relevantLayers->cend()) {
+      float weight = weights[0][std::distance(m_relevantLayers->cbegin(), itr)];
       FCS_MSG_DEBUG("TFCSPredictExtrapWeights::simulate: layer: "
-                    << ilayer << " weight: "
-                    << outputs["extrapWeight_" + std::to_string(ilayer)]);
-      float weight = outputs["extrapWeight_" + std::to_string(ilayer)];
+                    << ilayer << " weight: " << weight);
       // Protections
       if (weight < 0) {
         weight = 0;
@@ -315,9 +337,15 @@ bool TFCSPredictExtrapWeights::initializeNetwork(
     std::stringstream sin;
     sin << input.rdbuf();
     input.close();
-    auto config = lwt::parse_json(sin);
+    auto config = TFCSConfigCache::networkConfig(sin.str());
     m_nn = new lwt::LightweightNeuralNetwork(
         config.inputs, config.layers, config.outputs);
+    if (m_dense != nullptr) {
+      delete m_dense;
+    }
+    m_dense = TFCSDenseNetwork::enabled()
+        ? TFCSDenseNetwork::compile(config).release()
+        : nullptr;
     if (m_nn == nullptr) {
       FCS_MSG_ERROR("Could not create LightWeightNeuralNetwork from "
                     << inputFileName);
@@ -349,12 +377,16 @@ void TFCSPredictExtrapWeights::Streamer(TBuffer& R__b)
       delete m_nn;
       m_nn = nullptr;
     }
+    if (m_dense != nullptr) {
+      delete m_dense;
+      m_dense = nullptr;
+    }
     if (m_input && !m_input->empty()) {
-      std::stringstream sin;
-      sin.str(*m_input);
-      auto config = lwt::parse_json(sin);
+      auto config = TFCSConfigCache::networkConfig(*m_input);
       m_nn = new lwt::LightweightNeuralNetwork(
           config.inputs, config.layers, config.outputs);
+      if (TFCSDenseNetwork::enabled())
+        m_dense = TFCSDenseNetwork::compile(config).release();
     }
 #ifndef __FastCaloSimStandAlone__
     // When running inside Athena, delete input/config/normInputs to free the
@@ -0,0 +1,323 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "FastCaloSim/Core/TFCSShowerLibrary.h"
+
+#include "CLHEP/Random/RandFlat.h"
+#include "FastCaloSim/Core/TFCSExtrapolationState.h"
+#include "FastCaloSim/Core/TFCSSimulationState.h"
+#include "FastCaloSim/Core/TFCSTruthState.h"
+#include "FastCaloSim/Geometry/CaloGeo.h"
+#include "TVector2.h"
+
+namespace
+{
+// Bin of a value in bins with the given edges, values outside of the edges
+// use the first or last bin
+unsigned int edge_bin(const std::vector<float>& edges, float value)
+{
+  auto it = std::upper_bound(edges.begin(), edges.end(), value);
+  const long int bin = std::distance(edges.begin(), it) - 1;
+  return std::min<long int>(std::max<long int>(bin, 0), edges.size() - 2);
+}
+}  // namespace
+
+//=============================================
+//======= TFCSShowerLibrary =========
+//=============================================
+
+TFCSShowerLibrary::TFCSShowerLibrary(const char* name,
+                                     const char* title,
+                                     CaloGeo* geo)
+    : TFCSParametrization(name, title)
+    , m_geo(geo)
+{
+}
+
+void TFCSShowerLibrary::set_binning(const std::vector<int>& pdgids,
+                                    const std::vector<float>& Ekin_edges,
+                                    const std::vector<float>& abs_eta_edges,
+                                    unsigned int n_phi_bins)
+{
+  m_pdgids.clear();
+  m_Ekin_edges.clear();
+  m_abs_eta_edges.clear();
+  m_n_phi_bins = 1;
+  m_bin_showers.clear();
+  m_shower_begin.clear();
+  m_cell_layer.clear();
+  m_cell_deta.clear();
+  m_cell_dphi.clear();
+  m_cell_E.clear();
+  if (pdgids.empty() || Ekin_edges.size() < 2 || abs_eta_edges.size() < 2
+      || n_phi_bins == 0)
+  {
+    FCS_MSG_ERROR("Need at least one pdgid, energy, eta and phi bin");
+    return;
+  }
+
+  m_pdgids = pdgids;
+  m_Ekin_edges = Ekin_edges;
+  m_abs_eta_edges = abs_eta_edges;
+  m_n_phi_bins = n_phi_bins;
+  m_bin_showers.resize(pdgids.size() * (Ekin_edges.size() - 1)
+                       * (abs_eta_edges.size() - 1) * n_phi_bins);
+  set_pdgid(std::set<int>(pdgids.begin(), pdgids.end()));
+}
+
+bool TFCSShowerLibrary::add_shower(int pdgid,
+                                   unsigned int Ekin_bin,
+                                   unsigned int eta_bin,
+                                   unsigned int phi_bin,
+                                   const std::vector<ShowerCell_t>& cells)
+{
+  const int bin = bin_index(pdgid, Ekin_bin, eta_bin, phi_bin);
+  if (bin < 0) {
+    FCS_MSG_ERROR("No bin for pdgid=" << pdgid << " Ekin_bin=" << Ekin_bin
+                                      << " eta_bin=" << eta_bin
+                                      << " phi_bin=" << phi_bin);
+    return false;
+  }
+  for (const ShowerCell_t& cell : cells) {
+    const bool layer_ok = cell.layer >= 0
+        && cell.layer <= std::numeric_limits<unsigned char>::max()
+        && (!m_geo
+            || static_cast<unsigned int>(cell.layer) < m_geo->n_layers());
+    const auto offset_ok = [](int offset)
+    {
+      return offset >= std::numeric_limits<short>::min()
+          && offset <= std::numeric_limits<short>::max();
+    };
+    if (!layer_ok || !offset_ok(cell.deta) || !offset_ok(cell.dphi)) {
+      FCS_MSG_ERROR("Cell out of range: layer=" << cell.layer << " deta="
+                                                << cell.deta
+                                                << " dphi=" << cell.dphi);
+      return false;
+    }
+  }
+
+  if (m_shower_begin.empty())
+    m_shower_begin.push_back(0);
+  m_bin_showers[bin].push_back(m_shower_begin.size() - 1);
+
+  // Cells ordered by layer, so that the impact cell of a layer is looked up
+  // only once
+  std::vector<ShowerCell_t> sorted(cells);
+  std::stable_sort(sorted.begin(),
+                   sorted.end(),
+                   [](const ShowerCell_t& a, const ShowerCell_t& b)
+                   { return a.layer < b.layer; });
+  for (const ShowerCell_t& cell : sorted) {
+    m_cell_layer.push_back(cell.layer);
+    m_cell_deta.push_back(cell.deta);
+    m_cell_dphi.push_back(cell.dphi);
+    m_cell_E.push_back(cell.E);
+  }
+  m_shower_begin.push_back(m_cell_E.size());
+  return true;
+}
+
+std::size_t TFCSShowerLibrary::n_showers(int pdgid,
+                                         unsigned int Ekin_bin,
+                                         unsigned int eta_bin,
+                                         unsigned int phi_bin) const
+{
+  const int bin = bin_index(pdgid, Ekin_bin, eta_bin, phi_bin);
+  return bin < 0 ? 0 : m_bin_showers[bin].size();
+}
+
+int TFCSShowerLibrary::get_bin(int pdgid,
+                               float Ekin,
+                               float abs_eta,
+                               float phi_in_cell) const
+{
+  if (m_bin_showers.empty())
+    return -1;
+  const int phi_bin = std::min<int>(
+      std::max<int>(std::floor(phi_in_cell * m_n_phi_bins), 0),
+      m_n_phi_bins - 1);
+  return bin_index(pdgid,
+                   edge_bin(m_Ekin_edges, Ekin),
+                   edge_bin(m_abs_eta_edges, abs_eta),
+                   phi_bin);
+}
+
+int TFCSShowerLibrary::bin_index(int pdgid,
+                                 unsigned int Ekin_bin,
+                                 unsigned int eta_bin,
+                                 unsigned int phi_bin) const
+{
+  auto it = std::find(m_pdgids.begin(), m_pdgids.end(), pdgid);
+  if (it == m_pdgids.end() || Ekin_bin + 1 >= m_Ekin_edges.size()
+      || eta_bin + 1 >= m_abs_eta_edges.size() || phi_bin >= m_n_phi_bins)
+  {
+    return -1;
+  }
+  const std::size_t pdgid_index = std::distance(m_pdgids.begin(), it);
+  return ((pdgid_index * (m_Ekin_edges.size() - 1) + Ekin_bin)
+              * (m_abs_eta_edges.size() - 1)
+          + eta_bin)
+      * m_n_phi_bins
+      + phi_bin;
+}
+
+FCSReturnCode TFCSShowerLibrary::simulate(
+    TFCSSimulationState& simulstate,
+    const TFCSTruthState* truth,
+    const TFCSExtrapolationState* extrapol) const
+{
+  if (!simulstate.randomEngine()) {
+    return FCSFatal;
+  }
+
+  // Phi position of the particle within its impact cell in the reference
+  // layer, from 0 to 1. The middle of the cell if the particle was not
+  // extrapolated to that layer
+  double phi_in_cell = 0.5;
+  if (extrapol->is_valid(m_reference_layer, Cell::SubPos::MID)) {
+    const Position ref_pos {
+        0,
+        0,
+        0,
+        extrapol->eta(m_reference_layer, Cell::SubPos::MID),
+        extrapol->phi(m_reference_layer, Cell::SubPos::MID),
+        0};
+    const Cell& ref_cell = m_geo->get_cell(m_reference_layer, ref_pos);
+    if (ref_cell.dphi() > 0)
+      phi_in_cell =
+          TVector2::Phi_mpi_pi(ref_pos.phi() - ref_cell.phi()) / ref_cell.dphi()
+          + 0.5;
+  }
+
+  const double eta = extrapol->IDCaloBoundary_eta();
+  const int bin =
+      get_bin(truth->pdgid(), truth->Ekin(), std::abs(eta), phi_in_cell);
+  if (bin < 0 || m_bin_showers[bin].empty()) {
+    FCS_MSG_ERROR("No shower for pdgid=" << truth->pdgid()
+                                         << " Ekin=" << truth->Ekin()
+                                         << " eta=" << eta);
+    return FCSFatal;
+  }
+  const std::vector<unsigned int>& showers = m_bin_showers[bin];
+  const unsigned int shower = showers[CLHEP::RandFlat::shootInt(
+      simulstate.randomEngine(), showers.size())];
+  FCS_MSG_DEBUG("Using shower " << shower << " of bin " << bin << " with "
+                                << showers.size() << " showers");
+
+  const double E = simulstate.E();
+  simulstate.set_E(0);
+  for (unsigned int s = 0; s < m_geo->n_layers(); ++s) {
+    simulstate.set_E(s, 0.0);
+    simulstate.set_Efrac(s, 0.0);
+  }
+
+  // Showers are simulated for positive eta
+  const int eta_sign = eta < 0 ? -1 : 1;
+  int layer = -1;
+  const Cell* impact = nullptr;
+  for (unsigned int i = m_shower_begin[shower]; i < m_shower_begin[shower + 1];
+       ++i)
+  {
+    if (m_cell_layer[i] != layer) {
+      layer = m_cell_layer[i];
+      impact = nullptr;
+      // Layers the particle was not extrapolated to get no energy
+      if (static_cast<unsigned int>(layer) < m_geo->n_layers()
+          && extrapol->is_valid(layer, Cell::SubPos::MID))
+      {
+        const Position pos {0,
+                            0,
+                            0,
+                            extrapol->eta(layer, Cell::SubPos::MID),
+                            extrapol->phi(layer, Cell::SubPos::MID),
+                            0};
+        impact = &m_geo->get_cell(layer, pos);
+      } else {
+        FCS_MSG_DEBUG("Skipping layer " << layer
+                                        << " without extrapolation");
+      }
+    }
+    if (!impact)
+      continue;
+
+    const Cell* cell = impact;
+    if (m_cell_deta[i] != 0 || m_cell_dphi[i] != 0) {
+      const Position pos {
+          0,
+          0,
+          0,
+          impact->eta() + eta_sign * m_cell_deta[i] * impact->deta(),
+          TVector2::Phi_mpi_pi(impact->phi() + m_cell_dphi[i] * impact->dphi()),
+          0};
+      cell = &m_geo->get_cell(layer, pos);
+    }
+
+    const double E_cell = E * m_cell_E[i];
+    simulstate.deposit(cell->id(), E_cell);
+    simulstate.add_E(layer, E_cell);
+  }
+
+  if (simulstate.E() > std::numeric_limits<double>::epsilon()) {
+    for (unsigned int s = 0; s < m_geo->n_layers(); ++s)
+      simulstate.set_Efrac(s, simulstate.E(s) / simulstate.E());
+  }
+  return FCSSuccess;
+}
+
+bool TFCSShowerLibrary::operator==(const TFCSParametrizationBase& ref) const
+{
+  if (TFCSParametrizationBase::compare(ref))
+    return true;
+  if (!TFCSParametrization::compare(ref))
+    return false;
+
+  const TFCSShowerLibrary& ref_typed =
+      static_cast<const TFCSShowerLibrary&>(ref);
+  if (m_reference_layer != ref_typed.m_reference_layer
+      || m_pdgids != ref_typed.m_pdgids
+      || m_Ekin_edges != ref_typed.m_Ekin_edges
+      || m_abs_eta_edges != ref_typed.m_abs_eta_edges
+      || m_n_phi_bins != ref_typed.m_n_phi_bins)
+  {
+    FCS_MSG_DEBUG("operator==(): different binning");
+    return false;
+  }
+  if (m_bin_showers != ref_typed.m_bin_showers
+      || m_shower_begin != ref_typed.m_shower_begin
+      || m_cell_layer != ref_typed.m_cell_layer
+      || m_cell_deta != ref_typed.m_cell_deta
+      || m_cell_dphi != ref_typed.m_cell_dphi
+      || m_cell_E != ref_typed.m_cell_E)
+  {
+    FCS_MSG_DEBUG("operator==(): different showers");
+    return false;
+  }
+
+  return true;
+}
+
+void TFCSShowerLibrary::Print(Option_t* option) const
+{
+  TString opt(option);
+  bool shortprint = opt.Index("short") >= 0;
+  bool longprint =
+      msgLvl(FCS_MSG::DEBUG) || (msgLvl(FCS_MSG::INFO) && !shortprint);
+  TString optprint = opt;
+  optprint.ReplaceAll("short", "");
+  TFCSParametrization::Print(option);
+
+  if (longprint && m_bin_showers.empty()) {
+    FCS_MSG_INFO(optprint << "  no bins, geo=" << m_geo);
+  } else if (longprint) {
+    FCS_MSG_INFO(optprint << "  " << n_showers() << " showers in "
+                          << m_bin_showers.size() << " bins: "
+                          << m_pdgids.size() << " pdgids x "
+                          << m_Ekin_edges.size() - 1 << " Ekin x "
+                          << m_abs_eta_edges.size() - 1 << " |eta| x "
+                          << m_n_phi_bins << " phi, reference layer "
+                          << m_reference_layer << ", geo=" << m_geo);
+  }
+}
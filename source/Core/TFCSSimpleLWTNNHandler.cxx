@@ -8,7 +8,13 @@
 
 // LWTNN
 #include "lwtnn/LightweightNeuralNetwork.hh"
-#include "lwtnn/parse_json.hh"
+#include "lwtnn/Stack.hh"
+
+// Parsed configurations are cached on disk
+#include "FastCaloSim/Core/TFCSConfigCache.h"
+
+// For throwing exceptions
+#include <stdexcept>
 
 TFCSSimpleLWTNNHandler::TFCSSimpleLWTNNHandler(const std::string& inputFile)
     : VNetworkLWTNN(inputFile)
@@ -25,21 +31,41 @@ TFCSSimpleLWTNNHandler::TFCSSimpleLWTNNHandler(
   // Cannot take copy of lwt::LightweightNeuralNetwork
   // (copy constructor disabled)
   FCS_MSG_DEBUG("Making new m_lwtnn_neural for copy of network.");
-  std::stringstream json_stream(m_json);
-  const lwt::JSONConfig config = lwt::parse_json(json_stream);
+  const lwt::JSONConfig config = TFCSConfigCache::networkConfig(m_json);
+  buildNet(config);
+  m_outputLayers = copy_from.m_outputLayers;
+};
+
+void TFCSSimpleLWTNNHandler::buildNet(const lwt::JSONConfig& config)
+{
+  m_dense = TFCSDenseNetwork::enabled() ? TFCSDenseNetwork::compile(config)
+                                        : nullptr;
+  m_lwtnn_neural.reset();
+  m_lwtnn_stack.reset();
+  m_inputOffsets.clear();
+  m_inputScales.clear();
+  // The lwtnn objects hold two more copies of the weights, with the
+  // precompiled network they are only needed for the validation
+  if (m_dense && TFCSDenseNetwork::validationTolerance() <= 0)
+    return;
   m_lwtnn_neural = std::make_unique<lwt::LightweightNeuralNetwork>(
       config.inputs, config.layers, config.outputs);
-  m_outputLayers = copy_from.m_outputLayers;
+  // The same preprocessing as in lwt::InputPreprocessor,
+  // but applied by position rather than by name
+  m_lwtnn_stack =
+      std::make_unique<lwt::Stack>(config.inputs.size(), config.layers);
+  for (const lwt::Input& input : config.inputs) {
+    m_inputOffsets.push_back(input.offset);
+    m_inputScales.push_back(input.scale);
+  };
 };
 
 void TFCSSimpleLWTNNHandler::setupNet()
 {
   // build the graph
   FCS_MSG_DEBUG("Reading the m_json string stream into a neural network");
-  std::stringstream json_stream(m_json);
-  const lwt::JSONConfig config = lwt::parse_json(json_stream);
-  m_lwtnn_neural = std::make_unique<lwt::LightweightNeuralNetwork>(
-      config.inputs, config.layers, config.outputs);
+  const lwt::JSONConfig config = TFCSConfigCache::networkConfig(m_json);
+  buildNet(config);
   // Get the output layers
   FCS_MSG_DEBUG("Getting output layers for neural network");
   for (std::string name : config.outputs) {
@@ -60,9 +86,39 @@ std::vector<std::string> TFCSSimpleLWTNNHandler::getOutputLayers() const
 // regular format. For LWTNN, that's easy.
 TFCSSimpleLWTNNHandler::NetworkOutputs TFCSSimpleLWTNNHandler::compute(
     TFCSSimpleLWTNNHandler::NetworkInputs const& inputs) const
+{
+  thread_local std::vector<float> values;
+  // Inputs that don't match exactly are left to lwtnn, which also
+  // reports the problems
+  if (!m_dense || inputs.size() != 1
+      || !m_dense->fillInput(0, inputs.begin()->second, values))
+    return computeLWTNN(inputs);
+
+  FCS_MSG_DEBUG("Running computation on precompiled neural network");
+  thread_local TensorOutputs results;
+  m_dense->compute({values}, results);
+  NetworkOutputs outputs;
+  const std::vector<std::string>& labels = m_dense->outputLabels(0);
+  for (size_t i = 0; i < labels.size(); i++)
+    outputs[labels[i]] = results[0][i];
+  removePrefixes(outputs);
+  if (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_neural)
+    TFCSDenseNetwork::validate(
+        "TFCSSimpleLWTNNHandler::compute", outputs, computeLWTNN(inputs));
+  FCS_MSG_DEBUG(VNetworkBase::representNetworkOutputs(outputs, 20));
+  return outputs;
+};
+
+TFCSSimpleLWTNNHandler::NetworkOutputs TFCSSimpleLWTNNHandler::computeLWTNN(
+    TFCSSimpleLWTNNHandler::NetworkInputs const& inputs) const
 {
   FCS_MSG_DEBUG("Running computation on LWTNN neural network");
   FCS_MSG_DEBUG(VNetworkBase::representNetworkInputs(inputs, 20));
+  if (!m_lwtnn_neural) {
+    FCS_MSG_ERROR("Inputs do not match the input node of the "
+                  "precompiled network, and lwtnn was not set up");
+    throw std::runtime_error("Wrong inputs in compute.");
+  };
   // Flatten the map depth
   if (inputs.size() != 1) {
     FCS_MSG_ERROR("The inputs have multiple elements."
@@ -80,6 +136,67 @@ TFCSSimpleLWTNNHandler::NetworkOutputs TFCSSimpleLWTNNHandler::compute(
   return outputs;
 };
 
+void TFCSSimpleLWTNNHandler::computeTensors(
+    TFCSSimpleLWTNNHandler::TensorInputs const& inputs,
+    TFCSSimpleLWTNNHandler::TensorOutputs& outputs) const
+{
+  if (!m_dense) {
+    computeTensorsLWTNN(inputs, outputs);
+    return;
+  };
+  m_dense->compute(inputs, outputs);
+  if (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_neural) {
+    TensorOutputs reference;
+    computeTensorsLWTNN(inputs, reference);
+    TFCSDenseNetwork::validate(
+        "TFCSSimpleLWTNNHandler::computeTensors", outputs, reference);
+  };
+};
+
+void TFCSSimpleLWTNNHandler::computeTensorsBatch(
+    TFCSSimpleLWTNNHandler::TensorInputs const& inputs,
+    std::size_t n_batch,
+    TFCSSimpleLWTNNHandler::TensorOutputs& outputs) const
+{
+  // With the validation, computeTensors compares entry by entry
+  if (!m_dense || n_batch == 0
+      || (TFCSDenseNetwork::validationTolerance() > 0 && m_lwtnn_neural))
+  {
+    VNetworkBase::computeTensorsBatch(inputs, n_batch, outputs);
+    return;
+  };
+  m_dense->computeBatch(inputs, n_batch, outputs);
+};
+
+void TFCSSimpleLWTNNHandler::computeTensorsLWTNN(
+    TFCSSimpleLWTNNHandler::TensorInputs const& inputs,
+    TFCSSimpleLWTNNHandler::TensorOutputs& outputs) const
+{
+  if (inputs.size() != 1 || inputs[0].size != m_inputOffsets.size()) {
+    FCS_MSG_ERROR("An LWTNN neural network needs one input node with "
+                  << m_inputOffsets.size() << " values.");
+    throw std::runtime_error("Wrong inputs in computeTensors.");
+  };
+  const TensorView& node = inputs[0];
+  Eigen::VectorXd values(node.size);
+  for (size_t i = 0; i < node.size; i++) {
+    values(i) = (node[i] + m_inputOffsets[i]) * m_inputScales[i];
+  };
+  const Eigen::VectorXd result = m_lwtnn_stack->compute(values);
+  outputs.resize(1);
+  outputs[0].assign(result.data(), result.data() + result.size());
+};
+
+std::vector<std::string> TFCSSimpleLWTNNHandler::getInputNodes() const
+{
+  return {"node_0"};
+};
+
+std::vector<std::string> TFCSSimpleLWTNNHandler::getOutputNodes() const
+{
+  return {"node_0"};
+};
+
 // Giving this it's own streamer to call setupNet
 void TFCSSimpleLWTNNHandler::Streamer(TBuffer& buf)
 {
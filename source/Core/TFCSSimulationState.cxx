@@ -28,13 +28,190 @@ void TFCSSimulationState::clear()
   m_Etot = 0;
   m_E.clear();
   m_Efrac.clear();
+  m_journal.clear();
+  m_checkpoints.clear();
+  m_journal_cells.clear();
 }
 
 void TFCSSimulationState::deposit(const unsigned long long cell_id, float E)
 {
+  if (has_checkpoint())
+    journal(kJournalCell, cell_id);
   m_cells[cell_id] += E;
 }
 
+void TFCSSimulationState::journal(JournalKind_t kind, unsigned long long key)
+{
+  JournalEntry_t entry;
+  entry.kind = kind;
+  entry.existed = true;
+  entry.key = key;
+  entry.value.d = 0;
+  entry.prev = kNoEntry;
+  switch (kind) {
+    case kJournalEbin:
+      entry.value.i = m_Ebin;
+      break;
+    case kJournalEtot:
+      entry.value.d = m_Etot;
+      break;
+    case kJournalE: {
+      auto it = m_E.find(key);
+      entry.existed = it != m_E.end();
+      if (entry.existed)
+        entry.value.d = it->second;
+      break;
+    }
+    case kJournalEfrac: {
+      auto it = m_Efrac.find(key);
+      entry.existed = it != m_Efrac.end();
+      if (entry.existed)
+        entry.value.d = it->second;
+      break;
+    }
+    case kJournalCell: {
+      auto last = m_journal_cells.find(key);
+      if (last != m_journal_cells.end()) {
+        // The value at the innermost checkpoint is already recorded
+        if (last->second >= m_checkpoints.back())
+          return;
+        entry.prev = last->second;
+        last->second = m_journal.size();
+      } else
+        m_journal_cells.emplace(key, m_journal.size());
+      auto it = m_cells.find(key);
+      entry.existed = it != m_cells.end();
+      if (entry.existed)
+        entry.value.f = it->second;
+      break;
+    }
+    case kJournalAuxInfo: {
+      auto it = m_AuxInfo.find(key);
+      entry.existed = it != m_AuxInfo.end();
+      if (entry.existed)
+        entry.value = it->second;
+      break;
+    }
+  }
+  m_journal.push_back(entry);
+}
+
+std::size_t TFCSSimulationState::checkpoint()
+{
+  m_checkpoints.push_back(m_journal.size());
+  return m_checkpoints.size() - 1;
+}
+
+void TFCSSimulationState::rollback(std::size_t cp)
+{
+  if (cp >= m_checkpoints.size()) {
+    FCS_MSG_ERROR("rollback(): checkpoint " << cp << " is not active");
+    return;
+  }
+  rewind(m_checkpoints[cp]);
+  m_checkpoints.resize(cp + 1);
+}
+
+void TFCSSimulationState::rewind(std::size_t position)
+{
+  while (m_journal.size() > position) {
+    const JournalEntry_t& entry = m_journal.back();
+    switch (entry.kind) {
+      case kJournalEbin:
+        m_Ebin = entry.value.i;
+        break;
+      case kJournalEtot:
+        m_Etot = entry.value.d;
+        break;
+      case kJournalE:
+        if (entry.existed)
+          m_E[entry.key] = entry.value.d;
+        else
+          m_E.erase(entry.key);
+        break;
+      case kJournalEfrac:
+        if (entry.existed)
+          m_Efrac[entry.key] = entry.value.d;
+        else
+          m_Efrac.erase(entry.key);
+        break;
+      case kJournalCell:
+        if (entry.existed)
+          m_cells[entry.key] = entry.value.f;
+        else
+          m_cells.erase(entry.key);
+        if (entry.prev == kNoEntry)
+          m_journal_cells.erase(entry.key);
+        else
+          m_journal_cells[entry.key] = entry.prev;
+        break;
+      case kJournalAuxInfo:
+        if (entry.existed)
+          m_AuxInfo[entry.key] = entry.value;
+        else
+          m_AuxInfo.erase(entry.key);
+        break;
+    }
+    m_journal.pop_back();
+  }
+  while (!m_checkpoints.empty() && m_checkpoints.back() > position)
+    m_checkpoints.pop_back();
+}
+
+void TFCSSimulationState::commit(std::size_t cp)
+{
+  if (cp >= m_checkpoints.size())
+    return;
+  const std::size_t position = m_checkpoints[cp];
+  m_checkpoints.resize(cp);
+  // Without any checkpoint the journal is not needed any more. The memory is
+  // kept for the next checkpoint
+  if (m_checkpoints.empty()) {
+    m_journal.clear();
+    m_journal_cells.clear();
+    return;
+  }
+  merge(position);
+}
+
+void TFCSSimulationState::merge(std::size_t position)
+{
+  const std::size_t outer = m_checkpoints.back();
+  const std::size_t size = m_journal.size();
+  // An entry is dropped if the same cell was recorded before since the outer
+  // checkpoint. The target is the first entry of the cell since then, found
+  // before any entry is moved
+  m_merge_target.assign(size - position, kNoEntry);
+  for (std::size_t i = position; i < size; ++i) {
+    const JournalEntry_t& entry = m_journal[i];
+    if (entry.kind != kJournalCell || entry.prev == kNoEntry
+        || entry.prev < outer)
+      continue;
+    std::size_t first = entry.prev;
+    while (m_journal[first].prev != kNoEntry && m_journal[first].prev >= outer)
+      first = m_journal[first].prev;
+    m_merge_target[i - position] = first;
+  }
+
+  std::size_t out = position;
+  for (std::size_t i = position; i < size; ++i) {
+    const JournalEntry_t& entry = m_journal[i];
+    const std::size_t target = m_merge_target[i - position];
+    if (target != kNoEntry) {
+      // Entries kept in the merged range set their new index themselves
+      if (target < position)
+        m_journal_cells[entry.key] = target;
+      continue;
+    }
+    if (entry.kind == kJournalCell)
+      m_journal_cells[entry.key] = out;
+    if (out != i)
+      m_journal[out] = entry;
+    ++out;
+  }
+  m_journal.resize(out);
+}
+
 void TFCSSimulationState::Print(Option_t*) const
 {
   FCS_MSG_INFO("Ebin=" << m_Ebin << " E=" << E()
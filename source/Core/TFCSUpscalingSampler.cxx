@@ -0,0 +1,181 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "FastCaloSim/Core/TFCSUpscalingSampler.h"
+
+#include "CLHEP/Random/RandFlat.h"
+#include "TError.h"
+
+//=============================================
+//======= TFCSUpscalingSampler =========
+//=============================================
+
+TFCSUpscalingSampler::TFCSUpscalingSampler(const distribution_t& distribution,
+                                           const std::vector<float>& energies)
+    : m_energies(energies)
+    , m_begin(energies.size())
+{
+  if (distribution.size() != energies.size()) {
+    ::Warning("TFCSUpscalingSampler",
+              "Got distributions for %zu energies, but %zu energies",
+              distribution.size(),
+              energies.size());
+  }
+
+  for (std::size_t e = 0; e < energies.size(); ++e) {
+    std::vector<std::uint64_t>& begin = m_begin[e];
+    begin.push_back(m_probabilities.size());
+    if (e >= distribution.size())
+      continue;
+    for (std::size_t layer = 0; layer < distribution[e].size(); ++layer) {
+      const std::vector<std::vector<float>>& bins = distribution[e][layer];
+      const bool complete = std::all_of(bins.begin(),
+                                        bins.end(),
+                                        [](const std::vector<float>& bin)
+                                        { return bin.size() >= 3; });
+      if (complete) {
+        for (const std::vector<float>& bin : bins)
+          m_probabilities.insert(
+              m_probabilities.end(), bin.begin(), bin.begin() + 3);
+      } else {
+        ::Warning("TFCSUpscalingSampler",
+                  "Layer %zu at %g has bins with less than three "
+                  "probabilities, it is not upscaled",
+                  layer,
+                  energies[e]);
+      }
+      begin.push_back(m_probabilities.size());
+    }
+  }
+}
+
+TFCSUpscalingSampler::Weights_t TFCSUpscalingSampler::weights(
+    float e_init) const
+{
+  Weights_t weights;
+  if (m_energies.empty())
+    return weights;
+  weights.high = 0;
+  weights.f_high = 1;
+  if (m_energies.size() == 1)
+    return weights;
+
+  // The first energy point above e_init, or the last one
+  auto it = std::upper_bound(m_energies.begin(), m_energies.end(), e_init);
+  const int e_index = it != m_energies.end()
+      ? std::distance(m_energies.begin(), it)
+      : m_energies.size() - 1;
+  weights.high = e_index;
+  const float e_high = m_energies[e_index];
+  if (e_high < e_init || e_index == 0)
+    return weights;
+
+  // Interpolate in log(E) between the two neighbouring energy points
+  const float e_low = m_energies[e_index - 1];
+  weights.low = e_index - 1;
+  weights.f_low = std::log(e_high / e_init) / (std::log(e_high / e_low));
+  weights.f_high = 1 - weights.f_low;
+  return weights;
+}
+
+TFCSUpscalingSampler::Voxel_t TFCSUpscalingSampler::voxel(
+    const Weights_t& weights,
+    long unsigned int layer_index,
+    long unsigned int bin_index) const
+{
+  // Uniform in the voxel if there is no distribution
+  float p[3] = {0.25f, 0.5f, 0.75f};
+  if (weights.low < 0) {
+    const float* p_high = probabilities(weights.high, layer_index, bin_index);
+    if (p_high)
+      std::copy(p_high, p_high + 3, p);
+  } else {
+    const float* p_low = probabilities(weights.low, layer_index, bin_index);
+    const float* p_high = probabilities(weights.high, layer_index, bin_index);
+    if (p_low && p_high) {
+      for (unsigned int i = 0; i < 3; ++i)
+        p[i] = weights.f_low * p_low[i] + weights.f_high * p_high[i];
+    }
+  }
+
+  Voxel_t voxel;
+  voxel.p_alpha_low = p[2] - p[1] + p[0];
+  voxel.p_r[0] = p[0] / (voxel.p_alpha_low);
+  voxel.p_r[1] = (p[1] - p[0]) / (1 - voxel.p_alpha_low);
+
+  // NOTE: this is ATLAS dependent
+  // Use linear interpolation for layer 2 (EMB2)
+  // It works better than uniform sampling for the second layer...
+  voxel.linear_r = layer_index == 2;
+  for (int half = 0; voxel.linear_r && half < 2; ++half) {
+    float p_r = voxel.p_r[half];
+    if (p_r < 0.25) {
+      p_r = 0.25;  // Values below 0.25 are not allowed for linear pdf
+    } else if (p_r > 0.75) {
+      p_r = 0.75;  // Values above 0.75 are not allowed for linear pdf
+    } else if (std::abs(p_r - 0.5) < std::numeric_limits<float>::epsilon()) {
+      continue;  // Best upscaling is uniform sampling. Nothing to do here.
+    }
+    // Inverse CDF for linear pdf
+    voxel.linear[half] = true;
+    voxel.a[half] = (1. - 4. * p_r) / (2. - 4. * p_r);
+    voxel.a2[half] = voxel.a[half] * voxel.a[half];
+    voxel.c[half] = (1. / 2.) - p_r;
+  }
+  return voxel;
+}
+
+void TFCSUpscalingSampler::sample(CLHEP::HepRandomEngine* engine,
+                                  const Voxel_t& voxel,
+                                  float& R_min,
+                                  float& R_max,
+                                  float& alpha_min,
+                                  float& alpha_max)
+{
+  float p = CLHEP::RandFlat::shoot(engine, 0, 1);
+  int half;
+  if (p < voxel.p_alpha_low) {
+    alpha_max = (alpha_min + alpha_max) / 2.;
+    half = 0;
+  } else {
+    alpha_min = (alpha_min + alpha_max) / 2.;
+    half = 1;
+  }
+
+  p = CLHEP::RandFlat::shoot(engine, 0, 1);
+  if (!voxel.linear_r) {
+    if (p > voxel.p_r[half])
+      R_min = (R_min + R_max) / 2.;
+    else
+      R_max = (R_min + R_max) / 2.;
+    return;
+  }
+  if (!voxel.linear[half])
+    return;
+
+  const double root = std::sqrt(voxel.a2[half] + p / voxel.c[half]);
+  float r = voxel.a[half] - root;
+  if (r < 0)
+    r = voxel.a[half] + root;
+  R_min = R_min + r / 2 * (R_max - R_min);
+  R_max = R_min;
+}
+
+const float* TFCSUpscalingSampler::probabilities(
+    int energy_index,
+    long unsigned int layer_index,
+    long unsigned int bin_index) const
+{
+  if (energy_index < 0 || energy_index >= (int)m_begin.size())
+    return nullptr;
+  const std::vector<std::uint64_t>& begin = m_begin[energy_index];
+  if (layer_index + 1 >= begin.size())
+    return nullptr;
+  const std::uint64_t index = begin[layer_index] + 3 * bin_index;
+  if (index + 3 > begin[layer_index + 1])
+    return nullptr;
+  return m_probabilities.data() + index;
+}
@@ -139,6 +139,36 @@ bool TFCSVoxelHistoLateralCovarianceFluctuations::initialize(
   return true;
 }
 
+void TFCSVoxelHistoLateralCovarianceFluctuations::check_transform()
+{
+  m_Ebin_valid.assign(m_transform.size(), true);
+  for (unsigned int bin = 0; bin < m_transform.size(); ++bin) {
+    for (const auto& row : m_transform[bin]) {
+      for (const TFCS1DFunction* func : row) {
+        if (func && !func->is_valid())
+          m_Ebin_valid[bin] = false;
+      }
+    }
+    if (!m_Ebin_valid[bin])
+      FCS_MSG_ERROR("A transformation of Ebin " << bin + 1
+                                                << " could not be read");
+  }
+}
+
+void TFCSVoxelHistoLateralCovarianceFluctuations::Streamer(TBuffer& R__b)
+{
+  // Stream an object of class TFCSVoxelHistoLateralCovarianceFluctuations
+
+  if (R__b.IsReading()) {
+    R__b.ReadClassBuffer(
+        TFCSVoxelHistoLateralCovarianceFluctuations::Class(), this);
+    check_transform();
+  } else {
+    R__b.WriteClassBuffer(
+        TFCSVoxelHistoLateralCovarianceFluctuations::Class(), this);
+  }
+}
+
 // Implementation of multivariate Gaussian with ROOT classes (from ROOT forum,
 // but validated)
 void TFCSVoxelHistoLateralCovarianceFluctuations::MultiGaus(
@@ -222,6 +252,13 @@ FCSReturnCode TFCSVoxelHistoLateralCovarianceFluctuations::simulate(
     return FCSFatal;
   }
 
+  if (static_cast<size_t>(Ebin) <= m_Ebin_valid.size()
+      && !m_Ebin_valid[Ebin - 1])
+  {
+    FCS_MSG_ERROR("Transformations of Ebin " << Ebin << " could not be read");
+    return FCSFatal;
+  }
+
   // TODO: the following code should be executed for all relevant calo layers,
   // possibly simulating correlated fluctuations between layers depending on the
   // PCA bin
@@ -69,6 +69,42 @@ std::string VNetworkBase::representNetworkOutputs(
   return representation;
 };
 
+void VNetworkBase::computeTensorsBatch(
+    VNetworkBase::TensorInputs const& inputs,
+    std::size_t n_batch,
+    VNetworkBase::TensorOutputs& outputs) const
+{
+  outputs.clear();
+  if (n_batch == 0)
+    return;
+  TensorInputs entry_inputs(inputs.size());
+  TensorOutputs entry_outputs;
+  for (std::size_t entry = 0; entry < n_batch; entry++) {
+    for (size_t node_n = 0; node_n < inputs.size(); node_n++) {
+      const std::size_t node_size = inputs[node_n].size / n_batch;
+      entry_inputs[node_n] =
+          TensorView(inputs[node_n].data + entry * node_size, node_size);
+    };
+    computeTensors(entry_inputs, entry_outputs);
+    outputs.resize(entry_outputs.size());
+    for (size_t node_n = 0; node_n < entry_outputs.size(); node_n++) {
+      outputs[node_n].insert(outputs[node_n].end(),
+                             entry_outputs[node_n].begin(),
+                             entry_outputs[node_n].end());
+    };
+  };
+};
+
+int VNetworkBase::inputNodeIndex(std::string const& node_name) const
+{
+  const std::vector<std::string> nodes = getInputNodes();
+  for (size_t node_n = 0; node_n < nodes.size(); node_n++) {
+    if (nodes[node_n] == node_name)
+      return node_n;
+  };
+  return -1;
+};
+
 // this is also used for the stream operator
 void VNetworkBase::print(std::ostream& strm) const
 {
@@ -43,6 +43,30 @@ auto CaloGeo::get_cell(unsigned int layer, const Position& pos) const
   return get_cell(cell_id);
 }
 
+void CaloGeo::get_cells(unsigned int layer,
+                        const std::vector<Position>& positions,
+                        std::vector<const Cell*>& cells) const
+{
+  cells.resize(positions.size());
+
+  // Alternative geometry handlers may interpret the positions differently,
+  // every position is looked up
+  if (m_alt_geo_handlers.find(layer) != m_alt_geo_handlers.end()) {
+    for (std::size_t i = 0; i < positions.size(); ++i)
+      cells[i] = &get_cell(layer, positions[i]);
+    return;
+  }
+
+  const Cell* previous = nullptr;
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    // Cells of a layer don't overlap, so the nearest cell of a position
+    // inside a cell is that cell
+    if (!previous || !previous->is_inside(positions[i]))
+      previous = &get_cell(layer, positions[i]);
+    cells[i] = previous;
+  }
+}
+
 auto CaloGeo::get_cell_id(unsigned int layer, const Position& pos) const
     -> unsigned long long
 {
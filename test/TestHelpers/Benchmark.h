@@ -0,0 +1,18 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#pragma once
+
+#include <cstdlib>
+
+namespace TestHelpers
+{
+
+/// Timing measurements in the unit tests are only done if the environment
+/// variable FCS_RUN_BENCHMARKS is set. Tests that also check results run
+/// these checks in any case, with a smaller number of iterations
+inline bool run_benchmarks()
+{
+  return std::getenv("FCS_RUN_BENCHMARKS") != nullptr;
+}
+
+}  // namespace TestHelpers
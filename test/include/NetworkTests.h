@@ -0,0 +1,296 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "FastCaloSim/Core/VNetworkBase.h"
+
+/// Network with the input nodes of TFCSMLCalorimeterSimulator. Each output
+/// voxel is energy * (1 + eta) * exp(z_shape) of its row, so the outputs
+/// follow the sampled noise. Rows whose number is in nan_rows return NaN,
+/// the rows are numbered over all evaluations in order
+class VoxelStubNetwork : public VNetworkBase
+{
+public:
+  std::set<std::size_t> nan_rows;
+  // Number of rows of every evaluation
+  mutable std::vector<std::size_t> batches;
+  mutable std::size_t n_rows = 0;
+
+  void computeTensors(TensorInputs const& inputs,
+                      TensorOutputs& outputs) const override
+  {
+    computeTensorsBatch(inputs, 1, outputs);
+  }
+
+  void computeTensorsBatch(TensorInputs const& inputs,
+                           std::size_t n_batch,
+                           TensorOutputs& outputs) const override
+  {
+    batches.push_back(n_batch);
+    const std::size_t n_voxels = inputs[2].size / n_batch;
+    outputs.resize(1);
+    outputs[0].resize(inputs[2].size);
+    for (std::size_t row = 0; row < n_batch; ++row, ++n_rows) {
+      const bool nan = nan_rows.count(n_rows) > 0;
+      for (std::size_t voxel = 0; voxel < n_voxels; ++voxel) {
+        const std::size_t i = row * n_voxels + voxel;
+        const float value =
+            inputs[1][row] * (1 + inputs[0][row]) * std::exp(inputs[2][i]);
+        outputs[0][i] = nan ? std::numeric_limits<float>::quiet_NaN() : value;
+      }
+    }
+  }
+
+  NetworkOutputs compute(NetworkInputs const& /*inputs*/) const override
+  {
+    return {};
+  }
+  std::vector<std::string> getInputNodes() const override
+  {
+    return {"inn_eta_in", "inn_einc_in", "cfm_z_shape", "inn_z_energy"};
+  }
+  std::vector<std::string> getOutputNodes() const override
+  {
+    return {"voxels"};
+  }
+  std::vector<std::string> getOutputLayers() const override { return {}; }
+  void writeNetToTTree(TTree& /*tree*/) override {}
+  void deleteAllButNet() override {}
+
+protected:
+  void setupPersistedVariables() override {}
+  void setupNet() override {}
+};
+
+/// Builds small ONNX models in memory, so that the network tests do not
+/// depend on model files
+class NetworkTests : public ::testing::Test
+{
+protected:
+  /// Serialized ONNX model of a fully connected network with ReLU
+  /// activations (none after the last layer). The first input dimension is
+  /// symbolic, so the model accepts batches. Weights are deterministic.
+  static std::vector<char> make_mlp(const std::vector<int>& widths)
+  {
+    std::string graph;
+    std::string previous = "input";
+    for (std::size_t layer = 0; layer + 1 < widths.size(); ++layer) {
+      const std::string id = std::to_string(layer);
+      const int n_in = widths[layer];
+      const int n_out = widths[layer + 1];
+      std::vector<float> weights(n_in * n_out);
+      std::vector<float> bias(n_out);
+      std::uint32_t seed = 12345 + layer;
+      for (float& w : weights)
+        w = uniform(seed) / std::sqrt(float(n_in));
+      for (float& b : bias)
+        b = 0.1f * uniform(seed);
+      append_bytes(graph, 5, tensor("W" + id, {n_in, n_out}, weights));
+      append_bytes(graph, 5, tensor("B" + id, {n_out}, bias));
+
+      const bool last = layer + 2 == widths.size();
+      const std::string matmul = "matmul" + id;
+      const std::string add = last ? "output" : "add" + id;
+      append_bytes(graph, 1, node("MatMul", {previous, "W" + id}, matmul));
+      append_bytes(graph, 1, node("Add", {matmul, "B" + id}, add));
+      previous = add;
+      if (!last) {
+        previous = "relu" + id;
+        append_bytes(graph, 1, node("Relu", {add}, previous));
+      }
+    }
+    append_bytes(graph, 2, "mlp");
+    append_bytes(graph, 11, value_info("input", widths.front()));
+    append_bytes(graph, 12, value_info("output", widths.back()));
+
+    std::string opset;
+    append_bytes(opset, 1, "");
+    append_varint(opset, 2, 13);
+
+    std::string model;
+    append_varint(model, 1, 8);
+    append_bytes(model, 2, "FastCaloSim");
+    append_bytes(model, 7, graph);
+    append_bytes(model, 8, opset);
+    return std::vector<char>(model.begin(), model.end());
+  }
+
+  /// lwtnn json of a fully connected network with the same structure and
+  /// weights as make_mlp, but sigmoid after the last layer. As a graph it
+  /// has the inputs split into "node_0" (all but the last two variables)
+  /// and "node_1", which are concatenated, like the FastCaloGAN graphs.
+  static std::string make_lwtnn_json(const std::vector<int>& widths,
+                                     bool graph)
+  {
+    std::ostringstream layers;
+    layers << "[";
+    for (std::size_t layer = 0; layer + 1 < widths.size(); ++layer) {
+      const int n_in = widths[layer];
+      const int n_out = widths[layer + 1];
+      std::vector<float> weights(n_in * n_out);
+      std::vector<float> bias(n_out);
+      std::uint32_t seed = 12345 + layer;
+      for (float& w : weights)
+        w = uniform(seed) / std::sqrt(float(n_in));
+      for (float& b : bias)
+        b = 0.1f * uniform(seed);
+      // lwtnn stores the weights as n_out x n_in
+      std::vector<float> transposed(weights.size());
+      for (int i = 0; i < n_in; ++i)
+        for (int o = 0; o < n_out; ++o)
+          transposed[o * n_in + i] = weights[i * n_out + o];
+      const bool last = layer + 2 == widths.size();
+      layers << (layer ? "," : "") << "{\"architecture\": \"dense\", "
+             << "\"activation\": \"" << (last ? "sigmoid" : "rectified")
+             << "\", \"weights\": " << json_list(transposed)
+             << ", \"bias\": " << json_list(bias) << "}";
+    }
+    layers << "]";
+
+    std::vector<std::string> outputs;
+    for (int i = 0; i < widths.back(); ++i)
+      outputs.push_back("\"out_" + std::to_string(i) + "\"");
+    std::ostringstream json;
+    if (!graph) {
+      std::vector<std::string> inputs;
+      for (int i = 0; i < widths.front(); ++i)
+        inputs.push_back("{\"name\": \"variable_" + std::to_string(i)
+                         + "\", \"offset\": 0, \"scale\": 1}");
+      json << "{\"inputs\": " << json_list(inputs)
+           << ", \"layers\": " << layers.str()
+           << ", \"outputs\": " << json_list(outputs)
+           << ", \"defaults\": {}, \"miscellaneous\": {}}";
+      return json.str();
+    }
+
+    const int n_cond = 2;
+    const int n_noise = widths.front() - n_cond;
+    auto input_node = [](const std::string& name, int n_variables)
+    {
+      std::vector<std::string> variables;
+      for (int i = 0; i < n_variables; ++i)
+        variables.push_back("{\"name\": \"variable_" + std::to_string(i)
+                            + "\", \"offset\": 0, \"scale\": 1}");
+      return "{\"name\": \"" + name
+          + "\", \"variables\": " + json_list(variables) + "}";
+    };
+    std::vector<std::string> nodes = {
+        "{\"type\": \"input\", \"sources\": [0], \"size\": "
+            + std::to_string(n_noise) + "}",
+        "{\"type\": \"input\", \"sources\": [1], \"size\": "
+            + std::to_string(n_cond) + "}",
+        "{\"type\": \"concatenate\", \"sources\": [0, 1]}"};
+    for (std::size_t layer = 0; layer + 1 < widths.size(); ++layer)
+      nodes.push_back("{\"type\": \"feed_forward\", \"layer_index\": "
+                      + std::to_string(layer) + ", \"sources\": ["
+                      + std::to_string(nodes.size() - 1) + "]}");
+    json << "{\"input_sequences\": [], \"inputs\": ["
+         << input_node("node_0", n_noise) << ", "
+         << input_node("node_1", n_cond) << "], \"layers\": "
+         << layers.str() << ", \"nodes\": " << json_list(nodes)
+         << ", \"outputs\": {\"out\": {\"labels\": " << json_list(outputs)
+         << ", \"node_index\": " << nodes.size() - 1 << "}}}";
+    return json.str();
+  }
+
+private:
+  template<typename T>
+  static std::string json_list(const std::vector<T>& values)
+  {
+    std::ostringstream out;
+    out.precision(9);
+    out << "[";
+    for (std::size_t i = 0; i < values.size(); ++i)
+      out << (i ? ", " : "") << values[i];
+    out << "]";
+    return out.str();
+  }
+
+  static float uniform(std::uint32_t& seed)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) * (2.0f / 16777216.0f) - 1.0f;
+  }
+
+  // Minimal protobuf encoding
+  static void varint(std::string& out, std::uint64_t value)
+  {
+    while (value >= 0x80) {
+      out.push_back(char((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(char(value));
+  }
+  static void append_varint(std::string& out, int field, std::uint64_t value)
+  {
+    varint(out, field << 3);
+    varint(out, value);
+  }
+  static void append_bytes(std::string& out,
+                           int field,
+                           const std::string& bytes)
+  {
+    varint(out, (field << 3) | 2);
+    varint(out, bytes.size());
+    out += bytes;
+  }
+
+  static std::string tensor(const std::string& name,
+                            const std::vector<int>& dims,
+                            const std::vector<float>& values)
+  {
+    std::string out;
+    for (int dim : dims)
+      append_varint(out, 1, dim);
+    append_varint(out, 2, 1);  // float
+    append_bytes(out, 8, name);
+    std::string raw(values.size() * sizeof(float), '\0');
+    std::memcpy(&raw[0], values.data(), raw.size());
+    append_bytes(out, 9, raw);
+    return out;
+  }
+
+  static std::string node(const std::string& op_type,
+                          const std::vector<std::string>& inputs,
+                          const std::string& output)
+  {
+    std::string out;
+    for (const std::string& input : inputs)
+      append_bytes(out, 1, input);
+    append_bytes(out, 2, output);
+    append_bytes(out, 3, output + "_node");
+    append_bytes(out, 4, op_type);
+    return out;
+  }
+
+  static std::string value_info(const std::string& name, int width)
+  {
+    std::string batch_dim;
+    append_bytes(batch_dim, 2, "batch");
+    std::string width_dim;
+    append_varint(width_dim, 1, width);
+    std::string shape;
+    append_bytes(shape, 1, batch_dim);
+    append_bytes(shape, 1, width_dim);
+    std::string tensor_type;
+    append_varint(tensor_type, 1, 1);  // float
+    append_bytes(tensor_type, 2, shape);
+    std::string type;
+    append_bytes(type, 1, tensor_type);
+    std::string out;
+    append_bytes(out, 1, name);
+    append_bytes(out, 2, type);
+    return out;
+  }
+};
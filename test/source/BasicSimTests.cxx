@@ -2,13 +2,49 @@
 
 #include "BasicSimTests.h"
 
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include <CLHEP/Random/RandFlat.h>
+#include <H5Cpp.h>
 #include <CLHEP/Random/RanluxEngine.h>
 #include <gtest/gtest.h>
 
+#include "FastCaloSim/Core/TFCS1DFunctionTemplateHistogram.h"
+#include "FastCaloSim/Core/TFCSBinnedShower.h"
+#include "FastCaloSim/Core/TFCSBinnedShowerONNX.h"
+#include "FastCaloSim/Core/TFCSCenterPositionCalculation.h"
+#include "FastCaloSim/Core/TFCSEnergyAndHitGANV2.h"
+#include "FastCaloSim/Core/TFCSEventLibraryCache.h"
+#include "FastCaloSim/Core/TFCSEventLibraryFile.h"
+#include "FastCaloSim/Core/TFCSEventLibraryIndex.h"
 #include "FastCaloSim/Core/TFCSExtrapolationState.h"
+#include "FastCaloSim/Core/TFCSFlatArrayStore.h"
+#include "FastCaloSim/Core/TFCSHitCellMapping.h"
+#include "FastCaloSim/Core/TFCSInvisibleParametrization.h"
+#include "FastCaloSim/Core/TFCSLateralShapeParametrizationFixedHitChain.h"
+#include "FastCaloSim/Core/TFCSLateralShapeParametrizationHitChain.h"
+#include "FastCaloSim/Core/TFCSPCAEnergyParametrization.h"
+#include "FastCaloSim/Core/TFCSParametrizationAbsEtaSelectChain.h"
 #include "FastCaloSim/Core/TFCSParametrizationBase.h"
+#include "FastCaloSim/Core/TFCSParametrizationEkinSelectChain.h"
+#include "FastCaloSim/Core/TFCSParametrizationLazyPlaceholder.h"
+#include "FastCaloSim/Core/TFCSParametrizationPDGIDSelectChain.h"
+#include "FastCaloSim/Core/TFCSShowerLibrary.h"
 #include "FastCaloSim/Core/TFCSSimulationState.h"
 #include "FastCaloSim/Core/TFCSTruthState.h"
+#include "FastCaloSim/Core/TFCSUpscalingSampler.h"
+#include "NetworkTests.h"
+#include "TH1D.h"
+#include "TH1F.h"
+#include "TMath.h"
+#include "TTree.h"
+#include "TestHelpers/Benchmark.h"
 
 TEST_F(BasicSimTests, ReadParamFile)
 {
@@ -78,3 +114,1266 @@ TEST_F(BasicSimTests, DoDummySimulation)
   EXPECT_NEAR(simul_state.E(3), 85.8894, 1e-1);
   EXPECT_NEAR(simul_state.E(12), 50.1765, 1e-1);
 }
+
+TEST_F(BasicSimTests, LazyLoadSplitChain)
+{
+  const std::string file_name =
+      std::string(TEST_OUTPUT_DIR) + "/lazy_split_chain.root";
+
+  // Write a chain whose daughters are stored as separate keys
+  {
+    TFCSParametrizationPDGIDSelectChain chain("LazyChain", "LazyChain");
+    chain.set_SplitChainObjects();
+    chain.set_SimulateOnlyOnePDGID();
+    auto* photon = new TFCSInvisibleParametrization("LazyPhoton", "photon");
+    photon->set_pdgid(22);
+    auto* pion = new TFCSInvisibleParametrization("LazyPion", "pion");
+    pion->set_pdgid(211);
+    chain.push_back(photon);
+    chain.push_back(pion);
+
+    TFile out(file_name.c_str(), "RECREATE");
+    out.WriteTObject(&chain);
+    out.Close();
+  }
+
+  TFCSParametrizationLazyPlaceholder::set_LazyLoading(true);
+  TFile in(file_name.c_str(), "READ");
+  auto* chain =
+      dynamic_cast<TFCSParametrizationPDGIDSelectChain*>(in.Get("LazyChain"));
+  TFCSParametrizationLazyPlaceholder::set_LazyLoading(false);
+  ASSERT_NE(chain, nullptr);
+  ASSERT_EQ(chain->size(), 2u);
+
+  auto* lazy_photon =
+      dynamic_cast<TFCSParametrizationLazyPlaceholder*>((*chain)[0]);
+  auto* lazy_pion =
+      dynamic_cast<TFCSParametrizationLazyPlaceholder*>((*chain)[1]);
+  ASSERT_NE(lazy_photon, nullptr);
+  ASSERT_NE(lazy_pion, nullptr);
+  EXPECT_FALSE(lazy_photon->is_loaded());
+  EXPECT_FALSE(lazy_pion->is_loaded());
+
+  // The pdgid selection must not need the real objects
+  EXPECT_TRUE(lazy_pion->is_match_pdgid(211));
+  EXPECT_FALSE(lazy_photon->is_match_pdgid(211));
+  EXPECT_FALSE(lazy_pion->is_loaded());
+
+  TFCSSimulationState simul_state;
+  TFCSTruthState truth_state;
+  truth_state.SetPtEtaPhiM(1024, 0.2, 0, 0);
+  truth_state.set_pdgid(211);
+  TFCSExtrapolationState extrapol_state;
+  EXPECT_EQ(chain->simulate(simul_state, &truth_state, &extrapol_state),
+            FCSSuccess);
+
+  // Only the daughter that was simulated is read from the file
+  EXPECT_FALSE(lazy_photon->is_loaded());
+  EXPECT_TRUE(lazy_pion->is_loaded());
+
+  lazy_pion->evict();
+  EXPECT_FALSE(lazy_pion->is_loaded());
+  EXPECT_EQ(TFCSParametrizationLazyPlaceholder::MemoryUsed(), 0);
+
+  delete chain;
+  in.Close();
+}
+
+TEST_F(BasicSimTests, FlatArrayExport)
+{
+  const std::string root_name =
+      std::string(TEST_OUTPUT_DIR) + "/flat_array_export.root";
+  const std::string flat_name =
+      std::string(TEST_OUTPUT_DIR) + "/flat_array_export.flat";
+
+  TH1F hist("flat_hist", "flat_hist", 200, -5, 5);
+  for (int ibin = 1; ibin <= hist.GetNbinsX(); ++ibin) {
+    const double x = hist.GetBinCenter(ibin);
+    hist.SetBinContent(ibin, TMath::Gaus(x, 0, 1));
+  }
+  TFCS1DFunctionInt32Int32Histogram func(&hist);
+
+  // Export: the histogram arrays go into the flat file
+  {
+    TFCSFlatArrayWriter writer(flat_name);
+    ASSERT_TRUE(writer.is_open());
+    TFile out(root_name.c_str(), "RECREATE");
+    writer.Begin();
+    out.WriteTObject(&func, "flat_func");
+    writer.End();
+    out.Close();
+    EXPECT_EQ(writer.n_arrays(), 2u);
+    ASSERT_TRUE(writer.Close());
+  }
+
+  auto store = TFCSFlatArrayStore::Attach(flat_name);
+  ASSERT_NE(store, nullptr);
+  EXPECT_EQ(store->n_arrays(), 2u);
+
+  TFile in(root_name.c_str(), "READ");
+  auto* read_func =
+      dynamic_cast<TFCS1DFunctionInt32Int32Histogram*>(in.Get("flat_func"));
+  ASSERT_NE(read_func, nullptr);
+  for (double rnd = 0.005; rnd < 1; rnd += 0.01)
+    EXPECT_DOUBLE_EQ(read_func->rnd_to_fct(rnd), func.rnd_to_fct(rnd));
+
+  delete read_func;
+  in.Close();
+  TFCSFlatArrayStore::Detach(store);
+
+  // Without the store the arrays can not be resolved
+  TFile in_detached(root_name.c_str(), "READ");
+  auto* unresolved_func = dynamic_cast<TFCS1DFunctionInt32Int32Histogram*>(
+      in_detached.Get("flat_func"));
+  ASSERT_NE(unresolved_func, nullptr);
+  EXPECT_TRUE(func.is_valid());
+  EXPECT_FALSE(unresolved_func->is_valid());
+  delete unresolved_func;
+  in_detached.Close();
+}
+
+namespace
+{
+TFCSPCAEnergyParametrization* find_pca(TFCSParametrizationBase* param)
+{
+  if (auto* pca = dynamic_cast<TFCSPCAEnergyParametrization*>(param))
+    return pca;
+  for (unsigned int i = 0; i < param->size(); ++i)
+    if (auto* pca = find_pca((*param)[i]))
+      return pca;
+  return nullptr;
+}
+
+/// Leaf that only counts how often it was simulated
+class CountingParametrization : public TFCSInvisibleParametrization
+{
+public:
+  using TFCSInvisibleParametrization::TFCSInvisibleParametrization;
+  FCSReturnCode simulate(TFCSSimulationState&,
+                         const TFCSTruthState*,
+                         const TFCSExtrapolationState*) const override
+  {
+    ++m_count;
+    return FCSSuccess;
+  }
+  mutable long m_count = 0;
+};
+
+/// Leaf that deposits energy and asks for a retry on its first calls
+class RetryingParametrization : public TFCSInvisibleParametrization
+{
+public:
+  using TFCSInvisibleParametrization::TFCSInvisibleParametrization;
+  FCSReturnCode simulate(TFCSSimulationState& simulstate,
+                         const TFCSTruthState*,
+                         const TFCSExtrapolationState*) const override
+  {
+    ++m_count;
+    simulstate.add_E(0, 1);
+    if (m_count <= m_n_fail)
+      return static_cast<FCSReturnCode>(FCSRetry + m_n_retry);
+    return FCSSuccess;
+  }
+  int m_n_fail = 0;
+  int m_n_retry = 0;
+  mutable int m_count = 0;
+};
+}  // namespace
+
+TEST_F(BasicSimTests, DispatchTableMatchesSelectChains)
+{
+  // PDGID -> Ekin (log2 bins, random interpolation) -> |eta| (uniform bins)
+  const std::vector<int> pdgids = {22, 211, 11};
+  const int n_Ekin_bins = 10;
+  const int n_eta_bins = 100;
+  std::vector<std::unique_ptr<TFCSParametrizationBase>> owner;
+  std::vector<CountingParametrization*> leaves;
+
+  TFCSParametrizationPDGIDSelectChain top("SelPDGID", "SelPDGID");
+  top.set_SimulateOnlyOnePDGID();
+  for (int pdgid : pdgids) {
+    auto* ekin_chain = new TFCSParametrizationEkinSelectChain("SelEkin");
+    ekin_chain->set_DoRandomInterpolation();
+    owner.emplace_back(ekin_chain);
+    for (int iEkin = 0; iEkin < n_Ekin_bins; ++iEkin) {
+      const float Ekin_low = 16 << iEkin;
+      const float Ekin_up = 32 << iEkin;
+      auto* eta_chain = new TFCSParametrizationAbsEtaSelectChain("SelEta");
+      owner.emplace_back(eta_chain);
+      for (int ieta = 0; ieta < n_eta_bins; ++ieta) {
+        auto* leaf = new CountingParametrization("Leaf");
+        owner.emplace_back(leaf);
+        leaves.push_back(leaf);
+        leaf->set_pdgid(pdgid);
+        leaf->set_Ekin_nominal(1.5 * Ekin_low);
+        leaf->set_Ekin_min(Ekin_low);
+        leaf->set_Ekin_max(Ekin_up);
+        leaf->set_eta_min(ieta * 0.05f);
+        leaf->set_eta_max((ieta + 1) * 0.05f);
+        eta_chain->push_back_in_bin(leaf, ieta * 0.05f, (ieta + 1) * 0.05f);
+      }
+      ekin_chain->push_back_in_bin(eta_chain, Ekin_low, Ekin_up);
+    }
+    top.push_back(ekin_chain);
+  }
+
+  auto table = top.dispatch_table();
+  ASSERT_NE(table, nullptr);
+  EXPECT_EQ(table->n_direct_indexed(), pdgids.size() * (n_Ekin_bins + 1));
+
+  // Flood of low energy particles, where the selection dominates the time
+  const bool benchmark = TestHelpers::run_benchmarks();
+  const int n_particles = benchmark ? 200000 : 20000;
+  TFCSExtrapolationState extrapol_state;
+  TFCSTruthState truth_state;
+  auto run = [&](bool use_table)
+  {
+    if (use_table)
+      top.set_UseDispatchTable();
+    else
+      top.reset_UseDispatchTable();
+    for (auto* leaf : leaves)
+      leaf->m_count = 0;
+    CLHEP::RanluxEngine rnd_engine(42);
+    CLHEP::RanluxEngine particle_engine(43);
+    TFCSSimulationState simul_state(&rnd_engine);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_particles; ++i) {
+      const double Ekin =
+          16 * std::pow(2, 5.5 * CLHEP::RandFlat::shoot(&particle_engine));
+      const double eta = CLHEP::RandFlat::shoot(&particle_engine, -4.9, 4.9);
+      truth_state.SetPtEtaPhiM(Ekin / std::cosh(eta), eta, 0, 0);
+      truth_state.set_pdgid(pdgids[i % pdgids.size()]);
+      extrapol_state.set_IDCaloBoundary_eta(eta);
+      EXPECT_EQ(top.simulate(simul_state, &truth_state, &extrapol_state),
+                FCSSuccess);
+    }
+    const std::chrono::duration<double, std::micro> time =
+        std::chrono::steady_clock::now() - start;
+    if (benchmark)
+      std::cout << (use_table ? "dispatch table: " : "select chains:  ")
+                << time.count() * 1000 / n_particles << " ns/particle"
+                << std::endl;
+    std::vector<long> counts;
+    for (auto* leaf : leaves)
+      counts.push_back(leaf->m_count);
+    return counts;
+  };
+
+  const std::vector<long> tree_counts = run(false);
+  const std::vector<long> table_counts = run(true);
+  EXPECT_EQ(tree_counts, table_counts);
+
+  // Adding a new particle type must rebuild the table
+  auto* neutron = new CountingParametrization("Neutron");
+  owner.emplace_back(neutron);
+  neutron->set_pdgid(2112);
+  top.push_back(neutron);
+  EXPECT_NE(top.dispatch_table(), table);
+  truth_state.set_pdgid(2112);
+  TFCSSimulationState simul_state;
+  EXPECT_EQ(top.simulate(simul_state, &truth_state, &extrapol_state),
+            FCSSuccess);
+  EXPECT_EQ(neutron->m_count, 1);
+}
+
+TEST_F(BasicSimTests, DispatchTableRetries)
+{
+  // PDGID -> Ekin -> leaf asking for two retries
+  auto ekin_chain =
+      std::make_unique<TFCSParametrizationEkinSelectChain>("SelEkin");
+  auto leaf = std::make_unique<RetryingParametrization>("Leaf");
+  leaf->set_pdgid(22);
+  leaf->set_Ekin_nominal(1500);
+  leaf->set_Ekin_min(1000);
+  leaf->set_Ekin_max(2000);
+  leaf->m_n_fail = 2;
+  leaf->m_n_retry = 3;
+  ekin_chain->push_back_in_bin(leaf.get(), 1000, 2000);
+  TFCSParametrizationPDGIDSelectChain top("SelPDGID", "SelPDGID");
+  top.set_SimulateOnlyOnePDGID();
+  top.push_back(ekin_chain.get());
+
+  TFCSExtrapolationState extrapol_state;
+  extrapol_state.set_IDCaloBoundary_eta(0.2);
+  TFCSTruthState truth_state;
+  truth_state.SetPtEtaPhiM(1500 / std::cosh(0.2), 0.2, 0, 0);
+  truth_state.set_pdgid(22);
+
+  struct Result_t
+  {
+    FCSReturnCode status;
+    int count;
+    unsigned long long retries;
+    double E;
+  };
+  auto run = [&](bool use_table)
+  {
+    if (use_table)
+      top.set_UseDispatchTable();
+    else
+      top.reset_UseDispatchTable();
+    leaf->m_count = 0;
+    ekin_chain->reset_retry_count();
+    top.reset_retry_count();
+    CLHEP::RanluxEngine rnd_engine(42);
+    TFCSSimulationState simul_state(&rnd_engine);
+    Result_t result;
+    result.status = top.simulate(simul_state, &truth_state, &extrapol_state);
+    result.count = leaf->m_count;
+    result.retries = ekin_chain->retry_count();
+    result.E = simul_state.E(0);
+    // Retries are done and counted by the Ekin chain, not the top chain
+    EXPECT_EQ(top.retry_count(), 0u);
+    return result;
+  };
+  auto expect_same = [&](double E_expected)
+  {
+    const Result_t tree = run(false);
+    const Result_t table = run(true);
+    EXPECT_EQ(tree.status, FCSSuccess);
+    EXPECT_EQ(tree.count, 3);
+    EXPECT_EQ(tree.retries, 2u);
+    EXPECT_DOUBLE_EQ(tree.E, E_expected);
+    EXPECT_EQ(table.status, tree.status);
+    EXPECT_EQ(table.count, tree.count);
+    EXPECT_EQ(table.retries, tree.retries);
+    EXPECT_DOUBLE_EQ(table.E, tree.E);
+  };
+
+  // Without rollback the energy of the failed attempts stays
+  const auto table = top.dispatch_table();
+  ASSERT_NE(table, nullptr);
+  EXPECT_EQ(table->n_nodes(), 2u);
+  expect_same(3);
+
+  // Setters of objects inside the tree do not touch the table, they can be
+  // called during the simulation
+  leaf->set_pdgid(22);
+  EXPECT_EQ(top.dispatch_table(), table);
+
+  // A chain with retry bits is not flattened, the rollback must still happen.
+  // The first event after the change runs the changed chain as is, the table
+  // is rebuilt afterwards
+  ekin_chain->set_RollbackOnRetry();
+  expect_same(1);
+  ASSERT_NE(top.dispatch_table(), nullptr);
+  EXPECT_EQ(top.dispatch_table()->n_nodes(), 1u);
+  expect_same(1);
+
+  // Too few retries fail in both cases
+  ekin_chain->reset_RollbackOnRetry();
+  leaf->m_n_fail = 5;
+  for (bool use_table : {false, true}) {
+    const Result_t result = run(use_table);
+    EXPECT_EQ(result.status, FCSFatal);
+    EXPECT_EQ(result.count, 4);
+  }
+}
+
+TEST_F(BasicSimTests, PCABatchMatchesSingle)
+{
+  auto* param = static_cast<TFCSParametrizationBase*>(
+      param_files["barrel"]->Get("SelPDGID"));
+  ASSERT_NE(param, nullptr);
+  param->set_geometry(AtlasGeoTests::geo);
+  TFCSPCAEnergyParametrization* pca = find_pca(param);
+  ASSERT_NE(pca, nullptr);
+
+  const int n_states = 16;
+  std::vector<std::unique_ptr<CLHEP::RanluxEngine>> single_engines;
+  std::vector<std::unique_ptr<CLHEP::RanluxEngine>> batch_engines;
+  std::vector<TFCSSimulationState> single_states(n_states);
+  std::vector<TFCSSimulationState> batch_states(n_states);
+  std::vector<TFCSSimulationState*> batch;
+  for (int i = 0; i < n_states; ++i) {
+    single_engines.emplace_back(new CLHEP::RanluxEngine(100 + i));
+    batch_engines.emplace_back(new CLHEP::RanluxEngine(100 + i));
+    single_states[i].setRandomEngine(single_engines[i].get());
+    batch_states[i].setRandomEngine(batch_engines[i].get());
+    // Mix all PCA bins including the empty bin 0
+    const int pcabin = i % (pca->n_pcabins() + 1);
+    for (TFCSSimulationState* state : {&single_states[i], &batch_states[i]}) {
+      state->set_Ebin(pcabin);
+      state->set_E(65536);
+    }
+    batch.push_back(&batch_states[i]);
+  }
+
+  std::vector<FCSReturnCode> status;
+  pca->simulate_batch(batch, status);
+  ASSERT_EQ(status.size(), batch.size());
+  for (int i = 0; i < n_states; ++i) {
+    EXPECT_EQ(pca->simulate(single_states[i], nullptr, nullptr), status[i]);
+    if (status[i] != FCSSuccess)
+      continue;
+    // The matrix-matrix product may round differently than the matrix-vector
+    // product of a single particle
+    const double tolerance = 1e-6 * std::abs(single_states[i].E()) + 1e-9;
+    EXPECT_NEAR(batch_states[i].E(), single_states[i].E(), tolerance);
+    for (int layer : pca->get_layers())
+      EXPECT_NEAR(
+          batch_states[i].E(layer), single_states[i].E(layer), tolerance);
+  }
+}
+
+TEST_F(BasicSimTests, EventLibraryIndexMatchesScan)
+{
+  // Library with duplicated events, so that there are ties, and events
+  // with coordinates that are not finite
+  CLHEP::RanluxEngine engine(7);
+  const int n_events = 20000;
+  std::vector<std::array<float, 3>> library;
+  for (int i = 0; i < n_events; ++i)
+    library.push_back(
+        {float(CLHEP::RandFlat::shoot(&engine, 0.2, 0.25)),
+         float(std::pow(2, std::floor(CLHEP::RandFlat::shoot(&engine, 8, 22)))),
+         float(CLHEP::RandFlat::shoot(&engine, 0, 0.0245))});
+  for (int i = 0; i < 500; ++i)
+    library.push_back(library[7 * i]);
+  library[5][2] = NAN;
+  library[6][1] = 0;
+  library[7][0] = NAN;
+
+  const float phi_cell_size = 0.0245;
+  for (bool phi_mod_matching : {false, true}) {
+    auto distance = [&](std::size_t index, const std::array<float, 3>& q)
+    {
+      const std::array<float, 3>& event = library[index];
+      float eta_diff = (event[0] - q[0]) / 0.05;
+      float e_diff = std::log(event[1] / q[1]) / std::log(2);
+      float dist2 = eta_diff * eta_diff + e_diff * e_diff;
+      if (phi_mod_matching) {
+        float phi_diff = (event[2] - q[2]) / phi_cell_size;
+        dist2 = dist2 + phi_diff * phi_diff;
+      }
+      return float(TMath::Sqrt(dist2));
+    };
+
+    const unsigned int n_dims = phi_mod_matching ? 3 : 2;
+    std::vector<double> points;
+    for (const std::array<float, 3>& event : library) {
+      points.push_back(event[0] / 0.05);
+      points.push_back(std::log2(double(event[1])));
+      if (phi_mod_matching)
+        points.push_back(event[2]);
+    }
+    const TFCSEventLibraryIndex index(points, n_dims);
+    EXPECT_EQ(index.size(), library.size());
+
+    for (int i = 0; i < 300; ++i) {
+      // Some queries hit library events exactly
+      std::array<float, 3> q = library[3 * i];
+      if (i % 10 != 0)
+        q = {float(CLHEP::RandFlat::shoot(&engine, 0.18, 0.27)),
+             float(CLHEP::RandFlat::shoot(&engine, 100, 5e6)),
+             float(CLHEP::RandFlat::shoot(&engine, 0, phi_cell_size))};
+      if (i == 1)
+        q[1] = 0;
+
+      float best_distance = std::numeric_limits<float>::max();
+      std::size_t best = TFCSEventLibraryIndex::npos;
+      for (std::size_t event = 0; event < library.size(); ++event) {
+        const float d = distance(event, q);
+        if (d < best_distance) {
+          best_distance = d;
+          best = event;
+        }
+      }
+      const double query[3] = {q[0] / 0.05, std::log2(double(q[1])), q[2]};
+      const double weights[3] = {1, 1, 1 / phi_cell_size};
+      EXPECT_EQ(index.nearest(query,
+                              weights,
+                              [&](std::size_t event)
+                              { return distance(event, q); }),
+                best)
+          << "query " << i << " with phi_mod_matching " << phi_mod_matching;
+    }
+  }
+}
+
+TEST_F(BasicSimTests, EventLibraryFileRoundTrip)
+{
+  const std::string path =
+      std::string(TEST_OUTPUT_DIR) + "/event_library_file.evlib";
+
+  // Three events in layers 0 and 2, layer 1 has no data. The second event
+  // has no voxels with energy in layer 2
+  const std::vector<std::uint64_t> offsets_0 = {0, 2, 3, 5};
+  const std::vector<std::uint32_t> bins_0 = {0, 3, 1, 2, 3};
+  const std::vector<float> E_0 = {0.1, 0.2, 0.3, 0.4, 0.5};
+  const std::vector<std::uint64_t> offsets_2 = {0, 1, 1, 2};
+  const std::vector<std::uint32_t> bins_2 = {1, 0};
+  const std::vector<float> E_2 = {0.6, 0.7};
+  const std::vector<float> R_lower = {0, 1, 2, 3};
+  const std::vector<float> R_size = {1, 1, 1, 2};
+  const std::vector<float> alpha_lower = {0, 0, 0, 0};
+  const std::vector<float> alpha_size = {6, 6, 6, 6};
+  {
+    TFCSEventLibraryWriter writer(path, 3, 3);
+    ASSERT_TRUE(writer.is_open());
+    EXPECT_TRUE(writer.set_event_info({}, {0.2, 0.21, 0.22}, {1e3, 2e3, 4e3}));
+    EXPECT_TRUE(writer.add_layer(
+        2, offsets_2, bins_2, E_2, R_lower, R_size, alpha_lower, alpha_size));
+    EXPECT_TRUE(writer.add_layer(
+        0, offsets_0, bins_0, E_0, R_lower, R_size, alpha_lower, alpha_size));
+    // Offsets that don't match the number of events are rejected
+    EXPECT_FALSE(writer.add_layer(
+        1, offsets_0, bins_2, E_2, R_lower, R_size, alpha_lower, alpha_size));
+    ASSERT_TRUE(writer.Close());
+  }
+
+  auto library = TFCSEventLibraryFile::Open(path);
+  ASSERT_NE(library, nullptr);
+  EXPECT_EQ(library->n_events(), 3u);
+  EXPECT_EQ(library->n_layers(), 3u);
+  EXPECT_TRUE(library->has_layer(0));
+  EXPECT_FALSE(library->has_layer(1));
+  EXPECT_TRUE(library->has_layer(2));
+  EXPECT_FLOAT_EQ(library->center_eta(1), 0.21);
+  EXPECT_FLOAT_EQ(library->e_init(2), 4e3);
+  EXPECT_FLOAT_EQ(library->phi_mod(2), 0);
+
+  for (std::size_t event = 0; event < 3; ++event) {
+    const TFCSEventLibraryFile::Voxels_t voxels = library->voxels(event, 0);
+    ASSERT_EQ(voxels.size, offsets_0[event + 1] - offsets_0[event]);
+    for (std::size_t i = 0; i < voxels.size; ++i) {
+      EXPECT_EQ(voxels.bin_index[i], bins_0[offsets_0[event] + i]);
+      EXPECT_FLOAT_EQ(voxels.E[i], E_0[offsets_0[event] + i]);
+    }
+    EXPECT_EQ(library->voxels(event, 1).size, 0u);
+  }
+  EXPECT_EQ(library->voxels(1, 2).size, 0u);
+  EXPECT_FLOAT_EQ(library->voxels(2, 2).E[0], 0.7);
+  EXPECT_EQ(library->voxels(3, 0).size, 0u);
+
+  std::vector<float> R_lower_read, R_size_read, alpha_lower_read,
+      alpha_size_read;
+  EXPECT_FALSE(library->bin_boundaries(
+      1, R_lower_read, R_size_read, alpha_lower_read, alpha_size_read));
+  ASSERT_TRUE(library->bin_boundaries(
+      2, R_lower_read, R_size_read, alpha_lower_read, alpha_size_read));
+  EXPECT_EQ(R_lower_read, R_lower);
+  EXPECT_EQ(R_size_read, R_size);
+  EXPECT_EQ(alpha_lower_read, alpha_lower);
+  EXPECT_EQ(alpha_size_read, alpha_size);
+
+  // Converting a file that is no HDF5 file fails without throwing
+  EXPECT_FALSE(convert_event_library(path, path + ".converted", {0, 1, 2}));
+}
+
+TEST_F(BasicSimTests, EventLibraryCacheReadsOnDemand)
+{
+  const std::string path =
+      std::string(TEST_OUTPUT_DIR) + "/event_library_cache.h5";
+
+  // Layer 0 with 50 voxels, layer 1 without data. Every fifth voxel of an
+  // event has energy
+  const hsize_t n_events = 200;
+  const hsize_t n_bins = 50;
+  auto energy = [](hsize_t event, hsize_t bin)
+  { return bin % 5 == event % 5 ? float(event * n_bins + bin + 1) : 0.f; };
+  {
+    H5::H5File file(path, H5F_ACC_TRUNC);
+    const hsize_t dims[2] = {n_events, n_bins};
+    const hsize_t chunk[2] = {16, n_bins};
+    H5::DSetCreatPropList properties;
+    properties.setChunk(2, chunk);
+    std::vector<float> data;
+    for (hsize_t event = 0; event < n_events; ++event)
+      for (hsize_t bin = 0; bin < n_bins; ++bin)
+        data.push_back(energy(event, bin));
+    file.createDataSet("energy_layer_0",
+                       H5::PredType::NATIVE_FLOAT,
+                       H5::DataSpace(2, dims),
+                       properties)
+        .write(data.data(), H5::PredType::NATIVE_FLOAT);
+    std::vector<float> e_init(n_events);
+    for (hsize_t event = 0; event < n_events; ++event)
+      e_init[event] = 1000 + event;
+    file.createDataSet("incident_energy",
+                       H5::PredType::NATIVE_FLOAT,
+                       H5::DataSpace(1, dims))
+        .write(e_init.data(), H5::PredType::NATIVE_FLOAT);
+  }
+
+  // Room for about ten events
+  const std::size_t max_bytes =
+      10 * (sizeof(TFCSEventLibraryCache::Event_t) + 100);
+  auto cache = TFCSEventLibraryCache::Open(path, {0, 1}, max_bytes);
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(cache->n_events(), n_events);
+  EXPECT_EQ(cache->n_layers(), 2u);
+  EXPECT_FLOAT_EQ(cache->e_init(17), 1017);
+  EXPECT_FLOAT_EQ(cache->center_eta(17), 0);
+  EXPECT_EQ(cache->get(n_events), nullptr);
+
+  auto check = [&](hsize_t event)
+  {
+    auto data = cache->get(event);
+    ASSERT_NE(data, nullptr);
+    const TFCSEventLibraryFile::Voxels_t voxels = data->voxels(0);
+    ASSERT_EQ(voxels.size, n_bins / 5);
+    for (std::size_t i = 0; i < voxels.size; ++i) {
+      EXPECT_EQ(voxels.bin_index[i] % 5, event % 5);
+      EXPECT_EQ(voxels.E[i], energy(event, voxels.bin_index[i]));
+    }
+    EXPECT_EQ(data->voxels(1).size, 0u);
+  };
+
+  auto pinned = cache->get(3);
+  for (hsize_t event = 0; event < n_events; event += 7)
+    check(event);
+  TFCSEventLibraryCache::Stats_t stats = cache->stats();
+  EXPECT_GT(stats.evictions, 0u);
+  EXPECT_LE(stats.bytes, max_bytes);
+  // Evicted events stay valid while they are used
+  EXPECT_EQ(pinned->voxels(0).E[0], energy(3, 3));
+
+  cache->prefetch({150, 151, 152, 190, 151});
+  const std::uint64_t misses = cache->stats().misses;
+  for (hsize_t event : {150, 151, 152, 190})
+    check(event);
+  EXPECT_EQ(cache->stats().misses, misses);
+}
+
+TEST_F(BasicSimTests, BinnedShowerDirectProjection)
+{
+  const int layer = 2;
+  const float eta = 0.225;
+  const float phi = 1.8;
+  const float pi = TMath::Pi();
+
+  // One shower with four voxels in the middle layer, upper and lower half
+  // in phi at two distances
+  TFCSBinnedShower::eventvector_t library(1);
+  library[0].event_data.resize(layer + 1);
+  library[0].event_data[layer].bin_index_vector = {0, 1, 2, 3};
+  library[0].event_data[layer].E_vector = {0.4, 0.3, 0.2, 0.1};
+  library[0].phi_mod = 0;
+  library[0].center_eta = eta;
+  library[0].e_init = 65536;
+
+  // Shower center on the middle of the layer
+  const Position center_pos {0, 0, 0, eta, phi, 0};
+  const double center_r = AtlasGeoTests::geo->get_cell(layer, center_pos).r();
+  TFCSTruthState truth_state;
+  truth_state.SetPtEtaPhiM(65536, eta, phi, 0);
+  truth_state.set_pdgid(22);
+  TFCSExtrapolationState extrapol_state;
+  for (int i = 0; i < 24; ++i) {
+    for (Cell::SubPos pos :
+         {Cell::SubPos::ENT, Cell::SubPos::EXT, Cell::SubPos::MID})
+    {
+      extrapol_state.set_eta(i, pos, eta);
+      extrapol_state.set_phi(i, pos, phi);
+      extrapol_state.set_r(i, pos, center_r);
+      extrapol_state.set_z(i, pos, center_r * std::sinh(eta));
+    }
+  }
+
+  // Total energy and energy weighted eta and phi of the cells
+  auto simulate = [&](bool direct, bool fixed_chain)
+  {
+    TFCSBinnedShower shower("BinnedShower", "BinnedShower");
+    shower.set_geometry(AtlasGeoTests::geo);
+    shower.set_calosample(layer);
+    shower.set_event_library(library);
+    shower.set_bin_boundaries(layer,
+                              {0, 0, 20, 20},
+                              {20, 20, 40, 40},
+                              {0, pi, 0, pi},
+                              {pi, pi, pi, pi});
+    if (direct)
+      shower.set_direct_projection();
+
+    TFCSCenterPositionCalculation center("Center", "Center");
+    center.set_calosample(layer);
+    std::unique_ptr<TFCSLateralShapeParametrizationHitChain> chain;
+    if (fixed_chain)
+      chain = std::make_unique<TFCSLateralShapeParametrizationFixedHitChain>(
+          "Chain", "Chain");
+    else
+      chain = std::make_unique<TFCSLateralShapeParametrizationHitChain>(
+          "Chain", "Chain");
+    chain->set_calosample(layer);
+    chain->push_back_init(&center);
+    chain->push_back(&shower);
+    // The standard chain, the mapping skips the projected hits
+    TFCSHitCellMapping mapping("Mapping", "Mapping", AtlasGeoTests::geo);
+    mapping.set_calosample(layer);
+    chain->push_back(&mapping);
+    chain->set_geometry(AtlasGeoTests::geo);
+
+    CLHEP::RanluxEngine rnd_engine;
+    rnd_engine.setSeed(42);
+    TFCSSimulationState simul_state(&rnd_engine);
+    EXPECT_EQ(shower.simulate(simul_state, &truth_state, &extrapol_state),
+              FCSSuccess);
+    EXPECT_EQ(chain->simulate(simul_state, &truth_state, &extrapol_state),
+              FCSSuccess);
+
+    std::array<double, 3> result = {0, 0, 0};
+    for (const auto& [id, E] : simul_state.cells()) {
+      const Cell& cell = AtlasGeoTests::geo->get_cell(id);
+      result[0] += E;
+      result[1] += E * cell.eta();
+      result[2] += E * cell.phi();
+    }
+    result[1] /= result[0];
+    result[2] /= result[0];
+    return result;
+  };
+
+  const std::array<double, 3> hits = simulate(false, true);
+  const std::array<double, 3> projected = simulate(true, true);
+  EXPECT_GT(projected[0], 0);
+  EXPECT_NEAR(projected[0], hits[0], 1e-3 * hits[0]);
+  // Within the resolution of the projection, a quarter of a cell
+  EXPECT_NEAR(projected[1], hits[1], 0.01);
+  EXPECT_NEAR(projected[2], hits[2], 0.01);
+
+  // A plain hit chain stops after the first hit and deposits the layer once
+  const std::array<double, 3> plain = simulate(true, false);
+  EXPECT_DOUBLE_EQ(plain[0], projected[0]);
+  EXPECT_DOUBLE_EQ(plain[1], projected[1]);
+  EXPECT_DOUBLE_EQ(plain[2], projected[2]);
+}
+
+TEST_F(BasicSimTests, BinnedShowerHitIteration)
+{
+  const int layer = 2;
+  const float eta = 0.225;
+  const float phi = 1.8;
+
+  // Two empty voxels in between, which have no hits
+  TFCSBinnedShower::eventvector_t library(1);
+  library[0].event_data.resize(layer + 1);
+  library[0].event_data[layer].bin_index_vector = {0, 1, 2, 3};
+  library[0].event_data[layer].E_vector = {0.5, 0, 0, 0.25};
+  library[0].e_init = 1024;
+
+  TFCSBinnedShower shower("BinnedShower", "BinnedShower");
+  shower.set_geometry(AtlasGeoTests::geo);
+  shower.set_calosample(layer);
+  shower.set_event_library(library);
+  shower.set_bin_boundaries(
+      layer, {0, 10, 20, 30}, {10, 10, 10, 10}, {0, 0, 0, 0}, {1, 1, 1, 1});
+
+  TFCSTruthState truth_state;
+  truth_state.SetPtEtaPhiM(1024, eta, phi, 0);
+  truth_state.set_pdgid(22);
+  TFCSExtrapolationState extrapol_state;
+  for (int i = 0; i < 24; ++i) {
+    extrapol_state.set_eta(i, Cell::SubPos::MID, eta);
+    extrapol_state.set_phi(i, Cell::SubPos::MID, phi);
+  }
+  CLHEP::RanluxEngine rnd_engine;
+  TFCSSimulationState simul_state(&rnd_engine);
+  ASSERT_EQ(shower.simulate(simul_state, &truth_state, &extrapol_state),
+            FCSSuccess);
+
+  // The voxels hold consecutive hits and together the layer energy
+  std::vector<long unsigned int> voxels;
+  long unsigned int n_hits = 0;
+  double E = 0;
+  TFCSBinnedShowerBase::HitVoxel_t voxel;
+  for (bool ok = shower.first_hit_voxel(simul_state, layer, voxel); ok;
+       ok = shower.next_hit_voxel(simul_state, voxel))
+  {
+    voxels.push_back(voxel.voxel_index);
+    EXPECT_EQ(voxel.first_hit, n_hits);
+    EXPECT_FLOAT_EQ(voxel.R_min, 10.0f * voxel.bin_index);
+    EXPECT_FLOAT_EQ(voxel.R_max, 10.0f * voxel.bin_index + 10);
+    n_hits = voxel.end_hit;
+    E += voxel.n_hits() * voxel.E;
+  }
+  EXPECT_EQ(voxels, std::vector<long unsigned int>({0, 3}));
+  EXPECT_EQ(static_cast<int>(n_hits),
+            shower.get_number_of_hits(
+                simul_state, &truth_state, &extrapol_state));
+  EXPECT_NEAR(E, simul_state.E(layer), 1e-3);
+  EXPECT_NEAR(E, 0.75 * truth_state.Ekin(), 1e-3);
+}
+
+// Prefetching the network evaluation of the next particles during the
+// hits of the current one gives the same cells as evaluating in batches
+TEST_F(BasicSimTests, BinnedShowerONNXPipeline)
+{
+  const int layer = 2;
+  const float phi = 1.8;
+  const float pi = TMath::Pi();
+  const int n_particles = 5;
+  auto eta = [](int i) { return 0.1f + 0.05f * i; };
+
+  std::vector<TFCSTruthState> truths(n_particles);
+  std::vector<TFCSExtrapolationState> extrapols(n_particles);
+  std::vector<const TFCSTruthState*> truth_ptrs;
+  std::vector<const TFCSExtrapolationState*> extrapol_ptrs;
+  for (int i = 0; i < n_particles; ++i) {
+    truths[i].SetPtEtaPhiM(1000 * (i + 1), eta(i), phi, 0);
+    truths[i].set_pdgid(22);
+    const Position pos {0, 0, 0, eta(i), phi, 0};
+    const double r = AtlasGeoTests::geo->get_cell(layer, pos).r();
+    for (int sample = 0; sample < 24; ++sample) {
+      for (Cell::SubPos sub :
+           {Cell::SubPos::ENT, Cell::SubPos::EXT, Cell::SubPos::MID})
+      {
+        extrapols[i].set_eta(sample, sub, eta(i));
+        extrapols[i].set_phi(sample, sub, phi);
+        extrapols[i].set_r(sample, sub, r);
+        extrapols[i].set_z(sample, sub, r * std::sinh(eta(i)));
+      }
+    }
+    truth_ptrs.push_back(&truths[i]);
+    extrapol_ptrs.push_back(&extrapols[i]);
+  }
+
+  // Cells of each particle and the next random number of its engine
+  typedef std::pair<TFCSSimulationState::cellmap, double> result_t;
+  auto simulate = [&](unsigned int depth, bool shared_engine)
+  {
+    TFCSBinnedShowerONNX shower("BinnedShowerONNX", "BinnedShowerONNX");
+    shower.set_geometry(AtlasGeoTests::geo);
+    shower.set_calosample(layer);
+    shower.set_bin_boundaries(layer,
+                              {0, 0, 20, 20},
+                              {20, 20, 40, 40},
+                              {0, pi, 0, pi},
+                              {pi, pi, pi, pi});
+    EXPECT_TRUE(shower.set_network(
+        std::make_unique<VoxelStubNetwork>(), {0, 4}, {layer}));
+    shower.set_pipeline_depth(depth);
+    EXPECT_EQ(shower.pipeline_depth(), depth);
+
+    TFCSCenterPositionCalculation center("Center", "Center");
+    center.set_calosample(layer);
+    TFCSHitCellMapping mapping("Mapping", "Mapping", AtlasGeoTests::geo);
+    mapping.set_calosample(layer);
+    TFCSLateralShapeParametrizationFixedHitChain chain("Chain", "Chain");
+    chain.set_calosample(layer);
+    chain.push_back_init(&center);
+    chain.push_back(&shower);
+    chain.push_back(&mapping);
+    chain.set_geometry(AtlasGeoTests::geo);
+
+    std::vector<std::unique_ptr<CLHEP::RanluxEngine>> engines;
+    std::vector<TFCSSimulationState> states(n_particles);
+    std::vector<TFCSSimulationState*> state_ptrs;
+    for (int i = 0; i < n_particles; ++i) {
+      engines.emplace_back(new CLHEP::RanluxEngine(500 + i));
+      states[i].setRandomEngine(engines[shared_engine ? 0 : i].get());
+      state_ptrs.push_back(&states[i]);
+    }
+    std::vector<FCSReturnCode> status;
+    shower.simulate_batch(
+        state_ptrs, truth_ptrs, extrapol_ptrs, status, &chain);
+
+    std::vector<result_t> results;
+    for (int i = 0; i < n_particles; ++i) {
+      EXPECT_EQ(status[i], shared_engine ? FCSFatal : FCSSuccess);
+      results.emplace_back(states[i].cells(), engines[i]->flat());
+    }
+    return results;
+  };
+
+  const std::vector<result_t> batched = simulate(0, false);
+  const std::vector<result_t> pipelined = simulate(2, false);
+  for (int i = 0; i < n_particles; ++i) {
+    EXPECT_FALSE(batched[i].first.empty());
+    EXPECT_EQ(batched[i].first, pipelined[i].first);
+    EXPECT_EQ(batched[i].second, pipelined[i].second);
+  }
+
+  // The random numbers of a shared engine would depend on the depth
+  for (const result_t& result : simulate(2, true))
+    EXPECT_TRUE(result.first.empty());
+}
+
+TEST_F(BasicSimTests, UpscalingSamplerSubBins)
+{
+  // One bin in layers 1 and 2 at two energies
+  TFCSUpscalingSampler::distribution_t distribution(2);
+  distribution[0] = {{}, {{0.1, 0.3, 0.4}}, {{0.1, 0.2, 0.5}}};
+  distribution[1] = {{}, {{0.3, 0.5, 0.8}}, {{0.1, 0.2, 0.5}}};
+  TFCSUpscalingSampler sampler(distribution, {1024, 4096});
+
+  // Half way in log(E) between the two energy points
+  const TFCSUpscalingSampler::Weights_t weights = sampler.weights(2048);
+  EXPECT_EQ(weights.low, 0);
+  EXPECT_EQ(weights.high, 1);
+  EXPECT_NEAR(weights.f_low, 0.5, 1e-6);
+  EXPECT_EQ(sampler.weights(512).low, -1);
+  EXPECT_EQ(sampler.weights(512).high, 0);
+
+  // Probabilities {0.2, 0.4, 0.6}: the lower alpha half has 0.4, of which
+  // the lower R half has 0.2
+  const TFCSUpscalingSampler::Voxel_t voxel = sampler.voxel(weights, 1, 0);
+  EXPECT_NEAR(voxel.p_alpha_low, 0.4, 1e-6);
+  EXPECT_NEAR(voxel.p_r[0], 0.5, 1e-6);
+  EXPECT_NEAR(voxel.p_r[1], 1.0 / 3, 1e-6);
+
+  CLHEP::RanluxEngine rnd_engine;
+  const int n = 20000;
+  int n_alpha_low = 0;
+  int n_r_low = 0;
+  for (int i = 0; i < n; ++i) {
+    float R_min = 0, R_max = 2, alpha_min = 0, alpha_max = 2;
+    TFCSUpscalingSampler::sample(
+        &rnd_engine, voxel, R_min, R_max, alpha_min, alpha_max);
+    n_alpha_low += alpha_max == 1;
+    n_r_low += R_max == 1;
+    EXPECT_FLOAT_EQ(R_max - R_min, 1);
+    EXPECT_FLOAT_EQ(alpha_max - alpha_min, 1);
+  }
+  EXPECT_NEAR(n_alpha_low / double(n), 0.4, 0.02);
+  EXPECT_NEAR(n_r_low / double(n), 0.4, 0.02);
+
+  // Layer 2 places the hits at a single R inside the voxel
+  const TFCSUpscalingSampler::Voxel_t linear = sampler.voxel(weights, 2, 0);
+  EXPECT_TRUE(linear.linear_r);
+  for (int i = 0; i < 100; ++i) {
+    float R_min = 0, R_max = 2, alpha_min = 0, alpha_max = 2;
+    TFCSUpscalingSampler::sample(
+        &rnd_engine, linear, R_min, R_max, alpha_min, alpha_max);
+    EXPECT_EQ(R_min, R_max);
+    EXPECT_GE(R_min, 0);
+    EXPECT_LE(R_min, 2);
+  }
+
+  // Bins without a distribution are sampled uniformly
+  EXPECT_NEAR(sampler.voxel(weights, 1, 5).p_alpha_low, 0.5, 1e-6);
+}
+
+TEST_F(BasicSimTests, HitCellMappingBatchMatchesSingle)
+{
+  const int layer = 2;
+  TFCSHitCellMapping mapping("Mapping", "Mapping", AtlasGeoTests::geo);
+  mapping.set_calosample(layer);
+
+  // Hits on a fine grid, so that many consecutive hits share a cell
+  std::vector<Position> positions;
+  std::vector<float> E;
+  for (int ieta = 0; ieta < 40; ++ieta) {
+    for (int iphi = 0; iphi < 40; ++iphi) {
+      const float eta = 0.2 + 0.002 * ieta;
+      const float phi = 1.76 + 0.002 * iphi;
+      positions.push_back(Position {0, 0, 0, eta, phi, 0});
+      E.push_back(1 + ieta + 0.5 * iphi);
+    }
+  }
+
+  std::vector<const Cell*> cells;
+  AtlasGeoTests::geo->get_cells(layer, positions, cells);
+  ASSERT_EQ(cells.size(), positions.size());
+  for (std::size_t i = 0; i < positions.size(); ++i)
+    EXPECT_EQ(cells[i]->id(),
+              AtlasGeoTests::geo->get_cell(layer, positions[i]).id());
+
+  CLHEP::RanluxEngine rnd_engine;
+  TFCSSimulationState single_state(&rnd_engine);
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    TFCSLateralShapeParametrizationHitBase::Hit hit;
+    hit.set_eta_x(positions[i].eta());
+    hit.set_phi_y(positions[i].phi());
+    hit.set_E(E[i]);
+    mapping.simulate_hit(hit, single_state, nullptr, nullptr);
+  }
+
+  TFCSSimulationState batch_state(&rnd_engine);
+  mapping.simulate_hits(batch_state, positions, E);
+
+  EXPECT_GT(single_state.cells().size(), 1);
+  ASSERT_EQ(batch_state.cells().size(), single_state.cells().size());
+  for (const auto& [id, E_cell] : single_state.cells()) {
+    ASSERT_EQ(batch_state.cells().count(id), 1);
+    EXPECT_NEAR(batch_state.cells().at(id), E_cell, 1e-5 * E_cell);
+  }
+}
+
+// Layers whose bin chain is a plain hit-cell mapping are deposited in one
+// batch by fillEnergy, with the same cell energies as running the chain for
+// every hit
+TEST_F(BasicSimTests, GANHitBatchMatchesPerHit)
+{
+  const float eta = 0.225;
+  const float phi = 1.8;
+  const std::vector<int> layers = {2, 3};
+
+  // GAN inputs for pions in 0.20 < |eta| < 0.25. The network ignores the
+  // noise and returns fixed voxel energies, three voxels in layer 2 and two
+  // in layer 3
+  const std::string folder = std::string(TEST_OUTPUT_DIR) + "/gan_input";
+  std::filesystem::create_directories(folder + "/rootFiles");
+  {
+    std::ofstream xml(folder + "/binning.xml");
+    xml << "<Bins><Particle pid=\"211\" latentDim=\"2\" "
+           "symmetriseAlpha=\"false\"><Bin etaMin=\"20\" etaMax=\"25\" "
+           "regionId=\"0\" ganVersion=\"2\">"
+           "<Layer id=\"2\" r_edges=\"0,5,20,50\" n_bin_alpha=\"1\"/>"
+           "<Layer id=\"3\" r_edges=\"0,10,40\" n_bin_alpha=\"1\"/>"
+           "</Bin></Particle></Bins>";
+
+    auto variables = [](int n)
+    {
+      std::string list;
+      for (int i = 0; i < n; ++i)
+        list += std::string(i ? ", " : "") + "{\"name\": \"variable_"
+            + std::to_string(i) + "\", \"offset\": 0, \"scale\": 1}";
+      return "[" + list + "]";
+    };
+    std::string weights = "0";
+    for (int i = 1; i < 5 * 4; ++i)
+      weights += ", 0";
+    std::ofstream json(folder + "/neural_net_211_eta_20_25_All.json");
+    json << "{\"input_sequences\": [], \"inputs\": [{\"name\": \"node_0\", "
+         << "\"variables\": " << variables(2) << "}, {\"name\": \"node_1\", "
+         << "\"variables\": " << variables(2) << "}], \"layers\": [{"
+         << "\"architecture\": \"dense\", \"activation\": \"linear\", "
+         << "\"weights\": [" << weights << "], "
+         << "\"bias\": [0.3, 0.2, 0.1, 0.25, 0.15]}], \"nodes\": ["
+         << "{\"type\": \"input\", \"sources\": [0], \"size\": 2}, "
+         << "{\"type\": \"input\", \"sources\": [1], \"size\": 2}, "
+         << "{\"type\": \"concatenate\", \"sources\": [0, 1]}, "
+         << "{\"type\": \"feed_forward\", \"layer_index\": 0, "
+         << "\"sources\": [2]}], \"outputs\": {\"out\": {\"labels\": "
+         << "[\"out_0\", \"out_1\", \"out_2\", \"out_3\", \"out_4\"], "
+         << "\"node_index\": 3}}}";
+  }
+  // Empty radial distributions, so that the hits are placed on a grid in r
+  {
+    TFile file(
+        (folder + "/rootFiles/pid211_E1048576_eta_20_25.root").c_str(),
+        "RECREATE");
+    for (int layer : layers) {
+      TH1D h(("r" + std::to_string(layer) + "w").c_str(), "", 10, 0, 50);
+      h.Write();
+    }
+  }
+  {
+    TFile file(
+        (folder + "/rootFiles/pid211_E65536_eta_20_25_validation.root")
+            .c_str(),
+        "RECREATE");
+    TTree tree("rootTree", "rootTree");
+    std::vector<float> weights(layers.size(), 0.5);
+    for (std::size_t i = 0; i < layers.size(); ++i)
+      tree.Branch(("extrapWeight_" + std::to_string(layers[i])).c_str(),
+                  &weights[i]);
+    tree.Fill();
+    tree.Write();
+  }
+
+  TFCSEnergyAndHitGANV2 gan("GAN", "GAN", AtlasGeoTests::geo);
+  ASSERT_TRUE(gan.initializeNetwork(211, 20, folder));
+
+  TFCSTruthState truth_state;
+  truth_state.SetPtEtaPhiM(65536, eta, phi, 139.57);
+  truth_state.set_pdgid(211);
+  TFCSExtrapolationState extrapol_state;
+  const Position center_pos {0, 0, 0, eta, phi, 0};
+  for (int i = 0; i < 24; ++i) {
+    const int layer = i == 3 ? 3 : 2;
+    const double r = AtlasGeoTests::geo->get_cell(layer, center_pos).r();
+    for (Cell::SubPos pos :
+         {Cell::SubPos::ENT, Cell::SubPos::EXT, Cell::SubPos::MID})
+    {
+      extrapol_state.set_eta(i, pos, eta);
+      extrapol_state.set_phi(i, pos, phi);
+      extrapol_state.set_r(i, pos, r);
+      extrapol_state.set_z(i, pos, r * std::sinh(eta));
+    }
+  }
+
+  // Hit chain of every layer: the center position and the cell mapping
+  std::vector<std::unique_ptr<TFCSLateralShapeParametrizationHitBase>> owner;
+  for (int layer : layers) {
+    auto center =
+        std::make_unique<TFCSCenterPositionCalculation>("Center", "Center");
+    center->set_calosample(layer);
+    auto mapping = std::make_unique<TFCSHitCellMapping>(
+        "Mapping", "Mapping", AtlasGeoTests::geo);
+    mapping->set_calosample(layer);
+    gan.push_back_in_bin(center.get(), layer);
+    gan.set_nr_of_init(layer, 1);
+    gan.push_back_in_bin(mapping.get(), layer);
+    owner.push_back(std::move(center));
+    owner.push_back(std::move(mapping));
+  }
+
+  auto simulate = [&]()
+  {
+    CLHEP::RanluxEngine rnd_engine;
+    rnd_engine.setSeed(42);
+    TFCSSimulationState simul_state(&rnd_engine);
+    EXPECT_TRUE(gan.fillEnergy(simul_state, &truth_state, &extrapol_state));
+    return simul_state.cells();
+  };
+  const auto batch = simulate();
+
+  // A hit simulation that changes nothing after the mapping, so that the
+  // chain is run for every hit
+  class KeepHit : public TFCSLateralShapeParametrizationHitBase
+  {
+  public:
+    FCSReturnCode simulate_hit(Hit&,
+                               TFCSSimulationState&,
+                               const TFCSTruthState*,
+                               const TFCSExtrapolationState*) override
+    {
+      return FCSSuccess;
+    }
+  };
+  KeepHit keep;
+  for (int layer : layers)
+    gan.push_back_in_bin(&keep, layer);
+  const auto single = simulate();
+
+  EXPECT_GT(single.size(), 2);
+  ASSERT_EQ(batch.size(), single.size());
+  for (const auto& [id, E_cell] : single) {
+    ASSERT_EQ(batch.count(id), 1);
+    EXPECT_NEAR(batch.at(id), E_cell, 1e-5 * E_cell);
+  }
+}
+
+TEST_F(BasicSimTests, BinnedShowerLoadsLayersConcurrently)
+{
+  const std::string path =
+      std::string(TEST_OUTPUT_DIR) + "/binned_shower_library.h5";
+
+  // Layers 0 and 2 with a different number of bins, layer 1 has no data
+  const hsize_t n_events = 100;
+  const std::vector<hsize_t> n_bins = {30, 0, 12};
+  auto energy = [](hsize_t event, hsize_t bin, long unsigned int layer)
+  { return (bin + event + layer) % 3 == 0 ? float(event + 0.01 * bin) : 0.f; };
+  {
+    H5::H5File file(path, H5F_ACC_TRUNC);
+    for (long unsigned int layer : {0ul, 2ul}) {
+      const hsize_t dims[2] = {n_events, n_bins[layer]};
+      std::vector<float> data;
+      for (hsize_t event = 0; event < n_events; ++event)
+        for (hsize_t bin = 0; bin < n_bins[layer]; ++bin)
+          data.push_back(energy(event, bin, layer));
+      const std::string suffix = "_layer_" + std::to_string(layer);
+      file.createDataSet("energy" + suffix,
+                         H5::PredType::NATIVE_FLOAT,
+                         H5::DataSpace(2, dims))
+          .write(data.data(), H5::PredType::NATIVE_FLOAT);
+
+      const std::vector<float> boundaries(n_bins[layer], 1);
+      for (const std::string name :
+           {"binstart_radius", "binsize_radius", "binstart_alpha",
+            "binsize_alpha"})
+      {
+        file.createDataSet(name + suffix,
+                           H5::PredType::NATIVE_FLOAT,
+                           H5::DataSpace(1, dims + 1))
+            .write(boundaries.data(), H5::PredType::NATIVE_FLOAT);
+      }
+    }
+  }
+
+  for (unsigned int n_threads : {1u, 3u}) {
+    TFCSBinnedShower shower("BinnedShower", "BinnedShower");
+    std::vector<long unsigned int> layers = {0, 1, 2};
+    shower.load_event_library(path, layers, false, n_threads);
+    const TFCSBinnedShower::eventvector_t library = shower.get_eventlibrary();
+    ASSERT_EQ(library.size(), n_events);
+    for (hsize_t event = 0; event < n_events; ++event) {
+      ASSERT_EQ(library[event].event_data.size(), 3u);
+      EXPECT_TRUE(library[event].event_data[1].E_vector.empty());
+      for (long unsigned int layer : {0ul, 2ul}) {
+        const TFCSBinnedShower::layer_t& voxels =
+            library[event].event_data[layer];
+        std::size_t i = 0;
+        for (hsize_t bin = 0; bin < n_bins[layer]; ++bin) {
+          if (energy(event, bin, layer) == 0)
+            continue;
+          ASSERT_LT(i, voxels.E_vector.size());
+          EXPECT_EQ(voxels.bin_index_vector[i], bin);
+          EXPECT_EQ(voxels.E_vector[i], energy(event, bin, layer));
+          ++i;
+        }
+        EXPECT_EQ(i, voxels.E_vector.size());
+      }
+    }
+  }
+}
+
+TEST_F(BasicSimTests, ShowerLibraryDepositsRelativeToImpactCell)
+{
+  const int pdgid = 22;
+  TFCSShowerLibrary library("ShowerLibrary", "ShowerLibrary");
+  library.set_geometry(AtlasGeoTests::geo);
+  library.set_binning({pdgid}, {0, 1000, 4000}, {0, 1.4, 3.2}, 2);
+
+  // Half of the energy in the impact cell of the middle layer, the rest in
+  // its neighbours and in the strip layer
+  const std::vector<TFCSShowerLibrary::ShowerCell_t> shower = {
+      {2, 0, 0, 0.5}, {2, 1, 0, 0.2}, {1, 0, 0, 0.1}, {2, 0, -1, 0.1}};
+  for (unsigned int phi_bin = 0; phi_bin < 2; ++phi_bin)
+    EXPECT_TRUE(library.add_shower(pdgid, 1, 0, phi_bin, shower));
+  EXPECT_FALSE(library.add_shower(pdgid, 2, 0, 0, shower));
+  EXPECT_FALSE(library.add_shower(11, 0, 0, 0, shower));
+  // Cells that can't be stored or are not in the geometry
+  EXPECT_FALSE(library.add_shower(pdgid, 0, 0, 0, {{2, 40000, 0, 0.5}}));
+  EXPECT_FALSE(library.add_shower(pdgid, 0, 0, 0, {{2, 0, -40000, 0.5}}));
+  EXPECT_FALSE(library.add_shower(pdgid, 0, 0, 0, {{-1, 0, 0, 0.5}}));
+  EXPECT_FALSE(library.add_shower(pdgid, 0, 0, 0, {{300, 0, 0, 0.5}}));
+  EXPECT_EQ(library.n_showers(), 2u);
+  EXPECT_EQ(library.n_showers(pdgid, 1, 0, 1), 1u);
+  EXPECT_EQ(library.get_bin(11, 2000, 0.2, 0.5), -1);
+  // Energies and eta outside of the bins use the closest bin
+  EXPECT_EQ(library.get_bin(pdgid, 1e5, 5, 0.9),
+            library.get_bin(pdgid, 3000, 2, 0.6));
+
+  for (const float eta : {0.225f, -0.225f}) {
+    const float phi = 1.8;
+    TFCSTruthState truth_state;
+    truth_state.SetPtEtaPhiM(2000, eta, phi, 0);
+    truth_state.set_pdgid(pdgid);
+    TFCSExtrapolationState extrapol_state;
+    extrapol_state.set_IDCaloBoundary_eta(eta);
+    for (int i = 0; i < 24; ++i) {
+      extrapol_state.set_OK(i, Cell::SubPos::MID);
+      extrapol_state.set_eta(i, Cell::SubPos::MID, eta);
+      extrapol_state.set_phi(i, Cell::SubPos::MID, phi);
+    }
+
+    CLHEP::RanluxEngine rnd_engine;
+    TFCSSimulationState simul_state(&rnd_engine);
+    const double E = truth_state.Ekin();
+    simul_state.set_E(E);
+    EXPECT_EQ(library.simulate(simul_state, &truth_state, &extrapol_state),
+              FCSSuccess);
+
+    EXPECT_NEAR(simul_state.E(), 0.9 * E, 1e-4 * E);
+    EXPECT_NEAR(simul_state.E(2), 0.8 * E, 1e-4 * E);
+    EXPECT_NEAR(simul_state.Efrac(1), 0.1 / 0.9, 1e-4);
+    EXPECT_EQ(simul_state.cells().size(), 4u);
+
+    const Position pos {0, 0, 0, eta, phi, 0};
+    const Cell& impact = AtlasGeoTests::geo->get_cell(2, pos);
+    EXPECT_NEAR(simul_state.cells().at(impact.id()), 0.5 * E, 1e-4 * E);
+    // The eta offsets are mirrored for negative eta
+    for (const auto& [id, E_cell] : simul_state.cells()) {
+      const Cell& cell = AtlasGeoTests::geo->get_cell(id);
+      if (std::abs(E_cell - 0.2 * E) < 1e-4 * E) {
+        EXPECT_NEAR(cell.eta() - impact.eta(),
+                    eta > 0 ? impact.deta() : -impact.deta(),
+                    1e-3);
+      }
+    }
+
+    // No energy in a layer the particle was not extrapolated to
+    extrapol_state.set_OK(1, Cell::SubPos::MID, false);
+    TFCSSimulationState skipped_state(&rnd_engine);
+    skipped_state.set_E(E);
+    EXPECT_EQ(library.simulate(skipped_state, &truth_state, &extrapol_state),
+              FCSSuccess);
+    EXPECT_NEAR(skipped_state.E(), 0.8 * E, 1e-4 * E);
+    EXPECT_EQ(skipped_state.E(1), 0);
+    EXPECT_EQ(skipped_state.cells().size(), 3u);
+  }
+}
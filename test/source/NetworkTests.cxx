@@ -0,0 +1,955 @@
+// Copyright (c) 2026 CERN for the benefit of the FastCaloSim project
+
+#include "NetworkTests.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <CLHEP/Random/RanluxEngine.h>
+#include <gtest/gtest.h>
+
+#include "FastCaloSim/Core/TFCSConfigCache.h"
+#include "FastCaloSim/Core/TFCSContentHash.h"
+#include "FastCaloSim/Core/TFCSDenseNetwork.h"
+#include "FastCaloSim/Core/TFCSInferencePipeline.h"
+#include "FastCaloSim/Core/TFCSMLCalorimeterSimulator.h"
+#include "FastCaloSim/Core/TFCSNetworkFactory.h"
+#include "FastCaloSim/Core/TFCSONNXHandler.h"
+#include "FastCaloSim/Core/TFCSONNXQuantization.h"
+#include "FastCaloSim/Core/TFCSONNXRuntime.h"
+#include "FastCaloSim/Core/TFCSSimulationState.h"
+#include "FastCaloSim/Core/VNetworkBase.h"
+#include "TestHelpers/Benchmark.h"
+
+TEST_F(NetworkTests, ONNXSessionConfig)
+{
+  const TFCSONNXRuntime::SessionConfig original =
+      TFCSONNXRuntime::defaultSessionConfig();
+
+  TFCSONNXRuntime::SessionConfig config = original;
+  config.intra_op_threads = 3;
+  config.graph_optimization_level = 1;
+  config.cpu_mem_arena = false;
+  TFCSONNXRuntime::setDefaultSessionConfig(config);
+  EXPECT_EQ(TFCSONNXRuntime::defaultSessionConfig().intra_op_threads, 3);
+  EXPECT_EQ(TFCSONNXRuntime::defaultSessionConfig().graph_optimization_level,
+            1);
+  EXPECT_FALSE(TFCSONNXRuntime::defaultSessionConfig().cpu_mem_arena);
+
+  // Networks created with different options give the same results
+  const std::vector<char> model = make_mlp({8, 16, 4});
+  std::unique_ptr<VNetworkBase> net = TFCSNetworkFactory::create(model);
+  TFCSONNXRuntime::setDefaultSessionConfig(original);
+  std::unique_ptr<VNetworkBase> reference = TFCSNetworkFactory::create(model);
+
+  const std::vector<float> input = {1, -2, 3, -4, 5, -6, 7, -8};
+  VNetworkBase::TensorOutputs outputs, reference_outputs;
+  net->computeTensors({input}, outputs);
+  reference->computeTensors({input}, reference_outputs);
+  ASSERT_EQ(outputs.size(), 1u);
+  ASSERT_EQ(outputs[0].size(), 4u);
+  for (std::size_t i = 0; i < outputs[0].size(); ++i)
+    EXPECT_NEAR(outputs[0][i], reference_outputs[0][i], 1e-5);
+}
+
+TEST_F(NetworkTests, ONNXIoBinding)
+{
+  std::unique_ptr<VNetworkBase> net =
+      TFCSNetworkFactory::create(make_mlp({8, 16, 4}));
+
+  std::vector<float> batch(3 * 8);
+  for (std::size_t i = 0; i < batch.size(); ++i)
+    batch[i] = std::cos(0.3 * i);
+
+  // Single rows through the typed and the string keyed interface
+  std::vector<std::vector<float>> rows;
+  VNetworkBase::TensorOutputs outputs;
+  for (int row = 0; row < 3; ++row) {
+    net->computeTensors({VNetworkBase::TensorView(&batch[row * 8], 8)},
+                        outputs);
+    ASSERT_EQ(outputs[0].size(), 4u);
+    rows.push_back(outputs[0]);
+
+    VNetworkBase::NetworkInputs inputs;
+    for (int i = 0; i < 8; ++i)
+      inputs["input"]["input_" + std::to_string(i)] = batch[row * 8 + i];
+    const VNetworkBase::NetworkOutputs map_outputs = net->compute(inputs);
+    const std::vector<std::string> layers = net->getOutputLayers();
+    ASSERT_EQ(layers.size(), 4u);
+    for (int i = 0; i < 4; ++i)
+      EXPECT_NEAR(map_outputs.at(layers[i]), rows[row][i], 1e-6);
+  }
+
+  // The outputs are written straight into the caller's vector
+  const float* output_data = outputs[0].data();
+  net->computeTensors({VNetworkBase::TensorView(batch.data(), 8)}, outputs);
+  EXPECT_EQ(outputs[0].data(), output_data);
+  for (int i = 0; i < 4; ++i)
+    EXPECT_EQ(outputs[0][i], rows[0][i]);
+
+  // Changing the batch size binds the buffers again
+  for (std::size_t n_batch : {3, 1, 3}) {
+    net->computeTensorsBatch(
+        {VNetworkBase::TensorView(batch.data(), 8 * n_batch)},
+        n_batch,
+        outputs);
+    ASSERT_EQ(outputs[0].size(), 4 * n_batch);
+    for (std::size_t i = 0; i < outputs[0].size(); ++i)
+      EXPECT_NEAR(outputs[0][i], rows[i / 4][i % 4], 1e-6);
+  }
+
+  // Every thread has its own binding
+  std::vector<std::thread> workers;
+  std::vector<int> mismatches(4, 0);
+  for (int w = 0; w < 4; ++w)
+    workers.emplace_back(
+        [&, w]()
+        {
+          VNetworkBase::TensorOutputs thread_outputs;
+          for (int i = 0; i < 100; ++i) {
+            const int row = (i + w) % 3;
+            net->computeTensors(
+                {VNetworkBase::TensorView(&batch[row * 8], 8)},
+                thread_outputs);
+            for (int j = 0; j < 4; ++j)
+              if (std::abs(thread_outputs[0][j] - rows[row][j]) > 1e-6)
+                ++mismatches[w];
+          }
+        });
+  for (std::thread& worker : workers)
+    worker.join();
+  EXPECT_EQ(mismatches, std::vector<int>(4, 0));
+}
+
+TEST_F(NetworkTests, ONNXBindingsOfReplacedSession)
+{
+  // Keep the bytes, so that the session can be created again
+  const bool release = TFCSONNXRuntime::releaseModelBytes();
+  TFCSONNXRuntime::setReleaseModelBytes(false);
+  TFCSONNXHandler handler(make_mlp({8, 16, 4}));
+
+  const std::vector<float> input = {1, -2, 3, -4, 5, -6, 7, -8};
+  VNetworkBase::TensorOutputs reference, outputs;
+  handler.computeTensors({input}, reference);
+  std::thread([&]() { handler.computeTensors({input}, outputs); }).join();
+  EXPECT_EQ(outputs, reference);
+
+  // The bindings of the old session are released, every thread gets a new
+  // one for the new session
+  const TFCSONNXRuntime::SessionConfig config = handler.getSessionConfig();
+  handler.setSessionConfig(config);
+  TFCSONNXRuntime::setReleaseModelBytes(release);
+  for (int i = 0; i < 2; ++i) {
+    outputs.clear();
+    handler.computeTensors({input}, outputs);
+    EXPECT_EQ(outputs, reference);
+    outputs.clear();
+    std::thread([&]() { handler.computeTensors({input}, outputs); }).join();
+    EXPECT_EQ(outputs, reference);
+  }
+}
+
+TEST_F(NetworkTests, ONNXSharedSessions)
+{
+  const std::size_t n_sessions = TFCSONNXRuntime::nSessions();
+  const std::vector<char> model = make_mlp({4, 8, 2});
+  std::unique_ptr<VNetworkBase> first = TFCSNetworkFactory::create(model);
+  std::unique_ptr<VNetworkBase> second = TFCSNetworkFactory::create(model);
+  // Sessions are only created on first use
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions);
+
+  const std::vector<float> input = {0.5, -1, 2, 0};
+  VNetworkBase::TensorOutputs first_outputs, second_outputs;
+  first->computeTensors({input}, first_outputs);
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions + 1);
+  // The same model shares the session
+  second->computeTensors({input}, second_outputs);
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions + 1);
+  EXPECT_EQ(first_outputs, second_outputs);
+
+  first.reset();
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions + 1);
+  second.reset();
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions);
+}
+
+TEST_F(NetworkTests, ContentHash)
+{
+  // FIPS 180-4 examples
+  const std::string abc = "abc";
+  EXPECT_EQ(TFCSContentHash::hex(TFCSContentHash::sha256(abc.data(), 3)),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  const std::string two_blocks =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ(TFCSContentHash::hex(
+                TFCSContentHash::sha256(two_blocks.data(), two_blocks.size())),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  EXPECT_EQ(TFCSContentHash::hex(TFCSContentHash::sha256(nullptr, 0)),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  EXPECT_EQ(TFCSContentHash::fnv1a(nullptr, 0), 14695981039346656037ULL);
+
+  // Different models do not share a session
+  const std::size_t n_sessions = TFCSONNXRuntime::nSessions();
+  std::unique_ptr<VNetworkBase> first =
+      TFCSNetworkFactory::create(make_mlp({4, 8, 2}));
+  std::unique_ptr<VNetworkBase> second =
+      TFCSNetworkFactory::create(make_mlp({4, 9, 2}));
+  const std::vector<float> input = {0.5, -1, 2, 0};
+  VNetworkBase::TensorOutputs outputs;
+  first->computeTensors({input}, outputs);
+  second->computeTensors({input}, outputs);
+  EXPECT_EQ(TFCSONNXRuntime::nSessions(), n_sessions + 2);
+}
+
+TEST_F(NetworkTests, LWTNNDenseNetwork)
+{
+  const bool original = TFCSDenseNetwork::enabled();
+  for (bool graph : {false, true}) {
+    const std::string json = make_lwtnn_json({12, 32, 16, 5}, graph);
+    TFCSDenseNetwork::setEnabled(false);
+    std::unique_ptr<VNetworkBase> reference =
+        TFCSNetworkFactory::create(json, graph);
+    TFCSDenseNetwork::setEnabled(true);
+    std::unique_ptr<VNetworkBase> net = TFCSNetworkFactory::create(json, graph);
+
+    // String keyed inputs, named as in TFCSGANEtaSlice for the graph
+    VNetworkBase::NetworkInputs inputs;
+    std::vector<std::vector<float>> nodes(graph ? 2 : 1);
+    for (int i = 0; i < 12; ++i) {
+      const float value = std::sin(0.4 * i);
+      const int node = graph && i >= 10 ? 1 : 0;
+      const std::string name = graph ? (node ? "mycond" : "Noise") : "node_0";
+      inputs[name]["variable_" + std::to_string(nodes[node].size())] = value;
+      nodes[node].push_back(value);
+    }
+    const VNetworkBase::NetworkOutputs outputs = net->compute(inputs);
+    const VNetworkBase::NetworkOutputs reference_outputs =
+        reference->compute(inputs);
+    ASSERT_EQ(outputs.size(), 5u);
+    for (const auto& output : reference_outputs)
+      EXPECT_NEAR(outputs.at(output.first), output.second, 1e-5);
+
+    // Typed inputs, one row and a batch of the same row twice
+    VNetworkBase::TensorInputs tensors(nodes.begin(), nodes.end());
+    VNetworkBase::TensorOutputs values, reference_values;
+    net->computeTensors(tensors, values);
+    reference->computeTensors(tensors, reference_values);
+    ASSERT_EQ(values.size(), 1u);
+    ASSERT_EQ(values[0].size(), 5u);
+    for (std::size_t i = 0; i < 5; ++i)
+      EXPECT_NEAR(values[0][i], reference_values[0][i], 1e-5);
+    EXPECT_TRUE(TFCSDenseNetwork::validate("test", values, reference_values));
+
+    std::vector<std::vector<float>> batch;
+    for (const std::vector<float>& node : nodes) {
+      batch.push_back(node);
+      batch.back().insert(batch.back().end(), node.begin(), node.end());
+    }
+    VNetworkBase::TensorOutputs batch_values;
+    const VNetworkBase::TensorInputs batch_tensors(batch.begin(), batch.end());
+    net->computeTensorsBatch(batch_tensors, 2, batch_values);
+    ASSERT_EQ(batch_values[0].size(), 10u);
+    for (std::size_t i = 0; i < 10; ++i)
+      EXPECT_NEAR(batch_values[0][i], values[0][i % 5], 1e-6);
+
+    // Unused inputs are ignored as by lwtnn, which is not even set up
+    // for the precompiled network. Missing inputs are an error
+    inputs.begin()->second["unused"] = 1;
+    if (graph)
+      inputs["unused"]["variable_0"] = 1;
+    const VNetworkBase::NetworkOutputs extra_outputs = net->compute(inputs);
+    for (const auto& output : reference_outputs)
+      EXPECT_NEAR(extra_outputs.at(output.first), output.second, 1e-5);
+    inputs.begin()->second.erase("variable_0");
+    EXPECT_THROW(net->compute(inputs), std::runtime_error);
+  }
+  TFCSDenseNetwork::setEnabled(original);
+}
+
+// Typed inputs and outputs of a graph with two output nodes, the hidden
+// layer and the last layer. Both are evaluated with one pass over the graph
+TEST_F(NetworkTests, LWTNNTensorOutputs)
+{
+  const bool original = TFCSDenseNetwork::enabled();
+  const std::string single = make_lwtnn_json({12, 16, 5}, true);
+  std::string json = single;
+  std::string hidden_labels;
+  for (int i = 0; i < 16; ++i)
+    hidden_labels += (i ? ", \"hidden_" : "\"hidden_") + std::to_string(i)
+        + "\"";
+  const std::string outputs_key = "\"outputs\": {";
+  const std::size_t position = json.rfind(outputs_key);
+  ASSERT_NE(position, std::string::npos);
+  json.insert(position + outputs_key.size(),
+              "\"hidden\": {\"labels\": [" + hidden_labels
+                  + "], \"node_index\": 3}, ");
+
+  TFCSDenseNetwork::setEnabled(false);
+  std::unique_ptr<VNetworkBase> lwtnn = TFCSNetworkFactory::create(json, true);
+  std::unique_ptr<VNetworkBase> reference =
+      TFCSNetworkFactory::create(single, true);
+  TFCSDenseNetwork::setEnabled(true);
+  std::unique_ptr<VNetworkBase> dense = TFCSNetworkFactory::create(json, true);
+  TFCSDenseNetwork::setEnabled(original);
+  ASSERT_EQ(lwtnn->getOutputNodes(),
+            std::vector<std::string>({"hidden", "out"}));
+
+  std::vector<std::vector<float>> nodes = {std::vector<float>(10),
+                                           std::vector<float>(2)};
+  for (std::size_t node = 0; node < nodes.size(); ++node)
+    for (std::size_t i = 0; i < nodes[node].size(); ++i)
+      nodes[node][i] = std::cos(0.3 * i + node);
+  const VNetworkBase::TensorInputs tensors(nodes.begin(), nodes.end());
+  VNetworkBase::TensorOutputs values, dense_values, reference_values;
+  lwtnn->computeTensors(tensors, values);
+  dense->computeTensors(tensors, dense_values);
+  reference->computeTensors(tensors, reference_values);
+  ASSERT_EQ(values.size(), 2u);
+  ASSERT_EQ(values[0].size(), 16u);
+  ASSERT_EQ(values[1].size(), 5u);
+  ASSERT_EQ(dense_values.size(), 2u);
+  EXPECT_TRUE(TFCSDenseNetwork::validate("test", dense_values, values));
+  for (std::size_t i = 0; i < 5; ++i)
+    EXPECT_NEAR(values[1][i], reference_values[0][i], 1e-6);
+  // The hidden layer has rectified activations
+  for (float value : values[0])
+    EXPECT_GE(value, 0);
+
+}
+
+TEST_F(NetworkTests, LWTNNConfigCache)
+{
+  const std::string original = TFCSConfigCache::directory();
+  const std::string directory = ::testing::TempDir() + "fcs_config_cache";
+  std::filesystem::remove_all(directory);
+  TFCSConfigCache::setDirectory(directory);
+  for (bool graph : {false, true}) {
+    const std::string json = make_lwtnn_json({12, 16, 5}, graph);
+    const unsigned int stored = TFCSConfigCache::nStored();
+    const unsigned int hits = TFCSConfigCache::nHits();
+
+    // First creation parses and stores, the second reads the entry back
+    std::unique_ptr<VNetworkBase> parsed =
+        TFCSNetworkFactory::create(json, graph);
+    EXPECT_EQ(TFCSConfigCache::nStored(), stored + 1);
+    std::unique_ptr<VNetworkBase> cached =
+        TFCSNetworkFactory::create(json, graph);
+    EXPECT_EQ(TFCSConfigCache::nHits(), hits + 1);
+
+    std::vector<std::vector<float>> nodes;
+    for (int node = 0; node < (graph ? 2 : 1); ++node)
+      nodes.emplace_back(graph ? 10 - 8 * node : 12, 0.25f * (node + 1));
+    const VNetworkBase::TensorInputs tensors(nodes.begin(), nodes.end());
+    VNetworkBase::TensorOutputs values, cached_values;
+    parsed->computeTensors(tensors, values);
+    cached->computeTensors(tensors, cached_values);
+    ASSERT_EQ(cached_values.size(), values.size());
+    EXPECT_EQ(cached_values[0], values[0]);
+
+    // An entry with the right file name and hash but another digest, as
+    // written for a text with colliding hash, is parsed again. The digest
+    // follows the magic, version and hash in the header
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+      std::fstream file(entry.path(),
+                        std::ios::in | std::ios::out | std::ios::binary);
+      file.seekg(16);
+      const char byte = file.get();
+      file.seekp(16);
+      file.put(byte ^ 1);
+    }
+    std::unique_ptr<VNetworkBase> collided =
+        TFCSNetworkFactory::create(json, graph);
+    EXPECT_EQ(TFCSConfigCache::nHits(), hits + 1);
+    EXPECT_EQ(TFCSConfigCache::nStored(), stored + 2);
+    VNetworkBase::TensorOutputs collided_values;
+    collided->computeTensors(tensors, collided_values);
+    EXPECT_EQ(collided_values[0], values[0]);
+    std::filesystem::remove_all(directory);
+  }
+  TFCSConfigCache::setDirectory(original);
+  std::filesystem::remove_all(directory);
+}
+
+// Particles evaluated together in getEvents get the same events as with one
+// getEvent call each, as every particle draws from its own random engine
+TEST_F(NetworkTests, MLSimulatorBatchMatchesSingle)
+{
+  TFCSMLCalorimeterSimulator simulator;
+  simulator.setInputShapes({0, 4, 10}, {0, 2});
+  auto network = std::make_unique<VoxelStubNetwork>();
+  const VoxelStubNetwork* stub = network.get();
+  ASSERT_TRUE(simulator.setNetwork(std::move(network)));
+  simulator.set_max_batch_size(4);
+
+  const int n_particles = 6;
+  std::vector<std::unique_ptr<CLHEP::RanluxEngine>> single_engines;
+  std::vector<std::unique_ptr<CLHEP::RanluxEngine>> batch_engines;
+  std::vector<TFCSSimulationState> single_states(n_particles);
+  std::vector<TFCSSimulationState> batch_states(n_particles);
+  std::vector<TFCSSimulationState*> batch;
+  std::vector<float> etas, energies;
+  for (int i = 0; i < n_particles; ++i) {
+    single_engines.emplace_back(new CLHEP::RanluxEngine(100 + i));
+    batch_engines.emplace_back(new CLHEP::RanluxEngine(100 + i));
+    single_states[i].setRandomEngine(single_engines[i].get());
+    batch_states[i].setRandomEngine(batch_engines[i].get());
+    batch.push_back(&batch_states[i]);
+    etas.push_back(-0.5 + 0.2 * i);
+    energies.push_back(1000 * (i + 1));
+  }
+
+  const std::vector<TFCSMLCalorimeterSimulator::event_t> events =
+      simulator.getEvents(batch, etas, energies);
+  // Two network calls for six particles
+  EXPECT_EQ(stub->batches, std::vector<std::size_t>({4, 2}));
+  ASSERT_EQ(events.size(), std::size_t(n_particles));
+  for (int i = 0; i < n_particles; ++i) {
+    const TFCSMLCalorimeterSimulator::event_t single =
+        simulator.getEvent(single_states[i], etas[i], energies[i]);
+    ASSERT_EQ(events[i].event_data.size(), 3u);
+    ASSERT_EQ(single.event_data.size(), 3u);
+    for (int layer : {0, 2}) {
+      const auto& batch_layer = events[i].event_data[layer];
+      const auto& single_layer = single.event_data[layer];
+      EXPECT_EQ(batch_layer.bin_index_vector.size(), layer ? 6u : 4u);
+      EXPECT_EQ(batch_layer.bin_index_vector, single_layer.bin_index_vector);
+      ASSERT_EQ(batch_layer.E_vector.size(), single_layer.E_vector.size());
+      for (std::size_t v = 0; v < batch_layer.E_vector.size(); ++v)
+        EXPECT_FLOAT_EQ(batch_layer.E_vector[v], single_layer.E_vector[v]);
+    }
+  }
+  EXPECT_EQ(stub->batches.size(), 2u + n_particles);
+}
+
+// Only the rows with NaN outputs get new noise and are evaluated again,
+// the other particles keep their events
+TEST_F(NetworkTests, MLSimulatorRetriesNaNRows)
+{
+  typedef TFCSMLCalorimeterSimulator::event_t event_t;
+  const int n_particles = 6;
+  std::vector<std::vector<event_t>> results;
+  std::vector<std::vector<std::size_t>> batches;
+  // Rows 1 and 4 fail, and the retry of row 1 (row 6) fails once more
+  for (const std::set<std::size_t>& nan_rows :
+       {std::set<std::size_t>(), std::set<std::size_t>({1, 4, 6})})
+  {
+    TFCSMLCalorimeterSimulator simulator;
+    simulator.setInputShapes({0, 4, 10}, {0, 2});
+    auto network = std::make_unique<VoxelStubNetwork>();
+    network->nan_rows = nan_rows;
+    const VoxelStubNetwork* stub = network.get();
+    ASSERT_TRUE(simulator.setNetwork(std::move(network)));
+    simulator.set_max_batch_size(4);
+
+    std::vector<std::unique_ptr<CLHEP::RanluxEngine>> engines;
+    std::vector<TFCSSimulationState> states(n_particles);
+    std::vector<TFCSSimulationState*> batch;
+    std::vector<float> etas, energies;
+    for (int i = 0; i < n_particles; ++i) {
+      engines.emplace_back(new CLHEP::RanluxEngine(300 + i));
+      states[i].setRandomEngine(engines[i].get());
+      batch.push_back(&states[i]);
+      etas.push_back(-0.5 + 0.2 * i);
+      energies.push_back(1000 * (i + 1));
+    }
+    results.push_back(simulator.getEvents(batch, etas, energies));
+    batches.push_back(stub->batches);
+  }
+
+  EXPECT_EQ(batches[0], std::vector<std::size_t>({4, 2}));
+  EXPECT_EQ(batches[1], std::vector<std::size_t>({4, 2, 2, 1}));
+  for (int i = 0; i < n_particles; ++i) {
+    const event_t& clean = results[0][i];
+    const event_t& retried = results[1][i];
+    ASSERT_EQ(clean.event_data.size(), 3u);
+    ASSERT_EQ(retried.event_data.size(), 3u);
+    for (int layer : {0, 2}) {
+      const std::vector<float>& E = retried.event_data[layer].E_vector;
+      EXPECT_EQ(clean.event_data[layer].bin_index_vector,
+                retried.event_data[layer].bin_index_vector);
+      for (float value : E)
+        EXPECT_FALSE(std::isnan(value));
+      if (i == 1 || i == 4)
+        EXPECT_NE(E, clean.event_data[layer].E_vector);
+      else
+        EXPECT_EQ(E, clean.event_data[layer].E_vector);
+    }
+  }
+}
+
+// Jobs run in order in the background, submitting blocks while the queue
+// is full and uncollected jobs can be replaced or discarded
+TEST_F(NetworkTests, InferencePipeline)
+{
+  struct SquareJob : public TFCSInferencePipeline::Job
+  {
+    int value = 0;
+    int result = 0;
+    std::atomic<int>* finished = nullptr;
+    std::vector<int>* order = nullptr;
+
+    bool run() override
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      result = value * value;
+      order->push_back(value);
+      ++*finished;
+      if (value == 3)
+        throw std::runtime_error("failed evaluation");
+      return value != 5;
+    };
+  };
+
+  const unsigned int depth = 2;
+  const int n_jobs = 8;
+  std::vector<int> keys(n_jobs);
+  std::vector<int> order;
+  std::atomic<int> finished {0};
+  auto make_job = [&](int value)
+  {
+    auto job = std::make_shared<SquareJob>();
+    job->value = value;
+    job->finished = &finished;
+    job->order = &order;
+    return job;
+  };
+  TFCSInferencePipeline pipeline(depth);
+  EXPECT_EQ(pipeline.max_pending(), depth);
+
+  for (int i = 0; i < n_jobs; ++i) {
+    EXPECT_TRUE(pipeline.submit(&keys[i], make_job(i)));
+    EXPECT_LE(i + 1 - finished.load(), int(depth));
+    EXPECT_TRUE(pipeline.has(&keys[i]));
+  }
+
+  // Collected in any order, the results belong to their key
+  for (int i = n_jobs - 1; i >= 0; --i) {
+    bool ok = false;
+    auto job = std::static_pointer_cast<SquareJob>(
+        pipeline.collect(&keys[i], ok));
+    ASSERT_NE(job, nullptr);
+    EXPECT_EQ(job->result, i * i);
+    EXPECT_EQ(ok, i != 3 && i != 5);
+    EXPECT_FALSE(pipeline.has(&keys[i]));
+  }
+  bool ok = true;
+  EXPECT_EQ(pipeline.collect(&keys[0], ok), nullptr);
+  EXPECT_FALSE(ok);
+
+  ASSERT_EQ(order.size(), std::size_t(n_jobs));
+  for (int i = 0; i < n_jobs; ++i)
+    EXPECT_EQ(order[i], i);
+
+  // A job that was not collected is replaced by the next one of its key
+  EXPECT_TRUE(pipeline.submit(&keys[0], make_job(2)));
+  EXPECT_TRUE(pipeline.submit(&keys[0], make_job(4)));
+  auto job =
+      std::static_pointer_cast<SquareJob>(pipeline.collect(&keys[0], ok));
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->result, 16);
+  EXPECT_FALSE(pipeline.has(&keys[0]));
+
+  // Discarded jobs are gone
+  EXPECT_TRUE(pipeline.submit(&keys[1], make_job(6)));
+  pipeline.discard(&keys[1]);
+  EXPECT_FALSE(pipeline.has(&keys[1]));
+  EXPECT_EQ(pipeline.collect(&keys[1], ok), nullptr);
+}
+
+// Prefetching through the pipeline draws the same random numbers as
+// evaluating each particle in getEvent
+TEST_F(NetworkTests, MLSimulatorPipelineMatchesDirect)
+{
+  typedef TFCSMLCalorimeterSimulator::event_t event_t;
+  const int n_particles = 6;
+  auto eta = [](int i) { return -0.5f + 0.2f * i; };
+  auto energy = [](int i) { return 1000.f * (i + 1); };
+
+  std::vector<std::vector<event_t>> results;
+  std::vector<std::vector<double>> next_randoms;
+  for (unsigned int depth : {0u, 2u}) {
+    TFCSMLCalorimeterSimulator simulator;
+    simulator.setInputShapes({0, 4, 10}, {0, 2});
+    auto network = std::make_unique<VoxelStubNetwork>();
+    const VoxelStubNetwork* stub = network.get();
+    ASSERT_TRUE(simulator.setNetwork(std::move(network)));
+    simulator.set_pipeline_depth(depth);
+    EXPECT_EQ(simulator.pipeline_depth(), depth);
+
+    std::vector<std::unique_ptr<CLHEP::RanluxEngine>> engines;
+    std::vector<TFCSSimulationState> states(n_particles);
+    for (int i = 0; i < n_particles; ++i) {
+      engines.emplace_back(new CLHEP::RanluxEngine(200 + i));
+      states[i].setRandomEngine(engines[i].get());
+    }
+
+    // Keep depth particles in flight, including the simulated one
+    std::vector<event_t> events;
+    int next = 0;
+    for (int i = 0; i < n_particles; ++i) {
+      for (; next < n_particles && next < i + int(depth); ++next)
+        EXPECT_TRUE(simulator.submitEvent(states[next], eta(next),
+                                          energy(next)));
+      events.push_back(simulator.getEvent(states[i], eta(i), energy(i)));
+    }
+    EXPECT_EQ(stub->n_rows, std::size_t(n_particles));
+
+    results.push_back(events);
+    next_randoms.emplace_back();
+    for (auto& engine : engines)
+      next_randoms.back().push_back(engine->flat());
+  }
+
+  EXPECT_EQ(next_randoms[0], next_randoms[1]);
+  for (int i = 0; i < n_particles; ++i) {
+    const event_t& direct = results[0][i];
+    const event_t& pipelined = results[1][i];
+    ASSERT_EQ(direct.event_data.size(), 3u);
+    ASSERT_EQ(pipelined.event_data.size(), 3u);
+    for (int layer : {0, 2}) {
+      EXPECT_EQ(direct.event_data[layer].bin_index_vector,
+                pipelined.event_data[layer].bin_index_vector);
+      EXPECT_EQ(direct.event_data[layer].E_vector,
+                pipelined.event_data[layer].E_vector);
+    }
+  }
+}
+
+TEST_F(NetworkTests, ONNXQuantizedInt8)
+{
+  const std::vector<char> model = make_mlp({16, 64, 64, 32});
+  TFCSONNXQuantization::Report report;
+  const std::vector<char> quantized =
+      TFCSONNXQuantization::quantizeDynamicInt8(model, &report);
+  EXPECT_EQ(report.n_quantized, 3u);
+  EXPECT_EQ(report.n_skipped, 0u);
+  EXPECT_EQ(report.n_weights, std::size_t(16 * 64 + 64 * 64 + 64 * 32));
+  EXPECT_LT(quantized.size(), model.size() / 2);
+  EXPECT_TRUE(TFCSONNXQuantization::quantizeDynamicInt8(
+                  std::vector<char>(model.begin(), model.end() - 7))
+                  .empty());
+
+  // The factory quantizes a model file without int8 variant when loading
+  // it, and falls back to single precision without fp16 variant
+  const std::filesystem::path directory =
+      ::testing::TempDir() + "fcs_quantization";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  const std::string path = (directory / "mlp.onnx").string();
+  std::ofstream(path, std::ios::binary).write(model.data(), model.size());
+  EXPECT_EQ(
+      TFCSONNXQuantization::variantPath(path, TFCSONNXQuantization::kInt8),
+      (directory / "mlp.int8.onnx").string());
+
+  std::unique_ptr<VNetworkBase> reference = TFCSNetworkFactory::create(model);
+  std::unique_ptr<VNetworkBase> candidate =
+      TFCSNetworkFactory::create(path, TFCSONNXQuantization::kInt8);
+  std::unique_ptr<VNetworkBase> half =
+      TFCSNetworkFactory::create(path, TFCSONNXQuantization::kFP16);
+  std::filesystem::remove_all(directory);
+
+  const std::size_t n_events = 500;
+  std::vector<float> batch(n_events * 16);
+  for (std::size_t i = 0; i < batch.size(); ++i)
+    batch[i] = 2 * std::sin(0.37 * i + 0.01 * i * i);
+  const VNetworkBase::TensorInputs inputs = {
+      VNetworkBase::TensorView(batch.data(), batch.size())};
+  VNetworkBase::TensorOutputs reference_outputs, candidate_outputs,
+      half_outputs;
+  reference->computeTensorsBatch(inputs, n_events, reference_outputs);
+  candidate->computeTensorsBatch(inputs, n_events, candidate_outputs);
+  half->computeTensorsBatch(inputs, n_events, half_outputs);
+  EXPECT_EQ(half_outputs, reference_outputs);
+  ASSERT_EQ(candidate_outputs[0].size(), n_events * 32);
+
+  // A quantized handler runs the int8 model but keeps the single precision
+  // bytes for persistence
+  TFCSONNXHandler handler(model);
+  ASSERT_TRUE(handler.quantizeDynamicInt8());
+  std::ostringstream description;
+  description << handler;
+  EXPECT_NE(description.str().find(std::to_string(model.size()) + " bytes"),
+            std::string::npos);
+  VNetworkBase::TensorOutputs handler_outputs;
+  handler.computeTensorsBatch(inputs, n_events, handler_outputs);
+  EXPECT_EQ(handler_outputs, candidate_outputs);
+
+  std::vector<std::vector<float>> reference_events, candidate_events;
+  std::vector<std::vector<float>> shifted_events;
+  for (std::size_t event = 0; event < n_events; ++event) {
+    auto begin = reference_outputs[0].begin() + 32 * event;
+    reference_events.emplace_back(begin, begin + 32);
+    begin = candidate_outputs[0].begin() + 32 * event;
+    candidate_events.emplace_back(begin, begin + 32);
+    shifted_events.push_back(reference_events.back());
+    shifted_events.back()[event % 32] += 5;
+  }
+
+  const TFCSONNXQuantization::Comparison same =
+      TFCSONNXQuantization::compare(reference_events, reference_events);
+  EXPECT_EQ(same.n_events, n_events);
+  EXPECT_EQ(same.mean_event_difference, 0);
+  EXPECT_EQ(same.total_ks_distance, 0);
+  EXPECT_TRUE(same.agrees(1e-9));
+
+  // The int8 outputs agree with single precision, a shift of five units in
+  // one voxel per event does not
+  const TFCSONNXQuantization::Comparison comparison =
+      TFCSONNXQuantization::compare(reference_events, candidate_events);
+  EXPECT_TRUE(comparison.agrees(0.05))
+      << "mean shift " << comparison.total_mean_shift << ", rms ratio "
+      << comparison.total_rms_ratio << ", KS "
+      << comparison.total_ks_distance << ", voxel shift "
+      << comparison.max_voxel_mean_shift << ", event difference "
+      << comparison.mean_event_difference;
+  EXPECT_GT(comparison.mean_event_difference, 0);
+  EXPECT_FALSE(TFCSONNXQuantization::compare(reference_events, shifted_events)
+                   .agrees(0.05));
+  EXPECT_EQ(TFCSONNXQuantization::compare(reference_events, {}).n_events, 0u);
+}
+
+// int8 networks scale their inputs by the range of the whole batch, so each
+// particle is evaluated on its own, also if the batch queue is enabled
+TEST_F(NetworkTests, MLSimulatorInt8SingleParticleBatches)
+{
+  TFCSMLCalorimeterSimulator simulator;
+  simulator.setInputShapes({0, 4, 10}, {0, 2});
+  auto network = std::make_unique<VoxelStubNetwork>();
+  const VoxelStubNetwork* stub = network.get();
+  ASSERT_TRUE(
+      simulator.setNetwork(std::move(network), TFCSONNXQuantization::kInt8));
+  EXPECT_TRUE(simulator.is_int8());
+  simulator.set_max_batch_size(4);
+  simulator.set_max_batch_latency(1e6);
+
+  const int n_particles = 6;
+  std::vector<std::unique_ptr<CLHEP::RanluxEngine>> engines;
+  std::vector<TFCSSimulationState> states(n_particles);
+  std::vector<TFCSSimulationState*> batch;
+  for (int i = 0; i < n_particles; ++i) {
+    engines.emplace_back(new CLHEP::RanluxEngine(400 + i));
+    states[i].setRandomEngine(engines[i].get());
+    batch.push_back(&states[i]);
+  }
+  simulator.getEvents(batch,
+                      std::vector<float>(n_particles, 0.3),
+                      std::vector<float>(n_particles, 1000));
+  EXPECT_EQ(stub->batches, std::vector<std::size_t>(n_particles, 1));
+
+  // Without the batch queue a single call does not wait for the latency
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(simulator.getEvent(states[0], 0.3, 1000).event_data.size(), 3u);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  EXPECT_EQ(stub->batches.size(), std::size_t(n_particles + 1));
+}
+
+// Voxel energies of the int8 variant of a real shower model against single
+// precision, with the same noise for both. The model is not part of the
+// repository, its path is taken from the environment variable FCS_ML_MODEL.
+// It needs the default input shapes of TFCSMLCalorimeterSimulator
+TEST_F(NetworkTests, MLSimulatorInt8MatchesFP32)
+{
+  const char* path = std::getenv("FCS_ML_MODEL");
+  if (!path)
+    GTEST_SKIP() << "FCS_ML_MODEL not set";
+
+  std::vector<std::vector<std::vector<float>>> samples;
+  for (TFCSONNXQuantization::Precision precision :
+       {TFCSONNXQuantization::kFP32, TFCSONNXQuantization::kInt8})
+  {
+    TFCSMLCalorimeterSimulator simulator;
+    ASSERT_TRUE(simulator.loadSimulator(path, precision));
+    EXPECT_EQ(simulator.is_int8(),
+              precision == TFCSONNXQuantization::kInt8);
+
+    samples.emplace_back();
+    for (int event = 0; event < 200; ++event) {
+      CLHEP::RanluxEngine engine(1000 + event);
+      TFCSSimulationState state(&engine);
+      const float eta = 0.0065 * event;
+      const float energy = std::pow(2.0, 10 + event % 11);
+      samples.back().push_back(simulator.predictVoxels(state, eta, energy));
+      ASSERT_FALSE(samples.back().back().empty());
+    }
+  }
+
+  const TFCSONNXQuantization::Comparison comparison =
+      TFCSONNXQuantization::compare(samples[0], samples[1]);
+  EXPECT_EQ(comparison.n_events, samples[0].size());
+  EXPECT_TRUE(comparison.agrees(0.05))
+      << "mean shift " << comparison.total_mean_shift << ", rms ratio "
+      << comparison.total_rms_ratio << ", KS "
+      << comparison.total_ks_distance << ", voxel shift "
+      << comparison.max_voxel_mean_shift << ", event difference "
+      << comparison.mean_event_difference;
+}
+
+// Latency of a FastCaloGAN sized lwtnn graph with lwtnn and precompiled,
+// both give the same outputs
+TEST_F(NetworkTests, LWTNNDenseBenchmark)
+{
+  const bool benchmark = TestHelpers::run_benchmarks();
+  const bool original = TFCSDenseNetwork::enabled();
+  const std::string json = make_lwtnn_json({52, 50, 100, 200, 266}, true);
+  VNetworkBase::NetworkInputs inputs;
+  for (int i = 0; i < 50; ++i)
+    inputs["Noise"]["variable_" + std::to_string(i)] = std::cos(0.3 * i);
+  inputs["mycond"]["variable_0"] = 0.5;
+  inputs["mycond"]["variable_1"] = 0;
+
+  if (benchmark)
+    std::cout << std::setw(20) << "lwtnn graph" << std::setw(16) << "map [us]"
+              << std::setw(16) << "tensors [us]" << std::endl;
+  VNetworkBase::NetworkOutputs reference_map;
+  VNetworkBase::TensorOutputs reference_tensors;
+  for (bool dense : {false, true}) {
+    TFCSDenseNetwork::setEnabled(dense);
+    std::unique_ptr<VNetworkBase> net = TFCSNetworkFactory::create(json, true);
+    std::vector<float> noise(50), cond = {0.5, 0};
+    for (int i = 0; i < 50; ++i)
+      noise[i] = std::cos(0.3 * i);
+    const VNetworkBase::TensorInputs tensors = {noise, cond};
+    VNetworkBase::TensorOutputs outputs;
+
+    const int n_calls = benchmark ? 500 : 2;
+    VNetworkBase::NetworkOutputs map_outputs;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_calls; ++i)
+      map_outputs = net->compute(inputs);
+    const std::chrono::duration<double, std::micro> map_time =
+        std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_calls; ++i)
+      net->computeTensors(tensors, outputs);
+    const std::chrono::duration<double, std::micro> tensor_time =
+        std::chrono::steady_clock::now() - start;
+    if (benchmark)
+      std::cout << std::setw(20) << (dense ? "precompiled" : "lwtnn")
+                << std::setw(16) << map_time.count() / n_calls
+                << std::setw(16) << tensor_time.count() / n_calls << std::endl;
+
+    ASSERT_EQ(map_outputs.size(), 266u);
+    ASSERT_EQ(outputs.size(), 1u);
+    ASSERT_EQ(outputs[0].size(), 266u);
+    if (!dense) {
+      reference_map = map_outputs;
+      reference_tensors = outputs;
+      continue;
+    }
+    for (const auto& output : reference_map)
+      EXPECT_NEAR(map_outputs.at(output.first), output.second, 1e-5);
+    EXPECT_TRUE(TFCSDenseNetwork::validate("test", outputs, reference_tensors));
+  }
+  TFCSDenseNetwork::setEnabled(original);
+}
+
+// Latency of a typical fully connected network for different threading
+// options, all of them give the same outputs. The shared global thread pools
+// can be benchmarked by setting FCS_ONNX_GLOBAL_INTRA_OP_THREADS before
+// running the test.
+TEST_F(NetworkTests, ONNXThreadingBenchmark)
+{
+  const bool benchmark = TestHelpers::run_benchmarks();
+  const TFCSONNXRuntime::SessionConfig original =
+      TFCSONNXRuntime::defaultSessionConfig();
+  const std::vector<char> model = make_mlp({64, 256, 256, 256, 128});
+  const unsigned int n_workers =
+      std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+
+  struct Setup_t
+  {
+    const char* name;
+    int intra_op_threads;
+    int graph_optimization_level;
+    bool cpu_mem_arena;
+  };
+  const std::vector<Setup_t> setups = {{"1 thread", 1, 99, true},
+                                       {"1 thread, no opt", 1, 0, true},
+                                       {"1 thread, no arena", 1, 99, false},
+                                       {"2 threads", 2, 99, true},
+                                       {"4 threads", 4, 99, true}};
+
+  std::vector<float> input(64 * 64);
+  for (std::size_t i = 0; i < input.size(); ++i)
+    input[i] = std::sin(0.1 * i);
+
+  std::vector<float> reference;
+  if (benchmark)
+    std::cout << std::setw(20) << "config" << std::setw(16) << "batch 1 [us]"
+              << std::setw(16) << "batch 64 [us]" << std::setw(24)
+              << (std::to_string(n_workers) + " workers [us/row]")
+              << std::endl;
+  for (const Setup_t& setup : setups) {
+    TFCSONNXRuntime::SessionConfig config = original;
+    config.intra_op_threads = setup.intra_op_threads;
+    config.graph_optimization_level = setup.graph_optimization_level;
+    config.cpu_mem_arena = setup.cpu_mem_arena;
+    TFCSONNXRuntime::setDefaultSessionConfig(config);
+    std::unique_ptr<VNetworkBase> net = TFCSNetworkFactory::create(model);
+
+    auto time_per_call = [&](std::size_t n_batch, int n_calls)
+    {
+      VNetworkBase::TensorOutputs outputs;
+      const VNetworkBase::TensorInputs inputs = {
+          VNetworkBase::TensorView(input.data(), 64 * n_batch)};
+      net->computeTensorsBatch(inputs, n_batch, outputs);
+      const auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < n_calls; ++i)
+        net->computeTensorsBatch(inputs, n_batch, outputs);
+      const std::chrono::duration<double, std::micro> time =
+          std::chrono::steady_clock::now() - start;
+      if (n_batch == 64) {
+        if (reference.empty())
+          reference = outputs[0];
+        EXPECT_EQ(outputs[0].size(), reference.size());
+        for (std::size_t i = 0; i < reference.size(); ++i)
+          EXPECT_NEAR(outputs[0][i], reference[i], 1e-4);
+      }
+      return time.count() / n_calls;
+    };
+    const double batch1 = time_per_call(1, benchmark ? 500 : 5);
+    const double batch64 = time_per_call(64, benchmark ? 50 : 1);
+
+    // Concurrent single row calls, as done by the simulation threads
+    const int n_calls = benchmark ? 200 : 5;
+    std::vector<std::thread> workers;
+    std::vector<int> mismatches(n_workers, 0);
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int w = 0; w < n_workers; ++w)
+      workers.emplace_back(
+          [&, w]()
+          {
+            VNetworkBase::TensorOutputs outputs;
+            const VNetworkBase::TensorInputs inputs = {
+                VNetworkBase::TensorView(input.data(), 64)};
+            for (int i = 0; i < n_calls; ++i) {
+              net->computeTensors(inputs, outputs);
+              for (std::size_t j = 0; j < outputs[0].size(); ++j)
+                if (std::abs(outputs[0][j] - reference[j]) > 1e-4)
+                  ++mismatches[w];
+            }
+          });
+    for (std::thread& worker : workers)
+      worker.join();
+    const std::chrono::duration<double, std::micro> time =
+        std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(mismatches, std::vector<int>(n_workers, 0)) << setup.name;
+
+    if (benchmark)
+      std::cout << std::setw(20) << setup.name << std::setw(16) << batch1
+                << std::setw(16) << batch64 << std::setw(24)
+                << time.count() / (n_calls * n_workers) << std::endl;
+  }
+  TFCSONNXRuntime::setDefaultSessionConfig(original);
+}
@@ -2,6 +2,9 @@
 
 #include "SimStateTests.h"
 
+#include <stdexcept>
+#include <vector>
+
 #include <CLHEP/Random/RanluxEngine.h>
 #include <gtest/gtest.h>
 
@@ -74,3 +77,142 @@ TEST_F(TFCSSimulationStateTest, AuxiliaryInfoHandling)
   sim_state.setAuxInfo<double>(hash, 123.456);
   EXPECT_DOUBLE_EQ(sim_state.getAuxInfo<double>(hash), 123.456);
 }
+
+TEST_F(TFCSSimulationStateTest, CheckpointRollback)
+{
+  TFCSSimulationState sim_state;
+  const uint32_t hash = TFCSSimulationState::getAuxIndex("testInfo");
+  const uint32_t ptr_hash = TFCSSimulationState::getAuxIndex("testPointer");
+  int owned = 0;
+  sim_state.set_Ebin(1);
+  sim_state.set_E(1000);
+  sim_state.set_E(1, 100.0);
+  sim_state.deposit(42, 10.0);
+  sim_state.setAuxInfo<float>(hash, 1.f);
+
+  const std::size_t cp = sim_state.checkpoint();
+  sim_state.set_Ebin(2);
+  sim_state.add_E(1, 50.0);
+  sim_state.set_E(2, 20.0);
+  sim_state.set_Efrac(2, 0.5);
+  sim_state.deposit(42, 5.0);
+  sim_state.deposit(43, 7.0);
+  sim_state.setAuxInfo<float>(hash, 2.f);
+  sim_state.setAuxInfo<void*>(ptr_hash, &owned);
+
+  // Nested checkpoint that is kept
+  {
+    TFCSSimulationState::Checkpoint_t inner(sim_state);
+    sim_state.deposit(44, 1.0);
+  }
+  EXPECT_EQ(sim_state.cells().count(44), 1u);
+
+  sim_state.rollback(cp);
+  EXPECT_EQ(sim_state.Ebin(), 1);
+  EXPECT_DOUBLE_EQ(sim_state.E(), 1000);
+  EXPECT_DOUBLE_EQ(sim_state.E(1), 100.0);
+  EXPECT_THROW(sim_state.E(2), std::out_of_range);
+  EXPECT_THROW(sim_state.Efrac(2), std::out_of_range);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(42), 10.0);
+  EXPECT_EQ(sim_state.cells().count(43), 0u);
+  EXPECT_EQ(sim_state.cells().count(44), 0u);
+  EXPECT_FLOAT_EQ(sim_state.getAuxInfo<float>(hash), 1.f);
+  // Pointers are never rolled back, they might own memory
+  EXPECT_EQ(sim_state.getAuxInfo<void*>(ptr_hash), &owned);
+
+  // The checkpoint stays active until it is committed
+  EXPECT_TRUE(sim_state.has_checkpoint());
+  sim_state.deposit(43, 3.0);
+  sim_state.commit(cp);
+  EXPECT_FALSE(sim_state.has_checkpoint());
+  EXPECT_EQ(sim_state.journal_size(), 0u);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(43), 3.0);
+
+  // Without checkpoint nothing is recorded
+  sim_state.deposit(43, 3.0);
+  EXPECT_EQ(sim_state.journal_size(), 0u);
+
+  // Roll back a nested checkpoint only
+  const std::size_t outer = sim_state.checkpoint();
+  sim_state.deposit(43, 1.0);
+  const std::size_t position = sim_state.journal_size();
+  {
+    TFCSSimulationState::Checkpoint_t inner(sim_state);
+    sim_state.deposit(43, 2.0);
+    sim_state.deposit(45, 2.0);
+    inner.rollback();
+  }
+  EXPECT_EQ(sim_state.journal_size(), position);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(43), 7.0);
+  EXPECT_EQ(sim_state.cells().count(45), 0u);
+  sim_state.rollback(outer);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(43), 6.0);
+  sim_state.commit(outer);
+}
+
+TEST_F(TFCSSimulationStateTest, CheckpointMergesCells)
+{
+  TFCSSimulationState sim_state;
+  sim_state.deposit(42, 10.0);
+
+  // Many deposits into few cells, each in its own nested checkpoint like the
+  // hits of a hit chain, need only one journal entry per cell
+  const std::size_t cp = sim_state.checkpoint();
+  for (int i = 0; i < 1000; ++i) {
+    TFCSSimulationState::Checkpoint_t hit(sim_state);
+    sim_state.deposit(42 + i % 3, 1.0);
+  }
+  EXPECT_EQ(sim_state.journal_size(), 3u);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(42), 10.0 + 334);
+
+  // Nested checkpoints that are still active when the outer one is committed
+  const std::size_t first = sim_state.checkpoint();
+  sim_state.deposit(45, 1.0);
+  sim_state.checkpoint();
+  sim_state.deposit(45, 1.0);
+  sim_state.deposit(42, 1.0);
+  sim_state.commit(first);
+  EXPECT_EQ(sim_state.journal_size(), 4u);
+
+  // A failed deposit after the merge still restores the merged value
+  {
+    TFCSSimulationState::Checkpoint_t hit(sim_state);
+    sim_state.deposit(45, 5.0);
+    hit.rollback();
+  }
+  EXPECT_FLOAT_EQ(sim_state.cells().at(45), 2.0);
+
+  sim_state.rollback(cp);
+  EXPECT_FLOAT_EQ(sim_state.cells().at(42), 10.0);
+  EXPECT_EQ(sim_state.cells().count(43), 0u);
+  EXPECT_EQ(sim_state.cells().count(45), 0u);
+  EXPECT_EQ(sim_state.journal_size(), 0u);
+  sim_state.commit(cp);
+}
+
+TEST_F(TFCSSimulationStateTest, ScratchSlots)
+{
+  TFCSSimulationState sim_state;
+  const uint32_t hash = TFCSSimulationState::getAuxIndex("testScratch");
+  EXPECT_EQ(sim_state.findScratch<std::vector<float>>(hash), nullptr);
+
+  // The object and its memory are reused by the next particle
+  std::vector<float>& scratch = sim_state.getScratch<std::vector<float>>(hash);
+  scratch.assign(100, 1.f);
+  const float* data = scratch.data();
+  sim_state.clear();
+  std::vector<float>* found = sim_state.findScratch<std::vector<float>>(hash);
+  ASSERT_EQ(found, &scratch);
+  found->clear();
+  found->resize(50);
+  EXPECT_EQ(found->data(), data);
+
+  // Other types are not mistaken for the stored one
+  EXPECT_EQ(sim_state.findScratch<std::vector<int>>(hash), nullptr);
+  EXPECT_TRUE(sim_state.getScratch<std::vector<int>>(hash).empty());
+  EXPECT_EQ(sim_state.findScratch<std::vector<float>>(hash), nullptr);
+
+  // Copies of a state have their own scratch objects
+  TFCSSimulationState copy(sim_state);
+  EXPECT_EQ(copy.findScratch<std::vector<int>>(hash), nullptr);
+}